@@ -660,6 +660,155 @@ async_generic_result session::add_to_capped_collection(const key &id, const inde
 	return result;
 }
 
+async_generic_result session::add_to_capped_collection(const std::vector<key> &ids, const dnet_raw_id &index,
+		const std::vector<data_pointer> &datas, int limit, bool remove_data)
+{
+	if (ids.size() != datas.size())
+		throw_error(-EINVAL, "session::add_to_capped_collection: ids and datas sizes mismatch");
+
+	const std::vector<int> known_groups = get_groups();
+
+	if (ids.empty() || known_groups.empty()) {
+		async_generic_result result(*this);
+		async_result_handler<callback_result_entry> handler(result);
+		handler.complete(ids.empty() ? error_info() :
+			create_error(-ENXIO, "add_to_capped_collection: groups list is empty"));
+		return result;
+	}
+
+	session sess = *this;
+
+	if (remove_data) {
+		sess = clone();
+		sess.set_filter(filters::all_with_ack);
+		sess.set_checker(checkers::no_check);
+		sess.set_exceptions_policy(no_exceptions);
+	}
+
+	dnet_node *node = get_native_node();
+	const auto shard_count = dnet_node_get_indexes_shard_count(node);
+
+	std::list<async_generic_result> results;
+
+	// Objects are added to their lists of indexes one by one, while shards of the collection are updated
+	// by one chain of INDEXES_INTERNAL requests per shard
+	std::map<int, std::vector<size_t>> shards;
+
+	for (size_t i = 0; i < ids.size(); ++i) {
+		transform(ids[i]);
+
+		index_entry entry;
+		entry.index = index;
+		entry.data = datas[i];
+
+		results.emplace_back(session_set_indexes(sess, ids[i], std::vector<index_entry>(1, entry),
+			DNET_INDEXES_FLAGS_CAPPED_COLLECTION | DNET_INDEXES_FLAGS_UPDATE_ONLY | DNET_INDEXES_FLAGS_NOINTERNAL, limit));
+
+		dnet_id indexes_id;
+		memset(&indexes_id, 0, sizeof(indexes_id));
+		dnet_indexes_transform_object_id(node, &ids[i].id(), &indexes_id);
+
+		shards[dnet_indexes_get_shard_id(node, &key(indexes_id).raw_id())].push_back(i);
+	}
+
+	session internal_sess = sess.clean_clone();
+	std::vector<int> groups(1, 0);
+
+	for (auto it = shards.begin(); it != shards.end(); ++it) {
+		const int shard_id = it->first;
+		const std::vector<size_t> &objects = it->second;
+
+		dnet_raw_id shard_index_id;
+		dnet_indexes_transform_index_id(node, &index, &shard_index_id, shard_id);
+
+		size_t data_size = 0;
+		for (auto jt = objects.begin(); jt != objects.end(); ++jt)
+			data_size += datas[*jt].size();
+
+		data_buffer buffer((objects.size() + 1) * sizeof(dnet_indexes_request)
+			+ objects.size() * sizeof(dnet_indexes_request_entry) + data_size);
+
+		// Empty request starts the batch, servers which do not support batches reject it
+		// instead of applying only the first request of the chain
+		dnet_indexes_request header;
+		memset(&header, 0, sizeof(header));
+		header.id = ids[objects.front()].id();
+		header.flags = DNET_INDEXES_FLAGS_MORE;
+		header.shard_id = shard_id;
+		header.shard_count = shard_count;
+		buffer.write(header);
+
+		for (size_t j = 0; j < objects.size(); ++j) {
+			const size_t object = objects[j];
+
+			dnet_indexes_request request;
+			memset(&request, 0, sizeof(request));
+			request.id = ids[object].id();
+			request.entries_count = 1;
+			request.shard_id = shard_id;
+			request.shard_count = shard_count;
+			if (j + 1 < objects.size())
+				request.flags |= DNET_INDEXES_FLAGS_MORE;
+
+			dnet_indexes_request_entry entry;
+			memset(&entry, 0, sizeof(entry));
+			entry.id = shard_index_id;
+			entry.flags = DNET_INDEXES_FLAGS_INTERNAL_INSERT | DNET_INDEXES_FLAGS_INTERNAL_CAPPED_COLLECTION;
+			entry.limit = limit;
+			entry.shard_id = shard_id;
+			entry.shard_count = shard_count;
+			entry.size = datas[object].size();
+
+			buffer.write(request);
+			buffer.write(entry);
+			if (entry.size > 0)
+				buffer.write(datas[object].data<char>(), datas[object].size());
+		}
+
+		data_pointer data(std::move(buffer));
+
+		transport_control control;
+		control.set_command(DNET_CMD_INDEXES_INTERNAL);
+		control.set_cflags(DNET_FLAGS_NEED_ACK);
+		control.set_data(data.data(), data.size());
+
+		dnet_id id;
+		memset(&id, 0, sizeof(id));
+		memcpy(id.id, shard_index_id.id, DNET_ID_SIZE);
+
+		for (size_t j = 0; j < known_groups.size(); ++j) {
+			id.group_id = known_groups[j];
+
+			groups[0] = id.group_id;
+			internal_sess.set_groups(groups);
+
+			control.set_key(id);
+
+			results.emplace_back(send_to_single_state(internal_sess, control));
+		}
+	}
+
+	async_generic_result indexes_result = aggregated(sess, results.begin(), results.end());
+
+	if (!remove_data) {
+		return indexes_result;
+	}
+
+	session remove_sess = clone();
+	remove_sess.set_filter(filters::all_with_ack);
+	remove_sess.set_checker(checkers::no_check);
+	remove_sess.set_exceptions_policy(no_exceptions);
+
+	async_generic_result result(*this);
+
+	auto handler = std::make_shared<add_to_capped_collection_handler>(remove_sess, result);
+
+	indexes_result.connect(std::bind(&add_to_capped_collection_handler::on_entry, handler, std::placeholders::_1),
+		std::bind(&add_to_capped_collection_handler::on_finished, handler, std::placeholders::_1));
+
+	return result;
+}
+
 async_set_indexes_result session::remove_indexes(const key &id, const std::vector<dnet_raw_id> &indexes)
 {
 	std::vector<index_entry> index_entries;
@@ -1024,105 +1173,110 @@ async_list_indexes_result session::list_indexes(const key &request_id)
 	return result;
 }
 
-/*!
- * Auxiliary function to parse char* buffer with c-msgpack library
- */
-static bool buffer_reader(cmp_ctx_t *ctx, void *data, size_t limit)
-{
-	char *start_ptr = static_cast<char *>(ctx->buf);
-	char *ptr = start_ptr;
-	while (ptr && limit) {
-		++ptr;
-		--limit;
-	}
-	if (limit != 0) {
-		return false;
-	}
-	memcpy(data, start_ptr, ptr - start_ptr);
-	ctx->buf = ptr;
-	return true;
-}
+typedef std::map<dnet_raw_id, int, dnet_raw_id_less_than<> > id_to_shard_map;
 
 /*!
- * Structure of secondary index msgpack is following
- * Array of 4 elements
- * Version number
- * Array of indexes
+ * \brief Handles responses of bulk_read of shard headers
  *
- * We need to get size of indexes array, that's why we
- * skip first two fields in msgpack and return size
- * of array in third position of msgpack
+ * Each response corresponds to some shard, number of entries of a sorted table
+ * without the log of updates is taken from its header. Other shards are read
+ * completely, the result is completed when all of them are processed.
  */
-static uint32_t get_index_size(const std::string &index_metadata, int &err)
+struct get_index_metadata_handler : public std::enable_shared_from_this<get_index_metadata_handler>
 {
-	err = 0;
-	cmp_ctx_t cmp;
-
-	char *buffer = new char[index_metadata.length() + 1];
-	memcpy(buffer, index_metadata.data(), index_metadata.length() + 1);
-
-	cmp_init(&cmp, buffer, buffer_reader, NULL);
-
-	uint32_t array_size;
-	if (!cmp_read_array(&cmp, &array_size)) {
-		err = -EBADMSG;
-		return 0;
+	get_index_metadata_handler(const session &sess, const async_get_index_metadata_result &result,
+		const id_to_shard_map &id_to_shard)
+		: sess(sess), handler(result), id_to_shard(id_to_shard), counter(1)
+	{
 	}
 
-	int32_t version;
-	if (!cmp_read_int(&cmp, &version)) {
-		err = -EBADMSG;
-		return 0;
-	}
+	void on_header(const read_result_entry &result)
+	{
+		const int shard_id = this->shard_id(result);
+		const uint64_t total_size = result.io_attribute()->total_size;
+		size_t count;
+
+		if (index_table_view::header_count(result.file(), total_size, count)) {
+			get_index_metadata_result_entry metadata;
+			metadata.shard_id = shard_id;
+			metadata.index_size = count;
+			metadata.is_valid = true;
+			handler.process(metadata);
+			return;
+		}
 
-	if (!cmp_read_array(&cmp, &array_size)) {
-		err = -EBADMSG;
-		return 0;
-	}
+		if (result.file().size() >= total_size) {
+			on_shard(shard_id, result);
+			return;
+		}
 
-	delete[] buffer;
-	return array_size;
-}
+		// table in msgpack layout or the one followed by the log of updates
+		dnet_io_attr io;
+		memset(&io, 0, sizeof(io));
+		io.flags = sess.get_ioflags() | DNET_IO_FLAGS_CACHE;
+		memcpy(io.id, result.command()->id.id, DNET_ID_SIZE);
+		memcpy(io.parent, result.command()->id.id, DNET_ID_SIZE);
 
-typedef std::map<dnet_raw_id, int, dnet_raw_id_less_than<> > id_to_shard_map;
+		++counter;
 
-/*!
- * \brief Callback that handles bulk_read responses
- *
- * Each response corresponds to some shard
- * We extract metadata from each shard index
- * and put it into vector of answers
- */
-struct get_index_metadata_callback
-{
-	session sess;
-	async_result_handler<get_index_metadata_result_entry> handler;
-	id_to_shard_map id_to_shard;
+		sess.read_data(result.command()->id, result.command()->id.group_id, io).connect(
+			std::bind(&get_index_metadata_handler::on_shard, shared_from_this(), shard_id, std::placeholders::_1),
+			std::bind(&get_index_metadata_handler::on_shard_finished, shared_from_this(), std::placeholders::_1));
+	}
 
-	void operator() (const read_result_entry &result)
+	void on_shard(int shard_id, const read_result_entry &result)
 	{
 		get_index_metadata_result_entry metadata;
+		metadata.shard_id = shard_id;
 
-		dnet_raw_id raw_id;
-		memcpy(raw_id.id, result.command()->id.id, DNET_ID_SIZE);
-		metadata.shard_id = id_to_shard[raw_id];
-
-		std::string content =  result.file().to_string().substr(DNET_INDEX_TABLE_MAGIC_SIZE);
-		int err = 0;
-		metadata.index_size = get_index_size(content, err);
-		if (err) {
-			metadata.is_valid = false;
-			BH_LOG(sess.get_logger(), DNET_LOG_ERROR, "get_index_metadata: Incorrect msgpack format: err: %d", err);
-		} else {
+		// entries of the log of updates are counted too
+		try {
+			metadata.index_size = indexes_count(result.file());
 			metadata.is_valid = true;
+		} catch (const std::exception &e) {
+			metadata.index_size = 0;
+			metadata.is_valid = false;
+			BH_LOG(sess.get_logger(), DNET_LOG_ERROR, "get_index_metadata: Incorrect index table: %s", e.what());
 		}
 		handler.process(metadata);
 	}
 
-	void operator() (const error_info &error)
+	void on_shard_finished(const error_info &error)
 	{
-		handler.complete(error);
+		// shards which could not be read are not reported, as it happens for bulk_read of headers
+		if (error)
+			BH_LOG(sess.get_logger(), DNET_LOG_ERROR, "get_index_metadata: Failed to read index shard: %s", error.message().c_str());
+
+		if (0 == --counter)
+			handler.complete(total_error);
 	}
+
+	void on_finished(const error_info &error)
+	{
+		if (error) {
+			std::lock_guard<std::mutex> lock(total_error_mutex);
+			total_error = error;
+		}
+
+		if (0 == --counter)
+			handler.complete(total_error);
+	}
+
+	int shard_id(const read_result_entry &result) const
+	{
+		dnet_raw_id raw_id;
+		memcpy(raw_id.id, result.command()->id.id, DNET_ID_SIZE);
+
+		auto it = id_to_shard.find(raw_id);
+		return it != id_to_shard.end() ? it->second : 0;
+	}
+
+	session sess;
+	async_result_handler<get_index_metadata_result_entry> handler;
+	const id_to_shard_map id_to_shard;
+	std::atomic_size_t counter;
+	std::mutex total_error_mutex;
+	error_info total_error;
 };
 
 /*!
@@ -1166,7 +1320,8 @@ async_get_index_metadata_result session::get_index_metadata(const dnet_raw_id &i
 		dnet_io_attr &io = request_io_attrs[shard_id];
 		memset(&io, 0, sizeof(io));
 
-		io.size   = 100;
+		// only the header is read, shards whose entries can not be counted from it are read again completely
+		io.size   = sizeof(dnet_index_table_header);
 		io.offset = 0;
 		io.flags  = get_ioflags() | DNET_IO_FLAGS_CACHE;
 		memcpy(io.id, id.id, DNET_ID_SIZE);
@@ -1174,8 +1329,10 @@ async_get_index_metadata_result session::get_index_metadata(const dnet_raw_id &i
 	}
 
 	async_get_index_metadata_result result(*this);
-	get_index_metadata_callback callback = { sess, result, id_to_shard };
-	sess.bulk_read(request_io_attrs).connect(callback, callback);
+	auto handler = std::make_shared<get_index_metadata_handler>(sess, result, id_to_shard);
+	sess.bulk_read(request_io_attrs).connect(
+		std::bind(&get_index_metadata_handler::on_header, handler, std::placeholders::_1),
+		std::bind(&get_index_metadata_handler::on_finished, handler, std::placeholders::_1));
 
 	return result;
 }
@@ -1372,14 +1529,7 @@ struct merge_indexes_callback
 
 		// Pack indexes and write serialized data to server
 		try {
-			msgpack::sbuffer buffer;
-			msgpack::pack(buffer, result);
-
-			data_buffer tmp_buffer(DNET_INDEX_TABLE_MAGIC_SIZE + buffer.size());
-			tmp_buffer.write(dnet_bswap64(DNET_INDEX_TABLE_MAGIC));
-			tmp_buffer.write(buffer.data(), buffer.size());
-
-			data_pointer data = std::move(tmp_buffer);
+			data_pointer data = indexes_pack(result);
 
 			write_session.write_data(id, data, 0).connect(handler);
 		} catch (std::bad_alloc &) {
@@ -25,9 +25,15 @@
 #include <msgpack.hpp>
 
 #include <iostream>
+#include <map>
 
 #define DNET_INDEX_TABLE_MAGIC 0x5DA38CFBE7734027ull
 #define DNET_INDEX_TABLE_MAGIC_SIZE 8
+#define DNET_INDEX_TABLE_SORTED_MAGIC 0x5DA38CFBE7734028ull
+#define DNET_INDEX_TABLE_SORTED_VERSION 1
+
+/* Table has positions of the entries ordered by time from the oldest to the newest */
+#define DNET_INDEX_TABLE_FLAGS_TIME_ORDER (1<<0)
 
 namespace ioremap { namespace elliptics {
 
@@ -57,20 +63,405 @@ struct dnet_indexes
 	std::vector<dnet_index_entry> indexes;
 };
 
+/*!
+ * Insert or removal of single entry which is appended to the index table instead of rewriting it,
+ * table is followed by the log of such updates until it is compacted
+ */
+struct dnet_index_delta
+{
+	dnet_index_delta() : action(0)
+	{}
+
+	dnet_index_delta(uint32_t action, const dnet_index_entry &entry)
+		: action(action), entry(entry)
+	{}
+
+	uint32_t action;
+	dnet_index_entry entry;
+};
+
+/*!
+ * Applies @deltas to the sorted @indexes in the order they were appended
+ */
+static inline void indexes_apply_deltas(std::vector<dnet_index_entry> &indexes, const std::vector<dnet_index_delta> &deltas)
+{
+	if (deltas.empty())
+		return;
+
+	// only the last update of the entry matters
+	std::map<dnet_raw_id, const dnet_index_delta *, dnet_raw_id_less_than<>> latest;
+	for (auto it = deltas.begin(); it != deltas.end(); ++it)
+		latest[it->entry.index] = &*it;
+
+	dnet_raw_id_less_than<> less;
+	std::vector<dnet_index_entry> result;
+	result.reserve(indexes.size() + latest.size());
+
+	auto it = indexes.begin();
+	auto jt = latest.begin();
+	while (it != indexes.end() || jt != latest.end()) {
+		if (jt == latest.end() || (it != indexes.end() && less(it->index, jt->first))) {
+			result.push_back(*it);
+			++it;
+			continue;
+		}
+
+		// entry is either replaced or removed
+		if (it != indexes.end() && !less(jt->first, it->index))
+			++it;
+
+		if (jt->second->action == DNET_INDEXES_FLAGS_INTERNAL_INSERT)
+			result.push_back(jt->second->entry);
+		++jt;
+	}
+
+	indexes.swap(result);
+}
+
+/*!
+ * Index table in the sorted layout, all fields are little-endian:
+ *
+ * header | ids[count] | entries[count] | [time order[count]] | data of the entries | log of updates
+ *
+ * Ids are stored in one contiguous sorted array, so table can be searched and intersected
+ * right in the read buffer without unpacking every entry. Tables of capped collections
+ * also store 64-bit positions of the entries from the oldest to the newest one,
+ * so the oldest entries are evicted without scanning the table.
+ */
+struct dnet_index_table_header
+{
+	uint64_t magic;
+	uint32_t version;
+	int32_t shard_id;
+	int32_t shard_count;
+	uint32_t flags;
+	uint64_t count;
+	uint64_t data_size;
+} __attribute__ ((packed));
+
+struct dnet_index_table_entry
+{
+	// offset of the data from the beginning of the data area
+	uint64_t data_offset;
+	uint64_t data_size;
+	uint64_t tsec;
+	uint64_t tnsec;
+} __attribute__ ((packed));
+
+/*!
+ * Packs @data into the index table in the sorted layout,
+ * @time_order are positions of the entries from the oldest to the newest one if not NULL
+ */
+static inline data_pointer indexes_pack(const dnet_indexes &data, const std::vector<uint64_t> *time_order = NULL)
+{
+	const size_t count = data.indexes.size();
+	const size_t order_size = time_order ? count * sizeof(uint64_t) : 0;
+
+	uint64_t data_size = 0;
+	for (auto it = data.indexes.begin(); it != data.indexes.end(); ++it)
+		data_size += it->data.size();
+
+	dnet_index_table_header header;
+	header.magic = dnet_bswap64(DNET_INDEX_TABLE_SORTED_MAGIC);
+	header.version = dnet_bswap32(DNET_INDEX_TABLE_SORTED_VERSION);
+	header.shard_id = dnet_bswap32(data.shard_id);
+	header.shard_count = dnet_bswap32(data.shard_count);
+	header.flags = dnet_bswap32(time_order ? DNET_INDEX_TABLE_FLAGS_TIME_ORDER : 0);
+	header.count = dnet_bswap64(count);
+	header.data_size = dnet_bswap64(data_size);
+
+	data_buffer buffer(sizeof(header) + count * (DNET_ID_SIZE + sizeof(dnet_index_table_entry)) + order_size + data_size);
+	buffer.write(header);
+
+	for (auto it = data.indexes.begin(); it != data.indexes.end(); ++it)
+		buffer.write(it->index);
+
+	uint64_t data_offset = 0;
+	for (auto it = data.indexes.begin(); it != data.indexes.end(); ++it) {
+		dnet_index_table_entry entry;
+		entry.data_offset = dnet_bswap64(data_offset);
+		entry.data_size = dnet_bswap64(it->data.size());
+		entry.tsec = dnet_bswap64(it->time.tsec);
+		entry.tnsec = dnet_bswap64(it->time.tnsec);
+		buffer.write(entry);
+
+		data_offset += it->data.size();
+	}
+
+	if (time_order) {
+		for (auto it = time_order->begin(); it != time_order->end(); ++it)
+			buffer.write(uint64_t(dnet_bswap64(*it)));
+	}
+
+	for (auto it = data.indexes.begin(); it != data.indexes.end(); ++it) {
+		if (!it->data.empty())
+			buffer.write(it->data.data<char>(), it->data.size());
+	}
+
+	return std::move(buffer);
+}
+
+/*!
+ * Read-only view of the index table in the sorted layout, entries are accessed
+ * directly in the read buffer and their data shares it
+ */
+class index_table_view
+{
+public:
+	index_table_view() : m_count(0), m_table_size(0), m_data_offset(0), m_shard_id(0), m_shard_count(0),
+		m_ids(NULL), m_entries(NULL), m_time_order(NULL)
+	{}
+
+	/*!
+	 * Maps @file, returns false if it is not in the sorted layout
+	 * and throws if it is corrupted
+	 */
+	bool map(const data_pointer &file)
+	{
+		static const unsigned long long magic = dnet_bswap64(DNET_INDEX_TABLE_SORTED_MAGIC);
+
+		if (file.size() < DNET_INDEX_TABLE_MAGIC_SIZE
+			|| memcmp(file.data(), &magic, DNET_INDEX_TABLE_MAGIC_SIZE) != 0) {
+			return false;
+		}
+
+		dnet_index_table_header header;
+		if (file.size() < sizeof(header))
+			throw std::runtime_error("Truncated index table header");
+		memcpy(&header, file.data(), sizeof(header));
+
+		if (dnet_bswap32(header.version) != DNET_INDEX_TABLE_SORTED_VERSION)
+			throw std::runtime_error("Unsupported index table version");
+
+		const bool ordered = dnet_bswap32(header.flags) & DNET_INDEX_TABLE_FLAGS_TIME_ORDER;
+		const size_t entry_size = this->entry_size(header);
+
+		const uint64_t count = dnet_bswap64(header.count);
+		const uint64_t data_size = dnet_bswap64(header.data_size);
+		const uint64_t entries_size = (file.size() - sizeof(header)) / entry_size;
+
+		if (count > entries_size || data_size > file.size() - sizeof(header) - count * entry_size) {
+			throw std::runtime_error("Truncated index table");
+		}
+
+		m_file = file;
+		m_count = count;
+		m_shard_id = dnet_bswap32(header.shard_id);
+		m_shard_count = dnet_bswap32(header.shard_count);
+		m_ids = file.data<char>() + sizeof(header);
+		m_entries = m_ids + m_count * DNET_ID_SIZE;
+		m_time_order = ordered ? m_entries + m_count * sizeof(dnet_index_table_entry) : NULL;
+		m_data_offset = sizeof(header) + m_count * entry_size;
+		m_table_size = m_data_offset + data_size;
+		return true;
+	}
+
+	size_t size() const
+	{
+		return m_count;
+	}
+
+	int shard_id() const
+	{
+		return m_shard_id;
+	}
+
+	int shard_count() const
+	{
+		return m_shard_count;
+	}
+
+	/*!
+	 * Takes number of entries from @header, which is the beginning of the shard of @total_size bytes.
+	 * Returns false if the table is not in the sorted layout or it is followed by the log of updates,
+	 * i.e. when the whole shard has to be read to count its entries.
+	 */
+	static bool header_count(const data_pointer &header, uint64_t total_size, size_t &count)
+	{
+		static const unsigned long long magic = dnet_bswap64(DNET_INDEX_TABLE_SORTED_MAGIC);
+
+		dnet_index_table_header raw;
+		if (header.size() < sizeof(raw) || memcmp(header.data(), &magic, DNET_INDEX_TABLE_MAGIC_SIZE) != 0)
+			return false;
+		memcpy(&raw, header.data(), sizeof(raw));
+
+		if (dnet_bswap32(raw.version) != DNET_INDEX_TABLE_SORTED_VERSION || total_size < sizeof(raw))
+			return false;
+
+		const uint64_t entries = dnet_bswap64(raw.count);
+		const uint64_t data_size = dnet_bswap64(raw.data_size);
+		const uint64_t size = total_size - sizeof(raw);
+
+		if (entries > size / entry_size(raw) || data_size != size - entries * entry_size(raw))
+			return false;
+
+		count = entries;
+		return true;
+	}
+
+	/*!
+	 * Size of the table itself, it is followed by the log of updates if the file is larger
+	 */
+	size_t table_size() const
+	{
+		return m_table_size;
+	}
+
+	bool has_deltas() const
+	{
+		return m_table_size < m_file.size();
+	}
+
+	bool has_time_order() const
+	{
+		return m_time_order != NULL;
+	}
+
+	/*!
+	 * Returns position of @index'th oldest entry, table must have time order
+	 */
+	uint64_t time_order(size_t index) const
+	{
+		uint64_t position;
+		memcpy(&position, m_time_order + index * sizeof(position), sizeof(position));
+		return dnet_bswap64(position);
+	}
+
+	const dnet_raw_id &id(size_t index) const
+	{
+		return *reinterpret_cast<const dnet_raw_id *>(m_ids + index * DNET_ID_SIZE);
+	}
+
+	/*!
+	 * Returns data of the entry, it is empty if the entry points outside of the table
+	 */
+	data_pointer data(size_t index) const
+	{
+		const dnet_index_table_entry entry = this->entry(index);
+		const uint64_t offset = dnet_bswap64(entry.data_offset);
+		const uint64_t size = dnet_bswap64(entry.data_size);
+		const uint64_t data_size = m_table_size - m_data_offset;
+
+		if (size == 0 || offset > data_size || size > data_size - offset)
+			return data_pointer();
+		return m_file.slice(m_data_offset + offset, size);
+	}
+
+	dnet_time time(size_t index) const
+	{
+		const dnet_index_table_entry entry = this->entry(index);
+		dnet_time result;
+		result.tsec = dnet_bswap64(entry.tsec);
+		result.tnsec = dnet_bswap64(entry.tnsec);
+		return result;
+	}
+
+	/*!
+	 * Returns position of the first id not less than @raw starting from @first
+	 */
+	size_t lower_bound(const dnet_raw_id &raw, size_t first = 0) const
+	{
+		size_t count = m_count - first;
+		while (count > 0) {
+			const size_t step = count / 2;
+			if (memcmp(m_ids + (first + step) * DNET_ID_SIZE, raw.id, DNET_ID_SIZE) < 0) {
+				first += step + 1;
+				count -= step + 1;
+			} else {
+				count = step;
+			}
+		}
+		return first;
+	}
+
+private:
+	static size_t entry_size(const dnet_index_table_header &header)
+	{
+		const bool ordered = dnet_bswap32(header.flags) & DNET_INDEX_TABLE_FLAGS_TIME_ORDER;
+		return DNET_ID_SIZE + sizeof(dnet_index_table_entry) + (ordered ? sizeof(uint64_t) : 0);
+	}
+
+	dnet_index_table_entry entry(size_t index) const
+	{
+		dnet_index_table_entry result;
+		memcpy(&result, m_entries + index * sizeof(dnet_index_table_entry), sizeof(result));
+		return result;
+	}
+
+	data_pointer m_file;
+	size_t m_count;
+	size_t m_table_size;
+	size_t m_data_offset;
+	int m_shard_id;
+	int m_shard_count;
+	const char *m_ids;
+	const char *m_entries;
+	const char *m_time_order;
+};
+
+/*!
+ * Unpacks log of updates which starts at @offset of @buffer and appends them to @deltas,
+ * returns false if the last update was not written completely
+ */
+static inline bool indexes_unpack_deltas(const char *buffer, size_t size, size_t offset, std::vector<dnet_index_delta> &deltas)
+{
+	msgpack::unpacked msg;
+
+	while (offset < size) {
+		try {
+			msgpack::unpack(&msg, buffer, size, &offset);
+		} catch (const msgpack::unpack_error &) {
+			return false;
+		}
+
+		deltas.emplace_back();
+		msg.get().convert(&deltas.back());
+	}
+
+	return true;
+}
 
 template <typename T>
 static inline void indexes_unpack_raw(const data_pointer &file, T *data)
 {
 	static const unsigned long long magic = dnet_bswap64(DNET_INDEX_TABLE_MAGIC);
 
-	if (file.size() < DNET_INDEX_TABLE_MAGIC_SIZE
-		|| memcmp(file.data(), &magic, DNET_INDEX_TABLE_MAGIC_SIZE) != 0) {
-		throw std::runtime_error("Invalid magic");
-	}
+	index_table_view view;
+	const char *buffer = NULL;
+	size_t size = 0;
+	size_t offset = 0;
 
 	msgpack::unpacked msg;
-	msgpack::unpack(&msg, file.data<char>() + DNET_INDEX_TABLE_MAGIC_SIZE, file.size() - DNET_INDEX_TABLE_MAGIC_SIZE);
-	msg.get().convert(data);
+
+	if (view.map(file)) {
+		data->shard_id = view.shard_id();
+		data->shard_count = view.shard_count();
+		data->indexes.clear();
+		data->indexes.reserve(view.size());
+		for (size_t i = 0; i < view.size(); ++i)
+			data->indexes.push_back(dnet_index_entry(view.id(i), view.data(i), view.time(i)));
+
+		buffer = file.data<char>() + view.table_size();
+		size = file.size() - view.table_size();
+	} else {
+		if (file.size() < DNET_INDEX_TABLE_MAGIC_SIZE
+			|| memcmp(file.data(), &magic, DNET_INDEX_TABLE_MAGIC_SIZE) != 0) {
+			throw std::runtime_error("Invalid magic");
+		}
+
+		buffer = file.data<char>() + DNET_INDEX_TABLE_MAGIC_SIZE;
+		size = file.size() - DNET_INDEX_TABLE_MAGIC_SIZE;
+
+		msgpack::unpack(&msg, buffer, size, &offset);
+		msg.get().convert(data);
+	}
+
+	// table may be followed by the log of updates which are not compacted yet,
+	// the last one of them is skipped if it was not written completely
+	std::vector<dnet_index_delta> deltas;
+	indexes_unpack_deltas(buffer, size, offset, deltas);
+
+	indexes_apply_deltas(data->indexes, deltas);
 }
 
 template <typename T>
@@ -88,6 +479,43 @@ static inline void indexes_unpack(dnet_node *node, dnet_id *id, const data_point
 	}
 }
 
+/*!
+ * Returns number of entries of the index table @file with its log of updates applied.
+ * Table in the sorted layout is not unpacked: number of its entries is taken from the header
+ * and only ids of the updated entries are searched in it. Table in the msgpack layout is unpacked.
+ */
+static inline size_t indexes_count(const data_pointer &file)
+{
+	index_table_view view;
+	if (!view.map(file)) {
+		dnet_indexes indexes;
+		indexes_unpack_raw(file, &indexes);
+		return indexes.indexes.size();
+	}
+
+	std::vector<dnet_index_delta> deltas;
+	indexes_unpack_deltas(file.data<char>(), file.size(), view.table_size(), deltas);
+
+	// only the last update of the entry matters
+	std::map<dnet_raw_id, uint32_t, dnet_raw_id_less_than<>> latest;
+	for (auto it = deltas.begin(); it != deltas.end(); ++it)
+		latest[it->entry.index] = it->action;
+
+	size_t count = view.size();
+	size_t position = 0;
+	for (auto it = latest.begin(); it != latest.end(); ++it) {
+		position = view.lower_bound(it->first, position);
+		const bool exists = position < view.size() && view.id(position) == it->first;
+
+		if (it->second == DNET_INDEXES_FLAGS_INTERNAL_INSERT && !exists)
+			++count;
+		else if (it->second != DNET_INDEXES_FLAGS_INTERNAL_INSERT && exists)
+			--count;
+	}
+
+	return count;
+}
+
 static inline void find_result_unpack(dnet_node *node, dnet_id *id, const data_pointer &file, sync_find_indexes_result *data, const char *scope)
 {
 	try {
@@ -119,6 +547,10 @@ enum dnet_indexes_version : uint16_t {
 	dnet_indexes_version_second = 2
 };
 
+enum dnet_index_delta_version : uint16_t {
+	dnet_index_delta_version_first = 1
+};
+
 enum find_indexes_result_entry_version : uint16_t {
 	find_indexes_result_entry_version_first = 1
 };
@@ -258,6 +690,41 @@ inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const dn
 	return o;
 }
 
+inline dnet_index_delta &operator >>(msgpack::object o, dnet_index_delta &v)
+{
+	if (o.type != msgpack::type::ARRAY || o.via.array.size < 1)
+		throw msgpack::type_error();
+
+	object *p = o.via.array.ptr;
+	const uint32_t size = o.via.array.size;
+	uint16_t version = 0;
+	p[0].convert(&version);
+	switch (version) {
+	case dnet_index_delta_version_first: {
+		if (size != 3)
+			throw msgpack::type_error();
+
+		p[1].convert(&v.action);
+		p[2].convert(&v.entry);
+		break;
+	}
+	default:
+		throw msgpack::type_error();
+	}
+
+	return v;
+}
+
+template <typename Stream>
+inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const dnet_index_delta &v)
+{
+	o.pack_array(3);
+	o.pack(uint16_t(dnet_index_delta_version_first));
+	o.pack(v.action);
+	o.pack(v.entry);
+	return o;
+}
+
 template <typename Stream>
 inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const find_indexes_result_entry &result)
 {
@@ -18,6 +18,7 @@
 #include "cache.hpp"
 #include "slru_cache.hpp"
 
+#include <chrono>
 #include <fstream>
 
 #include <boost/lexical_cast.hpp>
@@ -48,41 +49,141 @@ std::unique_ptr<cache_config> cache_config::parse(const elliptics::config::confi
 	config.count = cache.at<size_t>("shards", DNET_DEFAULT_CACHES_NUMBER);
 	config.sync_timeout = cache.at<unsigned>("sync_timeout", DNET_DEFAULT_CACHE_SYNC_TIMEOUT_SEC);
 	config.pages_proportions = cache.at("pages_proportions", std::vector<size_t>(DNET_DEFAULT_CACHE_PAGES_NUMBER, 1));
+
+	const std::string admission = cache.at<std::string>("admission", "none");
+	if (admission != "none" && admission != "tinylfu") {
+		throw elliptics::config::config_error(cache.at("admission").path() + " must be either \"none\" or \"tinylfu\"");
+	}
+	config.tinylfu = (admission == "tinylfu");
+
+	const size_t object_size = cache.at<size_t>("admission_object_size", DNET_DEFAULT_CACHE_ADMISSION_OBJECT_SIZE);
+	if (object_size == 0) {
+		throw elliptics::config::config_error(cache.at("admission_object_size").path() + " must be non-zero");
+	}
+	config.admission_object_size = object_size;
+
+	config.flushers = cache.at<size_t>("flushers", DNET_DEFAULT_CACHE_FLUSHERS);
+
+	// writers are throttled when dirty data exceeds high watermark until it is flushed below low one,
+	// zero high watermark disables throttling
+	config.dirty_high_watermark = cache.at<size_t>("dirty_high_watermark", 0);
+	config.dirty_low_watermark = cache.at<size_t>("dirty_low_watermark", config.dirty_high_watermark / 2);
+	if (config.dirty_low_watermark > config.dirty_high_watermark) {
+		throw elliptics::config::config_error(cache.at("dirty_low_watermark").path() +
+				" must not be greater than dirty_high_watermark");
+	}
+
+	// hot keys are saved into backend's history directory, zero interval disables snapshot and warm-up
+	config.snapshot_interval = cache.at<unsigned>("snapshot_interval", 0);
+	config.warm_up_rate = cache.at<size_t>("warm_up_rate", DNET_DEFAULT_CACHE_WARM_UP_RATE);
+
+	// cache is resized within [min_size, max_size] by available memory, equal bounds disable resizing
+	config.min_size = cache.at<size_t>("min_size", config.size);
+	config.max_size = cache.at<size_t>("max_size", config.size);
+	if (config.min_size > config.size || config.size > config.max_size) {
+		throw elliptics::config::config_error(size.path() + " must be within [min_size, max_size]");
+	}
+	config.reserved_memory = cache.at<size_t>("reserved_memory", DNET_DEFAULT_CACHE_RESERVED_MEMORY);
+	config.resize_interval = cache.at<unsigned>("resize_interval", DNET_DEFAULT_CACHE_RESIZE_INTERVAL_SEC);
+	if (config.resize_interval == 0) {
+		throw elliptics::config::config_error(cache.at("resize_interval").path() + " must be non-zero");
+	}
 	return blackhole::aux::util::make_unique<cache_config>(config);
 }
 
-cache_manager::cache_manager(dnet_backend_io *backend, dnet_node *n, const cache_config &config) : m_node(n) {
+cache_manager::cache_manager(dnet_backend_io *backend, dnet_node *n, const cache_config &config) :
+	m_node(n), m_max_cache_size(config.size),
+	m_cache_pages_number(config.pages_proportions.size()), m_pages_proportions(config.pages_proportions),
+	m_backend(backend), m_background_stop(false),
+	m_snapshot_path(config.snapshot_path), m_snapshot_interval(config.snapshot_interval),
+	m_warm_up_rate(config.warm_up_rate), m_warmed_up(false),
+	m_min_cache_size(config.min_size), m_max_cache_size_bound(config.max_size),
+	m_reserved_memory(config.reserved_memory), m_resize_interval(config.resize_interval) {
 	size_t caches_number = config.count;
-	m_cache_pages_number = config.pages_proportions.size();
-	m_max_cache_size = config.size;
-	size_t max_size = m_max_cache_size / caches_number;
 
-	size_t proportionsSum = 0;
-	for (size_t i = 0; i < m_cache_pages_number; ++i) {
-		proportionsSum += config.pages_proportions[i];
+	// admission filter of every shard is sized by the number of objects expected to fit into it
+	const size_t admission_objects = config.tinylfu ?
+		std::max<size_t>(m_max_cache_size_bound / caches_number / config.admission_object_size, 1) : 0;
+
+	m_flushers.reset(new flusher_pool_t(config.flushers, backend->backend_id));
+
+	const std::vector<size_t> max_sizes = pages_max_sizes(config.size / caches_number);
+	for (size_t i = 0; i < caches_number; ++i) {
+		m_caches.emplace_back(std::make_shared<slru_cache_t>(backend, n, max_sizes, config.sync_timeout,
+					admission_objects, m_flushers.get(),
+					config.dirty_high_watermark / caches_number, config.dirty_low_watermark / caches_number));
 	}
 
-	std::vector<size_t> pages_max_sizes(m_cache_pages_number);
-	for (size_t i = 0; i < m_cache_pages_number; ++i) {
-		pages_max_sizes[i] = max_size * (config.pages_proportions[i] * 1.0 / proportionsSum);
+	if (m_snapshot_interval && !m_snapshot_path.empty()) {
+		m_snapshot_thread = std::thread(std::bind(&cache_manager::snapshot_loop, this));
 	}
 
-	for (size_t i = 0; i < caches_number; ++i) {
-		m_caches.emplace_back(std::make_shared<slru_cache_t>(backend, n, pages_max_sizes, config.sync_timeout));
+	if (m_min_cache_size < m_max_cache_size_bound) {
+		m_resize_thread = std::thread(std::bind(&cache_manager::resize_loop, this));
 	}
 }
 
 cache_manager::~cache_manager() {
+	{
+		std::lock_guard<std::mutex> guard(m_background_lock);
+		m_background_stop = true;
+	}
+	m_background_cond.notify_all();
+
+	if (m_resize_thread.joinable()) {
+		m_resize_thread.join();
+	}
+
+	if (m_snapshot_thread.joinable()) {
+		m_snapshot_thread.join();
+
+		// snapshot of partially warmed up cache would lose keys which were not loaded yet
+		if (m_warmed_up) {
+			write_snapshot();
+		}
+	}
 }
 
 int cache_manager::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd, dnet_io_attr *io, const char *data) {
 	return m_caches[idx(id)]->write(id, st, cmd, io, data);
 }
 
-std::shared_ptr<raw_data_t> cache_manager::read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
+void cache_manager::throttle(const unsigned char *id) {
+	m_caches[idx(id)]->throttle();
+}
+
+raw_data_ptr_t cache_manager::read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
 	return m_caches[idx(id)]->read(id, cmd, io);
 }
 
+void cache_manager::bulk_read(dnet_io_attr **ios, raw_data_ptr_t *data, size_t count) {
+	std::vector<std::vector<size_t>> shards(m_caches.size());
+	for (size_t i = 0; i < count; ++i) {
+		shards[idx(ios[i]->id)].push_back(i);
+	}
+
+	std::vector<dnet_io_attr *> shard_ios;
+	std::vector<raw_data_ptr_t> shard_data;
+
+	for (size_t shard = 0; shard < shards.size(); ++shard) {
+		const std::vector<size_t> &positions = shards[shard];
+		if (positions.empty())
+			continue;
+
+		shard_ios.clear();
+		for (auto it = positions.begin(); it != positions.end(); ++it) {
+			shard_ios.push_back(ios[*it]);
+		}
+		shard_data.assign(positions.size(), raw_data_ptr_t());
+
+		m_caches[shard]->bulk_read(shard_ios.data(), shard_data.data(), positions.size());
+
+		for (size_t i = 0; i < positions.size(); ++i) {
+			data[positions[i]] = std::move(shard_data[i]);
+		}
+	}
+}
+
 int cache_manager::remove(const unsigned char *id, dnet_io_attr *io) {
 	return m_caches[idx(id)]->remove(id, io);
 }
@@ -116,7 +217,7 @@ void cache_manager::clear() {
 }
 
 size_t cache_manager::cache_size() const {
-	return m_max_cache_size;
+	return m_max_cache_size.load(std::memory_order_relaxed);
 }
 
 size_t cache_manager::cache_pages_number() const {
@@ -133,11 +234,24 @@ cache_stats cache_manager::get_total_cache_stats() const {
 		stats.number_of_objects_marked_for_deletion += page_stats.number_of_objects_marked_for_deletion;
 		stats.size_of_objects_marked_for_deletion += page_stats.size_of_objects_marked_for_deletion;
 		stats.size_of_objects += page_stats.size_of_objects;
+		stats.hits += page_stats.hits;
+		stats.misses += page_stats.misses;
+		stats.admitted += page_stats.admitted;
+		stats.rejected += page_stats.rejected;
+		stats.dirty_size += page_stats.dirty_size;
+		stats.flushing_size += page_stats.flushing_size;
+		stats.synced_objects += page_stats.synced_objects;
+		stats.synced_size += page_stats.synced_size;
+		stats.throttled_writes += page_stats.throttled_writes;
+		stats.sync_lag = std::max(stats.sync_lag, page_stats.sync_lag);
+		stats.max_sync_lag = std::max(stats.max_sync_lag, page_stats.max_sync_lag);
 
 		for (size_t j = 0; j < m_cache_pages_number; ++j) {
 			stats.pages_sizes[j] += page_stats.pages_sizes[j];
 			stats.pages_max_sizes[j] += page_stats.pages_max_sizes[j];
 		}
+
+		stats.slab.merge(page_stats.slab);
 	}
 	return stats;
 }
@@ -186,6 +300,174 @@ std::string cache_manager::stat_json() const {
 	return buffer.GetString();
 }
 
+std::vector<size_t> cache_manager::pages_max_sizes(size_t max_size) const {
+	size_t proportionsSum = 0;
+	for (size_t i = 0; i < m_cache_pages_number; ++i) {
+		proportionsSum += m_pages_proportions[i];
+	}
+
+	std::vector<size_t> sizes(m_cache_pages_number);
+	for (size_t i = 0; i < m_cache_pages_number; ++i) {
+		sizes[i] = max_size * (m_pages_proportions[i] * 1.0 / proportionsSum);
+	}
+	return sizes;
+}
+
+void cache_manager::set_cache_size(size_t cache_size) {
+	m_max_cache_size.store(cache_size, std::memory_order_relaxed);
+
+	const std::vector<size_t> max_sizes = pages_max_sizes(cache_size / m_caches.size());
+	for (auto it = m_caches.begin(); it != m_caches.end(); ++it) {
+		(*it)->resize(max_sizes);
+	}
+}
+
+void cache_manager::resize_loop() {
+	dnet_set_name("dnet_resize_%zu", m_backend->backend_id);
+
+	std::unique_lock<std::mutex> guard(m_background_lock);
+	while (!m_background_stop) {
+		if (m_background_cond.wait_for(guard, std::chrono::seconds(m_resize_interval), [this] () { return m_background_stop; }))
+			break;
+
+		guard.unlock();
+		try {
+			adjust_cache_size();
+		} catch (const std::exception &e) {
+			dnet_log(m_node, DNET_LOG_ERROR, "cache: resize: backend: %zu: failed to resize cache: %s",
+					m_backend->backend_id, e.what());
+		}
+		guard.lock();
+	}
+}
+
+/*
+ * Cache is shrunk when memory available on the host drops below reserved one and is grown back
+ * when there is twice as much of it. Available memory is the kernel's estimate, which counts only
+ * reclaimable part of page cache and slab, unlike free memory plus whole page cache.
+ * Size is changed by at most 1/resize_steps of the bounds range per pass, so that objects are evicted
+ * in portions instead of dropping the whole cache at once.
+ */
+void cache_manager::adjust_cache_size() {
+	static const size_t resize_steps = 16;
+
+	dnet_vm_stat st;
+	int err = dnet_get_vm_stat(m_node->log, &st);
+	if (err || !st.vm_total) {
+		dnet_log(m_node, DNET_LOG_ERROR, "cache: resize: backend: %zu: failed to get memory stats, err: %d",
+				m_backend->backend_id, err);
+		return;
+	}
+
+	const size_t available = st.vm_available * 1024;
+	const size_t cache_size = m_max_cache_size.load(std::memory_order_relaxed);
+	const size_t step = std::max<size_t>((m_max_cache_size_bound - m_min_cache_size) / resize_steps, 1);
+
+	size_t new_cache_size = cache_size;
+	if (available < m_reserved_memory) {
+		new_cache_size -= std::min(cache_size - m_min_cache_size, std::min(step, m_reserved_memory - available));
+	} else if (available > 2 * m_reserved_memory) {
+		new_cache_size += std::min(m_max_cache_size_bound - cache_size, std::min(step, available - 2 * m_reserved_memory));
+	}
+
+	if (new_cache_size == cache_size)
+		return;
+
+	set_cache_size(new_cache_size);
+
+	dnet_log(m_node, DNET_LOG_INFO, "cache: resize: backend: %zu: available memory: %zu, cache size: %zu -> %zu",
+			m_backend->backend_id, available, cache_size, new_cache_size);
+}
+
+void cache_manager::snapshot_loop() {
+	dnet_set_name("dnet_snap_%zu", m_backend->backend_id);
+
+	warm_up();
+
+	std::unique_lock<std::mutex> guard(m_background_lock);
+	while (!m_background_stop) {
+		if (m_background_cond.wait_for(guard, std::chrono::seconds(m_snapshot_interval), [this] () { return m_background_stop; }))
+			break;
+
+		guard.unlock();
+		if (m_warmed_up) {
+			write_snapshot();
+		}
+		guard.lock();
+	}
+}
+
+/*
+ * Keys are loaded from the hottest to the coldest one,
+ * backend reads are spaced so that their rate does not exceed configured one
+ */
+void cache_manager::warm_up() {
+	std::vector<snapshot_record_t> records;
+
+	int err = snapshot_file_t::read(m_snapshot_path, records);
+	if (err) {
+		if (err != -ENOENT) {
+			dnet_log(m_node, DNET_LOG_ERROR, "cache: warm up: backend: %zu: failed to read snapshot: %s, err: %d",
+					m_backend->backend_id, m_snapshot_path.c_str(), err);
+		}
+		m_warmed_up = true;
+		return;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	size_t objects = 0, size = 0;
+
+	for (auto it = records.begin(); it != records.end(); ++it) {
+		if (dnet_need_exit(m_node) || m_backend->need_exit)
+			return;
+
+		try {
+			const size_t object_size = m_caches[idx(it->id.id)]->warm_up(it->id.id, it->page_number);
+			if (object_size) {
+				++objects;
+				size += object_size;
+			}
+		} catch (const std::exception &e) {
+			dnet_log(m_node, DNET_LOG_ERROR, "cache: warm up: backend: %zu: %s: failed to load object: %s",
+					m_backend->backend_id, dnet_dump_id_str(it->id.id), e.what());
+		}
+
+		auto deadline = start;
+		if (m_warm_up_rate) {
+			deadline += std::chrono::microseconds(size * 1000000 / m_warm_up_rate);
+		}
+
+		std::unique_lock<std::mutex> guard(m_background_lock);
+		if (m_background_cond.wait_until(guard, deadline, [this] () { return m_background_stop; }))
+			return;
+	}
+
+	m_warmed_up = true;
+
+	dnet_log(m_node, DNET_LOG_INFO, "cache: warm up: backend: %zu: loaded objects: %zu/%zu, size: %zu, elapsed: %lld ms",
+			m_backend->backend_id, objects, records.size(), size,
+			(long long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void cache_manager::write_snapshot() {
+	std::vector<snapshot_record_t> records;
+
+	for (auto it = m_caches.begin(); it != m_caches.end(); ++it) {
+		(*it)->snapshot(records);
+	}
+
+	// every shard lists its keys from the hottest page, keys of the same page of all shards are merged
+	std::stable_sort(records.begin(), records.end(), [] (const snapshot_record_t &a, const snapshot_record_t &b) {
+		return a.page_number < b.page_number;
+	});
+
+	int err = snapshot_file_t::write(m_snapshot_path, records);
+	if (err) {
+		dnet_log(m_node, DNET_LOG_ERROR, "cache: snapshot: backend: %zu: failed to write snapshot: %s, err: %d",
+				m_backend->backend_id, m_snapshot_path.c_str(), err);
+	}
+}
+
 size_t cache_manager::idx(const unsigned char *id) {
 	size_t i = *(size_t *)id;
 	size_t j = *(size_t *)(id + DNET_ID_SIZE - sizeof(size_t));
@@ -196,6 +478,86 @@ size_t cache_manager::idx(const unsigned char *id) {
 
 using namespace ioremap::cache;
 
+static void dnet_cache_release_chunk(void *priv)
+{
+	intrusive_ptr_release(static_cast<data_chunk_t *>(priv));
+}
+
+/*
+ * Sends requested range of the cached object, @cmd is the READ command which was served from cache
+ */
+static int dnet_cache_send_read_data(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_io_attr *io, const raw_data_t &d)
+{
+	struct dnet_node *n = st->n;
+
+	/*!
+	 * When offset is larger then size of the file, operation is definitely incorrect
+	 */
+	if (io->offset >= d.size()) {
+		BH_LOG(*n->log, DNET_LOG_ERROR, "%s: %s cache: invalid offset: "
+				"offset: %llu, size: %llu, cached-size: %zd",
+				dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd),
+				(unsigned long long)io->offset, (unsigned long long)io->size,
+				d.size());
+		return -EINVAL;
+	}
+
+	/*!
+	 * If offset is correct, but offset + read_size is bigger then file_size
+	 * then we should return data from offset position till the end of the file
+	 * This situation happens when for example we want to read first 100 bytes of
+	 * the file and it's size appears to be less then 100 bytes.
+	 */
+	io->size = std::min(io->size, d.size() - io->offset);
+
+	/*!
+	 * 0 is special value for io operation size and in this case we should read all file
+	 */
+	if (io->size == 0)
+		io->size = d.size() - io->offset;
+
+	io->total_size = d.size();
+
+	cmd->flags &= ~DNET_FLAGS_NEED_ACK;
+
+	// send queue keeps its own references to the chunks of requested range until reply is sent
+	std::vector<dnet_data_ref> refs;
+	refs.reserve(d.segments_number());
+
+	d.for_each_piece(io->offset, io->size, [&refs] (data_chunk_t *chunk, const char *data, size_t size) {
+		dnet_data_ref ref;
+		ref.data = const_cast<char *>(data);
+		ref.size = size;
+		ref.release = dnet_cache_release_chunk;
+		ref.priv = chunk;
+
+		intrusive_ptr_add_ref(chunk);
+		refs.push_back(ref);
+	});
+
+	return dnet_send_read_data_refs(st, cmd, io, refs.data(), refs.size());
+}
+
+void dnet_cmd_cache_throttle(struct dnet_backend_io *backend, struct dnet_net_state *st, struct dnet_cmd *cmd, const struct dnet_io_attr *io)
+{
+	if (!backend->cache || cmd->cmd != DNET_CMD_WRITE)
+		return;
+
+	struct dnet_io_attr attr = *io;
+	dnet_convert_io_attr(&attr);
+
+	if (attr.flags & (DNET_IO_FLAGS_NOCACHE | DNET_IO_FLAGS_CACHE_ONLY))
+		return;
+
+	cache_manager *cache = (cache_manager *)backend->cache;
+
+	try {
+		cache->throttle(attr.id);
+	} catch (const std::exception &e) {
+		BH_LOG(*st->n->log, DNET_LOG_ERROR, "%s: cache throttling failed: %s", dnet_dump_id(&cmd->id), e.what());
+	}
+}
+
 int dnet_cmd_cache_io(struct dnet_backend_io *backend, struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_io_attr *io, char *data)
 {
 	struct dnet_node *n = st->n;
@@ -209,7 +571,7 @@ int dnet_cmd_cache_io(struct dnet_backend_io *backend, struct dnet_net_state *st
 	}
 
 	cache_manager *cache = (cache_manager *)backend->cache;
-	std::shared_ptr<raw_data_t> d;
+	raw_data_ptr_t d;
 
 	FORMATTED(HANDY_TIMER_SCOPE, ("cache.%s", dnet_cmd_string(cmd->cmd)));
 
@@ -229,37 +591,7 @@ int dnet_cmd_cache_io(struct dnet_backend_io *backend, struct dnet_net_state *st
 					break;
 				}
 
-				/*!
-				 * When offset is larger then size of the file, operation is definitely incorrect
-				 */
-				if (io->offset >= d->size()) {
-					BH_LOG(*n->log, DNET_LOG_ERROR, "%s: %s cache: invalid offset: "
-							"offset: %llu, size: %llu, cached-size: %zd",
-							dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd),
-							(unsigned long long)io->offset, (unsigned long long)io->size,
-							d->size());
-					err = -EINVAL;
-					break;
-				}
-
-				/*!
-				 * If offset is correct, but offset + read_size is bigger then file_size
-				 * then we should return data from offset position till the end of the file
-				 * This situation happens when for example we want to read first 100 bytes of
-				 * the file and it's size appears to be less then 100 bytes.
-				 */
-				io->size = std::min(io->size, d->size() - io->offset);
-
-				/*!
-				 * 0 is special value for io operation size and in this case we should read all file
-				 */
-				if (io->size == 0)
-					io->size = d->size() - io->offset;
-
-				io->total_size = d->size();
-
-				cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-				err = dnet_send_read_data(st, cmd, io, (char *)d->data().data() + io->offset, -1, io->offset, 0);
+				err = dnet_cache_send_read_data(st, cmd, io, *d);
 				break;
 			case DNET_CMD_DEL:
 				err = cache->remove(cmd->id.id, io);
@@ -274,6 +606,92 @@ int dnet_cmd_cache_io(struct dnet_backend_io *backend, struct dnet_net_state *st
 	return err;
 }
 
+int dnet_cmd_cache_bulk_read(struct dnet_backend_io *backend, struct dnet_net_state *st, struct dnet_cmd *cmd,
+		struct dnet_io_attr *ios, uint64_t count, uint64_t *misses)
+{
+	struct dnet_node *n = st->n;
+	int err = -ENOENT;
+
+	*misses = count;
+
+	if (!backend->cache) {
+		return -ENOTSUP;
+	}
+
+	cache_manager *cache = (cache_manager *)backend->cache;
+
+	HANDY_TIMER_SCOPE("cache.BULK_READ");
+
+	// @ios are kept in network byte order, since missed ones are passed to the regular read path
+	std::vector<dnet_io_attr> converted;
+	std::vector<raw_data_ptr_t> data;
+
+	try {
+		converted.assign(ios, ios + count);
+		data.resize(count);
+
+		std::vector<dnet_io_attr *> lookup;
+		lookup.reserve(count);
+
+		for (auto it = converted.begin(); it != converted.end(); ++it) {
+			dnet_convert_io_attr(&*it);
+
+			if (n->flags & DNET_CFG_NO_CSUM)
+				it->flags |= DNET_IO_FLAGS_NOCSUM;
+
+			if (!(it->flags & DNET_IO_FLAGS_NOCACHE))
+				lookup.push_back(&*it);
+		}
+
+		std::vector<raw_data_ptr_t> found(lookup.size());
+		cache->bulk_read(lookup.data(), found.data(), lookup.size());
+
+		for (size_t i = 0; i < lookup.size(); ++i) {
+			data[lookup[i] - converted.data()] = std::move(found[i]);
+		}
+	} catch (const std::exception &e) {
+		BH_LOG(*n->log, DNET_LOG_ERROR, "%s: %s cache operation failed: %s",
+				dnet_dump_id(&cmd->id), dnet_cmd_string(DNET_CMD_BULK_READ), e.what());
+		return -ENOENT;
+	}
+
+	uint64_t missed = 0;
+	for (uint64_t i = 0; i < count; ++i) {
+		if (!data[i]) {
+			ios[missed++] = ios[i];
+			continue;
+		}
+
+		struct dnet_io_attr *io = &converted[i];
+		struct timeval start, end;
+		int ret;
+
+		gettimeofday(&start, NULL);
+		try {
+			ret = dnet_cache_send_read_data(st, cmd, io, *data[i]);
+		} catch (const std::exception &e) {
+			BH_LOG(*n->log, DNET_LOG_ERROR, "%s: %s cache operation failed: %s",
+					dnet_dump_id_str(io->id), dnet_cmd_string(cmd->cmd), e.what());
+			ret = -ENOMEM;
+		}
+		gettimeofday(&end, NULL);
+
+		const long diff = DIFF(start, end);
+		const uint64_t size = ret ? 0 : io->size;
+
+		monitor_command_counter(n, DNET_CMD_READ, cmd->trans, ret, 1, size, diff);
+		dnet_backend_command_stats_update(n, backend, cmd, size, 1, ret, diff);
+
+		if (!ret)
+			err = 0;
+		else if (err == -ENOENT)
+			err = ret;
+	}
+
+	*misses = missed;
+	return err;
+}
+
 int dnet_cmd_cache_lookup(struct dnet_backend_io *backend, struct dnet_net_state *st, struct dnet_cmd *cmd)
 {
 	struct dnet_node *n = st->n;
@@ -18,9 +18,12 @@
 #ifndef CACHE_HPP
 #define CACHE_HPP
 
+#include <algorithm>
 #include <vector>
 #include <mutex>
 #include <thread>
+#include <condition_variable>
+#include <string>
 #include <cstdio>
 #include <unordered_map>
 #include <limits>
@@ -31,6 +34,7 @@
 #endif
 
 #include <boost/intrusive/list.hpp>
+#include <boost/intrusive_ptr.hpp>
 
 #include "library/elliptics.h"
 #include "indexes/local_session.h"
@@ -42,35 +46,272 @@
 #include "monitor/rapidjson/writer.h"
 #include "monitor/rapidjson/stringbuffer.h"
 
-#include "treap.hpp"
+#include "eventtime_heap.hpp"
+#include "hash_index.hpp"
+#include "slab_allocator.hpp"
+#include "tinylfu.hpp"
+#include "flusher_pool.hpp"
+#include "snapshot.hpp"
 
 namespace ioremap { namespace cache {
 
+/*!
+ * Piece of cached data: reference counter and sizes are kept in the same slab slot right before the bytes.
+ * Bytes below size() are not modified while chunk is shared, so chunk may be referenced by several
+ * versions of object's data and by read replies waiting in the send queue. Bytes above size()
+ * are not visible to anyone, data is appended into them in place.
+ */
+class data_chunk_t {
+public:
+	static data_chunk_t *create(slab_allocator_t &slab, size_t capacity) {
+		void *slot = slab.allocate(sizeof(data_chunk_t) + capacity);
+		return new (slot) data_chunk_t(slab_allocator_t::usable_size(slot, sizeof(data_chunk_t) + capacity) - sizeof(data_chunk_t));
+	}
+
+	data_chunk_t(const data_chunk_t &other) = delete;
+	data_chunk_t &operator =(const data_chunk_t &other) = delete;
+
+	char *data(void) {
+		return reinterpret_cast<char *>(this + 1);
+	}
+
+	size_t size(void) const {
+		return m_size;
+	}
+
+	size_t capacity(void) const {
+		return m_capacity;
+	}
+
+	size_t available(void) const {
+		return m_capacity - m_size;
+	}
+
+	// Memory charged for the chunk
+	size_t slot_size(void) const {
+		return sizeof(data_chunk_t) + m_capacity;
+	}
+
+	// NULL @data appends zeroes, size must not exceed available()
+	void append(const char *data, size_t size) {
+		if (data)
+			memcpy(this->data() + m_size, data, size);
+		else
+			memset(this->data() + m_size, 0, size);
+		m_size += size;
+	}
+
+	// Only chunk which is not shared may be truncated
+	void truncate(size_t size) {
+		m_size = size;
+	}
+
+	unsigned use_count(void) const {
+		return m_refs.load(std::memory_order_relaxed);
+	}
+
+	friend void intrusive_ptr_add_ref(data_chunk_t *chunk) {
+		chunk->m_refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	friend void intrusive_ptr_release(data_chunk_t *chunk) {
+		if (chunk->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			const size_t slot_size = chunk->slot_size();
+			chunk->~data_chunk_t();
+			slab_allocator_t::free(chunk, slot_size);
+		}
+	}
+
+private:
+	data_chunk_t(size_t capacity) : m_refs(1), m_size(0), m_capacity(capacity) {}
+	~data_chunk_t() {}
+
+	std::atomic<unsigned> m_refs;
+	size_t m_size;
+	size_t m_capacity;
+};
+
+/*!
+ * Cached data: chain of chunk ranges (rope), segments array is kept in the same slab slot.
+ * Data is referenced by its object and by lock-free readers, read replies reference chunks of the
+ * requested range only. Shared data is never modified, object replaces it by the new version, which
+ * references the same chunks, so appends and overwrites copy only written bytes and segments array.
+ */
 class raw_data_t {
 public:
-	raw_data_t(const char *data, size_t size) {
-		m_data.reserve(size);
-		m_data.insert(m_data.begin(), data, data + size);
+	struct segment_t {
+		data_chunk_t *chunk;
+		size_t offset;
+		size_t size;
+	};
+
+	static raw_data_t *create(slab_allocator_t &slab, size_t segments_number) {
+		const size_t size = sizeof(raw_data_t) + segments_number * sizeof(segment_t);
+		void *slot = slab.allocate(size);
+		const size_t slot_size = slab_allocator_t::usable_size(slot, size);
+
+		return new (slot) raw_data_t((slot_size - sizeof(raw_data_t)) / sizeof(segment_t), slot_size);
+	}
+
+	static raw_data_t *create(slab_allocator_t &slab, const char *data, size_t size) {
+		raw_data_t *raw = create(slab, 1);
+
+		if (size) {
+			data_chunk_t *chunk = data_chunk_t::create(slab, size);
+			chunk->append(data, size);
+			raw->push_back(chunk, 0, size);
+		}
+		return raw;
+	}
+
+	/*!
+	 * Private copy of @other which has room for at least @segments_number segments
+	 */
+	static raw_data_t *create(slab_allocator_t &slab, const raw_data_t &other, size_t segments_number) {
+		raw_data_t *raw = create(slab, std::max(segments_number, other.m_segments_number));
+
+		for (size_t i = 0; i < other.m_segments_number; ++i) {
+			const segment_t &segment = other.segments()[i];
+			intrusive_ptr_add_ref(segment.chunk);
+			raw->push_back(segment.chunk, segment.offset, segment.size);
+		}
+		return raw;
 	}
 
-	std::vector<char> &data(void) {
-		return m_data;
+	raw_data_t(const raw_data_t &other) = delete;
+	raw_data_t &operator =(const raw_data_t &other) = delete;
+
+	size_t size(void) const {
+		return m_size;
+	}
+
+	// Memory charged for the data: segments array and all referenced chunks
+	size_t capacity(void) const {
+		return m_capacity;
 	}
 
-	size_t size(void) {
-		return m_data.size();
+	const segment_t *segments(void) const {
+		return reinterpret_cast<const segment_t *>(this + 1);
+	}
+
+	size_t segments_number(void) const {
+		return m_segments_number;
+	}
+
+	/*!
+	 * Calls @func(chunk, data, size) for every piece of [@offset, @offset + @size) range
+	 */
+	template <typename Func>
+	void for_each_piece(size_t offset, size_t size, Func func) const {
+		for (size_t i = 0; i < m_segments_number && size; ++i) {
+			const segment_t &segment = segments()[i];
+
+			if (offset >= segment.size) {
+				offset -= segment.size;
+				continue;
+			}
+
+			const size_t piece = std::min(size, segment.size - offset);
+			func(segment.chunk, segment.chunk->data() + segment.offset + offset, piece);
+
+			offset = 0;
+			size -= piece;
+		}
+	}
+
+	void copy(size_t offset, size_t size, char *buffer) const {
+		for_each_piece(offset, size, [&buffer] (data_chunk_t *, const char *data, size_t size) {
+			memcpy(buffer, data, size);
+			buffer += size;
+		});
+	}
+
+	/*!
+	 * Data as single memory block, it is gathered into @buffer only if data consists of several segments
+	 */
+	const char *contiguous_data(std::vector<char> &buffer) const {
+		if (m_segments_number == 1) {
+			const segment_t &segment = segments()[0];
+			return segment.chunk->data() + segment.offset;
+		}
+
+		buffer.resize(m_size);
+		copy(0, m_size, buffer.data());
+		return buffer.data();
+	}
+
+	unsigned use_count(void) const {
+		return m_refs.load(std::memory_order_relaxed);
+	}
+
+	friend void intrusive_ptr_add_ref(raw_data_t *raw) {
+		raw->m_refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	friend void intrusive_ptr_release(raw_data_t *raw) {
+		if (raw->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			const size_t slot_size = raw->slot_size();
+			raw->~raw_data_t();
+			slab_allocator_t::free(raw, slot_size);
+		}
 	}
 
 private:
-	std::vector<char> m_data;
+	// Data is modified only by its object while it is not shared
+	friend class data_t;
+
+	raw_data_t(size_t max_segments_number, size_t slot_size) :
+		m_refs(1), m_size(0), m_capacity(slot_size),
+		m_segments_number(0), m_max_segments_number(max_segments_number) {}
+
+	~raw_data_t() {
+		for (size_t i = 0; i < m_segments_number; ++i)
+			intrusive_ptr_release(segments()[i].chunk);
+	}
+
+	segment_t *mutable_segments(void) {
+		return reinterpret_cast<segment_t *>(this + 1);
+	}
+
+	// Size of the slot as it is needed by the allocator, segments array fills the slot
+	size_t slot_size(void) const {
+		return sizeof(raw_data_t) + m_max_segments_number * sizeof(segment_t);
+	}
+
+	// Takes ownership of the @chunk reference
+	void push_back(data_chunk_t *chunk, size_t offset, size_t size) {
+		segment_t &segment = mutable_segments()[m_segments_number++];
+		segment.chunk = chunk;
+		segment.offset = offset;
+		segment.size = size;
+
+		m_size += size;
+		m_capacity += chunk->slot_size();
+	}
+
+	void pop_back(void) {
+		segment_t &segment = mutable_segments()[--m_segments_number];
+
+		m_size -= segment.size;
+		m_capacity -= segment.chunk->slot_size();
+		intrusive_ptr_release(segment.chunk);
+	}
+
+	std::atomic<unsigned> m_refs;
+	size_t m_size;
+	size_t m_capacity;
+	size_t m_segments_number;
+	size_t m_max_segments_number;
 };
 
+typedef boost::intrusive_ptr<raw_data_t> raw_data_ptr_t;
+
 struct data_lru_tag_t;
 typedef boost::intrusive::list_base_hook<boost::intrusive::tag<data_lru_tag_t>,
 boost::intrusive::link_mode<boost::intrusive::safe_link>, boost::intrusive::optimize_size<true>
 > lru_list_base_hook_t;
 
-class data_t : public lru_list_base_hook_t, public treap_node_t<data_t> {
+class data_t : public lru_list_base_hook_t, public eventtime_heap_node_t<data_t> {
 public:
 	enum class sync_state_t : char {
 		NOT_SYNCING,
@@ -78,25 +319,31 @@ public:
 		ERASE_PHASE,
 	};
 
-	data_t(const unsigned char *id) :
-		m_lifetime(0), m_synctime(0), m_user_flags(0),
-		m_remove_from_disk(false), m_remove_from_cache(false),
-		m_only_append(false), m_removed_from_page(true), m_sync_state(sync_state_t::NOT_SYNCING) {
-		memcpy(m_id.id, id, DNET_ID_SIZE);
-		dnet_empty_time(&m_timestamp);
-	}
-
-	data_t(const unsigned char *id, size_t lifetime, const char *data, size_t size, bool remove_from_disk) :
+	data_t(slab_allocator_t &slab, const unsigned char *id, size_t lifetime, const char *data, size_t size, bool remove_from_disk) :
 		m_lifetime(0), m_synctime(0), m_user_flags(0),
 		m_remove_from_disk(remove_from_disk), m_remove_from_cache(false),
-		m_only_append(false), m_removed_from_page(true), m_sync_state(sync_state_t::NOT_SYNCING) {
+		m_only_append(false), m_removed_from_page(true), m_sync_state(sync_state_t::NOT_SYNCING),
+		m_accessed(false), m_sequence(1) {
 		memcpy(m_id.id, id, DNET_ID_SIZE);
 		dnet_empty_time(&m_timestamp);
 
 		if (lifetime)
 			m_lifetime = lifetime + time(NULL);
 
-		m_data.reset(new raw_data_t(data, size));
+		m_data.store(raw_data_t::create(slab, data, size), std::memory_order_relaxed);
+	}
+
+	// Objects live in slab slots, they are created by placement new with the allocator
+	static void *operator new(size_t size, slab_allocator_t &slab) {
+		return slab.allocate(size);
+	}
+
+	static void operator delete(void *ptr, slab_allocator_t &) {
+		slab_allocator_t::free(ptr, sizeof(data_t));
+	}
+
+	static void operator delete(void *ptr) {
+		slab_allocator_t::free(ptr, sizeof(data_t));
 	}
 
 	data_t(const data_t &other) = delete;
@@ -106,14 +353,132 @@ public:
 		if (!is_removed_from_page()) {
 			std::cerr << "~data_t(): element is not removed from cache" << std::endl;
 		}
+
+		intrusive_ptr_release(m_data.load(std::memory_order_relaxed));
 	}
 
 	const struct dnet_raw_id &id(void) const {
 		return m_id;
 	}
 
-	std::shared_ptr<raw_data_t> data(void) const {
-		return m_data;
+	raw_data_ptr_t data(void) const {
+		return raw_data_ptr_t(m_data.load(std::memory_order_acquire));
+	}
+
+	/*!
+	 * Appends @size bytes of @data, NULL @data appends zeroes.
+	 * Bytes are written in place only into the tail chunk which nobody else sees above its size,
+	 * otherwise they go into the new chunk, which has room for a quarter of the data,
+	 * so appended data consists of logarithmic number of segments and at most a quarter of it is reserved.
+	 * Must be called between begin_update() and end_update().
+	 */
+	void append(slab_allocator_t &slab, epoch_domain_t &epoch, const char *data, size_t size) {
+		raw_data_t *raw = private_data(slab, epoch, 1);
+
+		if (raw->m_segments_number) {
+			raw_data_t::segment_t &tail = raw->mutable_segments()[raw->m_segments_number - 1];
+			data_chunk_t *chunk = tail.chunk;
+			const size_t end = tail.offset + tail.size;
+
+			// bytes of the chunk referenced by this data only are not visible above the tail
+			if (end != chunk->size() && chunk->use_count() == 1)
+				chunk->truncate(end);
+
+			if (end == chunk->size()) {
+				const size_t piece = std::min(size, chunk->available());
+
+				chunk->append(data, piece);
+				tail.size += piece;
+				raw->m_size += piece;
+
+				if (data)
+					data += piece;
+				size -= piece;
+			}
+		}
+
+		if (size) {
+			data_chunk_t *chunk = data_chunk_t::create(slab, std::max(size, raw->size() / append_reserve_divisor));
+			chunk->append(data, size);
+			raw->push_back(chunk, 0, size);
+		}
+	}
+
+	/*!
+	 * Writes @size bytes of @data at @offset and truncates data after them,
+	 * gap between the end of data and @offset is filled with zeroes.
+	 * Only written bytes are copied, untouched prefix keeps referencing the same chunks.
+	 * Must be called between begin_update() and end_update().
+	 */
+	void write(slab_allocator_t &slab, epoch_domain_t &epoch, size_t offset, const char *data, size_t size) {
+		raw_data_t *raw = private_data(slab, epoch, 0);
+
+		while (raw->m_size > offset) {
+			raw_data_t::segment_t &tail = raw->mutable_segments()[raw->m_segments_number - 1];
+			const size_t excess = raw->m_size - offset;
+
+			// the only chunk is kept even if it becomes empty, so that rewritten data reuses it
+			if (excess < tail.size || (raw->m_segments_number == 1 && tail.chunk->use_count() == 1)) {
+				const size_t trim = std::min(excess, tail.size);
+				tail.size -= trim;
+				raw->m_size -= trim;
+				break;
+			}
+
+			raw->pop_back();
+		}
+
+		if (offset > raw->m_size)
+			append(slab, epoch, NULL, offset - raw->m_size);
+		append(slab, epoch, data, size);
+	}
+
+	/*!
+	 * Data, timestamp and user flags are modified between begin_update() and end_update(),
+	 * lock-free reader copies them between read_begin() and read_retry() and falls back
+	 * to locked read if sequence has changed. New object stays in update until the first end_update().
+	 * Both calls are idempotent.
+	 */
+	void begin_update(void) {
+		const unsigned sequence = m_sequence.load(std::memory_order_relaxed);
+
+		if (!(sequence & 1)) {
+			m_sequence.store(sequence + 1, std::memory_order_relaxed);
+			// pairs with the fence in read_retry(): either reader sees odd sequence,
+			// or private_data() sees reader's reference to the data
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+	}
+
+	void end_update(void) {
+		const unsigned sequence = m_sequence.load(std::memory_order_relaxed);
+
+		if (sequence & 1)
+			m_sequence.store(sequence + 1, std::memory_order_release);
+	}
+
+	unsigned read_begin(void) const {
+		return m_sequence.load(std::memory_order_acquire);
+	}
+
+	bool read_retry(unsigned sequence) const {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		return (sequence & 1) || m_sequence.load(std::memory_order_relaxed) != sequence;
+	}
+
+	/*!
+	 * CLOCK-style access bit: set by lock-free readers instead of moving object between pages,
+	 * checked under lock when object is promoted or evicted. Returns previous value.
+	 */
+	bool mark_accessed(void) {
+		if (m_accessed.load(std::memory_order_relaxed))
+			return true;
+		m_accessed.store(true, std::memory_order_relaxed);
+		return false;
+	}
+
+	bool clear_accessed(void) {
+		return m_accessed.exchange(false, std::memory_order_relaxed);
 	}
 
 	size_t lifetime(void) const {
@@ -150,11 +515,11 @@ public:
 	}
 
 	size_t cache_page_number() const {
-		return m_cache_page_number;
+		return m_cache_page_number.load(std::memory_order_relaxed);
 	}
 
 	void set_cache_page_number(size_t cache_page_number) {
-		m_cache_page_number = cache_page_number;
+		m_cache_page_number.store(cache_page_number, std::memory_order_relaxed);
 		if (!is_removed_from_page()) {
 			std::cerr << "Element is not removed from cache page" << std::endl;
 		}
@@ -186,7 +551,7 @@ public:
 	}
 
 	bool remove_from_cache() const {
-		return m_remove_from_cache;
+		return m_remove_from_cache.load(std::memory_order_relaxed);
 	}
 
 	sync_state_t sync_state() const {
@@ -206,15 +571,15 @@ public:
 	}
 
 	void set_remove_from_cache(bool remove_from_cache) {
-		m_remove_from_cache = remove_from_cache;
+		m_remove_from_cache.store(remove_from_cache, std::memory_order_relaxed);
 	}
 
 	bool only_append() const {
-		return m_only_append;
+		return m_only_append.load(std::memory_order_relaxed);
 	}
 
 	void set_only_append(bool only_append) {
-		m_only_append = only_append;
+		m_only_append.store(only_append, std::memory_order_relaxed);
 	}
 
 	bool is_removed_from_page() const {
@@ -229,12 +594,17 @@ public:
 		return capacity() + overhead_size();
 	}
 
+	// Both object and its data slots are charged, including slab class rounding
 	size_t overhead_size(void) const {
-		return sizeof(*this) + sizeof(*m_data);
+		return slab_allocator_t::usable_size(this, sizeof(data_t));
 	}
 
 	size_t capacity(void) const {
-		return m_data->data().capacity();
+		return m_data.load(std::memory_order_relaxed)->capacity();
+	}
+
+	size_t data_size(void) const {
+		return m_data.load(std::memory_order_relaxed)->size();
 	}
 
 	friend bool operator< (const data_t &a, const data_t &b) {
@@ -250,25 +620,83 @@ public:
 	}
 
 private:
+	// data gathered into single chunk when it is split into more segments
+	static const size_t max_segments_number = 32;
+	// new tail chunk of appended data reserves room for this fraction of the data
+	static const size_t append_reserve_divisor = 4;
+
+	/*!
+	 * Returns data private to the object which has room for @segments_number more segments.
+	 * Data may still be referenced by lock-free readers, such data is replaced by copy of the segments
+	 * array, which references the same chunks. Replaced data is released via epoch domain.
+	 */
+	raw_data_t *private_data(slab_allocator_t &slab, epoch_domain_t &epoch, size_t segments_number) {
+		raw_data_t *data = m_data.load(std::memory_order_relaxed);
+		const size_t required = data->m_segments_number + segments_number;
+
+		if (data->use_count() == 1 && required <= data->m_max_segments_number)
+			return data;
+
+		raw_data_t *copy;
+		if (required > max_segments_number) {
+			copy = raw_data_t::create(slab, 1 + segments_number);
+
+			if (data->size()) {
+				data_chunk_t *chunk = data_chunk_t::create(slab, data->size());
+				data->for_each_piece(0, data->size(), [chunk] (data_chunk_t *, const char *data, size_t size) {
+					chunk->append(data, size);
+				});
+				copy->push_back(chunk, 0, chunk->size());
+			}
+		} else {
+			copy = raw_data_t::create(slab, *data, std::max(2 * data->m_segments_number, required));
+		}
+
+		m_data.store(copy, std::memory_order_release);
+		epoch.retire(data, [] (void *p) { intrusive_ptr_release(static_cast<raw_data_t *>(p)); });
+		return copy;
+	}
+
 	size_t m_lifetime;
 	size_t m_synctime;
 	dnet_time m_timestamp;
 	uint64_t m_user_flags;
 	bool m_remove_from_disk;
-	bool m_remove_from_cache;
-	bool m_only_append;
+	std::atomic<bool> m_remove_from_cache;
+	std::atomic<bool> m_only_append;
 	bool m_removed_from_page;
 	sync_state_t m_sync_state;
-	char m_cache_page_number;
+	std::atomic<size_t> m_cache_page_number;
+	std::atomic<bool> m_accessed;
+	std::atomic<unsigned> m_sequence;
 	struct dnet_raw_id m_id;
-	std::shared_ptr<raw_data_t> m_data;
+	std::atomic<raw_data_t *> m_data;
+};
+
+/*!
+ * Scoped modification of the object which may be read without lock
+ */
+class data_update_guard_t {
+public:
+	data_update_guard_t(data_t *data) : m_data(data) {
+		m_data->begin_update();
+	}
+
+	~data_update_guard_t() {
+		m_data->end_update();
+	}
+
+private:
+	data_t *m_data;
 };
 
 struct record_info {
 	record_info(data_t* obj) {
 		only_append = obj->only_append();
 		memcpy(id.id, obj->id().id, DNET_ID_SIZE);
-		data = obj->data()->data();
+		raw_data_ptr_t raw = obj->data();
+		data.resize(raw->size());
+		raw->copy(0, raw->size(), data.data());
 		user_flags = obj->user_flags();
 		timestamp = obj->timestamp();
 		is_synced = false;
@@ -301,26 +729,60 @@ struct eventtime_less {
 	}
 };
 
-typedef treap<data_t> treap_t;
+typedef eventtime_heap<data_t> eventtime_heap_t;
 
 struct cache_stats {
 	cache_stats():
 		number_of_objects(0), size_of_objects(0),
-		number_of_objects_marked_for_deletion(0), size_of_objects_marked_for_deletion(0) {}
+		number_of_objects_marked_for_deletion(0), size_of_objects_marked_for_deletion(0),
+		hits(0), misses(0), admitted(0), rejected(0),
+		dirty_size(0), flushing_size(0), synced_objects(0), synced_size(0), throttled_writes(0),
+		sync_lag(0), max_sync_lag(0) {}
 
 	std::size_t number_of_objects;
 	std::size_t size_of_objects;
 	std::size_t number_of_objects_marked_for_deletion;
 	std::size_t size_of_objects_marked_for_deletion;
 
+	std::size_t hits;
+	std::size_t misses;
+	// decisions of admission filter, which is consulted only when cache is full
+	std::size_t admitted;
+	std::size_t rejected;
+
+	// size of objects which have to be synced and which are being synced now
+	std::size_t dirty_size;
+	std::size_t flushing_size;
+	std::size_t synced_objects;
+	std::size_t synced_size;
+	std::size_t throttled_writes;
+	// seconds between sync time of the object and the moment it has been written to the backend,
+	// maximum in the last write-back pass and over the whole run
+	std::size_t sync_lag;
+	std::size_t max_sync_lag;
+
 	std::vector<size_t> pages_sizes;
 	std::vector<size_t> pages_max_sizes;
 
+	slab_stats slab;
+
 	rapidjson::Value& to_json(rapidjson::Value &stat_value, rapidjson::Document::AllocatorType &allocator) const {
 		stat_value.AddMember("size", size_of_objects, allocator)
 				  .AddMember("removing_size", size_of_objects_marked_for_deletion, allocator)
 				  .AddMember("objects", number_of_objects, allocator)
-				  .AddMember("removing_objects", number_of_objects_marked_for_deletion, allocator);
+				  .AddMember("removing_objects", number_of_objects_marked_for_deletion, allocator)
+				  .AddMember("hits", hits, allocator)
+				  .AddMember("misses", misses, allocator)
+				  .AddMember("hit_ratio", hits + misses ? (double)hits / (hits + misses) : 0.0, allocator)
+				  .AddMember("admitted", admitted, allocator)
+				  .AddMember("rejected", rejected, allocator)
+				  .AddMember("dirty_size", dirty_size, allocator)
+				  .AddMember("flushing_size", flushing_size, allocator)
+				  .AddMember("synced_objects", synced_objects, allocator)
+				  .AddMember("synced_size", synced_size, allocator)
+				  .AddMember("throttled_writes", throttled_writes, allocator)
+				  .AddMember("sync_lag", sync_lag, allocator)
+				  .AddMember("max_sync_lag", max_sync_lag, allocator);
 
 		rapidjson::Value pages_sizes_stat(rapidjson::kArrayType);
 		for (auto it = pages_sizes.begin(), end = pages_sizes.end(); it != end; ++it) {
@@ -333,6 +795,32 @@ struct cache_stats {
 			pages_max_sizes_stat.PushBack(*it, allocator);
 		}
 		stat_value.AddMember("pages_max_sizes", pages_max_sizes_stat, allocator);
+
+		const size_t slab_allocated_size = slab.allocated_size();
+		const size_t slab_used_size = slab.used_size();
+
+		rapidjson::Value slab_stat(rapidjson::kObjectType);
+		slab_stat.AddMember("allocated_size", slab_allocated_size, allocator)
+			 .AddMember("used_size", slab_used_size, allocator)
+			 .AddMember("fragmentation", slab_allocated_size ?
+					 1.0 - (double)slab_used_size / slab_allocated_size : 0.0, allocator)
+			 .AddMember("large_objects", slab.large_objects, allocator)
+			 .AddMember("large_size", slab.large_size, allocator);
+
+		rapidjson::Value slab_classes_stat(rapidjson::kArrayType);
+		for (auto it = slab.classes.begin(), end = slab.classes.end(); it != end; ++it) {
+			if (!it->chunks)
+				continue;
+
+			rapidjson::Value class_stat(rapidjson::kObjectType);
+			class_stat.AddMember("slot_size", it->slot_size, allocator)
+				  .AddMember("chunks", it->chunks, allocator)
+				  .AddMember("slots", it->slots, allocator)
+				  .AddMember("used_slots", it->used_slots, allocator);
+			slab_classes_stat.PushBack(class_stat, allocator);
+		}
+		slab_stat.AddMember("classes", slab_classes_stat, allocator);
+		stat_value.AddMember("slab", slab_stat, allocator);
 		return stat_value;
 	}
 };
@@ -347,7 +835,18 @@ class cache_manager {
 
 		int write(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd, dnet_io_attr *io, const char *data);
 
-		std::shared_ptr<raw_data_t> read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io);
+		/*!
+		 * Blocks writer of @id while its shard has too much data waiting for write-back
+		 */
+		void throttle(const unsigned char *id);
+
+		raw_data_ptr_t read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io);
+
+		/*!
+		 * Reads @count objects grouped by cache shards, each shard is locked once for all its objects.
+		 * Data of found objects is put into @data, missed ones are left empty.
+		 */
+		void bulk_read(dnet_io_attr **ios, raw_data_ptr_t *data, size_t count);
 
 		int remove(const unsigned char *id, dnet_io_attr *io);
 
@@ -381,11 +880,49 @@ class cache_manager {
 
 	private:
 		dnet_node *m_node;
+		// shards are destroyed first, they wait for their write-back tasks
+		std::unique_ptr<flusher_pool_t> m_flushers;
 		std::vector<std::shared_ptr<slru_cache_t>> m_caches;
-		size_t m_max_cache_size;
+		std::atomic<size_t> m_max_cache_size;
 		size_t m_cache_pages_number;
+		std::vector<size_t> m_pages_proportions;
+
+		dnet_backend_io *m_backend;
+		// snapshot and resize threads wait here between their passes
+		std::mutex m_background_lock;
+		std::condition_variable m_background_cond;
+		bool m_background_stop;
+
+		// hot keys are periodically saved into snapshot file and loaded back when backend starts
+		std::string m_snapshot_path;
+		unsigned m_snapshot_interval;
+		size_t m_warm_up_rate;
+		bool m_warmed_up;
+		std::thread m_snapshot_thread;
+
+		// cache size follows memory available on the host between these bounds
+		size_t m_min_cache_size;
+		size_t m_max_cache_size_bound;
+		size_t m_reserved_memory;
+		unsigned m_resize_interval;
+		std::thread m_resize_thread;
 
 		size_t idx(const unsigned char *id);
+
+		// sizes of the pages of single shard which takes @max_size bytes
+		std::vector<size_t> pages_max_sizes(size_t max_size) const;
+
+		void set_cache_size(size_t cache_size);
+
+		void resize_loop();
+
+		void adjust_cache_size();
+
+		void snapshot_loop();
+
+		void warm_up();
+
+		void write_snapshot();
 };
 
 template <typename T>
@@ -0,0 +1,192 @@
+/*
+* 2015+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+* All rights reserved.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*/
+
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include <cstdint>
+#include <vector>
+#if __GNUC__ == 4 && __GNUC_MINOR__ < 5
+#  include <cstdatomic>
+#else
+#  include <atomic>
+#endif
+
+namespace ioremap { namespace cache {
+
+/*!
+ * Epoch based reclamation of objects which are read without locks.
+ *
+ * Reader announces global epoch in its own slot before accessing shared objects and clears
+ * the slot when it is done. Writer unlinks object under its own lock and retires it,
+ * retired object is freed when global epoch has advanced twice since then, which is only
+ * possible when every reader which could have seen the object has left its critical section.
+ *
+ * retire() and reclaim() must be serialized by the caller (they are called under cache shard lock),
+ * enter()/leave() may be called from any number of threads concurrently.
+ */
+class epoch_domain_t {
+public:
+	static const size_t slots_number = 256;
+
+	epoch_domain_t() : m_epoch(1) {
+		for (size_t i = 0; i < slots_number; ++i)
+			m_slots[i].epoch.store(0, std::memory_order_relaxed);
+	}
+
+	~epoch_domain_t() {
+		for (auto it = m_retired.begin(); it != m_retired.end(); ++it)
+			it->deleter(it->ptr);
+	}
+
+	epoch_domain_t(const epoch_domain_t &) = delete;
+	epoch_domain_t &operator =(const epoch_domain_t &) = delete;
+
+	/*!
+	 * Enters critical section, returns slot which has to be passed to leave()
+	 * or -1 if all slots are busy, in this case caller must not read shared objects
+	 */
+	int enter() {
+		static __thread size_t thread_slot = slots_number;
+		static std::atomic<size_t> next_slot(0);
+
+		if (thread_slot == slots_number)
+			thread_slot = next_slot.fetch_add(1, std::memory_order_relaxed) % slots_number;
+
+		const uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+
+		for (size_t i = 0; i < slots_number; ++i) {
+			const size_t idx = (thread_slot + i) % slots_number;
+			uint64_t free_slot = 0;
+
+			if (m_slots[idx].epoch.load(std::memory_order_relaxed) != 0)
+				continue;
+
+			if (m_slots[idx].epoch.compare_exchange_strong(free_slot, epoch)) {
+				// pairs with the fence in reclaim(): either reclaimer sees this slot,
+				// or this reader sees all objects unlinked before the slot was scanned
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				return idx;
+			}
+		}
+
+		return -1;
+	}
+
+	void leave(int slot) {
+		m_slots[slot].epoch.store(0, std::memory_order_release);
+	}
+
+	void retire(void *ptr, void (*deleter)(void *)) {
+		retired_t r;
+		r.ptr = ptr;
+		r.deleter = deleter;
+		r.epoch = m_epoch.load(std::memory_order_relaxed);
+		m_retired.push_back(r);
+
+		if (m_retired.size() >= reclaim_threshold)
+			reclaim();
+	}
+
+	template <typename T>
+	void retire(T *ptr) {
+		retire(ptr, [] (void *p) { delete static_cast<T *>(p); });
+	}
+
+	/*!
+	 * Advances global epoch if every active reader has already seen the current one
+	 * and frees objects which can not be referenced by readers anymore
+	 */
+	void reclaim() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		uint64_t epoch = m_epoch.load(std::memory_order_relaxed);
+		bool advance = true;
+
+		for (size_t i = 0; i < slots_number; ++i) {
+			const uint64_t slot_epoch = m_slots[i].epoch.load(std::memory_order_acquire);
+			if (slot_epoch && slot_epoch != epoch) {
+				advance = false;
+				break;
+			}
+		}
+
+		if (advance) {
+			++epoch;
+			m_epoch.store(epoch, std::memory_order_release);
+		}
+
+		size_t kept = 0;
+		for (size_t i = 0; i < m_retired.size(); ++i) {
+			if (m_retired[i].epoch + 2 <= epoch)
+				m_retired[i].deleter(m_retired[i].ptr);
+			else
+				m_retired[kept++] = m_retired[i];
+		}
+		m_retired.resize(kept);
+	}
+
+	size_t retired_number() const {
+		return m_retired.size();
+	}
+
+private:
+	static const size_t reclaim_threshold = 128;
+
+	// every slot is padded to cache line, so readers on different cpus do not share it
+	struct slot_t {
+		std::atomic<uint64_t> epoch;
+		char pad[64 - sizeof(std::atomic<uint64_t>)];
+	};
+
+	struct retired_t {
+		void *ptr;
+		void (*deleter)(void *);
+		uint64_t epoch;
+	};
+
+	std::atomic<uint64_t> m_epoch;
+	slot_t m_slots[slots_number];
+	std::vector<retired_t> m_retired;
+};
+
+/*!
+ * Scoped critical section of epoch domain
+ */
+class epoch_guard_t {
+public:
+	epoch_guard_t(epoch_domain_t &domain) : m_domain(domain), m_slot(domain.enter()) {
+	}
+
+	~epoch_guard_t() {
+		if (m_slot >= 0)
+			m_domain.leave(m_slot);
+	}
+
+	epoch_guard_t(const epoch_guard_t &) = delete;
+	epoch_guard_t &operator =(const epoch_guard_t &) = delete;
+
+	bool active() const {
+		return m_slot >= 0;
+	}
+
+private:
+	epoch_domain_t &m_domain;
+	int m_slot;
+};
+
+}}
+
+#endif // EPOCH_HPP
@@ -0,0 +1,148 @@
+/*
+* 2015+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+* All rights reserved.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*/
+
+#ifndef EVENTTIME_HEAP_HPP
+#define EVENTTIME_HEAP_HPP
+
+#include <stdexcept>
+#include <vector>
+
+namespace ioremap { namespace cache {
+
+template<typename T>
+class eventtime_heap_node_t {
+public:
+	eventtime_heap_node_t(): heap_index(0) {}
+	size_t heap_index;
+};
+
+/*!
+ * Binary min-heap of cached objects ordered by their eventtime,
+ * top() is the object which has to be synced or removed first.
+ * Node keeps its position in the heap, so it can be removed or repositioned in O(log n).
+ */
+template<typename node_type>
+class eventtime_heap {
+public:
+	typedef node_type* p_node_type;
+
+	void insert(p_node_type node) {
+		if (!node) {
+			throw std::logic_error("insert: can't insert NULL");
+		}
+		node->heap_index = m_heap.size();
+		m_heap.push_back(node);
+		sift_up(node->heap_index);
+	}
+
+	void erase(p_node_type node) {
+		const size_t idx = index(node);
+		const size_t last = m_heap.size() - 1;
+
+		if (idx != last) {
+			place(m_heap[last], idx);
+			m_heap.pop_back();
+			update(m_heap[idx]);
+		} else {
+			m_heap.pop_back();
+		}
+	}
+
+	/*!
+	 * Restores heap order after eventtime of the node has been changed in either direction
+	 */
+	void update(p_node_type node) {
+		const size_t idx = index(node);
+
+		if (idx && m_heap[idx]->eventtime() < m_heap[parent(idx)]->eventtime())
+			sift_up(idx);
+		else
+			sift_down(idx);
+	}
+
+	p_node_type top() const {
+		return m_heap.empty() ? NULL : m_heap.front();
+	}
+
+	bool empty() const {
+		return m_heap.empty();
+	}
+
+	size_t size() const {
+		return m_heap.size();
+	}
+
+private:
+	static size_t parent(size_t idx) {
+		return (idx - 1) / 2;
+	}
+
+	size_t index(p_node_type node) const {
+		if (!node || node->heap_index >= m_heap.size() || m_heap[node->heap_index] != node) {
+			throw std::logic_error("eventtime_heap: element does not exist");
+		}
+		return node->heap_index;
+	}
+
+	void place(p_node_type node, size_t idx) {
+		m_heap[idx] = node;
+		node->heap_index = idx;
+	}
+
+	void sift_up(size_t idx) {
+		p_node_type node = m_heap[idx];
+		const size_t eventtime = node->eventtime();
+
+		while (idx) {
+			const size_t p = parent(idx);
+			if (m_heap[p]->eventtime() <= eventtime)
+				break;
+
+			place(m_heap[p], idx);
+			idx = p;
+		}
+
+		place(node, idx);
+	}
+
+	void sift_down(size_t idx) {
+		p_node_type node = m_heap[idx];
+		const size_t eventtime = node->eventtime();
+		const size_t size = m_heap.size();
+
+		while (true) {
+			size_t child = 2 * idx + 1;
+			if (child >= size)
+				break;
+
+			if (child + 1 < size && m_heap[child + 1]->eventtime() < m_heap[child]->eventtime())
+				++child;
+
+			if (m_heap[child]->eventtime() >= eventtime)
+				break;
+
+			place(m_heap[child], idx);
+			idx = child;
+		}
+
+		place(node, idx);
+	}
+
+	std::vector<p_node_type> m_heap;
+};
+
+}}
+
+#endif // EVENTTIME_HEAP_HPP
@@ -0,0 +1,97 @@
+/*
+* 2015+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+* All rights reserved.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*/
+
+#ifndef FLUSHER_POOL_HPP
+#define FLUSHER_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "library/elliptics.h"
+
+namespace ioremap { namespace cache {
+
+/*!
+ * Threads which write dirty cached objects back to the backend on behalf of all cache shards
+ * of the backend. Tasks are executed in submission order, pending tasks are still executed
+ * when the pool is being destroyed.
+ */
+class flusher_pool_t {
+public:
+	flusher_pool_t(size_t threads_number, size_t backend_id) : m_stop(false) {
+		for (size_t i = 0; i < threads_number; ++i)
+			m_threads.emplace_back(std::bind(&flusher_pool_t::run, this, backend_id));
+	}
+
+	~flusher_pool_t() {
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+
+		for (auto it = m_threads.begin(); it != m_threads.end(); ++it)
+			it->join();
+	}
+
+	flusher_pool_t(const flusher_pool_t &) = delete;
+	flusher_pool_t &operator =(const flusher_pool_t &) = delete;
+
+	size_t size() const {
+		return m_threads.size();
+	}
+
+	void submit(const std::function<void ()> &task) {
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_tasks.push_back(task);
+		}
+		m_cond.notify_one();
+	}
+
+private:
+	void run(size_t backend_id) {
+		dnet_set_name("dnet_flush_%zu", backend_id);
+
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		while (true) {
+			m_cond.wait(guard, [this] () { return m_stop || !m_tasks.empty(); });
+			if (m_tasks.empty())
+				break;
+
+			std::function<void ()> task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+
+			guard.unlock();
+			task();
+			guard.lock();
+		}
+	}
+
+	std::mutex m_lock;
+	std::condition_variable m_cond;
+	std::deque<std::function<void ()>> m_tasks;
+	bool m_stop;
+	std::vector<std::thread> m_threads;
+};
+
+}}
+
+#endif // FLUSHER_POOL_HPP
@@ -0,0 +1,216 @@
+/*
+* 2015+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+* All rights reserved.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*/
+
+#ifndef HASH_INDEX_HPP
+#define HASH_INDEX_HPP
+
+#include "epoch.hpp"
+
+#include <cstring>
+#include <memory>
+
+#include "elliptics/interface.h"
+
+namespace ioremap { namespace cache {
+
+/*!
+ * Open-addressing hash index of cached objects keyed by 64-byte id.
+ *
+ * Every slot keeps short fingerprint of the id next to the object pointer, so probing
+ * compares full ids only for slots whose fingerprints match and does not touch other objects.
+ * Linear probing is used, removed objects leave tombstones which are dropped when table is rebuilt.
+ *
+ * Modifications are serialized by the caller, find() may run concurrently with them
+ * within critical section of the epoch domain. Concurrent reader may miss an object which is being
+ * inserted or moved to the new table, such miss has to be rechecked under lock.
+ */
+template<typename node_type>
+class hash_index {
+public:
+	typedef node_type* p_node_type;
+	typedef const unsigned char * key_type;
+
+	hash_index(epoch_domain_t &epoch) : m_epoch(epoch), m_size(0), m_used(0) {
+		m_table.store(new table_t(initial_slots_number), std::memory_order_relaxed);
+	}
+
+	~hash_index() {
+		delete m_table.load(std::memory_order_relaxed);
+	}
+
+	hash_index(const hash_index &) = delete;
+	hash_index &operator =(const hash_index &) = delete;
+
+	p_node_type find(const key_type &key) const {
+		const table_t *table = m_table.load(std::memory_order_acquire);
+		const uint32_t fp = fingerprint(key);
+		size_t idx = hash(key);
+
+		for (size_t i = 0; i < table->size(); ++i, ++idx) {
+			const slot_t &slot = table->slot(idx);
+			p_node_type node = slot.node.load(std::memory_order_acquire);
+
+			if (!node)
+				break;
+
+			if (node != tombstone() && slot.fingerprint.load(std::memory_order_relaxed) == fp &&
+					!dnet_id_cmp_str(node->id().id, key))
+				return node;
+		}
+
+		return NULL;
+	}
+
+	void insert(p_node_type node) {
+		table_t *table = m_table.load(std::memory_order_relaxed);
+
+		if ((m_used + 1) * max_load_denominator > table->size() * max_load_numerator)
+			table = rebuild(table);
+
+		if (place(table, node))
+			++m_used;
+		++m_size;
+	}
+
+	void erase(p_node_type node) {
+		table_t *table = m_table.load(std::memory_order_relaxed);
+		size_t idx = hash(node->id().id);
+
+		for (size_t i = 0; i < table->size(); ++i, ++idx) {
+			slot_t &slot = table->slot(idx);
+			p_node_type it = slot.node.load(std::memory_order_relaxed);
+
+			if (!it)
+				break;
+
+			if (it == node) {
+				slot.node.store(tombstone(), std::memory_order_release);
+				--m_size;
+				return;
+			}
+		}
+	}
+
+	size_t size() const {
+		return m_size;
+	}
+
+	size_t capacity() const {
+		return m_table.load(std::memory_order_relaxed)->size();
+	}
+
+private:
+	static const size_t initial_slots_number = 1024;
+	// table is rebuilt when live objects and tombstones occupy more than 3/4 of it
+	static const size_t max_load_numerator = 3;
+	static const size_t max_load_denominator = 4;
+
+	struct slot_t {
+		std::atomic<uint32_t> fingerprint;
+		std::atomic<p_node_type> node;
+	};
+
+	class table_t {
+	public:
+		table_t(size_t size) : m_mask(size - 1), m_slots(new slot_t[size]) {
+			for (size_t i = 0; i < size; ++i) {
+				m_slots[i].fingerprint.store(0, std::memory_order_relaxed);
+				m_slots[i].node.store(NULL, std::memory_order_relaxed);
+			}
+		}
+
+		slot_t &slot(size_t idx) const {
+			return m_slots[idx & m_mask];
+		}
+
+		size_t size() const {
+			return m_mask + 1;
+		}
+
+	private:
+		size_t m_mask;
+		std::unique_ptr<slot_t[]> m_slots;
+	};
+
+	static p_node_type tombstone() {
+		return reinterpret_cast<p_node_type>(static_cast<uintptr_t>(1));
+	}
+
+	// Ids are already uniformly distributed, bytes used by cache_manager::idx() to select a shard are skipped
+	static size_t hash(const key_type &key) {
+		size_t h;
+		memcpy(&h, key + sizeof(size_t), sizeof(size_t));
+		return h;
+	}
+
+	static uint32_t fingerprint(const key_type &key) {
+		uint32_t fp;
+		memcpy(&fp, key + 2 * sizeof(size_t), sizeof(uint32_t));
+		return fp;
+	}
+
+	/*
+	 * Puts node into the first free slot of its probe sequence,
+	 * returns true if empty slot was taken and false if tombstone was reused
+	 */
+	static bool place(table_t *table, p_node_type node) {
+		size_t idx = hash(node->id().id);
+
+		for (;; ++idx) {
+			slot_t &slot = table->slot(idx);
+			p_node_type it = slot.node.load(std::memory_order_relaxed);
+
+			if (!it || it == tombstone()) {
+				slot.fingerprint.store(fingerprint(node->id().id), std::memory_order_relaxed);
+				slot.node.store(node, std::memory_order_release);
+				return !it;
+			}
+		}
+	}
+
+	/*
+	 * Moves live objects into new table which has at least twice as many slots as there are objects,
+	 * old table may still be searched by readers, it is freed via epoch domain
+	 */
+	table_t *rebuild(table_t *table) {
+		size_t size = table->size();
+		while ((m_size + 1) * 2 > size)
+			size *= 2;
+
+		table_t *new_table = new table_t(size);
+
+		for (size_t i = 0; i < table->size(); ++i) {
+			p_node_type node = table->slot(i).node.load(std::memory_order_relaxed);
+
+			if (node && node != tombstone())
+				place(new_table, node);
+		}
+
+		m_used = m_size;
+
+		m_table.store(new_table, std::memory_order_release);
+		m_epoch.retire(table);
+		return new_table;
+	}
+
+	epoch_domain_t &m_epoch;
+	std::atomic<table_t *> m_table;
+	size_t m_size;
+	size_t m_used;
+};
+
+}}
+
+#endif // HASH_INDEX_HPP
@@ -0,0 +1,387 @@
+/*
+* 2015+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+* All rights reserved.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*/
+
+#ifndef SLAB_ALLOCATOR_HPP
+#define SLAB_ALLOCATOR_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace ioremap { namespace cache {
+
+struct slab_class_stats {
+	slab_class_stats() : slot_size(0), chunks(0), slots(0), used_slots(0) {}
+
+	size_t slot_size;
+	size_t chunks;
+	size_t slots;
+	size_t used_slots;
+};
+
+struct slab_stats {
+	slab_stats() : chunk_size(0), large_objects(0), large_size(0) {}
+
+	size_t chunk_size;
+	std::vector<slab_class_stats> classes;
+	size_t large_objects;
+	size_t large_size;
+
+	// memory taken from the system
+	size_t allocated_size() const {
+		size_t size = large_size;
+		for (auto it = classes.begin(); it != classes.end(); ++it)
+			size += it->chunks * chunk_size;
+		return size;
+	}
+
+	// memory handed out to the cache
+	size_t used_size() const {
+		size_t size = large_size;
+		for (auto it = classes.begin(); it != classes.end(); ++it)
+			size += it->used_slots * it->slot_size;
+		return size;
+	}
+
+	void merge(const slab_stats &other) {
+		chunk_size = other.chunk_size;
+		if (classes.size() < other.classes.size())
+			classes.resize(other.classes.size());
+
+		for (size_t i = 0; i < other.classes.size(); ++i) {
+			classes[i].slot_size = other.classes[i].slot_size;
+			classes[i].chunks += other.classes[i].chunks;
+			classes[i].slots += other.classes[i].slots;
+			classes[i].used_slots += other.classes[i].used_slots;
+		}
+
+		large_objects += other.large_objects;
+		large_size += other.large_size;
+	}
+};
+
+/*!
+ * Size-classed slab allocator for cached objects.
+ *
+ * Memory is taken from the system by chunks aligned to their size, every chunk is split into
+ * slots of single size class, which grow geometrically, so per-object overhead is bounded by
+ * the class step instead of malloc headers and heap fragmentation. Chunk header is found by
+ * masking slot address, so free() needs no allocator. Objects larger than the biggest class
+ * are allocated by malloc() with small header of their own, free() and usable_size() tell them
+ * from slots by the size, which is why they need it.
+ *
+ * Chunks are returned to the system as soon as their last slot is freed. Freed slots of chunks
+ * which are still in use are not available to other classes, chunks are kept small, so that
+ * evicted objects empty them and a chunk is not kept by few objects of the class.
+ *
+ * All methods are thread-safe: slots are allocated under cache shard lock, but may be freed
+ * from any thread when the last reference to cached data is dropped.
+ * Owner calls release() instead of deleting allocator, it is destroyed when its last chunk is freed.
+ */
+class slab_allocator_t {
+public:
+	static const size_t chunk_size = 1 << 16;
+
+	slab_allocator_t() : m_chunks_number(0), m_large_objects(0), m_large_size(0), m_released(false) {
+		for (size_t size = min_slot_size; ; size = round_up(size + size / growth_divisor)) {
+			class_t c;
+			c.slot_size = size < max_slot_size ? size : max_slot_size;
+			c.slots_per_chunk = (chunk_size - chunk_header_size) / c.slot_size;
+			m_classes.push_back(c);
+
+			if (c.slot_size == max_slot_size)
+				break;
+		}
+	}
+
+	slab_allocator_t(const slab_allocator_t &) = delete;
+	slab_allocator_t &operator =(const slab_allocator_t &) = delete;
+
+	void *allocate(size_t size) {
+		if (size > max_slot_size)
+			return allocate_large(size);
+
+		const size_t index = class_index(size);
+		class_t &c = m_classes[index];
+
+		std::lock_guard<std::mutex> guard(m_lock);
+
+		chunk_t *chunk = c.partial;
+		if (!chunk) {
+			chunk = new_chunk();
+			chunk->class_index = index;
+			chunk->slot_size = c.slot_size;
+			++c.chunks;
+			link(c, chunk);
+		}
+
+		void *slot = chunk->free_list;
+		if (slot) {
+			chunk->free_list = *static_cast<void **>(slot);
+		} else {
+			slot = slot_at(chunk, chunk->carved++);
+		}
+
+		++c.used_slots;
+		if (++chunk->used == c.slots_per_chunk)
+			unlink(c, chunk);
+
+		return slot;
+	}
+
+	/*!
+	 * Frees @ptr, @size is either requested size or usable one
+	 */
+	static void free(void *ptr, size_t size) {
+		if (!ptr)
+			return;
+
+		if (size > max_slot_size) {
+			large_t *large = large_of(ptr);
+			large->slab->free_large(large);
+		} else {
+			chunk_t *chunk = chunk_of(ptr);
+			chunk->slab->free_slot(chunk, ptr);
+		}
+	}
+
+	/*!
+	 * Size of the slot, which may be larger than requested @size
+	 */
+	static size_t usable_size(const void *ptr, size_t size) {
+		if (size > max_slot_size)
+			return size;
+		return chunk_of(ptr)->slot_size;
+	}
+
+	void release() {
+		bool destroy;
+
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_released = true;
+			destroy = !m_chunks_number && !m_large_objects;
+		}
+
+		if (destroy)
+			delete this;
+	}
+
+	slab_stats stats() const {
+		slab_stats stats;
+		stats.chunk_size = chunk_size;
+		stats.classes.resize(m_classes.size());
+
+		std::lock_guard<std::mutex> guard(m_lock);
+
+		for (size_t i = 0; i < m_classes.size(); ++i) {
+			const class_t &c = m_classes[i];
+			stats.classes[i].slot_size = c.slot_size;
+			stats.classes[i].chunks = c.chunks;
+			stats.classes[i].slots = c.chunks * c.slots_per_chunk;
+			stats.classes[i].used_slots = c.used_slots;
+		}
+
+		stats.large_objects = m_large_objects;
+		stats.large_size = m_large_size;
+		return stats;
+	}
+
+private:
+	static const size_t min_slot_size = 32;
+	static const size_t slot_align = 16;
+	// every next class is 1/8 larger than previous one
+	static const size_t growth_divisor = 8;
+	static const size_t min_slots_per_chunk = 8;
+
+	struct chunk_t {
+		slab_allocator_t *slab;
+		size_t class_index;
+		size_t slot_size;
+		size_t used;
+		size_t carved;
+		void *free_list;
+		chunk_t *prev;
+		chunk_t *next;
+	};
+
+	struct class_t {
+		class_t() : slot_size(0), slots_per_chunk(0), chunks(0), used_slots(0), partial(NULL) {}
+
+		size_t slot_size;
+		size_t slots_per_chunk;
+		size_t chunks;
+		size_t used_slots;
+		// chunks which have free slots
+		chunk_t *partial;
+	};
+
+	struct large_t {
+		slab_allocator_t *slab;
+		size_t size;
+	};
+
+	static const size_t chunk_header_size = (sizeof(chunk_t) + slot_align - 1) & ~(slot_align - 1);
+	static const size_t large_header_size = (sizeof(large_t) + slot_align - 1) & ~(slot_align - 1);
+	static const size_t max_slot_size = ((chunk_size - chunk_header_size) / min_slots_per_chunk) & ~(slot_align - 1);
+
+	~slab_allocator_t() {}
+
+	static size_t round_up(size_t size) {
+		return (size + slot_align - 1) & ~(slot_align - 1);
+	}
+
+	static chunk_t *chunk_of(const void *ptr) {
+		return reinterpret_cast<chunk_t *>(reinterpret_cast<uintptr_t>(ptr) & ~(uintptr_t)(chunk_size - 1));
+	}
+
+	static large_t *large_of(void *ptr) {
+		return reinterpret_cast<large_t *>(static_cast<char *>(ptr) - large_header_size);
+	}
+
+	static void *slot_at(chunk_t *chunk, size_t index) {
+		return reinterpret_cast<char *>(chunk) + chunk_header_size + index * chunk->slot_size;
+	}
+
+	size_t class_index(size_t size) const {
+		size_t low = 0, high = m_classes.size() - 1;
+
+		while (low < high) {
+			const size_t mid = (low + high) / 2;
+			if (m_classes[mid].slot_size < size)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+
+		return low;
+	}
+
+	chunk_t *new_chunk() {
+		void *ptr;
+		if (posix_memalign(&ptr, chunk_size, chunk_size))
+			throw std::bad_alloc();
+
+		chunk_t *chunk = static_cast<chunk_t *>(ptr);
+		chunk->slab = this;
+		chunk->used = 0;
+		chunk->carved = 0;
+		chunk->free_list = NULL;
+		chunk->prev = NULL;
+		chunk->next = NULL;
+
+		++m_chunks_number;
+		return chunk;
+	}
+
+	void *allocate_large(size_t size) {
+		large_t *large = static_cast<large_t *>(malloc(large_header_size + size));
+		if (!large)
+			throw std::bad_alloc();
+
+		large->slab = this;
+		large->size = size;
+
+		std::lock_guard<std::mutex> guard(m_lock);
+		++m_large_objects;
+		m_large_size += size;
+
+		return reinterpret_cast<char *>(large) + large_header_size;
+	}
+
+	void free_large(large_t *large) {
+		bool destroy;
+
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			--m_large_objects;
+			m_large_size -= large->size;
+
+			destroy = m_released && !m_chunks_number && !m_large_objects;
+		}
+
+		::free(large);
+
+		if (destroy)
+			delete this;
+	}
+
+	void free_slot(chunk_t *chunk, void *ptr) {
+		bool destroy;
+
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			class_t &c = m_classes[chunk->class_index];
+
+			if (chunk->used-- == c.slots_per_chunk)
+				link(c, chunk);
+
+			--c.used_slots;
+
+			if (chunk->used) {
+				*static_cast<void **>(ptr) = chunk->free_list;
+				chunk->free_list = ptr;
+			} else {
+				drop_chunk(c, chunk);
+			}
+
+			destroy = m_released && !m_chunks_number && !m_large_objects;
+		}
+
+		if (destroy)
+			delete this;
+	}
+
+	void drop_chunk(class_t &c, chunk_t *chunk) {
+		unlink(c, chunk);
+		--c.chunks;
+		--m_chunks_number;
+		::free(chunk);
+	}
+
+	static void link(class_t &c, chunk_t *chunk) {
+		chunk->prev = NULL;
+		chunk->next = c.partial;
+		if (c.partial)
+			c.partial->prev = chunk;
+		c.partial = chunk;
+	}
+
+	static void unlink(class_t &c, chunk_t *chunk) {
+		if (chunk->prev)
+			chunk->prev->next = chunk->next;
+		else
+			c.partial = chunk->next;
+
+		if (chunk->next)
+			chunk->next->prev = chunk->prev;
+
+		chunk->prev = NULL;
+		chunk->next = NULL;
+	}
+
+	mutable std::mutex m_lock;
+	std::vector<class_t> m_classes;
+	size_t m_chunks_number;
+	size_t m_large_objects;
+	size_t m_large_size;
+	bool m_released;
+};
+
+}}
+
+#endif // SLAB_ALLOCATOR_HPP
@@ -19,6 +19,7 @@
 #endif
 
 #include "slru_cache.hpp"
+#include <algorithm>
 #include <cassert>
 
 #include "monitor/measure_points.h"
@@ -45,13 +46,25 @@ namespace ioremap { namespace cache {
 // public:
 
 slru_cache_t::slru_cache_t(struct dnet_backend_io *backend, struct dnet_node *n,
-	const std::vector<size_t> &cache_pages_max_sizes, unsigned sync_timeout) :
+	const std::vector<size_t> &cache_pages_max_sizes, unsigned sync_timeout, size_t admission_objects,
+	flusher_pool_t *flushers, size_t dirty_high_watermark, size_t dirty_low_watermark) :
 	m_backend(backend),
 	m_node(n),
 	m_cache_pages_number(cache_pages_max_sizes.size()),
 	m_cache_pages_max_sizes(cache_pages_max_sizes),
 	m_cache_pages_sizes(m_cache_pages_number, 0),
 	m_cache_pages_lru(new lru_list_t[m_cache_pages_number]),
+	m_slab(new slab_allocator_t()),
+	m_index(m_epoch),
+	m_hits(0),
+	m_misses(0),
+	m_admission(admission_objects ? new tinylfu_t(admission_objects) : NULL),
+	m_flushers(flushers),
+	m_dirty_high_watermark(dirty_high_watermark),
+	m_dirty_low_watermark(dirty_low_watermark),
+	m_dirty_size(0),
+	m_flushing_size(0),
+	m_flush_requested(false),
 	m_clear_occured(false),
 	m_sync_timeout(sync_timeout) {
 	m_lifecheck = std::thread(std::bind(&slru_cache_t::life_check, this));
@@ -63,6 +76,8 @@ slru_cache_t::~slru_cache_t() {
 	m_lifecheck.join();
 	dnet_log(m_node, DNET_LOG_NOTICE, "cache: disable: backend: %zu: clearing\n", m_backend->backend_id);
 	clear();
+	// data referenced by replies in send queues keeps allocator alive
+	m_slab->release();
 	dnet_log(m_node, DNET_LOG_NOTICE, "cache: disable: backend: %zu: destructed\n", m_backend->backend_id);
 }
 
@@ -76,12 +91,15 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 	const bool cache_only = (io->flags & DNET_IO_FLAGS_CACHE_ONLY);
 	const bool append = (io->flags & DNET_IO_FLAGS_APPEND);
 
+	if (m_admission)
+		m_admission->record(id);
+
 	TIMER_START("write.lock");
 	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE WRITE: %p", dnet_dump_id_str(id), this);
 	TIMER_STOP("write.lock");
 
 	TIMER_START("write.find");
-	data_t* it = m_treap.find(id);
+	data_t* it = m_index.find(id);
 	TIMER_STOP("write.find");
 
 	if (!it && !cache) {
@@ -100,15 +118,15 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 				new_page = true;
 				it->set_only_append(true);
 				size_t previous_eventtime = it->eventtime();
-				it->set_synctime(time(NULL) + m_sync_timeout);
+				set_synctime(it, time(NULL) + m_sync_timeout);
 
 				if (previous_eventtime != it->eventtime()) {
 					TIMER_SCOPE("write.decrease_key");
-					m_treap.decrease_key(it);
+					m_eventtime_heap.update(it);
 				}
 			}
 
-			auto &raw = it->data()->data();
+			data_update_guard_t update(it);
 			size_t page_number = it->cache_page_number();
 			size_t new_page_number = page_number;
 			size_t new_size = it->size() + io->size;
@@ -125,8 +143,14 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 				m_cache_stats.size_of_objects_marked_for_deletion -= it->size();
 			}
 			m_cache_stats.size_of_objects -= it->size();
-			raw.insert(raw.end(), data, data + io->size);
+			if (it->synctime()) {
+				m_dirty_size.fetch_sub(it->size(), std::memory_order_relaxed);
+			}
+			it->append(*m_slab, m_epoch, data, io->size);
 			m_cache_stats.size_of_objects += it->size();
+			if (it->synctime()) {
+				m_dirty_size.fetch_add(it->size(), std::memory_order_relaxed);
+			}
 			if (it->remove_from_cache()) {
 				m_cache_stats.size_of_objects_marked_for_deletion += it->size();
 			}
@@ -175,16 +199,18 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 		}
 	}
 
-	raw_data_t &raw = *it->data();
+	data_update_guard_t update(it);
 
 	if (io->flags & DNET_IO_FLAGS_COMPARE_AND_SWAP) {
 		TIMER_SCOPE("write.cas");
 
 		// Data is already in memory, so it's free to use it
-		// raw.size() is zero only if there is no such file on the server
-		if (raw.size() != 0) {
+		// data size is zero only if there is no such file on the server
+		raw_data_ptr_t raw = it->data();
+		if (raw->size() != 0) {
 			struct dnet_raw_id csum;
-			dnet_transform_node(m_node, raw.data().data(), raw.size(), csum.id, sizeof(csum.id));
+			std::vector<char> buffer;
+			dnet_transform_node(m_node, raw->contiguous_data(buffer), raw->size(), csum.id, sizeof(csum.id));
 
 			if (memcmp(csum.id, io->parent, DNET_ID_SIZE)) {
 				dnet_log(m_node, DNET_LOG_ERROR, "%s: cas: cache checksum mismatch", dnet_dump_id(&cmd->id));
@@ -198,7 +224,7 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 	size_t new_data_size = 0;
 
 	if (append) {
-		new_data_size = raw.size() + size;
+		new_data_size = it->data_size() + size;
 	} else {
 		new_data_size = io->offset + io->size;
 	}
@@ -219,16 +245,21 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 		m_cache_stats.size_of_objects_marked_for_deletion -= it->size();
 	}
 	m_cache_stats.size_of_objects -= it->size();
+	if (it->synctime()) {
+		m_dirty_size.fetch_sub(it->size(), std::memory_order_relaxed);
+	}
 
 	TIMER_START("write.modify");
 	if (append) {
-		raw.data().insert(raw.data().end(), data, data + size);
+		it->append(*m_slab, m_epoch, data, size);
 	} else {
-		raw.data().resize(new_data_size);
-		memcpy(raw.data().data() + io->offset, data, size);
+		it->write(*m_slab, m_epoch, io->offset, data, size);
 	}
 	TIMER_STOP("write.modify");
 	m_cache_stats.size_of_objects += it->size();
+	if (it->synctime()) {
+		m_dirty_size.fetch_add(it->size(), std::memory_order_relaxed);
+	}
 
 	it->set_remove_from_cache(false);
 	insert_data_into_page(id, new_page_number, &*it);
@@ -238,7 +269,7 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 	size_t previous_eventtime = it->eventtime();
 
 	if (!it->synctime() && !(io->flags & DNET_IO_FLAGS_CACHE_ONLY)) {
-		it->set_synctime(time(NULL) + m_sync_timeout);
+		set_synctime(it, time(NULL) + m_sync_timeout);
 	}
 
 	if (lifetime) {
@@ -247,23 +278,46 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 
 	if (previous_eventtime != it->eventtime()) {
 		TIMER_SCOPE("write.decrease_key");
-		m_treap.decrease_key(it);
+		m_eventtime_heap.update(it);
 	}
 
 	it->set_timestamp(io->timestamp);
 	it->set_user_flags(io->user_flags);
 
 	cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-	return dnet_send_file_info_ts_without_fd(st, cmd, raw.data().data() + io->offset, io->size, &io->timestamp);
+	return dnet_send_file_info_ts_without_fd(st, cmd, data, io->size, &io->timestamp);
+}
+
+void slru_cache_t::throttle() {
+	// dirty sizes are modified under the shard lock, but writers check them without it
+	// and take the lock only when write-back has to be waited for
+	if (!m_dirty_high_watermark || dirty_and_flushing_size() <= m_dirty_high_watermark)
+		return;
+
+	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE THROTTLE: %p", this);
+	throttle_dirty(guard);
 }
 
-std::shared_ptr<raw_data_t> slru_cache_t::read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
+raw_data_ptr_t slru_cache_t::read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
 	TIMER_SCOPE("read");
 
 	const bool cache = (io->flags & DNET_IO_FLAGS_CACHE);
 	const bool cache_only = (io->flags & DNET_IO_FLAGS_CACHE_ONLY);
 	(void) cmd;
 
+	if (m_admission)
+		m_admission->record(id);
+
+	{
+		TIMER_SCOPE("read.lockless");
+		raw_data_ptr_t data;
+
+		if (read_lockless(id, io, data)) {
+			m_hits.fetch_add(1, std::memory_order_relaxed);
+			return data;
+		}
+	}
+
 	TIMER_START("read.lock");
 	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE READ: %p", dnet_dump_id_str(id), this);
 	TIMER_STOP("read.lock");
@@ -271,7 +325,7 @@ std::shared_ptr<raw_data_t> slru_cache_t::read(const unsigned char *id, dnet_cmd
 	bool new_page = false;
 
 	TIMER_START("read.find");
-	data_t* it = m_treap.find(id);
+	data_t* it = m_index.find(id);
 	TIMER_STOP("read.find");
 
 	if (it && it->only_append()) {
@@ -279,10 +333,17 @@ std::shared_ptr<raw_data_t> slru_cache_t::read(const unsigned char *id, dnet_cmd
 		it = NULL;
 	}
 
+	(it ? m_hits : m_misses).fetch_add(1, std::memory_order_relaxed);
+
 	if (!it && cache && !cache_only) {
 		int err = 0;
-		it = populate_from_disk(guard, id, false, &err);
+		raw_data_ptr_t bypass;
+
+		it = populate_from_disk(guard, id, false, &err, &bypass, io);
 		new_page = true;
+
+		if (bypass)
+			return bypass;
 	}
 
 	if (it) {
@@ -305,7 +366,64 @@ std::shared_ptr<raw_data_t> slru_cache_t::read(const unsigned char *id, dnet_cmd
 		return it->data();
 	}
 
-	return std::shared_ptr<raw_data_t>();
+	return raw_data_ptr_t();
+}
+
+void slru_cache_t::bulk_read(dnet_io_attr **ios, raw_data_ptr_t *data, size_t count) {
+	TIMER_SCOPE("bulk_read");
+
+	std::vector<size_t> locked;
+
+	{
+		TIMER_SCOPE("bulk_read.lockless");
+
+		for (size_t i = 0; i < count; ++i) {
+			if (read_lockless(ios[i]->id, ios[i], data[i])) {
+				if (m_admission)
+					m_admission->record(ios[i]->id);
+				m_hits.fetch_add(1, std::memory_order_relaxed);
+			} else {
+				locked.push_back(i);
+			}
+		}
+	}
+
+	if (locked.empty())
+		return;
+
+	TIMER_START("bulk_read.lock");
+	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE BULK READ: %zu objects: %p", locked.size(), this);
+	TIMER_STOP("bulk_read.lock");
+
+	for (auto i = locked.begin(); i != locked.end(); ++i) {
+		dnet_io_attr *io = ios[*i];
+		data_t *it = m_index.find(io->id);
+
+		if (!it) {
+			m_misses.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+
+		// append-only object has to be synced first, it is left to the regular read which accounts it
+		if (it->only_append())
+			continue;
+
+		if (m_admission)
+			m_admission->record(io->id);
+		m_hits.fetch_add(1, std::memory_order_relaxed);
+
+		if (it->remove_from_cache()) {
+			m_cache_stats.size_of_objects_marked_for_deletion -= it->size();
+		}
+		it->set_remove_from_cache(false);
+
+		const size_t page_number = it->cache_page_number();
+		move_data_between_pages(io->id, page_number, get_next_page_number(page_number), it);
+
+		io->timestamp = it->timestamp();
+		io->user_flags = it->user_flags();
+		data[*i] = it->data();
+	}
 }
 
 int slru_cache_t::remove(const unsigned char *id, dnet_io_attr *io) {
@@ -320,7 +438,7 @@ int slru_cache_t::remove(const unsigned char *id, dnet_io_attr *io) {
 	TIMER_STOP("remove.lock");
 
 	TIMER_START("remove.find");
-	data_t* it = m_treap.find(id);
+	data_t* it = m_index.find(id);
 	TIMER_STOP("remove.find");
 
 	if (it) {
@@ -329,11 +447,11 @@ int slru_cache_t::remove(const unsigned char *id, dnet_io_attr *io) {
 		remove_from_disk |= it->remove_from_disk();
 		if (it->synctime() && !cache_only) {
 			size_t previous_eventtime = it->eventtime();
-			it->clear_synctime();
+			clear_synctime(it);
 
 			if (previous_eventtime != it->eventtime()) {
 				TIMER_SCOPE("remove.decrease_key");
-				m_treap.decrease_key(it);
+				m_eventtime_heap.update(it);
 			}
 		}
 		if (it->is_syncing()) {
@@ -371,7 +489,7 @@ int slru_cache_t::lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd *
 	TIMER_STOP("lookup.lock");
 
 	TIMER_START("lookup.find");
-	data_t* it = m_treap.find(id);
+	data_t* it = m_index.find(id);
 	TIMER_STOP("lookup.find");
 
 	dnet_time timestamp;
@@ -417,38 +535,187 @@ int slru_cache_t::lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd *
 void slru_cache_t::clear() {
 	TIMER_SCOPE("clear");
 
-	std::vector<size_t> cache_pages_max_sizes = m_cache_pages_max_sizes;
-
 	TIMER_START("clear.lock");
 	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE CLEAR: %p", this);
 	TIMER_STOP("clear.lock");
 	m_clear_occured = true;
 
+	// reserving the whole page limit empties the page, limits themselves are kept,
+	// since they may be changed by resize() while the lock is released for sync below
 	for (size_t page_number = 0; page_number < m_cache_pages_number; ++page_number) {
-		m_cache_pages_max_sizes[page_number] = 0;
-		resize_page((unsigned char *) "", page_number, 0);
+		resize_page((unsigned char *) "", page_number, m_cache_pages_max_sizes[page_number]);
 	}
 
-	while (!m_treap.empty()) {
-		data_t *obj = m_treap.top();
+	while (!m_eventtime_heap.empty()) {
+		data_t *obj = m_eventtime_heap.top();
 
 		sync_if_required(obj, guard);
 		obj->set_sync_state(data_t::sync_state_t::NOT_SYNCING);
 
 		erase_element(obj);
 	}
+}
+
+void slru_cache_t::resize(const std::vector<size_t> &cache_pages_max_sizes) {
+	TIMER_SCOPE("resize");
 
-	m_cache_pages_max_sizes = cache_pages_max_sizes;
+	TIMER_START("resize.lock");
+	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE RESIZE: %p", this);
+	TIMER_STOP("resize.lock");
+
+	// limits are updated in place, since stats are read without lock
+	std::copy(cache_pages_max_sizes.begin(), cache_pages_max_sizes.end(), m_cache_pages_max_sizes.begin());
+
+	// overflow of hotter pages goes to colder ones, so they are shrunk first
+	for (size_t page_number = 0; page_number < m_cache_pages_number; ++page_number) {
+		lru_list_t &lru = m_cache_pages_lru[page_number];
+
+		if (!lru.empty() && m_cache_pages_sizes[page_number] > m_cache_pages_max_sizes[page_number]) {
+			resize_page(lru.front().id().id, page_number, 0);
+		}
+	}
 }
 
 cache_stats slru_cache_t::get_cache_stats() const {
 	m_cache_stats.pages_sizes = m_cache_pages_sizes;
 	m_cache_stats.pages_max_sizes = m_cache_pages_max_sizes;
+	m_cache_stats.slab = m_slab->stats();
+	m_cache_stats.dirty_size = m_dirty_size.load(std::memory_order_relaxed);
+	m_cache_stats.flushing_size = m_flushing_size.load(std::memory_order_relaxed);
+	m_cache_stats.hits = m_hits.load(std::memory_order_relaxed);
+	m_cache_stats.misses = m_misses.load(std::memory_order_relaxed);
 	return m_cache_stats;
 }
 
+void slru_cache_t::snapshot(std::vector<snapshot_record_t> &records) {
+	TIMER_SCOPE("snapshot");
+
+	TIMER_START("snapshot.lock");
+	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE SNAPSHOT: %p", this);
+	TIMER_STOP("snapshot.lock");
+
+	snapshot_record_t record;
+	memset(&record, 0, sizeof(record));
+
+	for (size_t page_number = 0; page_number < m_cache_pages_number; ++page_number) {
+		const lru_list_t &lru = m_cache_pages_lru[page_number];
+		record.page_number = page_number;
+
+		// the most recently used objects are at the tail
+		for (auto it = lru.rbegin(); it != lru.rend(); ++it) {
+			if (it->remove_from_cache() || it->only_append())
+				continue;
+
+			memcpy(record.id.id, it->id().id, DNET_ID_SIZE);
+			records.push_back(record);
+		}
+	}
+}
+
+size_t slru_cache_t::warm_up(const unsigned char *id, size_t page_number) {
+	TIMER_SCOPE("warm_up");
+
+	dnet_id key;
+	memset(&key, 0, sizeof(key));
+	memcpy(key.id, id, DNET_ID_SIZE);
+
+	// object is read from disk under its key lock like commands and write-back do,
+	// key lock is taken before shard lock, since commands hold it while they wait for shard lock
+	TIMER_START("warm_up.dnet_oplock");
+	dnet_oplock(m_node, &key);
+	TIMER_STOP("warm_up.dnet_oplock");
+
+	size_t size = 0;
+	try {
+		size = warm_up_object(id, page_number);
+	} catch (...) {
+		dnet_opunlock(m_node, &key);
+		throw;
+	}
+
+	dnet_opunlock(m_node, &key);
+	return size;
+}
+
 // private:
 
+size_t slru_cache_t::warm_up_object(const unsigned char *id, size_t page_number) {
+	TIMER_START("warm_up.lock");
+	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE WARM UP: %p", dnet_dump_id_str(id), this);
+	TIMER_STOP("warm_up.lock");
+
+	if (m_index.find(id))
+		return 0;
+
+	// number of pages may have been changed since snapshot was written
+	page_number = std::min(page_number, m_cache_pages_number - 1);
+
+	// objects are loaded from the hottest one, so they must not push each other out of the cache
+	while (page_number < m_cache_pages_number && m_cache_pages_sizes[page_number] >= m_cache_pages_max_sizes[page_number])
+		++page_number;
+
+	if (page_number >= m_cache_pages_number)
+		return 0;
+
+	int err = 0;
+	data_t *it = populate_from_disk(guard, id, false, &err);
+	if (!it)
+		return 0;
+
+	move_data_between_pages(id, it->cache_page_number(), page_number, it);
+	return it->data_size();
+}
+
+/*
+ * Hit path of the read: object is searched in hash index and its data is copied without shard lock.
+ * Instead of moving object to the hotter page on every hit, reader sets access bit and only tries
+ * to promote object which has already been accessed since it was put into its page, and only if
+ * shard lock is free, otherwise access bit gives object second chance on eviction.
+ *
+ * Returns false if object has to be read under lock: it is not found, it is being modified,
+ * it is append-only one which has to be synced first or it is marked for removal.
+ */
+bool slru_cache_t::read_lockless(const unsigned char *id, dnet_io_attr *io, raw_data_ptr_t &data) {
+	epoch_guard_t epoch(m_epoch);
+	if (!epoch.active())
+		return false;
+
+	data_t *it = m_index.find(id);
+	if (!it)
+		return false;
+
+	const unsigned sequence = it->read_begin();
+	if (it->only_append() || it->remove_from_cache())
+		return false;
+
+	data = it->data();
+	const dnet_time timestamp = it->timestamp();
+	const uint64_t user_flags = it->user_flags();
+
+	if (it->read_retry(sequence)) {
+		data.reset();
+		return false;
+	}
+
+	io->timestamp = timestamp;
+	io->user_flags = user_flags;
+
+	const size_t page_number = it->cache_page_number();
+	const size_t new_page_number = get_next_page_number(page_number);
+
+	if (it->mark_accessed() && new_page_number != page_number) {
+		std::unique_lock<std::mutex> guard(m_lock, std::try_to_lock);
+
+		// Object could be removed from its page or moved to another one while lock was not held
+		if (guard.owns_lock() && !it->is_removed_from_page() && it->cache_page_number() == page_number) {
+			TIMER_SCOPE("read.lockless.promote");
+			move_data_between_pages(id, page_number, new_page_number, it);
+		}
+	}
+
+	return true;
+}
+
 
 void slru_cache_t::sync_if_required(data_t* it, elliptics_unique_lock<std::mutex> &guard) {
 	TIMER_SCOPE("sync_if_required");
@@ -458,12 +725,13 @@ void slru_cache_t::sync_if_required(data_t* it, elliptics_unique_lock<std::mutex
 		memset(&id, 0, sizeof(id));
 		memcpy(id.id, it->id().id, DNET_ID_SIZE);
 
-		std::vector<char> data;
+		raw_data_ptr_t data;
 		uint64_t user_flags;
 		dnet_time timestamp;
 
 		bool only_append = it->only_append();
-		data = it->data()->data();
+		// data is copied by writer before modification while reference is held
+		data = it->data();
 		user_flags = it->user_flags();
 		timestamp = it->timestamp();
 
@@ -471,7 +739,7 @@ void slru_cache_t::sync_if_required(data_t* it, elliptics_unique_lock<std::mutex
 
 		// sync_element uses local_session which always uses DNET_FLAGS_NOLOCK
 		if (it->is_syncing()) {
-			sync_element(id, only_append, data, user_flags, timestamp);
+			sync_element(id, only_append, *data, user_flags, timestamp);
 			it->set_sync_state(data_t::sync_state_t::ERASE_PHASE);
 		}
 
@@ -493,6 +761,7 @@ void slru_cache_t::insert_data_into_page(const unsigned char *id, size_t page_nu
 	}
 
 	data->set_cache_page_number(page_number);
+	data->clear_accessed();
 	m_cache_pages_lru[page_number].push_back(*data);
 	m_cache_pages_sizes[page_number] += size;
 }
@@ -520,25 +789,75 @@ data_t* slru_cache_t::create_data(const unsigned char *id, const char *data, siz
 
 	size_t last_page_number = m_cache_pages_number - 1;
 
-	data_t *raw = new data_t(id, 0, data, size, remove_from_disk);
+	data_t *raw = new (*m_slab) data_t(*m_slab, id, 0, data, size, remove_from_disk);
 
 	insert_data_into_page(id, last_page_number, raw);
 
 	m_cache_stats.number_of_objects++;
 	m_cache_stats.size_of_objects += raw->size();
-	m_treap.insert(raw);
+	m_eventtime_heap.insert(raw);
+	// New object is invisible to lock-free readers until its first end_update()
+	m_index.insert(raw);
 	return raw;
 }
 
-data_t* slru_cache_t::populate_from_disk(elliptics_unique_lock<std::mutex> &guard, const unsigned char *id, bool remove_from_disk, int *err) {
+/*
+ * Called with shard lock held, which is dropped during disk read.
+ * Only one read of the key is issued at a time, concurrent callers wait for it and take its result.
+ * Object may be written into cache while lock is not held, such object is newer than the one
+ * read from disk and is returned instead.
+ *
+ * If @bypass is set, object may be rejected by admission filter, then NULL is returned and
+ * data is returned via @bypass, its timestamp and user flags via @io, without being cached.
+ */
+/*
+ * Error code of exception @e thrown while object was loaded from the backend
+ */
+static int exception_error(const std::exception &e) {
+	if (const ioremap::elliptics::error *err = dynamic_cast<const ioremap::elliptics::error *>(&e))
+		return err->error_code();
+	if (dynamic_cast<const std::bad_alloc *>(&e))
+		return -ENOMEM;
+	return -EIO;
+}
+
+data_t* slru_cache_t::populate_from_disk(elliptics_unique_lock<std::mutex> &guard, const unsigned char *id, bool remove_from_disk, int *err,
+		raw_data_ptr_t *bypass, dnet_io_attr *io) {
 	TIMER_SCOPE("populate_from_disk");
 
-	if (guard.owns_lock()) {
-		guard.unlock();
+	if (!guard.owns_lock()) {
+		guard.lock();
 	}
 
-	local_session sess(m_backend, m_node);
-	sess.set_ioflags(DNET_IO_FLAGS_NOCACHE);
+	const std::string key(reinterpret_cast<const char *>(id), DNET_ID_SIZE);
+
+	for (auto found = m_populating.find(key); found != m_populating.end(); found = m_populating.find(key)) {
+		TIMER_SCOPE("populate_from_disk.wait");
+
+		std::shared_ptr<populate_request_t> request = found->second;
+		request->cond.wait(guard, [&request] () { return request->done; });
+
+		data_t *it = m_index.find(id);
+		if (it || request->err) {
+			*err = it ? 0 : request->err;
+			return it;
+		}
+
+		if (request->data && bypass) {
+			*err = 0;
+			*bypass = request->data;
+			io->timestamp = request->timestamp;
+			io->user_flags = request->user_flags;
+			return NULL;
+		}
+
+		// object has been read, but it is already evicted or was not admitted, so read it once again
+	}
+
+	std::shared_ptr<populate_request_t> request = std::make_shared<populate_request_t>();
+	m_populating.insert(std::make_pair(key, request));
+
+	guard.unlock();
 
 	dnet_id raw_id;
 	memset(&raw_id, 0, sizeof(raw_id));
@@ -547,24 +866,90 @@ data_t* slru_cache_t::populate_from_disk(elliptics_unique_lock<std::mutex> &guar
 	uint64_t user_flags = 0;
 	dnet_time timestamp;
 	dnet_empty_time(&timestamp);
+	ioremap::elliptics::data_pointer data;
+
+	try {
+		local_session sess(m_backend, m_node);
+		sess.set_ioflags(DNET_IO_FLAGS_NOCACHE);
 
-	TIMER_START("populate_from_disk.local_read");
-	ioremap::elliptics::data_pointer data = sess.read(raw_id, &user_flags, &timestamp, err);
-	TIMER_STOP("populate_from_disk.local_read");
+		TIMER_START("populate_from_disk.local_read");
+		data = sess.read(raw_id, &user_flags, &timestamp, err);
+		TIMER_STOP("populate_from_disk.local_read");
+	} catch (const std::exception &e) {
+		// waiters must not sleep forever, they get the same error as this reader
+		guard.lock();
+		finish_populate(key, request, exception_error(e));
+		throw;
+	} catch (...) {
+		guard.lock();
+		finish_populate(key, request, -EIO);
+		throw;
+	}
 
 	TIMER_START("populate_from_disk.lock");
 	guard.lock();
 	TIMER_STOP("populate_from_disk.lock");
 
+	data_t *it = NULL;
+
 	if (*err == 0) {
-		auto it = create_data(id, reinterpret_cast<char *>(data.data()), data.size(), remove_from_disk);
-		it->set_user_flags(user_flags);
-		it->set_timestamp(timestamp);
+		it = m_index.find(id);
+
+		if (!it && bypass && !admit(id, data.size() + sizeof(data_t) + sizeof(raw_data_t) + sizeof(data_chunk_t))) {
+			request->data = raw_data_ptr_t(raw_data_t::create(*m_slab, reinterpret_cast<char *>(data.data()),
+						data.size()), false);
+			request->user_flags = user_flags;
+			request->timestamp = timestamp;
+
+			*bypass = request->data;
+			io->timestamp = timestamp;
+			io->user_flags = user_flags;
+		} else if (!it) {
+			try {
+				it = create_data(id, reinterpret_cast<char *>(data.data()), data.size(), remove_from_disk);
+			} catch (const std::exception &e) {
+				finish_populate(key, request, exception_error(e));
+				throw;
+			}
+
+			it->set_user_flags(user_flags);
+			it->set_timestamp(timestamp);
+			it->end_update();
+		}
+	}
+
+	finish_populate(key, request, *err);
+	return it;
+}
 
-		return it;
+/*
+ * Admission filter is consulted only when the coldest page has no room for the new object,
+ * which is then compared with the object that would be evicted first
+ */
+bool slru_cache_t::admit(const unsigned char *id, size_t size) {
+	if (!m_admission)
+		return true;
+
+	const size_t page_number = m_cache_pages_number - 1;
+	const lru_list_t &lru = m_cache_pages_lru[page_number];
+
+	if (lru.empty() || m_cache_pages_sizes[page_number] + size <= m_cache_pages_max_sizes[page_number])
+		return true;
+
+	if (m_admission->admit(id, lru.front().id().id)) {
+		m_cache_stats.admitted++;
+		return true;
 	}
 
-	return NULL;
+	m_cache_stats.rejected++;
+	return false;
+}
+
+void slru_cache_t::finish_populate(const std::string &key, const std::shared_ptr<populate_request_t> &request, int err) {
+	m_populating.erase(key);
+	request->err = err;
+	request->done = true;
+	request->cond.notify_all();
 }
 
 bool slru_cache_t::have_enough_space(const unsigned char *id, size_t page_number, size_t reserve) {
@@ -579,14 +964,32 @@ void slru_cache_t::resize_page(const unsigned char *id, size_t page_number, size
 	size_t &cache_size = m_cache_pages_sizes[page_number];
 	size_t &max_cache_size = m_cache_pages_max_sizes[page_number];
 	size_t previous_page_number = get_previous_page_number(page_number);
+	lru_list_t &lru = m_cache_pages_lru[page_number];
 
-	for (auto it = m_cache_pages_lru[page_number].begin(), end = m_cache_pages_lru[page_number].end(); it != end;) {
+	// Objects accessed by lock-free readers are moved to the tail once and may be checked again
+	size_t second_chances = lru.size();
+	size_t visits = 2 * lru.size();
+
+	for (auto it = lru.begin(); visits && !lru.empty(); --visits) {
 		if (max_cache_size + removed_size >= cache_size + reserve)
 			break;
 
+		if (it == lru.end())
+			it = lru.begin();
+
 		data_t *raw = &*it;
 		++it;
 
+		if (second_chances) {
+			--second_chances;
+
+			if (raw->clear_accessed()) {
+				lru.erase(lru.iterator_to(*raw));
+				lru.push_back(*raw);
+				continue;
+			}
+		}
+
 		// If page is not last move object to previous page
 		if (previous_page_number < m_cache_pages_number) {
 			move_data_between_pages(id, page_number, previous_page_number, raw);
@@ -598,14 +1001,14 @@ void slru_cache_t::resize_page(const unsigned char *id, size_t page_number, size
 					raw->set_remove_from_cache(true);
 
 					size_t previous_eventtime = raw->eventtime();
-					raw->set_synctime(1);
+					set_synctime(raw, 1);
 					if (previous_eventtime != raw->eventtime()) {
 						TIMER_SCOPE("resize_page.decrease_key");
-						m_treap.decrease_key(raw);
+						m_eventtime_heap.update(raw);
 					}
 				}
 				removed_size += raw->size();
-				m_cache_pages_lru[page_number].erase(m_cache_pages_lru[page_number].iterator_to(*raw));
+				lru.erase(lru.iterator_to(*raw));
 				raw->set_removed_from_page(true);
 			} else {
 				erase_element(raw);
@@ -630,11 +1033,11 @@ void slru_cache_t::erase_element(data_t *obj) {
 
 	size_t page_number = obj->cache_page_number();
 	remove_data_from_page(obj->id().id, page_number, obj);
-	m_treap.erase(obj);
+	m_eventtime_heap.erase(obj);
 
 	if (obj->synctime()) {
 		sync_element(obj);
-		obj->clear_synctime();
+		clear_synctime(obj);
 	}
 
 	if (obj->remove_from_cache()) {
@@ -642,16 +1045,19 @@ void slru_cache_t::erase_element(data_t *obj) {
 		m_cache_stats.size_of_objects_marked_for_deletion -= obj->size();
 	}
 
-	delete obj;
+	// Lock-free readers may still reference the object
+	m_index.erase(obj);
+	m_epoch.retire(obj);
 }
 
-void slru_cache_t::sync_element(const dnet_id &raw, bool after_append, const std::vector<char> &data, uint64_t user_flags, const dnet_time &timestamp) {
+void slru_cache_t::sync_element(const dnet_id &raw, bool after_append, raw_data_t &data, uint64_t user_flags, const dnet_time &timestamp) {
 	HANDY_TIMER_SCOPE("slru_cache.sync_element");
 
 	local_session sess(m_backend, m_node);
 	sess.set_ioflags(DNET_IO_FLAGS_NOCACHE | (after_append ? DNET_IO_FLAGS_APPEND : 0));
 
-	int err = sess.write(raw, data.data(), data.size(), user_flags, timestamp);
+	std::vector<char> buffer;
+	int err = sess.write(raw, data.contiguous_data(buffer), data.size(), user_flags, timestamp);
 	if (err) {
 		dnet_log(m_node, DNET_LOG_ERROR, "%s: CACHE: forced to sync to disk, err: %d", dnet_dump_id_str(raw.id), err);
 	} else {
@@ -664,17 +1070,15 @@ void slru_cache_t::sync_element(data_t *obj) {
 	memset(&raw, 0, sizeof(struct dnet_id));
 	memcpy(raw.id, obj->id().id, DNET_ID_SIZE);
 
-	auto &data = obj->data()->data();
-
-	sync_element(raw, obj->only_append(), data, obj->user_flags(), obj->timestamp());
+	sync_element(raw, obj->only_append(), *obj->data(), obj->user_flags(), obj->timestamp());
 }
 
 void slru_cache_t::sync_after_append(elliptics_unique_lock<std::mutex> &guard, bool lock_guard, data_t *obj) {
 	TIMER_SCOPE("sync_after_append");
 
-	std::shared_ptr<raw_data_t> raw_data = obj->data();
+	raw_data_ptr_t raw_data = obj->data();
 
-	obj->clear_synctime();
+	clear_synctime(obj);
 
 	dnet_id id;
 	memset(&id, 0, sizeof(id));
@@ -690,10 +1094,9 @@ void slru_cache_t::sync_after_append(elliptics_unique_lock<std::mutex> &guard, b
 	local_session sess(m_backend, m_node);
 	sess.set_ioflags(DNET_IO_FLAGS_NOCACHE | DNET_IO_FLAGS_APPEND);
 
-	auto &raw = raw_data->data();
-
 	TIMER_START("sync_after_append.local_write");
-	int err = sess.write(id, raw.data(), raw.size(), user_flags, timestamp);
+	std::vector<char> buffer;
+	int err = sess.write(id, raw_data->contiguous_data(buffer), raw_data->size(), user_flags, timestamp);
 	TIMER_STOP("sync_after_append.local_write");
 
 	TIMER_START("sync_after_append.lock");
@@ -704,6 +1107,114 @@ void slru_cache_t::sync_after_append(elliptics_unique_lock<std::mutex> &guard, b
 	dnet_log(m_node, DNET_LOG_INFO, "%s: CACHE: sync after append, err: %d", dnet_dump_id_str(id.id), err);
 }
 
+void slru_cache_t::set_synctime(data_t *obj, size_t synctime) {
+	if (!obj->synctime()) {
+		m_dirty_size.fetch_add(obj->size(), std::memory_order_relaxed);
+	}
+	obj->set_synctime(synctime);
+}
+
+void slru_cache_t::clear_synctime(data_t *obj) {
+	if (obj->synctime()) {
+		m_dirty_size.fetch_sub(obj->size(), std::memory_order_relaxed);
+	}
+	obj->clear_synctime();
+}
+
+/*
+ * Writer waits for write-back when dirty and being synced data exceeds high watermark,
+ * throttling is bounded, since objects which have to expire first may hold back forced write-back
+ */
+void slru_cache_t::throttle_dirty(elliptics_unique_lock<std::mutex> &guard) {
+	if (!m_dirty_high_watermark || dirty_and_flushing_size() <= m_dirty_high_watermark)
+		return;
+
+	TIMER_SCOPE("write.throttle");
+
+	m_cache_stats.throttled_writes++;
+	m_flush_requested = true;
+	m_flush_cond.notify_one();
+
+	m_dirty_cond.wait_for(guard, std::chrono::seconds(1), [this] () {
+		return dirty_and_flushing_size() <= m_dirty_low_watermark || need_exit();
+	});
+}
+
+/*
+ * Elements are sorted by key and split into batches, which are written back by flusher threads
+ * of the backend and by the calling thread itself, returns when all of them are processed
+ */
+void slru_cache_t::sync_elements(std::vector<sync_element_t> &elements) {
+	TIMER_SCOPE("life_check.sync_iterate");
+	HANDY_GAUGE_SET("slru_cache.life_check.sync_iterate.element_count", elements.size());
+
+	if (elements.empty())
+		return;
+
+	std::sort(elements.begin(), elements.end(), [] (const sync_element_t &a, const sync_element_t &b) {
+		return dnet_id_cmp_str(a.obj->id().id, b.obj->id().id) < 0;
+	});
+
+	struct state_t {
+		std::mutex lock;
+		std::condition_variable cond;
+		std::atomic<size_t> next;
+		size_t running;
+	};
+
+	auto state = std::make_shared<state_t>();
+	const size_t batches = (elements.size() + sync_batch_size - 1) / sync_batch_size;
+	const size_t helpers = std::min(m_flushers->size(), batches - 1);
+
+	state->next = 0;
+	state->running = helpers + 1;
+
+	auto worker = [this, state, batches, &elements] () {
+		for (size_t batch = state->next++; batch < batches; batch = state->next++) {
+			const size_t offset = batch * sync_batch_size;
+			sync_batch(&elements[offset], std::min(sync_batch_size, elements.size() - offset));
+		}
+
+		std::lock_guard<std::mutex> guard(state->lock);
+		if (--state->running == 0)
+			state->cond.notify_all();
+	};
+
+	for (size_t i = 0; i < helpers; ++i)
+		m_flushers->submit(worker);
+
+	worker();
+
+	std::unique_lock<std::mutex> guard(state->lock);
+	state->cond.wait(guard, [&state] () { return state->running == 0; });
+}
+
+void slru_cache_t::sync_batch(sync_element_t *elements, size_t count) {
+	dnet_id id;
+	memset(&id, 0, sizeof(id));
+
+	for (size_t i = 0; i < count; ++i) {
+		if (m_clear_occured)
+			break;
+
+		data_t *elem = elements[i].obj;
+		memcpy(id.id, elem->id().id, DNET_ID_SIZE);
+
+		TIMER_START("life_check.sync_iterate.dnet_oplock");
+		dnet_oplock(m_node, &id);
+		TIMER_STOP("life_check.sync_iterate.dnet_oplock");
+
+		// sync_element uses local_session which always uses DNET_FLAGS_NOLOCK
+		if (elem->is_syncing()) {
+			sync_element(id, elem->only_append(), *elem->data(), elem->user_flags(), elem->timestamp());
+			elem->set_sync_state(data_t::sync_state_t::ERASE_PHASE);
+			elements[i].synced_time = time(NULL);
+		}
+
+		dnet_opunlock(m_node, &id);
+	}
+}
+
 void slru_cache_t::life_check(void) {
 
 	dnet_set_name("dnet_cache_%zu", m_backend->backend_id);
@@ -713,7 +1224,7 @@ void slru_cache_t::life_check(void) {
 			TIMER_SCOPE("life_check");
 
 			std::deque<struct dnet_id> remove;
-			std::deque<data_t*> elements_for_sync;
+			std::vector<sync_element_t> elements_for_sync;
 			size_t last_time = 0;
 			dnet_id id;
 			memset(&id, 0, sizeof(id));
@@ -724,15 +1235,25 @@ void slru_cache_t::life_check(void) {
 				TIMER_STOP("life_check.lock");
 
 				TIMER_SCOPE("life_check.prepare_sync");
-				while (!need_exit() && !m_treap.empty()) {
+
+				// Writers are throttled, so dirty objects are synced before their sync time
+				// until dirty data drops below low watermark
+				bool force = m_dirty_high_watermark && dirty_and_flushing_size() > m_dirty_high_watermark;
+
+				while (!need_exit() && !m_eventtime_heap.empty()) {
 					size_t time = ::time(NULL);
 					last_time = time;
 
-					if (m_treap.empty())
+					if (m_eventtime_heap.empty())
 						break;
 
-					data_t* it = m_treap.top();
-					if (it->eventtime() > time)
+					data_t* it = m_eventtime_heap.top();
+
+					if (force && m_dirty_size.load(std::memory_order_relaxed) <= m_dirty_low_watermark)
+						force = false;
+
+					if (it->eventtime() > time && !(force && it->eventtime() == it->synctime() &&
+								it->eventtime() != it->lifetime()))
 						break;
 
 					if (it->eventtime() == it->lifetime())
@@ -747,43 +1268,28 @@ void slru_cache_t::life_check(void) {
 					}
 					else if (it->eventtime() == it->synctime())
 					{
-						elements_for_sync.push_back(it);
+						sync_element_t elem;
+						elem.obj = it;
+						elem.size = it->size();
+						elem.synctime = it->synctime();
+						elem.synced_time = 0;
+						elements_for_sync.push_back(elem);
 
 						size_t previous_eventtime = it->eventtime();
-						it->clear_synctime();
+						// account flushing data first, so that unlocked throttle() does not miss it
+						m_flushing_size.fetch_add(elem.size, std::memory_order_relaxed);
+						clear_synctime(it);
 						it->set_sync_state(data_t::sync_state_t::SYNC_PHASE);
 
 						if (previous_eventtime != it->eventtime()) {
 							TIMER_SCOPE("life_check.decrease_key");
-							m_treap.decrease_key(it);
+							m_eventtime_heap.update(it);
 						}
 					}
 				}
 			}
 
-			{
-				TIMER_SCOPE("life_check.sync_iterate");
-				HANDY_GAUGE_SET("slru_cache.life_check.sync_iterate.element_count", elements_for_sync.size());
-				for (auto it = elements_for_sync.begin(); it != elements_for_sync.end(); ++it) {
-					if (m_clear_occured)
-						break;
-
-					data_t *elem = *it;
-					memcpy(id.id, elem->id().id, DNET_ID_SIZE);
-
-					TIMER_START("life_check.sync_iterate.dnet_oplock");
-					dnet_oplock(m_node, &id);
-					TIMER_STOP("life_check.sync_iterate.dnet_oplock");
-
-					// sync_element uses local_session which always uses DNET_FLAGS_NOLOCK
-					if (elem->is_syncing()) {
-						sync_element(id, elem->only_append(), elem->data()->data(), elem->user_flags(), elem->timestamp());
-						elem->set_sync_state(data_t::sync_state_t::ERASE_PHASE);
-					}
-
-					dnet_opunlock(m_node, &id);
-				}
-			}
+			sync_elements(elements_for_sync);
 
 			{
 				TIMER_SCOPE("life_check.remove_local");
@@ -797,10 +1303,25 @@ void slru_cache_t::life_check(void) {
 				elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE CLEAR PAGES: %p", this);
 				TIMER_STOP("life_check.lock");
 
+				size_t sync_lag = 0;
+				for (auto it = elements_for_sync.begin(); it != elements_for_sync.end(); ++it) {
+					m_flushing_size.fetch_sub(it->size, std::memory_order_relaxed);
+
+					if (it->synced_time) {
+						m_cache_stats.synced_objects++;
+						m_cache_stats.synced_size += it->size;
+						if (it->synced_time > it->synctime)
+							sync_lag = std::max(sync_lag, it->synced_time - it->synctime);
+					}
+				}
+				m_cache_stats.sync_lag = sync_lag;
+				m_cache_stats.max_sync_lag = std::max(m_cache_stats.max_sync_lag, sync_lag);
+				m_dirty_cond.notify_all();
+
 				if (!m_clear_occured) {
 					TIMER_SCOPE("life_check.erase_iterate");
-					for (std::deque<data_t*>::iterator it = elements_for_sync.begin(); it != elements_for_sync.end(); ++it) {
-						data_t *elem = *it;
+					for (auto it = elements_for_sync.begin(); it != elements_for_sync.end(); ++it) {
+						data_t *elem = it->obj;
 						elem->set_sync_state(data_t::sync_state_t::NOT_SYNCING);
 						if (elem->synctime() <= last_time) {
 							if (elem->only_append() || elem->remove_from_cache()) {
@@ -811,10 +1332,16 @@ void slru_cache_t::life_check(void) {
 				} else {
 					m_clear_occured = false;
 				}
+
+				m_epoch.reclaim();
 			}
 		}
 
-		std::this_thread::sleep_for( std::chrono::milliseconds(1000) );
+		std::unique_lock<std::mutex> guard(m_lock);
+		m_flush_cond.wait_for(guard, std::chrono::seconds(1), [this] () {
+			return m_flush_requested || need_exit();
+		});
+		m_flush_requested = false;
 	}
 
 }
@@ -19,17 +19,35 @@
 
 #include "cache.hpp"
 
+#include <condition_variable>
+#include <string>
+
 namespace ioremap { namespace cache {
 
 class slru_cache_t {
 public:
-	slru_cache_t(struct dnet_backend_io *backend, struct dnet_node *n, const std::vector<size_t> &cache_pages_max_sizes, unsigned sync_timeout);
+	slru_cache_t(struct dnet_backend_io *backend, struct dnet_node *n, const std::vector<size_t> &cache_pages_max_sizes, unsigned sync_timeout,
+			size_t admission_objects, flusher_pool_t *flushers,
+			size_t dirty_high_watermark, size_t dirty_low_watermark);
 
 	~slru_cache_t();
 
 	int write(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd, dnet_io_attr *io, const char *data);
 
-	std::shared_ptr<raw_data_t> read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io);
+	/*!
+	 * Blocks writer while dirty data exceeds high watermark, it is called before writer takes the key lock,
+	 * since write-back of the dirty objects takes their key locks
+	 */
+	void throttle();
+
+	raw_data_ptr_t read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io);
+
+	/*!
+	 * Looks up @count objects at once, shard lock is taken at most once for all of them.
+	 * Data of found objects is put into @data, missed ones are left empty and are not accounted,
+	 * since they are expected to be read again by the regular read.
+	 */
+	void bulk_read(dnet_io_attr **ios, raw_data_ptr_t *data, size_t count);
 
 	int remove(const unsigned char *id, dnet_io_attr *io);
 
@@ -37,8 +55,25 @@ public:
 
 	void clear();
 
+	/*!
+	 * Sets new limits of the pages, objects which do not fit anymore are moved to colder pages
+	 * and evicted from the last one
+	 */
+	void resize(const std::vector<size_t> &cache_pages_max_sizes);
+
 	cache_stats get_cache_stats() const;
 
+	/*!
+	 * Appends ids of the cached objects to @records, from the hottest page to the coldest one
+	 */
+	void snapshot(std::vector<snapshot_record_t> &records);
+
+	/*!
+	 * Loads object from the backend into @page_number page or colder one which has free space,
+	 * returns size of the loaded data, zero if object is already cached or there is no room for it
+	 */
+	size_t warm_up(const unsigned char *id, size_t page_number);
+
 private:
 	struct dnet_backend_io *m_backend;
 	struct dnet_node *m_node;
@@ -48,8 +83,60 @@ private:
 	std::vector<size_t> m_cache_pages_sizes;
 	std::unique_ptr<lru_list_t[]> m_cache_pages_lru;
 	std::thread m_lifecheck;
-	treap_t m_treap;
+	slab_allocator_t *m_slab;
+	eventtime_heap_t m_eventtime_heap;
+	epoch_domain_t m_epoch;
+	hash_index<data_t> m_index;
 	mutable cache_stats m_cache_stats;
+	// lock-free readers update these counters without shard lock
+	std::atomic<size_t> m_hits;
+	std::atomic<size_t> m_misses;
+	std::unique_ptr<tinylfu_t> m_admission;
+
+	/*!
+	 * Disk read of the object which is missing in cache, done without shard lock,
+	 * concurrent misses of the same key wait for the first one instead of reading it again
+	 */
+	struct populate_request_t {
+		populate_request_t() : done(false), err(0), user_flags(0) {
+			dnet_empty_time(&timestamp);
+		}
+
+		std::condition_variable_any cond;
+		bool done;
+		int err;
+		// data which was read but not admitted into cache
+		raw_data_ptr_t data;
+		uint64_t user_flags;
+		dnet_time timestamp;
+	};
+
+	std::unordered_map<std::string, std::shared_ptr<populate_request_t>> m_populating;
+
+	/*!
+	 * Dirty object which is being written back to the backend by flushers
+	 */
+	struct sync_element_t {
+		data_t *obj;
+		size_t size;
+		size_t synctime;
+		size_t synced_time;
+	};
+
+	// number of objects written back by one flusher task
+	static const size_t sync_batch_size = 64;
+
+	flusher_pool_t *m_flushers;
+	size_t m_dirty_high_watermark;
+	size_t m_dirty_low_watermark;
+	// modified under shard lock, read without it by throttle()
+	std::atomic<size_t> m_dirty_size;
+	std::atomic<size_t> m_flushing_size;
+	bool m_flush_requested;
+	// life_check waits here for the next pass, throttled writers ask for it to start early
+	std::condition_variable_any m_flush_cond;
+	// throttled writers wait here for the write-back
+	std::condition_variable_any m_dirty_cond;
 	bool m_clear_occured;
 	unsigned m_sync_timeout;
 
@@ -71,6 +158,11 @@ private:
 		return page_number + 1;
 	}
 
+	// warm_up() of the object whose key lock is taken
+	size_t warm_up_object(const unsigned char *id, size_t page_number);
+
+	bool read_lockless(const unsigned char *id, dnet_io_attr *io, raw_data_ptr_t &data);
+
 	void sync_if_required(data_t* it, elliptics_unique_lock<std::mutex> &guard);
 
 	void insert_data_into_page(const unsigned char *id, size_t page_number, data_t *data);
@@ -84,7 +176,26 @@ private:
 
 	data_t* create_data(const unsigned char *id, const char *data, size_t size, bool remove_from_disk);
 
-	data_t* populate_from_disk(elliptics_unique_lock<std::mutex> &guard, const unsigned char *id, bool remove_from_disk, int *err);
+	data_t* populate_from_disk(elliptics_unique_lock<std::mutex> &guard, const unsigned char *id, bool remove_from_disk, int *err,
+			raw_data_ptr_t *bypass = NULL, dnet_io_attr *io = NULL);
+
+	bool admit(const unsigned char *id, size_t size);
+
+	void set_synctime(data_t *obj, size_t synctime);
+
+	void clear_synctime(data_t *obj);
+
+	void throttle_dirty(elliptics_unique_lock<std::mutex> &guard);
+
+	size_t dirty_and_flushing_size() const {
+		return m_dirty_size.load(std::memory_order_relaxed) + m_flushing_size.load(std::memory_order_relaxed);
+	}
+
+	void sync_elements(std::vector<sync_element_t> &elements);
+
+	void sync_batch(sync_element_t *elements, size_t count);
+
+	void finish_populate(const std::string &key, const std::shared_ptr<populate_request_t> &request, int err);
 
 	bool have_enough_space(const unsigned char *id, size_t page_number, size_t reserve);
 
@@ -92,7 +203,7 @@ private:
 
 	void erase_element(data_t *obj);
 
-	void sync_element(const dnet_id &raw, bool after_append, const std::vector<char> &data, uint64_t user_flags, const dnet_time &timestamp);
+	void sync_element(const dnet_id &raw, bool after_append, raw_data_t &data, uint64_t user_flags, const dnet_time &timestamp);
 
 	void sync_element(data_t *obj);
 
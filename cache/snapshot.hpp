@@ -0,0 +1,155 @@
+/*
+* 2015+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+* All rights reserved.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*/
+
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "elliptics/packet.h"
+
+namespace ioremap { namespace cache {
+
+/*!
+ * Cached object which is loaded into cache when backend starts
+ */
+struct snapshot_record_t {
+	struct dnet_raw_id id;
+	uint32_t page_number;
+} __attribute__ ((packed));
+
+/*!
+ * File with ids of the cached objects and numbers of SLRU pages they were in,
+ * records go from the hottest object to the coldest one.
+ * File is replaced atomically: new file is synced before it is renamed over the old one
+ * and directory is synced after that, so it is either old or new one after crash.
+ */
+class snapshot_file_t {
+public:
+	static int write(const std::string &path, const std::vector<snapshot_record_t> &records) {
+		char tmp_path[1024];
+		snprintf(tmp_path, sizeof(tmp_path), "%s_%08x%08x", path.c_str(), rand(), rand());
+
+		header_t header;
+		header.magic = snapshot_magic;
+		header.version = snapshot_version;
+		header.reserved = 0;
+		header.records_number = records.size();
+
+		int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return -errno;
+
+		int err = write_all(fd, &header, sizeof(header));
+		if (!err)
+			err = write_all(fd, records.data(), records.size() * sizeof(snapshot_record_t));
+		if (!err && fsync(fd))
+			err = -errno;
+		if (close(fd) && !err)
+			err = -errno;
+
+		if (!err && std::rename(tmp_path, path.c_str()))
+			err = -errno;
+
+		if (err) {
+			unlink(tmp_path);
+			return err;
+		}
+
+		return sync_directory(path);
+	}
+
+	static int read(const std::string &path, std::vector<snapshot_record_t> &records) {
+		std::ifstream in(path.c_str(), std::ifstream::binary);
+		if (!in)
+			return -errno;
+
+		in.seekg(0, std::ifstream::end);
+		const uint64_t size = in.tellg();
+		in.seekg(0, std::ifstream::beg);
+
+		header_t header;
+		if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+				header.magic != snapshot_magic || header.version != snapshot_version ||
+				header.records_number != (size - sizeof(header)) / sizeof(snapshot_record_t))
+			return -EINVAL;
+
+		records.resize(header.records_number);
+		if (!in.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(snapshot_record_t))) {
+			records.clear();
+			return -EINVAL;
+		}
+
+		return 0;
+	}
+
+private:
+	static const uint64_t snapshot_magic = 0x70616e73656863ULL; // "chesnap"
+	static const uint32_t snapshot_version = 2;
+
+	struct header_t {
+		uint64_t magic;
+		uint32_t version;
+		uint32_t reserved;
+		uint64_t records_number;
+	} __attribute__ ((packed));
+
+	static int write_all(int fd, const void *data, size_t size) {
+		const char *ptr = static_cast<const char *>(data);
+
+		while (size) {
+			const ssize_t written = ::write(fd, ptr, size);
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+				return -errno;
+			}
+
+			ptr += written;
+			size -= written;
+		}
+
+		return 0;
+	}
+
+	// makes rename of the file durable
+	static int sync_directory(const std::string &path) {
+		const size_t pos = path.rfind('/');
+		const std::string dir = (pos == std::string::npos) ? "." : (pos == 0 ? "/" : path.substr(0, pos));
+
+		int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0)
+			return -errno;
+
+		int err = 0;
+		if (fsync(fd))
+			err = -errno;
+
+		close(fd);
+		return err;
+	}
+};
+
+}}
+
+#endif // SNAPSHOT_HPP
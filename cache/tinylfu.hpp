@@ -0,0 +1,191 @@
+/*
+* 2015+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+* All rights reserved.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*/
+
+#ifndef TINYLFU_HPP
+#define TINYLFU_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#if __GNUC__ == 4 && __GNUC_MINOR__ < 5
+#  include <cstdatomic>
+#else
+#  include <atomic>
+#endif
+
+namespace ioremap { namespace cache {
+
+/*!
+ * TinyLFU admission filter: approximate access frequency of recently seen keys.
+ *
+ * The first access of the key in the sample only sets its bits in the doorkeeper bloom filter,
+ * further accesses are counted in count-min sketch of 4-bit counters. When number of accesses
+ * reaches sample size, all counters are halved and doorkeeper is cleared, so old popularity fades.
+ * New object is admitted into full cache only if it is accessed more frequently than the object
+ * it would evict.
+ *
+ * Counters are updated with relaxed atomics without lock by lock-free readers, so concurrent
+ * updates of the same word may be lost, which only makes estimation slightly less precise.
+ */
+class tinylfu_t {
+public:
+	typedef const unsigned char * key_type;
+
+	/*!
+	 * @objects is the expected number of objects in the cache
+	 */
+	tinylfu_t(size_t objects) : m_samples(0) {
+		const size_t width = round_pow2(objects < min_width ? min_width : objects);
+
+		m_row_mask = width - 1;
+		m_row_words = width / counters_per_word;
+		m_counters.reset(new std::atomic<uint64_t>[depth * m_row_words]);
+
+		m_doorkeeper_mask = round_pow2(width * doorkeeper_bits_per_object) - 1;
+		m_doorkeeper.reset(new std::atomic<uint64_t>[(m_doorkeeper_mask + 1) / 64]);
+
+		m_sample_size = width * sample_factor;
+		clear();
+	}
+
+	tinylfu_t(const tinylfu_t &) = delete;
+	tinylfu_t &operator =(const tinylfu_t &) = delete;
+
+	void record(const key_type &key) {
+		uint64_t h1, h2;
+		hash(key, h1, h2);
+
+		if (doorkeeper_test_and_set(h1, h2)) {
+			for (size_t i = 0; i < depth; ++i)
+				increment(i, h1 + i * h2);
+		}
+
+		// exactly one thread sees the threshold and ages the sketch
+		if (m_samples.fetch_add(1, std::memory_order_relaxed) + 1 == m_sample_size)
+			reset();
+	}
+
+	size_t estimate(const key_type &key) const {
+		uint64_t h1, h2;
+		hash(key, h1, h2);
+
+		size_t frequency = max_counter;
+		for (size_t i = 0; i < depth; ++i) {
+			const size_t counter = get(i, h1 + i * h2);
+			if (counter < frequency)
+				frequency = counter;
+		}
+
+		return frequency + (doorkeeper_test(h1, h2) ? 1 : 0);
+	}
+
+	bool admit(const key_type &candidate, const key_type &victim) const {
+		return estimate(candidate) > estimate(victim);
+	}
+
+private:
+	static const size_t depth = 4;
+	static const size_t counter_bits = 4;
+	static const size_t counters_per_word = 64 / counter_bits;
+	static const uint64_t max_counter = (1 << counter_bits) - 1;
+	static const size_t min_width = 1024;
+	static const size_t sample_factor = 10;
+	static const size_t doorkeeper_bits_per_object = 8;
+
+	static size_t round_pow2(size_t size) {
+		size_t result = 1;
+		while (result < size)
+			result <<= 1;
+		return result;
+	}
+
+	// Ids are already uniformly distributed, bytes used for shard and hash index selection are skipped
+	static void hash(const key_type &key, uint64_t &h1, uint64_t &h2) {
+		memcpy(&h1, key + 3 * sizeof(uint64_t), sizeof(uint64_t));
+		memcpy(&h2, key + 4 * sizeof(uint64_t), sizeof(uint64_t));
+		h2 |= 1;
+	}
+
+	std::atomic<uint64_t> &word(size_t row, uint64_t h, size_t &shift) const {
+		const size_t index = h & m_row_mask;
+		shift = (index % counters_per_word) * counter_bits;
+		return m_counters[row * m_row_words + index / counters_per_word];
+	}
+
+	size_t get(size_t row, uint64_t h) const {
+		size_t shift;
+		return (word(row, h, shift).load(std::memory_order_relaxed) >> shift) & max_counter;
+	}
+
+	void increment(size_t row, uint64_t h) {
+		size_t shift;
+		std::atomic<uint64_t> &w = word(row, h, shift);
+		const uint64_t value = w.load(std::memory_order_relaxed);
+
+		if (((value >> shift) & max_counter) != max_counter)
+			w.store(value + (uint64_t(1) << shift), std::memory_order_relaxed);
+	}
+
+	bool doorkeeper_test(uint64_t h1, uint64_t h2) const {
+		const uint64_t b1 = h1 & m_doorkeeper_mask, b2 = (h1 + h2) & m_doorkeeper_mask;
+
+		return (m_doorkeeper[b1 / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (b1 % 64))) &&
+			(m_doorkeeper[b2 / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (b2 % 64)));
+	}
+
+	bool doorkeeper_test_and_set(uint64_t h1, uint64_t h2) {
+		const uint64_t b1 = h1 & m_doorkeeper_mask, b2 = (h1 + h2) & m_doorkeeper_mask;
+		const uint64_t m1 = uint64_t(1) << (b1 % 64), m2 = uint64_t(1) << (b2 % 64);
+
+		const bool seen1 = m_doorkeeper[b1 / 64].fetch_or(m1, std::memory_order_relaxed) & m1;
+		const bool seen2 = m_doorkeeper[b2 / 64].fetch_or(m2, std::memory_order_relaxed) & m2;
+		return seen1 && seen2;
+	}
+
+	void reset() {
+		// halves every 4-bit counter of the word at once
+		const uint64_t mask = 0x7777777777777777ULL;
+
+		for (size_t i = 0; i < depth * m_row_words; ++i) {
+			const uint64_t value = m_counters[i].load(std::memory_order_relaxed);
+			m_counters[i].store((value >> 1) & mask, std::memory_order_relaxed);
+		}
+
+		for (size_t i = 0; i < (m_doorkeeper_mask + 1) / 64; ++i)
+			m_doorkeeper[i].store(0, std::memory_order_relaxed);
+
+		m_samples.fetch_sub(m_sample_size / 2, std::memory_order_relaxed);
+	}
+
+	void clear() {
+		for (size_t i = 0; i < depth * m_row_words; ++i)
+			m_counters[i].store(0, std::memory_order_relaxed);
+
+		for (size_t i = 0; i < (m_doorkeeper_mask + 1) / 64; ++i)
+			m_doorkeeper[i].store(0, std::memory_order_relaxed);
+	}
+
+	size_t m_row_mask;
+	size_t m_row_words;
+	std::unique_ptr<std::atomic<uint64_t>[]> m_counters;
+	uint64_t m_doorkeeper_mask;
+	std::unique_ptr<std::atomic<uint64_t>[]> m_doorkeeper;
+	size_t m_sample_size;
+	std::atomic<size_t> m_samples;
+};
+
+}}
+
+#endif // TINYLFU_HPP
@@ -0,0 +1,24 @@
+# Check whether io_uring kernel interface headers are available
+# Sets variables:
+#  HAVE_IO_URING_SUPPORT - whether io_uring with socket operations can be used
+
+include(CheckCSourceCompiles)
+
+check_c_source_compiles("#include <sys/types.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+int main()
+{
+    struct io_uring_params p;
+    int op = IORING_OP_RECV + IORING_OP_RECVMSG + IORING_OP_SENDMSG;
+    syscall(__NR_io_uring_setup, 1, &p);
+    syscall(__NR_io_uring_enter, 0, 0, 0, IORING_ENTER_GETEVENTS, 0, 0);
+    syscall(__NR_io_uring_register, 0, IORING_REGISTER_PROBE, 0, 0);
+    return op;
+}" HAVE_IO_URING_SUPPORT)
+
+if(HAVE_IO_URING_SUPPORT)
+    add_definitions(-DHAVE_IO_URING_SUPPORT=1)
+endif()
+message(STATUS "io_uring support: ${HAVE_IO_URING_SUPPORT}")
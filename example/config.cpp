@@ -90,6 +90,8 @@ extern "C" void dnet_config_data_destroy(dnet_config_data *public_data)
 	config_data *data = static_cast<config_data *>(public_data);
 
 	free(data->cfg_addrs);
+	free((char *)data->cfg_state.net_thread_cpus);
+	free((char *)data->cfg_state.io_thread_cpus);
 
 	delete data;
 }
@@ -262,6 +264,7 @@ void parse_options(config_data *data, const config &options)
 	data->cfg_state.stall_count = options.at("stall_count", 0l);
 	data->cfg_state.flags |= (options.at("join", false) ? DNET_CFG_JOIN_NETWORK : 0);
 	data->cfg_state.flags |= (options.at("flags", 0) & ~DNET_CFG_JOIN_NETWORK);
+	data->cfg_state.flags |= (options.at("reuseport", false) ? DNET_CFG_REUSEPORT : 0);
 	data->cfg_state.io_thread_num = options.at<unsigned>("io_thread_num");
 	data->cfg_state.nonblocking_io_thread_num = options.at<unsigned>("nonblocking_io_thread_num");
 	data->cfg_state.net_thread_num = options.at<unsigned>("net_thread_num");
@@ -271,6 +274,9 @@ void parse_options(config_data *data, const config &options)
 	data->cfg_state.server_prio = options.at("server_net_prio", 0);
 	data->cfg_state.client_prio = options.at("client_net_prio", 0);
 	data->cfg_state.indexes_shard_count = options.at("indexes_shard_count", 0);
+	data->cfg_state.send_batch_size = options.at("send_batch_size", 0);
+	data->cfg_state.work_steal_threshold = options.at("work_steal_threshold", 0);
+	data->cfg_state.io_queue_limit = options.at("io_queue_limit", 0);
 	data->daemon_mode = options.at("daemon", false);
 	data->parallel_start = options.at("parallel", true);
 	snprintf(data->cfg_state.cookie, DNET_AUTH_COOKIE_SIZE, "%s", options.at<std::string>("auth_cookie").c_str());
@@ -293,6 +299,28 @@ void parse_options(config_data *data, const config &options)
 		data->cfg_state.monitor_port = monitor.at("port", 0);
 	}
 
+	if (options.has("net_engine")) {
+		const config engine = options.at("net_engine");
+		const std::string name = engine.as<std::string>();
+
+		if (name == "io_uring")
+			data->cfg_state.flags |= DNET_CFG_IO_URING;
+		else if (name != "epoll")
+			throw config_error() << engine.path() << " must be either \"epoll\" or \"io_uring\"";
+	}
+
+	if (options.has("net_thread_cpus")) {
+		data->cfg_state.net_thread_cpus = strdup(options.at<std::string>("net_thread_cpus").c_str());
+		if (!data->cfg_state.net_thread_cpus)
+			throw std::bad_alloc();
+	}
+
+	if (options.has("io_thread_cpus")) {
+		data->cfg_state.io_thread_cpus = strdup(options.at<std::string>("io_thread_cpus").c_str());
+		if (!data->cfg_state.io_thread_cpus)
+			throw std::bad_alloc();
+	}
+
 	if (options.has("handystats_config")) {
 		data->cfg_state.handystats_config = strdup(options.at<std::string>("handystats_config").c_str());
 		if (!data->cfg_state.handystats_config)
@@ -3,17 +3,108 @@
 
 #include <boost/program_options.hpp>
 
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 
+#include "bindings/cpp/session_indexes.hpp"
+#include "indexes/intersection.hpp"
+
 using namespace ioremap;
 
+static elliptics::dnet_index_entry random_index_entry(const elliptics::data_pointer &data)
+{
+	elliptics::dnet_index_entry entry;
+	for (size_t i = 0; i < sizeof(entry.index.id); ++i)
+		entry.index.id[i] = rand();
+	entry.data = data;
+	return entry;
+}
+
+static void print_speed(const char *name, int iterations, size_t found, int64_t elapsed)
+{
+	printf("%s: found: %zu, iterations: %d, time: %lld ms, speed: %.3f iterations/sec\n",
+			name, found, iterations, (long long)elapsed,
+			elapsed ? (double)(iterations * 1000) / (double)elapsed : 0.);
+}
+
+/*
+ * Offline benchmark of INDEXES_FIND intersection and union: shard with @small_num entries
+ * is intersected with shard of @large_num entries which contains all of them.
+ */
+static void intersection_benchmark(int small_num, int large_num, int data_size, int iterations)
+{
+	elliptics::data_pointer index_data = elliptics::data_pointer::allocate(data_size);
+
+	elliptics::dnet_indexes small, large;
+	small.shard_id = large.shard_id = 0;
+	small.shard_count = large.shard_count = 1;
+
+	for (int i = 0; i < large_num; ++i) {
+		large.indexes.push_back(random_index_entry(index_data));
+		if (i < small_num)
+			small.indexes.push_back(large.indexes.back());
+	}
+
+	std::sort(small.indexes.begin(), small.indexes.end(), elliptics::dnet_raw_id_less_than<elliptics::skip_data>());
+	std::sort(large.indexes.begin(), large.indexes.end(), elliptics::dnet_raw_id_less_than<elliptics::skip_data>());
+
+	elliptics::data_pointer small_table = elliptics::indexes_pack(small);
+	elliptics::data_pointer large_table = elliptics::indexes_pack(large);
+
+	elliptics::index_table_view small_view, large_view;
+	small_view.map(small_table);
+	large_view.map(large_table);
+
+	std::vector<const elliptics::index_table_view *> shards;
+	shards.push_back(&large_view);
+	shards.push_back(&small_view);
+
+	size_t found = 0;
+	elliptics::timer tm;
+	for (int i = 0; i < iterations; ++i) {
+		elliptics::indexes_intersect(shards, [&found] (const dnet_raw_id &, const std::vector<size_t> &) {
+			++found;
+		});
+	}
+	print_speed("galloping intersection", iterations, found, tm.restart());
+
+	found = 0;
+	for (int i = 0; i < iterations; ++i) {
+		// shards are added in request order as INDEXES_FIND reads them
+		elliptics::indexes_intersection<elliptics::index_table_view> matches;
+		matches.add(large_view);
+		matches.add(small_view);
+		found += matches.size();
+	}
+	print_speed("incremental intersection", iterations, found, tm.restart());
+
+	found = 0;
+	for (int i = 0; i < iterations; ++i) {
+		std::vector<elliptics::dnet_index_entry> result;
+		std::set_intersection(large.indexes.begin(), large.indexes.end(),
+				small.indexes.begin(), small.indexes.end(),
+				std::back_inserter(result), elliptics::dnet_raw_id_less_than<elliptics::skip_data>());
+		found += result.size();
+	}
+	print_speed("linear intersection", iterations, found, tm.restart());
+
+	found = 0;
+	for (int i = 0; i < iterations; ++i) {
+		elliptics::indexes_unite(shards, [&found] (const dnet_raw_id &, const std::vector<size_t> &) {
+			++found;
+		});
+	}
+	print_speed("union", iterations, found, tm.restart());
+}
+
 int main(int argc, char *argv[])
 {
 	namespace bpo = boost::program_options;
 
 	bpo::options_description generic("Index performance tool options");
 
-	int data_size, num;
+	int data_size, num, small_num, iterations;
 	std::string log_level_name;
 	std::string log, remote, index, groups;
 
@@ -26,6 +117,9 @@ int main(int argc, char *argv[])
 		("index", bpo::value<std::string>(&index)->default_value("test-index"), "Elliptics secondary index name")
 		("num", bpo::value<int>(&num)->default_value(1000000), "Number of entries to put into the index")
 		("size", bpo::value<int>(&data_size)->default_value(100), "Size of every index entry")
+		("intersect", "Benchmark intersection of index shards locally instead of filling the index")
+		("small-num", bpo::value<int>(&small_num)->default_value(1000), "Number of entries in the smaller shard to intersect")
+		("iterations", bpo::value<int>(&iterations)->default_value(100), "Number of intersections to run")
 		;
 
 	bpo::options_description cmdline_options;
@@ -50,6 +144,11 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	if (vm.count("intersect")) {
+		intersection_benchmark(std::min(small_num, num), num, data_size, iterations);
+		return 0;
+	}
+
 
 	elliptics::file_logger logger(log.c_str(), log_level);
 	elliptics::node node(elliptics::logger(logger, blackhole::attribute::set_t()));
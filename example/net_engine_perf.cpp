@@ -0,0 +1,366 @@
+/*
+ * Copyright 2015+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Network engine microbenchmark: client threads exchange messages with echo server over loopback
+ * connections. Server runs single network thread which waits for ready sockets with epoll and either
+ * receives/sends data with plain syscalls (epoll engine) or submits all receives and sends of
+ * the ready sockets with single io_uring_enter() call (io_uring engine), the same way net threads do.
+ */
+
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include <elliptics/timer.hpp>
+
+#include "library/elliptics.h"
+
+using namespace ioremap;
+
+struct bench_conn {
+	int			fd;
+	int			send;
+	size_t			have;
+	size_t			sent;
+	std::vector<char>	buf;
+	struct iovec		iov;
+	struct msghdr		msg;
+};
+
+static volatile int bench_need_exit;
+
+static void bench_set_events(int epoll_fd, bench_conn *c, int send)
+{
+	struct epoll_event ev;
+
+	if (c->send == send)
+		return;
+
+	ev.events = send ? EPOLLOUT : EPOLLIN;
+	ev.data.ptr = c;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->send = send;
+}
+
+/*
+ * Accounts result of receive or send, returns 1 if the echo has to be sent next
+ */
+static int bench_complete(int epoll_fd, bench_conn *c, int send, ssize_t res)
+{
+	if (res == -EAGAIN) {
+		bench_set_events(epoll_fd, c, send);
+		return 0;
+	}
+
+	if (res <= 0) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+		return 0;
+	}
+
+	if (!send) {
+		c->have = res;
+		c->sent = 0;
+		return 1;
+	}
+
+	c->sent += res;
+	if (c->sent != c->have) {
+		bench_set_events(epoll_fd, c, 1);
+		return 0;
+	}
+
+	c->have = c->sent = 0;
+	bench_set_events(epoll_fd, c, 0);
+	return 0;
+}
+
+static void bench_epoll_process(int epoll_fd, bench_conn *c)
+{
+	ssize_t res;
+	int send = c->have != 0;
+
+	while (1) {
+		if (send)
+			res = ::send(c->fd, c->buf.data() + c->sent, c->have - c->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		else
+			res = recv(c->fd, c->buf.data(), c->buf.size(), MSG_DONTWAIT);
+		if (res < 0)
+			res = -errno;
+
+		if (!bench_complete(epoll_fd, c, send, res))
+			break;
+		send = 1;
+	}
+}
+
+static int bench_uring_prep(struct dnet_uring *ring, bench_conn *c)
+{
+	if (!c->have)
+		return dnet_uring_prep_recv(ring, c->fd, c->buf.data(), c->buf.size(), c);
+
+	c->iov.iov_base = c->buf.data() + c->sent;
+	c->iov.iov_len = c->have - c->sent;
+	memset(&c->msg, 0, sizeof(struct msghdr));
+	c->msg.msg_iov = &c->iov;
+	c->msg.msg_iovlen = 1;
+	return dnet_uring_prep_sendmsg(ring, c->fd, &c->msg, c);
+}
+
+static void bench_uring_flush(int epoll_fd, struct dnet_uring *ring, int queued)
+{
+	void *priv;
+	int res;
+
+	while (queued) {
+		int err = dnet_uring_submit_and_wait(ring);
+		if (err)
+			throw std::runtime_error("io_uring submit failed: " + std::string(strerror(-err)));
+
+		queued = 0;
+		while (dnet_uring_reap(ring, &priv, &res)) {
+			bench_conn *c = reinterpret_cast<bench_conn *>(priv);
+			int send = c->have != 0;
+
+			if (bench_complete(epoll_fd, c, send, res) && !bench_uring_prep(ring, c))
+				queued++;
+		}
+	}
+}
+
+static void bench_server(int epoll_fd, struct dnet_uring *ring)
+{
+	std::vector<struct epoll_event> evs(DNET_URING_ENTRIES);
+
+	while (!bench_need_exit) {
+		int num = epoll_wait(epoll_fd, evs.data(), evs.size(), 100);
+		if (num <= 0)
+			continue;
+
+		int queued = 0;
+		for (int i = 0; i < num; ++i) {
+			bench_conn *c = reinterpret_cast<bench_conn *>(evs[i].data.ptr);
+
+			if (!ring) {
+				bench_epoll_process(epoll_fd, c);
+				continue;
+			}
+
+			if (!bench_uring_prep(ring, c))
+				queued++;
+		}
+
+		if (ring)
+			bench_uring_flush(epoll_fd, ring, queued);
+	}
+}
+
+static void bench_client(int fd, size_t size, int num)
+{
+	std::vector<char> buf(size, 'x');
+
+	for (int i = 0; i < num; ++i) {
+		for (size_t off = 0; off < size; ) {
+			ssize_t res = ::send(fd, buf.data() + off, size - off, MSG_NOSIGNAL);
+			if (res <= 0)
+				throw std::runtime_error("send failed: " + std::string(strerror(errno)));
+			off += res;
+		}
+
+		for (size_t off = 0; off < size; ) {
+			ssize_t res = recv(fd, buf.data() + off, size - off, 0);
+			if (res <= 0)
+				throw std::runtime_error("recv failed: " + std::string(strerror(errno)));
+			off += res;
+		}
+	}
+}
+
+static int bench_listen(struct sockaddr_in *addr)
+{
+	socklen_t len = sizeof(struct sockaddr_in);
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s < 0)
+		return -errno;
+
+	memset(addr, 0, sizeof(struct sockaddr_in));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(s, (struct sockaddr *)addr, len) || listen(s, 1024) || getsockname(s, (struct sockaddr *)addr, &len)) {
+		int err = -errno;
+		close(s);
+		return err;
+	}
+
+	return s;
+}
+
+static long bench_run(const char *engine, int connections, size_t size, int num)
+{
+	struct dnet_uring *ring = NULL;
+	struct sockaddr_in addr;
+	int err;
+
+	if (!strcmp(engine, "io_uring")) {
+		ring = dnet_uring_create(DNET_URING_ENTRIES, &err);
+		if (!ring) {
+			std::cerr << "Could not create io_uring: " << strerror(-err) << std::endl;
+			return -1;
+		}
+	}
+
+	int ls = bench_listen(&addr);
+	int epoll_fd = epoll_create(connections);
+	if (ls < 0 || epoll_fd < 0)
+		throw std::runtime_error("could not create listening socket or epoll set");
+
+	std::vector<bench_conn> conns(connections);
+	std::vector<int> clients(connections);
+
+	for (int i = 0; i < connections; ++i) {
+		int opt = 1;
+
+		clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+		if (connect(clients[i], (struct sockaddr *)&addr, sizeof(addr)))
+			throw std::runtime_error("connect failed: " + std::string(strerror(errno)));
+		setsockopt(clients[i], IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+		bench_conn &c = conns[i];
+		c.fd = accept(ls, NULL, NULL);
+		if (c.fd < 0)
+			throw std::runtime_error("accept failed: " + std::string(strerror(errno)));
+		setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+		c.send = 0;
+		c.have = c.sent = 0;
+		c.buf.resize(size);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = &c;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.fd, &ev);
+	}
+
+	bench_need_exit = 0;
+	std::thread server(bench_server, epoll_fd, ring);
+
+	elliptics::timer tm;
+
+	std::vector<std::thread> client_threads;
+	for (int i = 0; i < connections; ++i)
+		client_threads.emplace_back(bench_client, clients[i], size, num);
+
+	for (auto &thread : client_threads)
+		thread.join();
+
+	long total_time = tm.elapsed();
+
+	bench_need_exit = 1;
+	server.join();
+
+	for (int i = 0; i < connections; ++i) {
+		close(clients[i]);
+		close(conns[i].fd);
+	}
+	close(epoll_fd);
+	close(ls);
+
+	if (ring)
+		dnet_uring_destroy(ring);
+
+	return total_time;
+}
+
+int main(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::options_description generic("Network engine performance tool options");
+
+	int connections, num;
+	std::vector<size_t> sizes;
+	std::vector<std::string> engines;
+
+	generic.add_options()
+		("help", "This help message")
+		("connections", bpo::value<int>(&connections)->default_value(64), "Number of loopback connections, every one is served by its own client thread")
+		("num", bpo::value<int>(&num)->default_value(10000), "Number of messages echoed over every connection")
+		("size", bpo::value<std::vector<size_t>>(&sizes)->multitoken()->default_value(std::vector<size_t>({64, 4096, 65536}), "64 4096 65536"),
+			"Message sizes to test")
+		("engine", bpo::value<std::vector<std::string>>(&engines)->multitoken()->default_value(std::vector<std::string>({"epoll", "io_uring"}), "epoll io_uring"),
+			"Network engines to test")
+		;
+
+	bpo::variables_map vm;
+
+	try {
+		bpo::store(bpo::command_line_parser(argc, argv).options(generic).run(), vm);
+
+		if (vm.count("help")) {
+			std::cout << generic << std::endl;
+			return 0;
+		}
+
+		bpo::notify(vm);
+	} catch (const std::exception &e) {
+		std::cerr << "Invalid options: " << e.what() << "\n" << generic << std::endl;
+		return -1;
+	}
+
+	if (connections <= 0 || connections > DNET_URING_ENTRIES || num <= 0) {
+		std::cerr << "Invalid options: connections must be in (0, " << DNET_URING_ENTRIES << "], num must be positive\n"
+			<< generic << std::endl;
+		return -1;
+	}
+
+	try {
+		for (auto size : sizes) {
+			for (const auto &engine : engines) {
+				if (engine != "epoll" && engine != "io_uring") {
+					std::cerr << "Invalid engine: " << engine << std::endl;
+					return -1;
+				}
+
+				long total_time = bench_run(engine.c_str(), connections, size, num);
+				if (total_time < 0)
+					continue;
+
+				const double total = (double)num * connections;
+				const double secs = (double)(total_time ? total_time : 1) / 1000;
+
+				printf("engine: %8s, connections: %d, size: %zu, messages: %.0f, time: %ld msecs, "
+						"speed: %.3f messages/sec, %.3f MB/sec\n",
+						engine.c_str(), connections, size, total, total_time,
+						total / secs, total * size * 2 / secs / (1024 * 1024));
+			}
+		}
+	} catch (const std::exception &e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2015+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * IO pool microbenchmark: several producers queue requests into the pool via dnet_work_pool_push(),
+ * pool threads take them via dnet_work_pool_take(). Part of requests are transaction replies,
+ * benchmark checks that replies for the same transaction are never processed simultaneously.
+ */
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include <elliptics/session.hpp>
+#include <elliptics/timer.hpp>
+
+#include "library/elliptics.h"
+
+using namespace ioremap;
+
+static volatile int bench_need_exit;
+static atomic_t bench_processed;
+static atomic_t bench_violations;
+static std::vector<atomic_t> bench_trans_active;
+static int bench_work;
+
+static void *bench_process(void *data)
+{
+	struct dnet_work_io *wio = reinterpret_cast<dnet_work_io *>(data);
+
+	while (!bench_need_exit) {
+		struct dnet_io_req *r = dnet_work_pool_take(wio, 100);
+		if (!r)
+			continue;
+
+		struct dnet_cmd *cmd = reinterpret_cast<dnet_cmd *>(r->header);
+		atomic_t *active = NULL;
+
+		if (cmd->flags & DNET_FLAGS_REPLY) {
+			active = &bench_trans_active[cmd->trans];
+			if (atomic_inc(active) != 1)
+				atomic_inc(&bench_violations);
+		}
+
+		for (volatile int i = 0; i < bench_work; ++i)
+			;
+
+		if (active)
+			atomic_dec(active);
+
+		dnet_io_req_free(r);
+		atomic_inc(&bench_processed);
+	}
+
+	return NULL;
+}
+
+static void bench_produce(struct dnet_work_pool *pool, int num, int transactions, int replies, unsigned int seed)
+{
+	for (int i = 0; i < num; ++i) {
+		struct dnet_io_req *r = reinterpret_cast<dnet_io_req *>(malloc(sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd)));
+		if (!r)
+			throw std::bad_alloc();
+
+		memset(r, 0, sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd));
+		/* requests left in the queues are freed by dnet_work_pool_cleanup() via dnet_io_req_free() */
+		atomic_init(&r->refcnt, 1);
+		r->fd = -1;
+		r->header = r + 1;
+		r->hsize = sizeof(struct dnet_cmd);
+
+		struct dnet_cmd *cmd = reinterpret_cast<dnet_cmd *>(r->header);
+		if ((int)(rand_r(&seed) % 100) < replies) {
+			cmd->flags = DNET_FLAGS_REPLY;
+			cmd->trans = rand_r(&seed) % transactions;
+		}
+
+		dnet_work_pool_push(pool, r);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::options_description generic("IO pool performance tool options");
+
+	int threads, producers, num, transactions, replies;
+
+	generic.add_options()
+		("help", "This help message")
+		("threads", bpo::value<int>(&threads)->default_value(32), "Number of IO pool threads")
+		("producers", bpo::value<int>(&producers)->default_value(4), "Number of threads queueing requests")
+		("num", bpo::value<int>(&num)->default_value(1000000), "Number of requests queued by every producer")
+		("transactions", bpo::value<int>(&transactions)->default_value(1024), "Number of distinct transactions replies belong to")
+		("replies", bpo::value<int>(&replies)->default_value(50), "Percent of requests which are transaction replies")
+		("work", bpo::value<int>(&bench_work)->default_value(0), "Number of idle loop iterations per request")
+		;
+
+	bpo::variables_map vm;
+
+	try {
+		bpo::store(bpo::command_line_parser(argc, argv).options(generic).run(), vm);
+
+		if (vm.count("help")) {
+			std::cout << generic << std::endl;
+			return 0;
+		}
+
+		bpo::notify(vm);
+	} catch (const std::exception &e) {
+		std::cerr << "Invalid options: " << e.what() << "\n" << generic << std::endl;
+		return -1;
+	}
+
+	if (threads <= 0 || producers <= 0 || num <= 0 || transactions <= 0) {
+		std::cerr << "Invalid options: threads, producers, num and transactions must be positive\n" << generic << std::endl;
+		return -1;
+	}
+
+	bench_trans_active.resize(transactions);
+	for (auto &active : bench_trans_active)
+		atomic_init(&active, 0);
+	atomic_init(&bench_processed, 0);
+	atomic_init(&bench_violations, 0);
+
+	elliptics::file_logger logger("/dev/null", DNET_LOG_ERROR);
+	elliptics::node node(elliptics::logger(logger, blackhole::attribute::set_t()));
+
+	struct dnet_work_pool_place place;
+	int err = dnet_work_pool_place_init(&place);
+	if (err) {
+		std::cerr << "Could not initialize pool place: " << err << std::endl;
+		return err;
+	}
+
+	err = dnet_work_pool_alloc(&place, node.get_native(), NULL, threads, DNET_WORK_IO_MODE_NONBLOCKING, bench_process);
+	if (err) {
+		std::cerr << "Could not allocate pool: " << err << std::endl;
+		dnet_work_pool_place_cleanup(&place);
+		return err;
+	}
+
+	const long total = (long)num * producers;
+
+	elliptics::timer tm;
+
+	std::vector<std::thread> producer_threads;
+	for (int i = 0; i < producers; ++i)
+		producer_threads.emplace_back(bench_produce, place.pool, num, transactions, replies, (unsigned int)i);
+
+	for (auto &thread : producer_threads)
+		thread.join();
+
+	long queue_time = tm.elapsed();
+
+	while (atomic_read(&bench_processed) < total)
+		usleep(1000);
+
+	long total_time = tm.elapsed();
+
+	bench_need_exit = 1;
+	dnet_work_pool_cleanup(&place);
+	dnet_work_pool_place_cleanup(&place);
+
+	printf("threads: %d, producers: %d, requests: %ld, replies: %d%%, transactions: %d\n",
+			threads, producers, total, replies, transactions);
+	printf("queue-time: %ld msecs, total-time: %ld msecs, speed: %.3f requests/sec, affinity violations: %ld\n",
+			queue_time, total_time, (double)total * 1000 / (double)(total_time ? total_time : 1),
+			(long)atomic_read(&bench_violations));
+
+	return atomic_read(&bench_violations) ? -1 : 0;
+}
@@ -85,6 +85,42 @@
 
 #define DNET_DEFAULT_CACHE_PAGES_NUMBER 1
 
+/*
+ * Default average size of cached object used to size cache admission filter.
+ */
+#define DNET_DEFAULT_CACHE_ADMISSION_OBJECT_SIZE 4096
+
+/*
+ * Default number of threads per backend which write dirty cached objects back to the backend.
+ */
+#define DNET_DEFAULT_CACHE_FLUSHERS 4
+
+/*
+ * Default number of bytes per second read from the backend while cache is being warmed up from its snapshot.
+ */
+#define DNET_DEFAULT_CACHE_WARM_UP_RATE (16 * 1024 * 1024)
+
+/*
+ * Default amount of host memory which auto-sized cache leaves to the rest of the system.
+ */
+#define DNET_DEFAULT_CACHE_RESERVED_MEMORY (1024 * 1024 * 1024)
+
+/*
+ * Default interval in seconds between checks of available memory by auto-sized cache.
+ */
+#define DNET_DEFAULT_CACHE_RESIZE_INTERVAL_SEC 10
+
+/*
+ * Default maximum number of bytes coalesced from the send queue into single sendmsg() call.
+ */
+#define DNET_DEFAULT_SEND_BATCH_SIZE	(64 * 1024)
+
+/*
+ * Default maximum number of requests queued per IO thread.
+ * Sockets whose requests go to the pool which exceeds the limit are not read until the queue shrinks by half.
+ */
+#define DNET_DEFAULT_IO_QUEUE_LIMIT	1000
+
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 #ifndef dnet_offsetof
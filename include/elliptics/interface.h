@@ -159,6 +159,31 @@ int dnet_search_range(struct dnet_node *n, struct dnet_id *id,
 int __attribute__((weak)) dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
 		void *data, int fd, uint64_t offset, int on_exit);
 
+/*
+ * Sends read reply without copying @data into the send queue.
+ * @release(@priv) is called exactly once when @data is no longer referenced,
+ * even if sending fails.
+ */
+int __attribute__((weak)) dnet_send_read_data_ref(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
+		void *data, void (*release)(void *priv), void *priv);
+
+/*
+ * Data block referenced by the send queue, @release(@priv) is called when block is no longer needed
+ */
+struct dnet_data_ref {
+	void			*data;
+	uint64_t		size;
+	void			(*release)(void *priv);
+	void			*priv;
+};
+
+/*
+ * Sends read reply whose data is split into @num blocks without copying them into the send queue,
+ * sizes of the blocks must sum up to @io->size. Every block is released exactly once, even if sending fails.
+ */
+int __attribute__((weak)) dnet_send_read_data_refs(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
+		struct dnet_data_ref *refs, int num);
+
 #define DNET_MAX_ADDRLEN		256
 #define DNET_MAX_PORTLEN		8
 
@@ -174,6 +199,8 @@ int __attribute__((weak)) dnet_send_read_data(void *state, struct dnet_cmd *cmd,
 #define DNET_CFG_NO_CSUM		(1<<3)		/* globally disable checksum verification and update */
 #define DNET_CFG_RANDOMIZE_STATES	(1<<5)		/* randomize states for read requests */
 #define DNET_CFG_KEEPS_IDS_IN_CLUSTER	(1<<6)		/* keeps ids in elliptics cluster */
+#define DNET_CFG_REUSEPORT		(1<<7)		/* every network thread accepts clients on its own SO_REUSEPORT socket */
+#define DNET_CFG_IO_URING		(1<<8)		/* network threads send and receive data via io_uring if kernel supports it */
 
 static inline const char *dnet_flags_dump_cfgflags(uint64_t flags)
 {
@@ -185,6 +212,8 @@ static inline const char *dnet_flags_dump_cfgflags(uint64_t flags)
 		{ DNET_CFG_NO_CSUM, "n_ocsum" },
 		{ DNET_CFG_RANDOMIZE_STATES, "randomize_states" },
 		{ DNET_CFG_KEEPS_IDS_IN_CLUSTER, "keeps_ids_in_cluster" },
+		{ DNET_CFG_REUSEPORT, "reuseport" },
+		{ DNET_CFG_IO_URING, "io_uring" },
 	};
 
 	dnet_flags_dump_raw(buffer, sizeof(buffer), flags, infos, sizeof(infos) / sizeof(infos[0]));
@@ -346,8 +375,34 @@ struct dnet_config
 	/* Unused. Will be removed at next major release */
 	long		__unused_1;
 
+	/*
+	 * Maximum number of bytes of queued memory-backed replies
+	 * sent with single sendmsg() call
+	 */
+	int			send_batch_size;
+
+	/*
+	 * Idle IO threads of one backend take nonblocking requests queued to other backends
+	 * once their queue is longer than this number of requests, 0 disables stealing
+	 */
+	int			work_steal_threshold;
+
+	/*
+	 * CPU lists (like "0-3,8") network and IO threads are bound to.
+	 * Every network thread is bound to its own CPU from the list,
+	 * IO threads may run on any CPU from their list. NULL - no affinity.
+	 */
+	const char		*net_thread_cpus;
+	const char		*io_thread_cpus;
+
+	/*
+	 * Maximum number of requests queued per IO thread of every pool,
+	 * clients which send requests to overloaded pool are not read until its queue shrinks
+	 */
+	int			io_queue_limit;
+
 	/* so that we do not change major version frequently */
-	int			reserved_for_future_use[8];
+	int			reserved_for_future_use[1];
 };
 
 struct dnet_node *dnet_get_node_from_state(void *state);
@@ -884,6 +939,8 @@ struct dnet_vm_stat {
 	uint64_t	vm_free;
 	uint64_t	vm_cached;
 	uint64_t	vm_buffers;
+	/* memory which can be allocated without swapping, estimated by kernel */
+	uint64_t	vm_available;
 };
 
 int dnet_get_vm_stat(dnet_logger *l, struct dnet_vm_stat *st);
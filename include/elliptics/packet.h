@@ -536,10 +536,15 @@ static inline const char *dnet_flags_dump_ioflags(uint64_t flags)
 /*
  * DNET_INDEXES_FLAGS_MORE
  *
- * Used for bulk find requests. If this flag is set this request is
- * not the last. Next request is placed right after it in this cmd.
+ * Used for bulk find requests and batch inserts into capped collection.
+ * If this flag is set this request is not the last. Next request is placed
+ * right after it in this cmd.
  *
- * This flag is for DNET_CMD_INDEXES_FIND request only.
+ * Batch of DNET_CMD_INDEXES_INTERNAL requests starts with a request without
+ * entries, so servers which do not support batches reject it with -EINVAL
+ * instead of processing only the first request of the chain.
+ *
+ * This flag is for DNET_CMD_INDEXES_FIND and DNET_CMD_INDEXES_INTERNAL requests only.
  */
 #define DNET_INDEXES_FLAGS_MORE			(1<<3)
 
@@ -787,6 +787,21 @@ class session
 		 * Returns async_generic_result.
 		 */
 		async_generic_result add_to_capped_collection(const key &id, const index_entry &index, int limit, bool remove_data);
+		/*!
+		 * \brief Adds objects \a ids to capped collection \a index, \a datas are their index data.
+		 *
+		 * Objects are added in the given order, so the earlier ones are displaced first if the \a limit is reached.
+		 * Object passed several times keeps its last data and is as new as its last occurrence.
+		 * Objects which belong to the same shard of the collection are added to it by single request,
+		 * so the shard is read and written once for all of them. Servers which do not support such requests
+		 * reject them with -EINVAL.
+		 *
+		 * If \a remove_data is true in addition to displacing of the object it's data is also removed from the storage.
+		 *
+		 * Returns async_generic_result.
+		 */
+		async_generic_result add_to_capped_collection(const std::vector<key> &ids, const dnet_raw_id &index,
+				const std::vector<data_pointer> &datas, int limit, bool remove_data);
 		/*!
 		 * \brief Removes \a id from \a indexes.
 		 *
@@ -0,0 +1,218 @@
+/*
+* 2015+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+* All rights reserved.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*/
+
+#ifndef INDEXES_CAPPED_HPP
+#define INDEXES_CAPPED_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "../bindings/cpp/session_indexes.hpp"
+
+/*
+ * Updates of capped collection shards.
+ *
+ * Table of capped collection stores positions of its entries from the oldest to the newest one,
+ * so the oldest entries are evicted without sorting the whole table by time on every update.
+ */
+
+namespace ioremap { namespace elliptics {
+
+/*!
+ * Insert or removal of single object in capped collection
+ */
+struct capped_update_t
+{
+	uint32_t action;
+	dnet_raw_id object;
+	data_pointer data;
+};
+
+static inline bool indexes_entry_time_less_than(const dnet_index_entry &first, const dnet_index_entry &second)
+{
+	return first.time.tsec < second.time.tsec ||
+		(first.time.tsec == second.time.tsec && first.time.tnsec < second.time.tnsec);
+}
+
+/*!
+ * Loads positions of @indexes unpacked from @data from the oldest to the newest one, they are stored
+ * in the table of capped collection and sorted by time only for tables written in other way.
+ */
+static inline void indexes_capped_time_order(const data_pointer &data, const std::vector<dnet_index_entry> &indexes,
+	std::vector<uint64_t> &order)
+{
+	order.clear();
+	order.reserve(indexes.size() + 1);
+
+	index_table_view view;
+	bool ordered = false;
+	try {
+		ordered = view.map(data) && !view.has_deltas() && view.has_time_order() && view.size() == indexes.size();
+	} catch (const std::exception &) {
+	}
+
+	if (ordered) {
+		std::vector<bool> seen(indexes.size(), false);
+		for (size_t i = 0; i < view.size(); ++i) {
+			const uint64_t position = view.time_order(i);
+			if (position >= indexes.size() || seen[position])
+				break;
+
+			seen[position] = true;
+			order.push_back(position);
+		}
+
+		if (order.size() == indexes.size())
+			return;
+		order.clear();
+	}
+
+	for (size_t i = 0; i < indexes.size(); ++i)
+		order.push_back(i);
+
+	std::stable_sort(order.begin(), order.end(), [&indexes] (uint64_t first, uint64_t second) {
+		return indexes_entry_time_less_than(indexes[first], indexes[second]);
+	});
+}
+
+/*!
+ * Applies @updates to entries of capped collection @indexes, @order is their time order
+ * and it is replaced by the time order of the result.
+ *
+ * Only the last update of every object matters, inserted objects get @now time and become
+ * the newest ones in the order of their last updates, removals of absent objects are ignored.
+ * Objects which do not fit into @limit (0 means no limit) are evicted from the oldest one,
+ * they are appended to @removed.
+ *
+ * Returns false if nothing is changed.
+ */
+static inline bool indexes_capped_apply(dnet_indexes &indexes, std::vector<uint64_t> &order,
+	const std::vector<capped_update_t> &updates, uint32_t limit, const dnet_time &now,
+	std::vector<dnet_indexes_reply_entry> &removed)
+{
+	const size_t count = indexes.indexes.size();
+
+	std::map<dnet_raw_id, size_t, dnet_raw_id_less_than<>> latest;
+	for (size_t i = 0; i < updates.size(); ++i)
+		latest[updates[i].object] = i;
+
+	// Old entries of updated objects are replaced or removed
+	std::vector<bool> dropped(count, false);
+	size_t dropped_count = 0;
+	for (auto it = latest.begin(); it != latest.end(); ++it) {
+		auto jt = std::lower_bound(indexes.indexes.begin(), indexes.indexes.end(), it->first,
+			dnet_raw_id_less_than<skip_data>());
+		if (jt != indexes.indexes.end() && jt->index == it->first) {
+			dropped[jt - indexes.indexes.begin()] = true;
+			++dropped_count;
+		}
+	}
+
+	// Time order of the new table, inserted objects are the newest ones in the order of updates
+	struct slot_t {
+		bool inserted;
+		size_t index;
+	};
+	std::vector<slot_t> slots;
+	slots.reserve(count + latest.size());
+	for (auto it = order.begin(); it != order.end(); ++it) {
+		if (!dropped[*it])
+			slots.push_back(slot_t{false, size_t(*it)});
+	}
+
+	size_t inserted_count = 0;
+	for (size_t i = 0; i < updates.size(); ++i) {
+		if (updates[i].action == DNET_INDEXES_FLAGS_INTERNAL_INSERT && latest[updates[i].object] == i) {
+			slots.push_back(slot_t{true, i});
+			++inserted_count;
+		}
+	}
+
+	if (dropped_count == 0 && inserted_count == 0) {
+		// Only absent objects were removed
+		return false;
+	}
+
+	// Evict the oldest objects
+	const size_t evicted_count = (limit != 0 && slots.size() > limit) ? slots.size() - limit : 0;
+
+	std::vector<bool> evicted(count, false);
+	std::vector<bool> evicted_updates(updates.size(), false);
+
+	dnet_indexes_reply_entry removed_entry;
+	memset(&removed_entry, 0, sizeof(removed_entry));
+	removed_entry.status = DNET_INDEXES_CAPPED_REMOVED;
+
+	for (size_t i = 0; i < evicted_count; ++i) {
+		const slot_t &slot = slots[i];
+		if (slot.inserted) {
+			evicted_updates[slot.index] = true;
+			removed_entry.id = updates[slot.index].object;
+		} else {
+			evicted[slot.index] = true;
+			removed_entry.id = indexes.indexes[slot.index].index;
+		}
+		removed.push_back(removed_entry);
+	}
+
+	// Merge the rest of old entries with inserted objects, both are sorted by id
+	std::vector<dnet_index_entry> result;
+	result.reserve(slots.size() - evicted_count);
+
+	std::vector<uint64_t> positions(count);
+	std::vector<uint64_t> updates_positions(updates.size());
+
+	size_t position = 0;
+	auto jt = latest.begin();
+	while (position < count || jt != latest.end()) {
+		if (jt != latest.end() && (updates[jt->second].action != DNET_INDEXES_FLAGS_INTERNAL_INSERT
+				|| evicted_updates[jt->second])) {
+			++jt;
+			continue;
+		}
+
+		if (position < count && (dropped[position] || evicted[position])) {
+			++position;
+			continue;
+		}
+
+		if (jt == latest.end() || (position < count
+				&& dnet_raw_id_less_than<>()(indexes.indexes[position].index, jt->first))) {
+			positions[position] = result.size();
+			result.push_back(indexes.indexes[position]);
+			++position;
+		} else {
+			const capped_update_t &update = updates[jt->second];
+			updates_positions[jt->second] = result.size();
+			result.push_back(dnet_index_entry(update.object, update.data, now));
+			++jt;
+		}
+	}
+
+	order.clear();
+	for (size_t i = evicted_count; i < slots.size(); ++i) {
+		const slot_t &slot = slots[i];
+		order.push_back(slot.inserted ? updates_positions[slot.index] : positions[slot.index]);
+	}
+
+	indexes.indexes.swap(result);
+	return true;
+}
+
+}} /* namespace ioremap::elliptics */
+
+#endif /* INDEXES_CAPPED_HPP */
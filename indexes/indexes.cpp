@@ -25,10 +25,17 @@
 #include "../library/elliptics.h"
 #include "../bindings/cpp/functional_p.h"
 #include "local_session.h"
+#include "capped.hpp"
+#include "intersection.hpp"
 
 #include "elliptics/debug.hpp"
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
 
 namespace {
 
@@ -463,10 +470,75 @@ err_out_complete:
 	}
 };
 
-static bool entry_time_less_than(const dnet_index_entry &first, const dnet_index_entry &second)
+/*!
+ * Way the update of index shard is applied
+ */
+enum index_delta_action {
+	// update is appended to the log of updates of the shard
+	index_delta_append,
+	// shard is read, merged with the update and rewritten
+	index_delta_rewrite,
+	// update does not change the shard
+	index_delta_skip
+};
+
+// log of updates may grow up to this size even if table is smaller
+static const size_t index_delta_log_min_size = 64 * 1024;
+
+/*!
+ * Decides how @delta of @delta_size bytes is applied to the stored shard @data.
+ *
+ * Update is appended only to the table in the sorted layout whose log is complete and does not grow
+ * larger than a half of the table, so missing shard, tables written by older versions and torn logs
+ * are rewritten instead. Insert of the same data and removal of absent entry are skipped,
+ * so they neither grow the log nor change time of the entry.
+ */
+static index_delta_action check_index_delta(const data_pointer &data, const dnet_index_delta &delta, size_t delta_size)
 {
-	return first.time.tsec < second.time.tsec ||
-		(first.time.tsec == second.time.tsec && first.time.tnsec < second.time.tnsec);
+	index_table_view view;
+	try {
+		if (!view.map(data))
+			return index_delta_rewrite;
+	} catch (const std::exception &) {
+		return index_delta_rewrite;
+	}
+
+	const size_t log_size = data.size() - view.table_size();
+	const size_t max_log_size = std::max(view.table_size() / 2, index_delta_log_min_size);
+
+	std::vector<dnet_index_delta> deltas;
+	if (!indexes_unpack_deltas(data.data<char>(), data.size(), view.table_size(), deltas))
+		return index_delta_rewrite;
+
+	// the last update of the entry overrides the table
+	bool found = false;
+	bool exists = false;
+	data_pointer current;
+
+	for (auto it = deltas.rbegin(); it != deltas.rend(); ++it) {
+		if (it->entry.index == delta.entry.index) {
+			found = true;
+			exists = it->action == DNET_INDEXES_FLAGS_INTERNAL_INSERT;
+			current = it->entry.data;
+			break;
+		}
+	}
+
+	if (!found) {
+		const size_t position = view.lower_bound(delta.entry.index);
+		if (position < view.size() && view.id(position) == delta.entry.index) {
+			exists = true;
+			current = view.data(position);
+		}
+	}
+
+	if (delta.action == DNET_INDEXES_FLAGS_INTERNAL_INSERT ? (exists && current == delta.entry.data) : !exists)
+		return index_delta_skip;
+
+	if (log_size + delta_size > max_log_size)
+		return index_delta_rewrite;
+
+	return index_delta_append;
 }
 
 /*!
@@ -477,10 +549,8 @@ static bool entry_time_less_than(const dnet_index_entry &first, const dnet_index
  */
 data_pointer convert_index_table(dnet_node *node, dnet_id *cmd_id, const dnet_indexes_request *request,
 	const data_pointer &index_data, const data_pointer &data, uint32_t action,
-	std::vector<dnet_indexes_reply_entry> * &removed, const dnet_indexes_request_entry &entry)
+	const dnet_indexes_request_entry &entry)
 {
-	const uint32_t limit = entry.limit;
-
 	elliptics_timer timer;
 
 	dnet_indexes indexes;
@@ -502,8 +572,8 @@ data_pointer convert_index_table(dnet_node *node, dnet_id *cmd_id, const dnet_in
 	if (it != indexes.indexes.end() && it->index == request_index.index) {
 		// It's already there
 		if (action == DNET_INDEXES_FLAGS_INTERNAL_INSERT) {
-			// Item exists, update it's data and time if it's capped collection
-			if (!removed && it->data == request_index.data) {
+			// Item exists, update it's data
+			if (it->data == request_index.data) {
 				const int64_t timer_compare = timer.restart();
 				DNET_DUMP_ID_LEN(id_str, cmd_id, DNET_DUMP_NUM);
 				typedef long long int lld;
@@ -523,29 +593,6 @@ data_pointer convert_index_table(dnet_node *node, dnet_id *cmd_id, const dnet_in
 	} else {
 		// Index is not created yet
 		if (action == DNET_INDEXES_FLAGS_INTERNAL_INSERT) {
-			// Remove extra elements from capped collection
-			if (removed && limit != 0 && indexes.indexes.size() + 1 > limit) {
-				dnet_indexes_reply_entry entry;
-				memset(&entry, 0, sizeof(entry));
-
-				auto position = it - indexes.indexes.begin();
-
-				while (indexes.indexes.size() + 1 > limit && !indexes.indexes.empty()) {
-					auto jt = std::min_element(indexes.indexes.begin(), indexes.indexes.end(), entry_time_less_than);
-
-					// jt will be removed, so it should be modified to be still valid
-					if (position > jt - indexes.indexes.begin())
-						--position;
-
-					memcpy(entry.id.id, jt->index.id, DNET_ID_SIZE);
-					entry.status = DNET_INDEXES_CAPPED_REMOVED;
-
-					indexes.indexes.erase(jt);
-					removed->push_back(entry);
-				}
-
-				it = indexes.indexes.begin() + position;
-			}
 			// And just insert new index
 			indexes.indexes.insert(it, 1, request_index);
 		} else {
@@ -566,29 +613,110 @@ data_pointer convert_index_table(dnet_node *node, dnet_id *cmd_id, const dnet_in
 	indexes.shard_id = entry.shard_id;
 	indexes.shard_count = entry.shard_count;
 
-	msgpack::sbuffer buffer;
-	msgpack::pack(&buffer, indexes);
+	data_pointer new_buffer = indexes_pack(indexes);
 
 	const int64_t timer_pack = timer.restart();
 
-	data_buffer new_buffer(DNET_INDEX_TABLE_MAGIC_SIZE + buffer.size());
-	new_buffer.write(dnet_bswap64(DNET_INDEX_TABLE_MAGIC));
-	new_buffer.write(buffer.data(), buffer.size());
-
-	const int64_t timer_write = timer.restart();
-
 	DNET_DUMP_ID_LEN(id_str, cmd_id, DNET_DUMP_NUM);
 	typedef long long int lld;
 	dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: convert: id: %s, data size: %zu, new data size: %zu,"
-		 "unpack: %lld ms, lower_bound: %lld ms, update: %lld ms, pack: %lld ms, write: %lld ms",
+		 "unpack: %lld ms, lower_bound: %lld ms, update: %lld ms, pack: %lld ms",
 		 id_str, data.size(), new_buffer.size(), lld(timer_unpack), lld(timer_lower_bound),
-		 lld(timer_update), lld(timer_pack), lld(timer_write));
+		 lld(timer_update), lld(timer_pack));
+
+	return new_buffer;
+}
+
+/*!
+ * Applies @updates to the table of capped collection in their order.
+ *
+ * Objects which do not fit into the limit are evicted from the oldest one using time order
+ * stored in the table, evicted objects are appended to @removed.
+ */
+data_pointer convert_capped_table(dnet_node *node, dnet_id *cmd_id, const std::vector<capped_update_t> &updates,
+	const data_pointer &data, const dnet_indexes_request_entry &entry, std::vector<dnet_indexes_reply_entry> &removed)
+{
+	elliptics_timer timer;
+
+	dnet_indexes indexes;
+	std::vector<uint64_t> order;
+	if (!data.empty()) {
+		indexes_unpack(node, cmd_id, data, &indexes, "convert_capped_table");
+		indexes_capped_time_order(data, indexes.indexes, order);
+	}
+
+	const int64_t timer_unpack = timer.restart();
+
+	dnet_time now;
+	dnet_current_time(&now);
+
+	const size_t removed_count = removed.size();
+	if (!indexes_capped_apply(indexes, order, updates, entry.limit, now, removed))
+		return data;
+
+	const int64_t timer_update = timer.restart();
+
+	indexes.shard_id = entry.shard_id;
+	indexes.shard_count = entry.shard_count;
+	data_pointer new_data = indexes_pack(indexes, &order);
+
+	const int64_t timer_pack = timer.restart();
+
+	DNET_DUMP_ID_LEN(id_str, cmd_id, DNET_DUMP_NUM);
+	typedef long long int lld;
+	dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: convert capped: id: %s, data size: %zu, new data size: %zu, "
+		 "updates: %zu, evicted: %zu, unpack: %lld ms, update: %lld ms, pack: %lld ms",
+		 id_str, data.size(), new_data.size(), updates.size(), removed.size() - removed_count,
+		 lld(timer_unpack), lld(timer_update), lld(timer_pack));
+
+	return new_data;
+}
+
+/*!
+ * Reads table of capped collection shard @id, applies @updates to it and writes it back
+ */
+int process_capped_updates(local_session &sess, dnet_node *node, const dnet_id &id,
+	const std::vector<capped_update_t> &updates, const dnet_indexes_request_entry &entry,
+	std::vector<dnet_indexes_reply_entry> &removed)
+{
+	elliptics_timer timer;
+
+	dnet_id cmd_id = id;
+
+	int err = 0;
+	data_pointer data = sess.read(cmd_id, &err);
+	const int64_t timer_read = timer.restart();
 
-	return std::move(new_buffer);
+	data_pointer new_data = convert_capped_table(node, &cmd_id, updates, data, entry, removed);
+	const int64_t timer_convert = timer.restart();
+
+	int64_t timer_write = 0;
+
+	if (data == new_data) {
+		dnet_log(node, DNET_LOG_DEBUG, "INDEXES_INTERNAL: data is the same");
+		err = 0;
+	} else {
+		dnet_log(node, DNET_LOG_DEBUG, "INDEXES_INTERNAL: data is different");
+		err = sess.write(cmd_id, new_data);
+		timer_write = timer.restart();
+	}
+
+	DNET_DUMP_ID_LEN(id_str, &cmd_id, DNET_DUMP_NUM);
+	typedef long long int lld;
+	dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: capped id: %s, updates: %zu, data size: %zu, new data size: %zu, "
+		 "read: %lld ms, convert: %lld ms, write: %lld ms",
+		 id_str, updates.size(), data.size(), new_data.size(),
+		 lld(timer_read), lld(timer_convert), lld(timer_write));
+
+	return err;
 }
 
+/*!
+ * Applies single update of the table of non-capped index or removes a table of any index,
+ * updates of capped collections are applied by process_capped_updates()
+ */
 int process_internal_indexes_entry(struct dnet_backend_io *backend, dnet_node *node, const dnet_indexes_request &request,
-	dnet_indexes_request_entry &entry, std::vector<dnet_indexes_reply_entry> * &removed)
+	dnet_indexes_request_entry &entry)
 {
 	elliptics_timer timer;
 
@@ -612,10 +740,6 @@ int process_internal_indexes_entry(struct dnet_backend_io *backend, dnet_node *n
 
 	uint32_t action = entry.flags & (DNET_INDEXES_FLAGS_INTERNAL_INSERT
 		| DNET_INDEXES_FLAGS_INTERNAL_REMOVE | DNET_INDEXES_FLAGS_INTERNAL_REMOVE_ALL);
-	const bool capped = entry.flags & DNET_INDEXES_FLAGS_INTERNAL_CAPPED_COLLECTION;
-
-	if (!capped)
-		removed = NULL;
 
 	switch (action) {
 		case DNET_INDEXES_FLAGS_INTERNAL_INSERT:
@@ -631,13 +755,11 @@ int process_internal_indexes_entry(struct dnet_backend_io *backend, dnet_node *n
 			dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: id: %s, checks: %lld ms, remove: %lld ms",
 				 id_str, lld(timer_checks), lld(timer_remove));
 
-			removed = NULL;
 			return err;
 		}
 		default: {
 			dnet_log(node, DNET_LOG_ERROR, "INDEXES_INTERNAL: invalid flags: %s",
 				dnet_flags_dump_indexes_internal(entry.flags));
-			removed = NULL;
 			return -EINVAL;
 		}
 	}
@@ -645,10 +767,41 @@ int process_internal_indexes_entry(struct dnet_backend_io *backend, dnet_node *n
 	const int64_t timer_checks = timer.restart();
 
 	int err = 0;
+
 	data_pointer data = sess.read(id, &err);
 	const int64_t timer_read = timer.restart();
 
-	data_pointer new_data = convert_index_table(node, &id, &request, entry_data, data, action, removed, entry);
+	// Append update to the shard instead of rewriting it
+	dnet_index_delta delta;
+	delta.action = action;
+	memcpy(delta.entry.index.id, request.id.id, sizeof(delta.entry.index.id));
+	delta.entry.data = entry_data;
+	dnet_current_time(&delta.entry.time);
+
+	msgpack::sbuffer buffer;
+	msgpack::pack(&buffer, delta);
+
+	const index_delta_action delta_action = check_index_delta(data, delta, buffer.size());
+	if (delta_action != index_delta_rewrite) {
+		if (delta_action == index_delta_append) {
+			sess.set_ioflags(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+			err = sess.write(id, buffer.data(), buffer.size());
+		} else {
+			err = 0;
+		}
+		const int64_t timer_append = timer.restart();
+
+		DNET_DUMP_ID_LEN(id_str, &id, DNET_DUMP_NUM);
+		typedef long long int lld;
+		dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: id: %s, data size: %zu, delta size: %zu, skipped: %d, "
+			 "checks: %lld ms, read: %lld ms, append: %lld ms, err: %d",
+			 id_str, data.size(), buffer.size(), int(delta_action == index_delta_skip),
+			 lld(timer_checks), lld(timer_read), lld(timer_append), err);
+
+		return err;
+	}
+
+	data_pointer new_data = convert_index_table(node, &id, &request, entry_data, data, action, entry);
 	const int64_t timer_convert = timer.restart();
 
 	const bool data_equal = data == new_data;
@@ -676,56 +829,147 @@ int process_internal_indexes_entry(struct dnet_backend_io *backend, dnet_node *n
 	return err;
 }
 
+/*!
+ * Processes INDEXES_INTERNAL command. Batch of updates of capped collection is a chain of requests
+ * linked by DNET_INDEXES_FLAGS_MORE after an empty one, see DNET_INDEXES_FLAGS_MORE.
+ *
+ * Entries are processed in their order, except that all insertions and removals of the same capped
+ * collection shard are applied by single read and write of it at the position of the first of them.
+ * Statuses are replied in the order of entries followed by objects evicted from capped collections.
+ */
 int process_internal_indexes(struct dnet_backend_io *backend, dnet_net_state *state, dnet_cmd *cmd, dnet_indexes_request *request)
 {
-	if (request->entries_count == 0) {
+	const bool batch = request->entries_count == 0 && (request->flags & DNET_INDEXES_FLAGS_MORE);
+
+	if (request->entries_count == 0 && !batch) {
+		return -EINVAL;
+	}
+
+	struct item_t {
+		dnet_indexes_request *request;
+		dnet_indexes_request_entry *entry;
+		int status;
+	};
+
+	std::vector<item_t> items;
+
+	const char *end = reinterpret_cast<const char *>(request) + cmd->size;
+	for (dnet_indexes_request *it = request; ; ) {
+		char *data = reinterpret_cast<char *>(it + 1);
+		if (data > end)
+			return -EINVAL;
+
+		for (uint64_t i = 0; i < it->entries_count; ++i) {
+			auto entry = reinterpret_cast<dnet_indexes_request_entry *>(data);
+			if (data + sizeof(*entry) > end || entry->size > uint64_t(end - data - sizeof(*entry)))
+				return -EINVAL;
+
+			items.push_back(item_t{it, entry, 0});
+			data += sizeof(*entry) + entry->size;
+		}
+
+		if (!(it->flags & DNET_INDEXES_FLAGS_MORE))
+			break;
+
+		// only batch may be chained
+		if (!batch)
+			return -EINVAL;
+
+		it = reinterpret_cast<dnet_indexes_request *>(data);
+	}
+
+	if (items.empty()) {
 		return -EINVAL;
 	}
 
-	data_buffer buffer(sizeof(dnet_indexes_reply) + request->entries_count * 2 * sizeof(dnet_indexes_reply_entry));
+	// Group updates of capped collections by shard
+	std::map<dnet_raw_id, std::vector<size_t>, dnet_raw_id_less_than<>> capped;
+	for (size_t i = 0; i < items.size(); ++i) {
+		const uint64_t flags = items[i].entry->flags;
+		const uint64_t action = flags & (DNET_INDEXES_FLAGS_INTERNAL_INSERT
+			| DNET_INDEXES_FLAGS_INTERNAL_REMOVE | DNET_INDEXES_FLAGS_INTERNAL_REMOVE_ALL);
+
+		if ((flags & DNET_INDEXES_FLAGS_INTERNAL_CAPPED_COLLECTION)
+				&& (action == DNET_INDEXES_FLAGS_INTERNAL_INSERT || action == DNET_INDEXES_FLAGS_INTERNAL_REMOVE)) {
+			capped[items[i].entry->id].push_back(i);
+		}
+	}
+
+	std::vector<dnet_indexes_reply_entry> removed;
+	std::vector<bool> processed(items.size(), false);
+
+	local_session sess(backend, state->n);
+
+	for (size_t i = 0; i < items.size(); ++i) {
+		if (processed[i])
+			continue;
+
+		auto group = capped.find(items[i].entry->id);
+		if (group == capped.end() || group->second.front() != i) {
+			items[i].status = process_internal_indexes_entry(backend, state->n, *items[i].request, *items[i].entry);
+			processed[i] = true;
+			continue;
+		}
+
+		const std::vector<size_t> &positions = group->second;
+
+		std::vector<capped_update_t> updates;
+		updates.reserve(positions.size());
+
+		for (auto it = positions.begin(); it != positions.end(); ++it) {
+			const item_t &item = items[*it];
+
+			capped_update_t update;
+			update.action = item.entry->flags & (DNET_INDEXES_FLAGS_INTERNAL_INSERT | DNET_INDEXES_FLAGS_INTERNAL_REMOVE);
+			memcpy(update.object.id, item.request->id.id, sizeof(update.object.id));
+			update.data = data_pointer::from_raw(item.entry->data, item.entry->size);
+			updates.push_back(update);
+		}
+
+		dnet_id id;
+		memset(&id, 0, sizeof(id));
+		memcpy(id.id, group->first.id, DNET_ID_SIZE);
+
+		// limit and shard of the latest update are used
+		const dnet_indexes_request_entry &entry = *items[positions.back()].entry;
+		const int ret = process_capped_updates(sess, state->n, id, updates, entry, removed);
+
+		for (auto it = positions.begin(); it != positions.end(); ++it) {
+			items[*it].status = ret;
+			processed[*it] = true;
+		}
+	}
+
+	data_buffer buffer(sizeof(dnet_indexes_reply) + (items.size() + removed.size()) * sizeof(dnet_indexes_reply_entry));
 
 	dnet_indexes_reply reply;
 	memset(&reply, 0, sizeof(reply));
+	reply.entries_count = items.size() + removed.size();
 	buffer.write(reply);
 
-	size_t entries_count = request->entries_count;
-
 	dnet_indexes_reply_entry reply_entry;
 	memset(&reply_entry, 0, sizeof(reply_entry));
-	dnet_indexes_reply_entry reply_entry_removed;
-	memset(&reply_entry, 0, sizeof(reply_entry_removed));
-
-	std::vector<dnet_indexes_reply_entry> removed;
 
 	int err = -1;
 
-	for (uint64_t i = 0; i < request->entries_count; ++i) {
-		dnet_indexes_request_entry &entry = request->entries[i];
-		removed.clear();
-		auto *tmp = &removed;
-		int ret = process_internal_indexes_entry(backend, state->n, *request, entry, tmp);
-
-		reply_entry.id = entry.id;
-		reply_entry.status = ret;
+	for (auto it = items.begin(); it != items.end(); ++it) {
+		reply_entry.id = it->entry->id;
+		reply_entry.status = it->status;
 
 		buffer.write(reply_entry);
 
-		if (tmp) {
-			entries_count += removed.size();
-			for (auto it = removed.begin(); it != removed.end(); ++it)
-				buffer.write(*it);
-		}
-
-		if (!ret) {
+		if (!it->status) {
 			err = 0;
 		} else if (err == -1) {
-			err = ret;
+			err = it->status;
 		}
 	}
 
+	for (auto it = removed.begin(); it != removed.end(); ++it)
+		buffer.write(*it);
+
 	if (!err) {
 		data_pointer reply_data = std::move(buffer);
-		reply_data.data<dnet_indexes_reply>()->entries_count = entries_count;
 
 		cmd->flags &= (DNET_FLAGS_NEED_ACK | DNET_FLAGS_MORE);
 
@@ -736,10 +980,270 @@ int process_internal_indexes(struct dnet_backend_io *backend, dnet_net_state *st
 	return err;
 }
 
-int process_find_indexes(struct dnet_backend_io *backend, dnet_net_state *state, dnet_cmd *cmd, const dnet_id &request_id, dnet_indexes_request *request, bool more)
+/*!
+ * Sorted entries of the index shard. Table in the sorted layout is accessed right in the read buffer,
+ * tables in the msgpack layout or with not compacted updates are unpacked.
+ */
+class index_shard_entries
 {
-	local_session sess(backend, state->n);
+public:
+	index_shard_entries() : m_mapped(false)
+	{}
+
+	void load(dnet_node *node, dnet_id *id, const data_pointer &file)
+	{
+		try {
+			m_mapped = m_view.map(file) && !m_view.has_deltas();
+		} catch (const std::exception &) {
+			// corrupted table is reported by unpack
+			m_mapped = false;
+		}
+
+		if (!m_mapped) {
+			m_unpacked.indexes.clear();
+			indexes_unpack(node, id, file, &m_unpacked, "process_find_indexes");
+		}
+	}
+
+	size_t size() const
+	{
+		return m_mapped ? m_view.size() : m_unpacked.indexes.size();
+	}
+
+	const dnet_raw_id &id(size_t index) const
+	{
+		return m_mapped ? m_view.id(index) : m_unpacked.indexes[index].index;
+	}
+
+	data_pointer data(size_t index) const
+	{
+		return m_mapped ? m_view.data(index) : m_unpacked.indexes[index].data;
+	}
+
+private:
+	bool m_mapped;
+	index_table_view m_view;
+	dnet_indexes m_unpacked;
+};
+
+// number of threads of the node which read index shards ahead of INDEXES_FIND requests
+static const size_t index_reader_threads = 8;
+
+/*!
+ * Threads which read index shards ahead of INDEXES_FIND requests of all backends of the node.
+ * Pending tasks are still executed when the pool is being destroyed.
+ */
+class index_reader_pool
+{
+public:
+	index_reader_pool(size_t threads_number) : m_stop(false)
+	{
+		for (size_t i = 0; i < threads_number; ++i)
+			m_threads.emplace_back(std::bind(&index_reader_pool::run, this));
+	}
+
+	~index_reader_pool()
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+
+		for (auto it = m_threads.begin(); it != m_threads.end(); ++it)
+			it->join();
+	}
+
+	index_reader_pool(const index_reader_pool &) = delete;
+	index_reader_pool &operator =(const index_reader_pool &) = delete;
+
+	void submit(std::function<void ()> &&task)
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_tasks.push_back(std::move(task));
+		}
+		m_cond.notify_one();
+	}
+
+private:
+	void run()
+	{
+		dnet_set_name("dnet_index_read");
+
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		while (true) {
+			m_cond.wait(guard, [this] () { return m_stop || !m_tasks.empty(); });
+			if (m_tasks.empty())
+				break;
+
+			std::function<void ()> task = std::move(m_tasks.front());
+			m_tasks.pop_front();
 
+			guard.unlock();
+			task();
+			guard.lock();
+		}
+	}
+
+	std::mutex m_lock;
+	std::condition_variable m_cond;
+	std::deque<std::function<void ()>> m_tasks;
+	bool m_stop;
+	std::vector<std::thread> m_threads;
+};
+
+/*!
+ * Reads index shards of INDEXES_FIND request ahead by the node's index reader pool,
+ * the thread which processes the request reads shards nobody has started to read yet,
+ * so requests progress even when the pool is busy. Shards are read in request order
+ * not more than max_reads ahead of the processed one.
+ */
+class find_indexes_reader
+{
+public:
+	find_indexes_reader(struct dnet_backend_io *backend, dnet_node *node, std::vector<dnet_id> &&ids)
+		: m_sess(backend, node), m_pool(static_cast<index_reader_pool *>(node->indexes)),
+		m_state(std::make_shared<state_t>(backend, node, std::move(ids)))
+	{
+		std::unique_lock<std::mutex> guard(m_state->lock);
+		schedule(0);
+	}
+
+	~find_indexes_reader()
+	{
+		// queued reads are dropped, reads in progress use the backend and are waited for
+		std::unique_lock<std::mutex> guard(m_state->lock);
+		m_state->stop = true;
+		m_state->cond.wait(guard, [this] () { return m_state->reading == 0; });
+	}
+
+	/*!
+	 * Returns shard @index, waits for it if it is being read by the pool.
+	 * Shards must be requested in ascending order.
+	 */
+	data_pointer read(size_t index, int *err)
+	{
+		std::unique_lock<std::mutex> guard(m_state->lock);
+		schedule(index + 1);
+
+		shard_t &shard = m_state->shards[index];
+		if (shard.status == shard_t::pending)
+			read_shard(*m_state, &m_sess, index, guard);
+
+		m_state->cond.wait(guard, [&shard] () { return shard.status == shard_t::done; });
+
+		*err = shard.err;
+		return std::move(shard.data);
+	}
+
+private:
+	enum {
+		// number of shards read ahead of the processed one
+		max_reads = 8
+	};
+
+	struct shard_t {
+		enum status_t {
+			pending,
+			reading,
+			done
+		};
+
+		shard_t() : err(0), status(pending)
+		{}
+
+		data_pointer data;
+		int err;
+		status_t status;
+	};
+
+	// shared with queued pool tasks, which may outlive the reader
+	struct state_t {
+		state_t(struct dnet_backend_io *backend, dnet_node *node, std::vector<dnet_id> &&ids)
+			: backend(backend), node(node), ids(std::move(ids)), shards(this->ids.size()),
+			scheduled(0), reading(0), stop(false)
+		{}
+
+		struct dnet_backend_io *backend;
+		dnet_node *node;
+		std::vector<dnet_id> ids;
+		std::vector<shard_t> shards;
+		size_t scheduled;
+		size_t reading;
+		bool stop;
+		std::mutex lock;
+		std::condition_variable cond;
+	};
+
+	/*!
+	 * Submits reads of shards up to max_reads after @first to the pool, must be called under state lock
+	 */
+	void schedule(size_t first)
+	{
+		if (!m_pool)
+			return;
+
+		const size_t end = std::min(first + size_t(max_reads), m_state->shards.size());
+		for (m_state->scheduled = std::max(m_state->scheduled, first); m_state->scheduled < end; ++m_state->scheduled) {
+			std::shared_ptr<state_t> state = m_state;
+			const size_t index = m_state->scheduled;
+
+			m_pool->submit([state, index] () {
+				std::unique_lock<std::mutex> guard(state->lock);
+				if (!state->stop && state->shards[index].status == shard_t::pending)
+					read_shard(*state, NULL, index, guard);
+			});
+		}
+	}
+
+	/*!
+	 * Reads shard @index by @sess or by a new session if it is NULL, failure is stored into the shard,
+	 * so waiters are always woken up. @guard must hold state lock.
+	 */
+	static void read_shard(state_t &state, local_session *sess, size_t index, std::unique_lock<std::mutex> &guard)
+	{
+		shard_t &shard = state.shards[index];
+		shard.status = shard_t::reading;
+		++state.reading;
+		guard.unlock();
+
+		int err = 0;
+		data_pointer data;
+		try {
+			if (sess) {
+				data = sess->read(state.ids[index], &err);
+			} else {
+				local_session pool_sess(state.backend, state.node);
+				data = pool_sess.read(state.ids[index], &err);
+			}
+		} catch (const std::bad_alloc &) {
+			err = -ENOMEM;
+		} catch (const std::exception &e) {
+			dnet_log(state.node, DNET_LOG_ERROR, "INDEXES_FIND: failed to read shard: %s", e.what());
+			err = -EIO;
+		}
+
+		guard.lock();
+		shard.data = std::move(data);
+		shard.err = err;
+		shard.status = shard_t::done;
+		--state.reading;
+		state.cond.notify_all();
+	}
+
+	local_session m_sess;
+	index_reader_pool *m_pool;
+	std::shared_ptr<state_t> m_state;
+};
+
+/*!
+ * Processes one request of INDEXES_FIND chain, its shards are read by @reader starting from @first one
+ */
+int process_find_indexes(find_indexes_reader &reader, size_t first, dnet_net_state *state, dnet_cmd *cmd,
+	const dnet_id &request_id, dnet_indexes_request *request, bool more)
+{
 	const bool intersection = request->flags & DNET_INDEXES_FLAGS_INTERSECT;
 	const bool unite = request->flags & DNET_INDEXES_FLAGS_UNITE;
 
@@ -751,11 +1255,15 @@ int process_find_indexes(struct dnet_backend_io *backend, dnet_net_state *state,
 	}
 
 	std::vector<find_indexes_result_entry> result;
-	std::vector<data_pointer> data_cache;
 
-	std::map<dnet_raw_id, size_t, dnet_raw_id_less_than<> > result_map;
+	// shards which were read, in request order, they are not moved since intersection refers to them
+	std::vector<index_shard_entries> entries;
+	std::vector<dnet_raw_id> entries_ids;
+	entries.reserve(request->entries_count);
+	entries_ids.reserve(request->entries_count);
 
-	dnet_indexes tmp;
+	// objects found in all shards read so far, the rest shards are not read once it is empty
+	indexes_intersection<index_shard_entries> matches;
 
 	int err = -1;
 	dnet_id id = request_id;
@@ -769,8 +1277,7 @@ int process_find_indexes(struct dnet_backend_io *backend, dnet_net_state *state,
 		memcpy(id.id, request_entry.id.id, sizeof(id.id));
 
 		int ret = 0;
-		data_pointer data = sess.read(id, &ret);
-		data_cache.push_back(data);
+		data_pointer data = reader.read(first + i, &ret);
 
 		if (ret) {
 			dnet_log(state->n, DNET_LOG_DEBUG, "%s: INDEXES_FIND, err: %d",
@@ -786,52 +1293,48 @@ int process_find_indexes(struct dnet_backend_io *backend, dnet_net_state *state,
 		}
 		err = 0;
 
-		tmp.indexes.clear();
-		indexes_unpack(state->n, &id, data, &tmp, "process_find_indexes");
+		entries.emplace_back();
+		entries.back().load(state->n, &id, data);
+		entries_ids.push_back(request_entry.id);
 
-		if (unite) {
-			for (size_t j = 0; j < tmp.indexes.size(); ++j) {
-				const auto &entry = tmp.indexes[j];
+		if (intersection) {
+			matches.add(entries.back());
+			if (matches.size() == 0)
+				break;
+		}
+	}
 
-				auto it = result_map.find(entry.index);
-				if (it == result_map.end()) {
-					it = result_map.insert(std::make_pair(entry.index, result.size())).first;
-					result.resize(result.size() + 1);
-					result.back().id = entry.index;
-				}
+	if (intersection) {
+		result.resize(matches.size());
+		for (size_t i = 0; i < matches.size(); ++i) {
+			find_indexes_result_entry &entry = result[i];
+			entry.id = matches.id(i);
+			entry.indexes.reserve(entries.size());
 
-				index_entry result_entry = { request_entry.id, entry.data };
-				result[it->second].indexes.push_back(result_entry);
-			}
-		} else if (intersection && i == 0) {
-			result.resize(tmp.indexes.size());
-			for (size_t j = 0; j < tmp.indexes.size(); ++j) {
-				auto &entry = result[j];
-				entry.id = tmp.indexes[j].index;
-				index_entry result_entry = { request_entry.id, tmp.indexes[j].data };
+			for (size_t j = 0; j < entries.size(); ++j) {
+				index_entry result_entry = { entries_ids[j], entries[j].data(matches.position(i, j)) };
 				entry.indexes.push_back(result_entry);
 			}
-		} else if (intersection) {
-			// Remove all objects from result, which are not presented for this index
-			auto it = std::set_intersection(result.begin(), result.end(),
-				tmp.indexes.begin(), tmp.indexes.end(),
-				result.begin(),
-				dnet_raw_id_less_than<skip_data>());
-			result.resize(it - result.begin());
-
-			// Remove all objects from this index, which are not presented in result
-			std::set_intersection(tmp.indexes.begin(), tmp.indexes.end(),
-				result.begin(), result.end(),
-				tmp.indexes.begin(),
-				dnet_raw_id_less_than<skip_data>());
-
-			// As lists contain othe same objects - it's possible to add index data by one cycle
-			auto jt = tmp.indexes.begin();
-			for (auto kt = result.begin(); kt != result.end(); ++kt, ++jt) {
-				index_entry result_entry = { request_entry.id, jt->data };
-				kt->indexes.push_back(result_entry);
-			}
 		}
+	} else {
+		std::vector<const index_shard_entries *> shards;
+		shards.reserve(entries.size());
+		for (auto it = entries.begin(); it != entries.end(); ++it)
+			shards.push_back(&*it);
+
+		indexes_unite(shards, [&] (const dnet_raw_id &object, const std::vector<size_t> &positions) {
+			result.resize(result.size() + 1);
+			find_indexes_result_entry &entry = result.back();
+			entry.id = object;
+
+			for (size_t i = 0; i < shards.size(); ++i) {
+				if (positions[i] == indexes_npos)
+					continue;
+
+				index_entry result_entry = { entries_ids[i], shards[i]->data(positions[i]) };
+				entry.indexes.push_back(result_entry);
+			}
+		});
 	}
 
 	if (err != 0)
@@ -860,13 +1363,22 @@ int process_find_indexes(struct dnet_backend_io *backend, dnet_net_state *state,
 
 }
 
-int dnet_indexes_init(struct dnet_node *, struct dnet_config *)
+int dnet_indexes_init(struct dnet_node *node, struct dnet_config *)
 {
+	try {
+		node->indexes = new index_reader_pool(index_reader_threads);
+	} catch (const std::exception &e) {
+		dnet_log(node, DNET_LOG_ERROR, "failed to start index reader pool: %s", e.what());
+		return -ENOMEM;
+	}
+
 	return 0;
 }
 
-void dnet_indexes_cleanup(struct dnet_node *)
+void dnet_indexes_cleanup(struct dnet_node *node)
 {
+	delete static_cast<index_reader_pool *>(node->indexes);
+	node->indexes = NULL;
 }
 
 int dnet_process_indexes(struct dnet_backend_io *backend, dnet_net_state *st, dnet_cmd *cmd, void *data)
@@ -898,13 +1410,33 @@ int dnet_process_indexes(struct dnet_backend_io *backend, dnet_net_state *st, dn
 			err = process_internal_indexes(backend, st, cmd, request);
 			break;
 		case DNET_CMD_INDEXES_FIND: {
+			// Collect shards of all chained requests, so they all are read concurrently
+			std::vector<dnet_id> ids;
+			for (dnet_indexes_request *it = request; ; ) {
+				dnet_id id = it == request ? cmd->id : it->id;
+
+				char *data = reinterpret_cast<char *>(it + 1);
+				for (size_t i = 0; i < it->entries_count; ++i) {
+					auto entry = reinterpret_cast<dnet_indexes_request_entry *>(data);
+					memcpy(id.id, entry->id.id, sizeof(id.id));
+					ids.push_back(id);
+					data += sizeof(*entry) + entry->size;
+				}
+
+				if (!(it->flags & DNET_INDEXES_FLAGS_MORE))
+					break;
+				it = reinterpret_cast<dnet_indexes_request *>(data);
+			}
+
+			find_indexes_reader reader(backend, st->n, std::move(ids));
+			size_t shards_offset = 0;
 			bool first = true;
 
 			err = -1;
 
 			while (request) {
 				bool more = (request->flags & DNET_INDEXES_FLAGS_MORE);
-				int ret = process_find_indexes(backend, st, cmd, first ? cmd->id : request->id, request, more);
+				int ret = process_find_indexes(reader, shards_offset, st, cmd, first ? cmd->id : request->id, request, more);
 				first = false;
 
 				if (err == -1)
@@ -916,6 +1448,8 @@ int dnet_process_indexes(struct dnet_backend_io *backend, dnet_net_state *st, dn
 					break;
 				}
 
+				shards_offset += request->entries_count;
+
 				char *data = reinterpret_cast<char *>(request + 1);
 				for (size_t i = 0; i < request->entries_count; ++i) {
 					auto entry = reinterpret_cast<dnet_indexes_request_entry *>(data);
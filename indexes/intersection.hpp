@@ -0,0 +1,298 @@
+/*
+* 2015+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+* All rights reserved.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*/
+
+#ifndef INDEXES_INTERSECTION_HPP
+#define INDEXES_INTERSECTION_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <endian.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "elliptics/packet.h"
+
+/*
+ * Intersection and union of sorted index shards.
+ *
+ * Shard is any type which provides size() and id(position) returning const dnet_raw_id &
+ * in ascending order, like index_table_view or unpacked table.
+ */
+
+namespace ioremap { namespace elliptics {
+
+/*!
+ * Compares ids in memcmp() order. Ids of different objects almost always differ
+ * in the first 8 bytes, so they are compared as one big-endian number first.
+ */
+static inline int indexes_compare_id(const dnet_raw_id &a, const dnet_raw_id &b)
+{
+	uint64_t prefix_a, prefix_b;
+	memcpy(&prefix_a, a.id, sizeof(prefix_a));
+	memcpy(&prefix_b, b.id, sizeof(prefix_b));
+
+	if (prefix_a != prefix_b)
+		return be64toh(prefix_a) < be64toh(prefix_b) ? -1 : 1;
+
+#ifdef __SSE2__
+	for (size_t offset = 0; offset < DNET_ID_SIZE; offset += sizeof(__m128i)) {
+		const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a.id + offset));
+		const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b.id + offset));
+		const unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+
+		if (mask) {
+			const size_t position = offset + __builtin_ctz(mask);
+			return a.id[position] < b.id[position] ? -1 : 1;
+		}
+	}
+	return 0;
+#else
+	return memcmp(a.id + sizeof(prefix_a), b.id + sizeof(prefix_b), DNET_ID_SIZE - sizeof(prefix_a));
+#endif
+}
+
+/*!
+ * Returns position of the first id in @shard not less than @id starting from @first.
+ * Exponential search costs O(log distance), so skipping long runs of the larger shard is cheap.
+ */
+template <typename Shard>
+static inline size_t indexes_gallop(const Shard &shard, const dnet_raw_id &id, size_t first)
+{
+	const size_t size = shard.size();
+
+	if (first >= size || indexes_compare_id(shard.id(first), id) >= 0)
+		return first;
+
+	size_t bound = 1;
+	while (first + bound < size && indexes_compare_id(shard.id(first + bound), id) < 0)
+		bound *= 2;
+
+	// id at first + bound / 2 is known to be less than @id
+	size_t low = first + bound / 2 + 1;
+	size_t high = std::min(first + bound, size);
+
+	while (low < high) {
+		const size_t middle = low + (high - low) / 2;
+		if (indexes_compare_id(shard.id(middle), id) < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+/*!
+ * Calls @func(id, positions) for every id presented in all @shards in ascending order,
+ * positions[i] is the position of the id in shards[i].
+ *
+ * The smallest shard drives the intersection, others are galloped through,
+ * so intersecting a small shard with a huge one does not scan the huge one.
+ */
+template <typename Shard, typename Func>
+static inline void indexes_intersect(const std::vector<const Shard *> &shards, Func func)
+{
+	if (shards.empty())
+		return;
+
+	std::vector<size_t> order(shards.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		if (shards[i]->size() == 0)
+			return;
+		order[i] = i;
+	}
+
+	std::sort(order.begin(), order.end(), [&shards] (size_t first, size_t second) {
+		return shards[first]->size() < shards[second]->size();
+	});
+
+	std::vector<size_t> positions(shards.size(), 0);
+
+	const Shard &driver = *shards[order[0]];
+	size_t &driver_position = positions[order[0]];
+
+	while (driver_position < driver.size()) {
+		const dnet_raw_id &id = driver.id(driver_position);
+		bool matched = true;
+
+		for (size_t i = 1; i < order.size(); ++i) {
+			const Shard &shard = *shards[order[i]];
+			size_t &position = positions[order[i]];
+
+			position = indexes_gallop(shard, id, position);
+			if (position == shard.size())
+				return;
+
+			if (indexes_compare_id(shard.id(position), id) != 0) {
+				// skip ids of the driver which can not be presented in this shard
+				driver_position = indexes_gallop(driver, shard.id(position), driver_position + 1);
+				matched = false;
+				break;
+			}
+		}
+
+		if (matched) {
+			func(id, positions);
+			++driver_position;
+		}
+	}
+}
+
+/*!
+ * Intersection of shards which are added one by one as they are read, so reading of
+ * the remaining shards may be stopped as soon as nothing is left. Keeps positions
+ * of objects presented in all added shards, shards must outlive the intersection.
+ */
+template <typename Shard>
+class indexes_intersection
+{
+public:
+	indexes_intersection() : m_first(NULL), m_count(0)
+	{}
+
+	/*!
+	 * Leaves only objects which are presented in @shard too, the first shard is not copied.
+	 * Costs O(m log(n / m)), where m is the size of the smaller of the result and @shard.
+	 */
+	void add(const Shard &shard)
+	{
+		if (!m_first) {
+			m_first = &shard;
+			m_count = 1;
+			return;
+		}
+
+		std::vector<size_t> rows;
+		size_t index = 0;
+		size_t shard_position = 0;
+
+		while (index < size()) {
+			shard_position = indexes_gallop(shard, id(index), shard_position);
+			if (shard_position == shard.size())
+				break;
+
+			if (indexes_compare_id(shard.id(shard_position), id(index)) == 0) {
+				for (size_t i = 0; i < m_count; ++i)
+					rows.push_back(position(index, i));
+				rows.push_back(shard_position);
+
+				++index;
+				++shard_position;
+			} else {
+				index = indexes_gallop(*this, shard.id(shard_position), index + 1);
+			}
+		}
+
+		m_rows.swap(rows);
+		++m_count;
+	}
+
+	// number of objects presented in all added shards
+	size_t size() const
+	{
+		if (!m_first)
+			return 0;
+		return m_count == 1 ? m_first->size() : m_rows.size() / m_count;
+	}
+
+	// number of added shards
+	size_t shards() const
+	{
+		return m_count;
+	}
+
+	// id of object @index in ascending order
+	const dnet_raw_id &id(size_t index) const
+	{
+		return m_first->id(position(index, 0));
+	}
+
+	// position of object @index in added shard @shard
+	size_t position(size_t index, size_t shard) const
+	{
+		return m_count == 1 ? index : m_rows[index * m_count + shard];
+	}
+
+private:
+	const Shard *m_first;
+	size_t m_count;
+	// m_count positions per object, unused while there is only one shard
+	std::vector<size_t> m_rows;
+};
+
+// position of the shard which does not contain the id passed to indexes_unite() callback
+static const size_t indexes_npos = size_t(-1);
+
+/*!
+ * Calls @func(id, positions) for every id presented in any of @shards in ascending order,
+ * positions[i] is the position of the id in shards[i] or indexes_npos if it is not there.
+ */
+template <typename Shard, typename Func>
+static inline void indexes_unite(const std::vector<const Shard *> &shards, Func func)
+{
+	std::vector<size_t> cursors(shards.size(), 0);
+	std::vector<size_t> positions(shards.size(), indexes_npos);
+
+	// heap of shards which are not passed yet, the one with the least current id is on top
+	std::vector<size_t> heap;
+	heap.reserve(shards.size());
+	for (size_t i = 0; i < shards.size(); ++i) {
+		if (shards[i]->size() != 0)
+			heap.push_back(i);
+	}
+
+	auto greater = [&shards, &cursors] (size_t first, size_t second) {
+		return indexes_compare_id(shards[first]->id(cursors[first]), shards[second]->id(cursors[second])) > 0;
+	};
+	std::make_heap(heap.begin(), heap.end(), greater);
+
+	std::vector<size_t> matched;
+	matched.reserve(shards.size());
+
+	while (!heap.empty()) {
+		const size_t top = heap.front();
+		const dnet_raw_id &id = shards[top]->id(cursors[top]);
+
+		// take all shards which contain the same id
+		do {
+			const size_t shard = heap.front();
+			std::pop_heap(heap.begin(), heap.end(), greater);
+			heap.pop_back();
+
+			positions[shard] = cursors[shard];
+			matched.push_back(shard);
+		} while (!heap.empty() && indexes_compare_id(shards[heap.front()]->id(cursors[heap.front()]), id) == 0);
+
+		func(id, positions);
+
+		for (auto it = matched.begin(); it != matched.end(); ++it) {
+			positions[*it] = indexes_npos;
+
+			if (++cursors[*it] < shards[*it]->size()) {
+				heap.push_back(*it);
+				std::push_heap(heap.begin(), heap.end(), greater);
+			}
+		}
+		matched.clear();
+	}
+}
+
+}} /* namespace ioremap::elliptics */
+
+#endif /* INDEXES_INTERSECTION_HPP */
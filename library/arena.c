@@ -0,0 +1,253 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "elliptics.h"
+
+/*
+ * Slab is a large chunk of memory carved into objects of the same class.
+ * Slabs are never returned to the heap until arena is released.
+ */
+struct dnet_io_arena_slab {
+	struct dnet_io_arena_slab	*next;
+	size_t				size;
+	/* keep objects cacheline aligned */
+	char				__pad[64 - sizeof(void *) - sizeof(size_t)];
+};
+
+/*
+ * Returns arena holding a single owner's reference, which is dropped by dnet_io_arena_put().
+ */
+struct dnet_io_arena *dnet_io_arena_create(void)
+{
+	struct dnet_io_arena *a;
+	int i, err;
+
+	a = malloc(sizeof(struct dnet_io_arena));
+	if (!a)
+		goto err_out_exit;
+
+	memset(a, 0, sizeof(struct dnet_io_arena));
+	atomic_init(&a->refcnt, 1);
+
+	for (i = 0; i < DNET_IO_ARENA_CLASSES; ++i) {
+		struct dnet_io_arena_class *c = &a->classes[i];
+
+		err = dnet_lock_init(&c->lock);
+		if (err)
+			goto err_out_destroy;
+
+		c->arena = a;
+		c->size = 1UL << (DNET_IO_ARENA_MIN_SHIFT + i);
+	}
+
+	return a;
+
+err_out_destroy:
+	while (--i >= 0)
+		dnet_lock_destroy(&a->classes[i].lock);
+	free(a);
+err_out_exit:
+	return NULL;
+}
+
+/*
+ * Every request allocated from slab memory holds a reference to the arena,
+ * so slabs are freed only when both the owner has dropped its reference and the last such request
+ * has been returned: requests may outlive network and IO threads, e.g. when their data is referenced
+ * by requests queued to the send lists of states which are still alive.
+ */
+void dnet_io_arena_put(struct dnet_io_arena *a)
+{
+	struct dnet_io_arena_slab *slab, *next;
+	int i;
+
+	if (!atomic_dec_and_test(&a->refcnt))
+		return;
+
+	for (slab = a->slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+
+	for (i = 0; i < DNET_IO_ARENA_CLASSES; ++i)
+		dnet_lock_destroy(&a->classes[i].lock);
+
+	free(a);
+}
+
+static int dnet_io_arena_class_index(size_t size)
+{
+	int i;
+
+	for (i = 0; i < DNET_IO_ARENA_CLASSES; ++i) {
+		if (size <= (1UL << (DNET_IO_ARENA_MIN_SHIFT + i)))
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Allocates new slab for given class and puts all its objects into class free list.
+ * Called only from the owning network thread, so slab list is not protected.
+ */
+static int dnet_io_arena_grow(struct dnet_io_arena *a, struct dnet_io_arena_class *c)
+{
+	struct dnet_io_arena_slab *slab;
+	size_t slab_size = DNET_IO_ARENA_SLAB_SIZE;
+	size_t num, i;
+	char *first, *obj;
+
+	if (slab_size < c->size * 4 + sizeof(struct dnet_io_arena_slab))
+		slab_size = c->size * 4 + sizeof(struct dnet_io_arena_slab);
+
+	if (a->slab_memory + slab_size > DNET_IO_ARENA_MAX_SIZE)
+		return -ENOMEM;
+
+	slab = malloc(slab_size);
+	if (!slab)
+		return -ENOMEM;
+
+	slab->size = slab_size;
+	slab->next = a->slabs;
+	a->slabs = slab;
+	a->slab_memory += slab_size;
+
+	num = (slab_size - sizeof(struct dnet_io_arena_slab)) / c->size;
+	first = (char *)(slab + 1);
+
+	for (i = 0; i < num - 1; ++i) {
+		obj = first + i * c->size;
+		*(void **)obj = obj + c->size;
+	}
+	obj = first + (num - 1) * c->size;
+
+	dnet_lock_lock(&c->lock);
+	*(void **)obj = c->free_list;
+	c->free_list = first;
+	dnet_lock_unlock(&c->lock);
+
+	return 0;
+}
+
+static void *dnet_io_arena_class_pop(struct dnet_io_arena_class *c)
+{
+	void *obj;
+
+	dnet_lock_lock(&c->lock);
+	obj = c->free_list;
+	if (obj)
+		c->free_list = *(void **)obj;
+	dnet_lock_unlock(&c->lock);
+
+	return obj;
+}
+
+/*
+ * Returns request with zeroed dnet_io_req part and @size bytes of memory in total,
+ * header and data pointers must be set up by the caller.
+ */
+struct dnet_io_req *dnet_io_arena_alloc(struct dnet_io_arena *a, size_t size)
+{
+	struct dnet_io_arena_class *c = NULL;
+	struct dnet_io_req *r;
+	int idx;
+
+	idx = dnet_io_arena_class_index(size);
+	if (idx < 0) {
+		a->large++;
+		goto err_out_heap;
+	}
+
+	c = &a->classes[idx];
+
+	r = dnet_io_arena_class_pop(c);
+	if (!r) {
+		if (dnet_io_arena_grow(a, c)) {
+			a->misses++;
+			goto err_out_heap;
+		}
+
+		r = dnet_io_arena_class_pop(c);
+		if (!r) {
+			a->misses++;
+			goto err_out_heap;
+		}
+	}
+
+	a->hits++;
+	atomic_inc(&a->refcnt);
+
+	memset(r, 0, sizeof(struct dnet_io_req));
+	atomic_init(&r->refcnt, 1);
+	r->arena_class = c;
+	return r;
+
+err_out_heap:
+	r = malloc(size);
+	if (!r)
+		return NULL;
+
+	memset(r, 0, sizeof(struct dnet_io_req));
+	atomic_init(&r->refcnt, 1);
+	return r;
+}
+
+void dnet_io_arena_free(struct dnet_io_req *r)
+{
+	struct dnet_io_arena_class *c = r->arena_class;
+
+	if (!c) {
+		free(r);
+		return;
+	}
+
+	dnet_lock_lock(&c->lock);
+	*(void **)r = c->free_list;
+	c->free_list = r;
+	dnet_lock_unlock(&c->lock);
+
+	dnet_io_arena_put(c->arena);
+}
+
+void dnet_io_arena_stat(struct dnet_io_arena *a, struct dnet_io_arena_stats *stats)
+{
+	stats->hits += a->hits;
+	stats->misses += a->misses;
+	stats->large += a->large;
+	stats->slab_memory += a->slab_memory;
+}
+
+void dnet_io_arena_stat_all(struct dnet_node *n, struct dnet_io_arena_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(struct dnet_io_arena_stats));
+
+	if (!n->io)
+		return;
+
+	for (i = 0; i < n->io->net_thread_num; ++i) {
+		if (n->io->net[i].arena)
+			dnet_io_arena_stat(n->io->net[i].arena, stats);
+	}
+}
@@ -169,6 +169,8 @@ static void dnet_backend_io_cleanup(struct dnet_node *n, struct dnet_backend_io
 
 	dnet_work_pool_cleanup(&io->pool.recv_pool);
 	dnet_work_pool_cleanup(&io->pool.recv_pool_nb);
+	// requests stolen by other backends' threads may still be in progress
+	dnet_work_pool_wait_stolen(io);
 	dnet_backend_command_stats_cleanup(io);
 
 	dnet_log(n, DNET_LOG_NOTICE, "dnet_backend_io_cleanup: backend: %zu", io->backend_id);
@@ -785,6 +787,9 @@ void dnet_backend_info::parse(ioremap::elliptics::config::config_data *data, con
 		cache_config = blackhole::aux::util::make_unique<ioremap::cache::cache_config>(*data->cache_config);
 	}
 
+	if (cache_config)
+		cache_config->snapshot_path = history + "/cache.snapshot";
+
 	io_thread_num = backend.at("io_thread_num", data->cfg_state.io_thread_num);
 	nonblocking_io_thread_num = backend.at("nonblocking_io_thread_num", data->cfg_state.nonblocking_io_thread_num);
 
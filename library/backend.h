@@ -25,6 +25,18 @@ struct cache_config
 	size_t			count;
 	unsigned		sync_timeout;
 	std::vector<size_t>	pages_proportions;
+	bool			tinylfu;
+	size_t			admission_object_size;
+	size_t			flushers;
+	size_t			dirty_high_watermark;
+	size_t			dirty_low_watermark;
+	std::string		snapshot_path;
+	unsigned		snapshot_interval;
+	size_t			warm_up_rate;
+	size_t			min_size;
+	size_t			max_size;
+	size_t			reserved_memory;
+	unsigned		resize_interval;
 
 	static std::unique_ptr<cache_config> parse(const ioremap::elliptics::config::config &cache);
 };
@@ -17,6 +17,10 @@
  * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -24,6 +28,7 @@
 #include <sys/wait.h>
 
 #include <fcntl.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -55,8 +60,27 @@ long dnet_get_id(void)
 {
 	return syscall(SYS_gettid);
 }
+
+int dnet_set_affinity(const int *cpus, int num)
+{
+	cpu_set_t set;
+	int i;
+
+	CPU_ZERO(&set);
+	for (i = 0; i < num; ++i) {
+		if (cpus[i] >= CPU_SETSIZE)
+			return -EINVAL;
+		CPU_SET(cpus[i], &set);
+	}
+
+	if (sched_setaffinity(0, sizeof(set), &set))
+		return -errno;
+
+	return 0;
+}
 #else
 int dnet_set_name(char *format __attribute__ ((unused)), ...) { return 0; }
+int dnet_set_affinity(const int *cpus __attribute__ ((unused)), int num __attribute__ ((unused))) { return 0; }
 
 long dnet_get_id(void)
 {
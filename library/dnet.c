@@ -311,8 +311,8 @@ int dnet_send_reply(void *state, struct dnet_cmd *cmd, const void *odata, unsign
 
 	dnet_convert_cmd(c);
 
-	err = dnet_send(st, c, sizeof(struct dnet_cmd) + size);
-	free(c);
+	/* reply buffer is handed over to the send queue and freed when sent */
+	err = dnet_send_data_ref(st, NULL, 0, c, sizeof(struct dnet_cmd) + size, free, c);
 
 	return err;
 }
@@ -735,7 +735,7 @@ static int dnet_cmd_bulk_read(struct dnet_backend_io *backend, struct dnet_net_s
 	int err = -1, ret;
 	struct dnet_io_attr *io = data;
 	struct dnet_io_attr *ios = io + 1;
-	uint64_t count = 0;
+	uint64_t count = 0, misses = 0;
 	uint64_t i;
 
 	struct dnet_cmd read_cmd = *cmd;
@@ -746,6 +746,35 @@ static int dnet_cmd_bulk_read(struct dnet_backend_io *backend, struct dnet_net_s
 	dnet_convert_io_attr(io);
 	count = io->size / sizeof(struct dnet_io_attr);
 
+	/*
+	 * Objects found in cache are sent right away without taking their oplocks,
+	 * only missed ones are left in @ios for the backend
+	 */
+	ret = dnet_cmd_cache_bulk_read(backend, st, &read_cmd, ios, count, &misses);
+	if (misses < count) {
+		dnet_log(st->n, DNET_LOG_NOTICE, "%s: BULK_READ: %d/%d commands served from cache, err: %d",
+			dnet_dump_id(&cmd->id), (int) (count - misses), (int) count, ret);
+
+		err = ret;
+		count = misses;
+		io->size = count * sizeof(struct dnet_io_attr);
+		cmd->size = sizeof(struct dnet_io_attr) + io->size;
+
+		if (count == 0)
+			return err;
+	}
+
+	dnet_convert_io_attr(io);
+	ret = backend->cb->command_handler(st, backend->cb->command_private, cmd, data);
+	if (ret != -ENOTSUP) {
+		if (!ret)
+			err = 0;
+		else if (err == -1)
+			err = ret;
+		return err;
+	}
+	dnet_convert_io_attr(io);
+
 	if (count > 0) {
 		cmd->flags &= ~DNET_FLAGS_NEED_ACK;
 	}
@@ -923,11 +952,7 @@ static int dnet_process_cmd_with_backend_raw(struct dnet_backend_io *backend, st
 				err = dnet_notify_remove(st, cmd);
 			break;
 		case DNET_CMD_BULK_READ:
-			err = backend->cb->command_handler(st, backend->cb->command_private, cmd, data);
-
-			if (err == -ENOTSUP) {
-				err = dnet_cmd_bulk_read(backend, st, cmd, data);
-			}
+			err = dnet_cmd_bulk_read(backend, st, cmd, data);
 			break;
 		case DNET_CMD_READ:
 		case DNET_CMD_WRITE:
@@ -1033,6 +1058,9 @@ int dnet_process_cmd_raw(struct dnet_backend_io *backend, struct dnet_net_state
 	HANDY_TIMER_SCOPE(recursive ? "io.cmd_recursive" : "io.cmd");
 	FORMATTED(HANDY_TIMER_SCOPE, ("io.cmd%s.%s", (recursive ? "_recursive" : ""), dnet_cmd_string(cmd->cmd)));
 
+	if (backend && cmd->cmd == DNET_CMD_WRITE && cmd->size >= sizeof(struct dnet_io_attr))
+		dnet_cmd_cache_throttle(backend, st, cmd, data);
+
 	if (!(cmd->flags & DNET_FLAGS_NOLOCK)) {
 		FORMATTED(HANDY_TIMER_SCOPE, ("io.cmd.%s.lock_time", dnet_cmd_string(cmd->cmd)));
 		dnet_oplock(n, &cmd->id);
@@ -1120,8 +1148,52 @@ int dnet_process_cmd_raw(struct dnet_backend_io *backend, struct dnet_net_state
 	return err;
 }
 
-int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
-		int fd, uint64_t offset, int on_exit)
+static void dnet_release_data_refs(struct dnet_data_ref *refs, int num)
+{
+	int i;
+
+	for (i = 0; i < num; ++i) {
+		if (refs[i].release)
+			refs[i].release(refs[i].priv);
+	}
+}
+
+/*
+ * Checksum is calculated over contiguous data, so data split into several blocks is gathered first
+ */
+static int dnet_checksum_data_refs(struct dnet_node *n, struct dnet_data_ref *refs, int num,
+		unsigned char *csum, int csize)
+{
+	uint64_t size = 0, offset = 0;
+	char *buf;
+	int i, err;
+
+	if (num == 1)
+		return dnet_checksum_data(n, refs[0].data, refs[0].size, csum, csize);
+
+	for (i = 0; i < num; ++i)
+		size += refs[i].size;
+
+	buf = malloc(size);
+	if (!buf)
+		return -ENOMEM;
+
+	for (i = 0; i < num; ++i) {
+		memcpy(buf + offset, refs[i].data, refs[i].size);
+		offset += refs[i].size;
+	}
+
+	err = dnet_checksum_data(n, buf, size, csum, csize);
+	free(buf);
+	return err;
+}
+
+/*
+ * Reply data is either @data buffer, which is copied into the send queue,
+ * or @num blocks referenced by @refs, or @fd file region.
+ */
+static int dnet_send_read_data_raw(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		int fd, uint64_t offset, int on_exit, struct dnet_data_ref *refs, int num)
 {
 	struct dnet_net_state *st = state;
 	struct dnet_node *n = st->n;
@@ -1138,15 +1210,17 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 	 * back to parental client, instead server will wrap data into
 	 * proper transaction reply next to this obscure packet.
 	 */
-	if (io->flags & DNET_IO_FLAGS_SKIP_SENDING)
-		return 0;
+	if (io->flags & DNET_IO_FLAGS_SKIP_SENDING) {
+		err = 0;
+		goto err_out_release;
+	}
 
 	gettimeofday(&start_tv, NULL);
 
 	c = malloc(hsize);
 	if (!c) {
 		err = -ENOMEM;
-		goto err_out_exit;
+		goto err_out_release;
 	}
 
 	memset(c, 0, hsize);
@@ -1171,19 +1245,23 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 	dnet_convert_io_attr(rio);
 
 	if (io->flags & DNET_IO_FLAGS_CHECKSUM) {
-		if (data) {
+		if (refs) {
+			err = dnet_checksum_data_refs(n, refs, num, rio->parent, sizeof(rio->parent));
+		} else if (data) {
 			err = dnet_checksum_data(n, data, rio->size, rio->parent, sizeof(rio->parent));
 		} else {
 			err = dnet_checksum_fd(n, fd, offset, rio->size, rio->parent, sizeof(rio->parent));
 		}
 
 		if (err)
-			goto err_out_free;
+			goto err_out_free_release;
 	}
 
 	gettimeofday(&csum_tv, NULL);
 
-	if (data)
+	if (refs)
+		err = dnet_send_data_refs(st, c, hsize, refs, num);
+	else if (data)
 		err = dnet_send_data(st, c, hsize, data, rio->size);
 	else
 		err = dnet_send_fd(st, c, hsize, fd, offset, rio->size, on_exit);
@@ -1200,13 +1278,41 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 			(unsigned long long)io->offset,	(unsigned long long)io->size,
 			csum_time, send_time, total_time);
 
+	free(c);
+	return err;
 
-err_out_free:
+err_out_free_release:
 	free(c);
-err_out_exit:
+err_out_release:
+	dnet_release_data_refs(refs, num);
 	return err;
 }
 
+int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		int fd, uint64_t offset, int on_exit)
+{
+	return dnet_send_read_data_raw(state, cmd, io, data, fd, offset, on_exit, NULL, 0);
+}
+
+int dnet_send_read_data_ref(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		void (*release)(void *priv), void *priv)
+{
+	struct dnet_data_ref ref;
+
+	ref.data = data;
+	ref.size = io->size;
+	ref.release = release;
+	ref.priv = priv;
+
+	return dnet_send_read_data_raw(state, cmd, io, NULL, -1, 0, 0, &ref, 1);
+}
+
+int dnet_send_read_data_refs(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
+		struct dnet_data_ref *refs, int num)
+{
+	return dnet_send_read_data_raw(state, cmd, io, NULL, -1, 0, 0, refs, num);
+}
+
 static void dnet_fill_state_addr(void *state, struct dnet_addr *addr)
 {
 	struct dnet_net_state *st = state;
@@ -1597,7 +1597,9 @@ int dnet_get_vm_stat(dnet_logger *l, struct dnet_vm_stat *st) {
 	int err;
 	FILE *f;
 	float la[3];
-	unsigned long long stub;
+	char line[128], name[32];
+	unsigned long long value;
+	int have_available = 0;
 
 	memset(st, 0, sizeof(struct dnet_vm_stat));
 
@@ -1634,13 +1636,37 @@ int dnet_get_vm_stat(dnet_logger *l, struct dnet_vm_stat *st) {
 		goto err_out_exit;
 	}
 
-	err = fscanf(f, "MemTotal:%llu kB\n", (unsigned long long *)&st->vm_total);
-	err = fscanf(f, "MemFree:%llu kB\n", (unsigned long long *)&st->vm_free);
-	err = fscanf(f, "Buffers:%llu kB\n", (unsigned long long *)&st->vm_buffers);
-	err = fscanf(f, "Cached:%llu kB\n", (unsigned long long *)&st->vm_cached);
-	err = fscanf(f, "SwapCached:%llu kB\n", (unsigned long long *)&stub);
-	err = fscanf(f, "Active:%llu kB\n", (unsigned long long *)&st->vm_active);
-	err = fscanf(f, "Inactive:%llu kB\n", (unsigned long long *)&st->vm_inactive);
+	/*
+	 * Fields are matched by name, since set and order of the fields differ between kernels
+	 */
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%31[^:]: %llu", name, &value) != 2)
+			continue;
+
+		if (!strcmp(name, "MemTotal"))
+			st->vm_total = value;
+		else if (!strcmp(name, "MemFree"))
+			st->vm_free = value;
+		else if (!strcmp(name, "MemAvailable")) {
+			st->vm_available = value;
+			have_available = 1;
+		}
+		else if (!strcmp(name, "Buffers"))
+			st->vm_buffers = value;
+		else if (!strcmp(name, "Cached"))
+			st->vm_cached = value;
+		else if (!strcmp(name, "Active"))
+			st->vm_active = value;
+		else if (!strcmp(name, "Inactive"))
+			st->vm_inactive = value;
+	}
+
+	/*
+	 * Kernels before 3.14 do not report MemAvailable, page cache and buffers are counted
+	 * as available there, although part of them can not be reclaimed
+	 */
+	if (!have_available)
+		st->vm_available = st->vm_free + st->vm_cached + st->vm_buffers;
 
 	fclose(f);
 	return 0;
@@ -1698,6 +1724,8 @@ int dnet_get_vm_stat(dnet_logger *l, struct dnet_vm_stat *st) {
 	st->vm_cached *= page_size;
 	st->vm_buffers *= page_size;
 
+	st->vm_available = st->vm_free + st->vm_cached;
+
 	return 0;
 }
 #else
@@ -108,11 +108,18 @@ extern __thread uint64_t trace_id;
 	DNET_LOG_PRINT_ERR(-errno, format, ##a) \
 	DNET_LOG_END()
 
+struct dnet_io_arena_class;
+struct dnet_work_reply_bucket;
 struct dnet_io_req {
 	struct list_head	req_entry;
+	/* work pool's reply bucket of the queued transaction reply, NULL for other requests */
+	struct dnet_work_reply_bucket	*reply_bucket;
 
 	struct dnet_net_state	*st;
 
+	/* size class of receive arena this request was allocated from, NULL if it lives in the heap */
+	struct dnet_io_arena_class	*arena_class;
+
 	void			*header;
 	size_t			hsize;
 
@@ -123,6 +130,16 @@ struct dnet_io_req {
 	int			fd;
 	off_t			local_offset;
 	size_t			fsize;
+
+	/*
+	 * If @release is set, @data is not copied when request is queued,
+	 * instead @release(@release_priv) is called when request is sent or dropped.
+	 */
+	void			(*release)(void *priv);
+	void			*release_priv;
+
+	/* request is destroyed when the last reference is dropped via dnet_io_req_free() */
+	atomic_t		refcnt;
 };
 
 /*
@@ -142,6 +159,15 @@ struct dnet_io_req {
 #define DNET_SEND_WATERMARK_HIGH	(1024 * 100)
 #define DNET_SEND_WATERMARK_LOW		(512 * 100)
 
+/* Maximum number of queued requests coalesced into single sendmsg() call */
+#define DNET_SEND_BATCH_MAX_REQUESTS	64
+
+/* Size of per-state buffer many small commands are received into with single recv() call */
+#define DNET_RECV_BUFFER_SIZE		(64 * 1024)
+
+/* Maximum number of received requests queued to IO pools at once */
+#define DNET_RECV_BATCH_MAX_REQUESTS	64
+
 /* Internal flag to ignore cache */
 #define DNET_IO_FLAGS_NOCACHE		(1<<28)
 
@@ -160,6 +186,8 @@ struct dnet_net_state
 	struct list_head	storage_state_entry;
 	// To store list of all idc connected with this state
 	struct list_head	idc_list;
+	// To store at dnet_work_pool::paused_list while reading from the socket is paused
+	struct list_head	paused_entry;
 
 	struct dnet_node	*n;
 
@@ -190,6 +218,10 @@ struct dnet_net_state
 	unsigned int		rcv_flags;
 	void			*rcv_data;
 
+	/* received but not yet parsed bytes are [rcv_buf_start, rcv_buf_end) of DNET_RECV_BUFFER_SIZE buffer */
+	char			*rcv_buf;
+	unsigned int		rcv_buf_start, rcv_buf_end;
+
 	int			epoll_fd;
 	size_t			send_offset;
 	pthread_mutex_t		send_lock;
@@ -253,7 +285,7 @@ int dnet_state_move_to_dht(struct dnet_net_state *st, struct dnet_addr *addrs, i
 struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 		struct dnet_backend_ids **backends, int backends_count,
 		struct dnet_addr *addr, int s, int *errp, int join, int server_node, int idx,
-		int accepting_state, struct dnet_addr *addrs, int addrs_count);
+		int accepting_state, struct dnet_addr *addrs, int addrs_count, int epoll_fd);
 
 void dnet_state_reset(struct dnet_net_state *st, int error);
 void dnet_state_clean(struct dnet_net_state *st);
@@ -283,7 +315,7 @@ int dnet_schedule_recv(struct dnet_net_state *st);
 void dnet_unschedule_send(struct dnet_net_state *st);
 void dnet_unschedule_all(struct dnet_net_state *st);
 
-int dnet_setup_control_nolock(struct dnet_net_state *st);
+int dnet_setup_control_nolock(struct dnet_net_state *st, int epoll_fd);
 
 int dnet_add_reconnect_state(struct dnet_node *n, const struct dnet_addr *addr, unsigned int join_state);
 
@@ -396,10 +428,85 @@ struct dnet_transform
 int dnet_crypto_init(struct dnet_node *n);
 void dnet_crypto_cleanup(struct dnet_node *n);
 
+/*
+ * Receive arena: size-classed slab allocator for incoming requests.
+ *
+ * Every network thread owns an arena. Requests (dnet_io_req + command + payload)
+ * are allocated only by the thread which reads them from the socket, but they are
+ * returned by IO threads when processing is completed, thus every class free list
+ * is protected by its own lock. Requests larger than the biggest class or those
+ * which do not fit into arena memory limit are allocated from the heap.
+ * Arena is reference counted, since its requests may outlive the network thread.
+ */
+#define DNET_IO_ARENA_MIN_SHIFT		8			/* smallest class is 256 bytes */
+#define DNET_IO_ARENA_CLASSES		9			/* largest class is 64 Kb */
+#define DNET_IO_ARENA_SLAB_SIZE		(256 * 1024)
+#define DNET_IO_ARENA_MAX_SIZE		(16 * 1024 * 1024)	/* slab memory limit per network thread */
+
+struct dnet_io_arena;
+struct dnet_io_arena_slab;
+
+struct dnet_io_arena_class {
+	struct dnet_lock	lock;
+	struct dnet_io_arena	*arena;
+	size_t			size;
+	void			*free_list;
+};
+
+struct dnet_io_arena {
+	struct dnet_io_arena_class	classes[DNET_IO_ARENA_CLASSES];
+	struct dnet_io_arena_slab	*slabs;
+	uint64_t			slab_memory;
+
+	/* owner's reference plus one per request allocated from slab memory */
+	atomic_t			refcnt;
+
+	/* updated only by the owning network thread */
+	uint64_t			hits;
+	uint64_t			misses;
+	uint64_t			large;
+};
+
+struct dnet_io_arena_stats {
+	uint64_t		hits;		/* requests served from slab memory */
+	uint64_t		misses;		/* requests allocated from the heap because arena is full */
+	uint64_t		large;		/* requests allocated from the heap because they do not fit any class */
+	uint64_t		slab_memory;
+};
+
+struct dnet_io_arena *dnet_io_arena_create(void);
+void dnet_io_arena_put(struct dnet_io_arena *a);
+struct dnet_io_req *dnet_io_arena_alloc(struct dnet_io_arena *a, size_t size);
+void dnet_io_arena_free(struct dnet_io_req *r);
+void dnet_io_arena_stat(struct dnet_io_arena *a, struct dnet_io_arena_stats *stats);
+
+/*
+ * io_uring network engine: epoll still reports ready sockets, but receives and sends
+ * for all of them are submitted to the kernel with single io_uring_enter() call.
+ */
+#define DNET_URING_ENTRIES		256
+
+struct dnet_uring;
+struct dnet_uring_op;
+
+struct dnet_uring *dnet_uring_create(unsigned int entries, int *errp);
+void dnet_uring_destroy(struct dnet_uring *ring);
+int dnet_uring_prep_recv(struct dnet_uring *ring, int fd, void *buf, size_t size, void *priv);
+int dnet_uring_prep_recvmsg(struct dnet_uring *ring, int fd, struct msghdr *msg, void *priv);
+int dnet_uring_prep_sendmsg(struct dnet_uring *ring, int fd, struct msghdr *msg, void *priv);
+int dnet_uring_submit_and_wait(struct dnet_uring *ring);
+int dnet_uring_reap(struct dnet_uring *ring, void **priv, int *res);
+
 struct dnet_net_io {
 	int			epoll_fd;
 	pthread_t		tid;
 	struct dnet_node	*n;
+	struct dnet_io_arena	*arena;
+
+	/* NULL if network thread uses plain epoll engine */
+	struct dnet_uring	*uring;
+	struct dnet_uring_op	*uring_ops;
+	int			uring_ops_num;
 };
 
 enum dnet_work_io_mode {
@@ -409,19 +516,53 @@ enum dnet_work_io_mode {
 	DNET_WORK_IO_MODE_EXEC_BLOCKING,
 };
 
+struct list_stat {
+	uint64_t		list_size;
+};
+
+/*
+ * Transaction replies of the pool whose transaction numbers hash to the same bucket.
+ * Bucket is claimed by the thread processing its reply, thus replies to the same transaction
+ * are processed sequentially and in order. Bucket belongs to the thread selected by its index,
+ * its fields are protected by that thread's @lock.
+ */
+struct dnet_work_reply_bucket {
+	/* replies taken from the owner's queue while bucket has been claimed, they go first once it is released */
+	struct list_head	list;
+	/* entry of owner's @reply_ready list while bucket has parked replies and is not claimed */
+	struct list_head	ready_entry;
+	int			claimed;
+};
+
+#define DNET_WORK_REPLY_BUCKETS		256
+
+/* idle threads steal transaction replies only from queues longer than this, see dnet_work_io_overloaded() */
+#define DNET_WORK_REPLY_STEAL_BACKLOG	64
+
+/*
+ * Every IO thread owns its own request queue protected by its own lock.
+ * Transaction replies are queued to the owner of their reply bucket, the thread or any idle thread
+ * which steals from it claims the bucket of the taken reply until it asks for the next request.
+ */
 struct dnet_work_pool;
 struct dnet_work_io {
 	struct list_head	list;
+	/* reply buckets of this thread which have parked replies and are not claimed */
+	struct list_head	reply_ready;
+	struct list_stat	list_stats;
+	pthread_mutex_t		lock;
+	pthread_cond_t		wait;
+	/* thread waits on @wait for new requests, updated under @lock */
+	int			sleeping;
+	/* thread has been asked to look for requests in other queues, updated under @lock */
+	int			woken;
 	int			thread_index;
-	uint64_t		trans;
+	/* reply bucket claimed by this thread or NULL */
+	struct dnet_work_reply_bucket	*reply_bucket;
 	pthread_t		tid;
 	struct dnet_work_pool	*pool;
 };
 
-struct list_stat {
-	uint64_t		list_size;
-};
-
 static inline void list_stat_init(struct list_stat *st) {
 	st->list_size = 0ULL;
 }
@@ -440,23 +581,40 @@ struct dnet_work_pool {
 	struct dnet_backend_io	*io;
 	int			mode;
 	int			num;
-	struct list_head	list;
-	struct list_stat	list_stats;
+	/* round-robin position for requests which are not transaction replies */
+	atomic_t		next_thread;
+	/* requests this pool's threads took from other backends and requests other backends took from it */
+	atomic_t		steals;
+	atomic_t		stolen;
+	/* number of requests queued to all pool's threads and its limit, 0 - unlimited */
+	atomic_t		queued;
+	int			queue_limit;
+	/* states which do not read new requests until the queue shrinks, protected by @lock */
+	atomic_t		paused;
+	struct list_head	paused_list;
 	pthread_mutex_t		lock;
-	pthread_cond_t		wait;
+	/* transaction replies which are not taken by any thread yet, buckets are selected by transaction hash */
+	struct dnet_work_reply_bucket	reply_buckets[DNET_WORK_REPLY_BUCKETS];
 	struct dnet_work_io	*wio_list;
 };
 
 struct dnet_work_pool_place
 {
 	pthread_mutex_t		lock;
+	/* signalled when requests stolen from the backend by other backends' threads are completed */
 	pthread_cond_t		wait;
 	struct dnet_work_pool	*pool;
 };
 
+int dnet_work_pool_place_init(struct dnet_work_pool_place *place);
+void dnet_work_pool_place_cleanup(struct dnet_work_pool_place *place);
 void dnet_work_pool_cleanup(struct dnet_work_pool_place *place);
 int dnet_work_pool_alloc(struct dnet_work_pool_place *place, struct dnet_node *n,
 	struct dnet_backend_io *io, int num, int mode, void *(* process)(void *));
+void dnet_work_pool_push(struct dnet_work_pool *pool, struct dnet_io_req *r);
+struct dnet_io_req *dnet_work_pool_take(struct dnet_work_io *wio, long timeout_ms);
+void dnet_work_pool_stat(struct dnet_work_pool *pool, struct list_stat *stats);
+void dnet_work_pool_wait_stolen(struct dnet_backend_io *io);
 
 struct dnet_io_pool
 {
@@ -474,6 +632,8 @@ struct dnet_backend_io
 	struct dnet_backend_callbacks	*cb;
 	void				*cache;
 	void				*command_stats;
+	/* number of this backend's requests being processed by other backends' threads */
+	atomic_t			stolen_inflight;
 };
 
 int dnet_backend_command_stats_init(struct dnet_backend_io *backend_io);
@@ -487,6 +647,17 @@ struct dnet_io {
 	int			net_thread_num, net_thread_pos;
 	struct dnet_net_io	*net;
 
+	/* CPUs network and IO threads are bound to, NULL - no affinity */
+	int			*net_cpus, net_cpus_num;
+	int			*io_cpus, io_cpus_num;
+
+	size_t			send_batch_size;
+
+	/* nonblocking backend queue length which allows other backends to steal from it, 0 - disabled */
+	int			work_steal_threshold;
+
+	/* maximum number of requests queued per IO thread of the pool */
+	int			io_queue_limit;
 
 	struct dnet_backend_io	*backends;
 	size_t			backends_count;
@@ -494,10 +665,8 @@ struct dnet_io {
 
 	struct dnet_io_pool	pool;
 
-	// condition variable for waiting when io pools are able to process packets
+	// protects output_stats
 	pthread_mutex_t		full_lock;
-	pthread_cond_t		full_wait;
-	int			blocked;
 
 	struct list_stat	output_stats;
 };
@@ -510,20 +679,46 @@ void dnet_io_exit(struct dnet_node *n);
 
 void dnet_io_req_free(struct dnet_io_req *r);
 
+static inline struct dnet_io_req *dnet_io_req_get(struct dnet_io_req *r)
+{
+	atomic_inc(&r->refcnt);
+	return r;
+}
+void dnet_io_arena_stat_all(struct dnet_node *n, struct dnet_io_arena_stats *stats);
+uint64_t dnet_io_paused_states(struct dnet_node *n);
+
 struct dnet_locks_entry {
-	struct rb_node		lock_tree_entry;
 	struct list_head	lock_list_entry;
 	pthread_mutex_t		lock;
 	pthread_cond_t		wait;
+	uint64_t		hash;
 	struct dnet_raw_id	id;
 	int			locked;
 	atomic_t		refcnt;
 };
 
-struct dnet_locks {
-	struct list_head	lock_list;
-	struct rb_root		lock_tree;
+#define DNET_LOCKS_STRIPES_NUM		64
+/* lock wait time histogram: <10us, <100us, <1ms, <10ms, <100ms, <1s, >=1s */
+#define DNET_LOCKS_WAIT_BUCKETS		7
+
+struct dnet_locks_stripe {
 	pthread_mutex_t		lock;
+	struct list_head	free_list;
+	/* open-addressing table of entries in use, @mask + 1 slots */
+	struct dnet_locks_entry	**table;
+	unsigned int		mask;
+	unsigned int		used;
+	atomic_t		wait_hist[DNET_LOCKS_WAIT_BUCKETS];
+};
+
+struct dnet_locks {
+	int			stripes_num;
+	struct dnet_locks_stripe	stripes[DNET_LOCKS_STRIPES_NUM];
+};
+
+struct dnet_locks_stripe_stats {
+	uint64_t		used, free, table_size;
+	uint64_t		wait_hist[DNET_LOCKS_WAIT_BUCKETS];
 };
 
 void dnet_locks_destroy(struct dnet_node *n);
@@ -531,6 +726,7 @@ int dnet_locks_init(struct dnet_node *n, int num);
 void dnet_oplock(struct dnet_node *n, struct dnet_id *key);
 void dnet_opunlock(struct dnet_node *n, struct dnet_id *key);
 int dnet_optrylock(struct dnet_node *n, struct dnet_id *key);
+void dnet_locks_stat(struct dnet_node *n, int stripe, struct dnet_locks_stripe_stats *stats);
 
 struct dnet_config_data {
 	void (*destroy_config_data) (struct dnet_config_data *);
@@ -741,6 +937,8 @@ int dnet_recv(struct dnet_net_state *st, void *data, unsigned int size);
 int dnet_sendfile(struct dnet_net_state *st, int fd, uint64_t *offset, uint64_t size);
 
 int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r);
+int dnet_send_request_batch(struct dnet_net_state *st, struct dnet_io_req **reqs, int num, size_t *sent);
+int dnet_send_batch_iov(struct dnet_net_state *st, struct dnet_io_req **reqs, int num, struct iovec *iov, size_t *total_size);
 
 
 /*
@@ -754,7 +952,7 @@ int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r);
 int __attribute__((weak)) dnet_send_ack(struct dnet_net_state *st, struct dnet_cmd *cmd, int err, int recursive);
 int __attribute__((weak)) dnet_send_reply(void *state, struct dnet_cmd *cmd, const void *odata, unsigned int size, int more);
 int __attribute__((weak)) dnet_send_reply_threshold(void *state, struct dnet_cmd *cmd, const void *odata, unsigned int size, int more);
-void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r);
+int dnet_schedule_io_batch(struct dnet_node *n, struct dnet_io_req **reqs, int num);
 
 struct dnet_config;
 
@@ -837,6 +1035,9 @@ int dnet_recv_list(struct dnet_node *n, struct dnet_net_state *st);
 ssize_t dnet_send_fd(struct dnet_net_state *st, void *header, uint64_t hsize,
 		int fd, uint64_t offset, uint64_t dsize, int on_exit);
 ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize);
+ssize_t dnet_send_data_ref(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize,
+		void (*release)(void *priv), void *priv);
+ssize_t dnet_send_data_refs(struct dnet_net_state *st, void *header, uint64_t hsize, struct dnet_data_ref *refs, int num);
 ssize_t dnet_send(struct dnet_net_state *st, void *data, uint64_t size);
 ssize_t dnet_send_nolock(struct dnet_net_state *st, void *data, uint64_t size);
 
@@ -853,6 +1054,7 @@ void dnet_check_thread_stop(struct dnet_node *n);
 void dnet_reconnect_and_check_route_table(struct dnet_node *node);
 
 int dnet_set_name(const char *format, ...);
+int dnet_set_affinity(const int *cpus, int num);
 int dnet_ioprio_set(long pid, int class_id, int prio);
 int dnet_ioprio_get(long pid);
 
@@ -880,6 +1082,18 @@ void *dnet_cache_init(struct dnet_node *n, struct dnet_backend_io *backend, cons
 void dnet_cache_cleanup(void *);
 int dnet_cmd_cache_io(struct dnet_backend_io *backend, struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_io_attr *io, char *data);
 int dnet_cmd_cache_lookup(struct dnet_backend_io *backend, struct dnet_net_state *st, struct dnet_cmd *cmd);
+/*
+ * Blocks WRITE @cmd while too much of cached data waits for write-back, @io is not converted yet.
+ * It is called before the key lock is taken, since write-back takes locks of the flushed keys.
+ */
+void dnet_cmd_cache_throttle(struct dnet_backend_io *backend, struct dnet_net_state *st, struct dnet_cmd *cmd, const struct dnet_io_attr *io);
+/*
+ * Sends replies to READ @cmd for all objects of @ios found in cache, ios of the missed ones
+ * are moved to the beginning of @ios and their number is stored in @misses.
+ * Returns 0 if at least one reply was sent, error of the first failed one otherwise.
+ */
+int dnet_cmd_cache_bulk_read(struct dnet_backend_io *backend, struct dnet_net_state *st, struct dnet_cmd *cmd,
+		struct dnet_io_attr *ios, uint64_t count, uint64_t *misses);
 
 int dnet_indexes_init(struct dnet_node *, struct dnet_config *);
 void dnet_indexes_cleanup(struct dnet_node *);
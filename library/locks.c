@@ -27,72 +27,173 @@
 
 #include "elliptics.h"
 
-void dnet_locks_destroy(struct dnet_node *n)
+/*
+ * Oplock table is split into stripes selected by key hash, every stripe has its own mutex,
+ * list of free entries and open-addressing (linear probing) table of used entries.
+ */
+
+static inline uint64_t dnet_locks_hash(struct dnet_id *id)
 {
-	struct dnet_locks_entry *r, *tmp;
+	uint64_t hash;
 
-	if (n->locks) {
+	memcpy(&hash, id->id, sizeof(hash));
+	return hash * 0x9e3779b97f4a7c15ULL;
+}
 
-		list_for_each_entry_safe(r, tmp, &n->locks->lock_list, lock_list_entry) {
-			list_del(&r->lock_list_entry);
-			pthread_mutex_destroy(&r->lock);
-			pthread_cond_destroy(&r->wait);
+static inline struct dnet_locks_stripe *dnet_locks_stripe(struct dnet_node *n, uint64_t hash)
+{
+	return &n->locks->stripes[(hash >> 32) % DNET_LOCKS_STRIPES_NUM];
+}
 
-			if (r->lock_tree_entry.rb_parent_color) {
-				rb_erase(&r->lock_tree_entry, &n->locks->lock_tree);
-			}
-		}
+static struct dnet_locks_entry *dnet_locks_entry_alloc(struct dnet_node *n)
+{
+	struct dnet_locks_entry *entry;
+	int err;
+
+	entry = malloc(sizeof(struct dnet_locks_entry));
+	if (!entry)
+		return NULL;
+
+	memset(entry, 0, sizeof(struct dnet_locks_entry));
+
+	err = pthread_mutex_init(&entry->lock, NULL);
+	if (err) {
+		dnet_log(n, DNET_LOG_ERROR, "Could not create lock: %s [%d]", strerror(err), -err);
+		goto err_out_free;
+	}
+
+	err = pthread_cond_init(&entry->wait, NULL);
+	if (err) {
+		dnet_log(n, DNET_LOG_ERROR, "Could not create cond: %s [%d]", strerror(err), -err);
+		goto err_out_destroy_lock;
+	}
+
+	return entry;
+
+err_out_destroy_lock:
+	pthread_mutex_destroy(&entry->lock);
+err_out_free:
+	free(entry);
+	return NULL;
+}
+
+static void dnet_locks_entry_free(struct dnet_locks_entry *entry)
+{
+	pthread_mutex_destroy(&entry->lock);
+	pthread_cond_destroy(&entry->wait);
+	free(entry);
+}
+
+static void dnet_locks_stripe_destroy(struct dnet_locks_stripe *stripe)
+{
+	struct dnet_locks_entry *entry, *tmp;
+	unsigned int i;
+
+	list_for_each_entry_safe(entry, tmp, &stripe->free_list, lock_list_entry) {
+		list_del(&entry->lock_list_entry);
+		dnet_locks_entry_free(entry);
+	}
+
+	/* entries which are still locked are freed too, nobody is going to unlock them */
+	for (i = 0; i <= stripe->mask; ++i) {
+		if (stripe->table[i])
+			dnet_locks_entry_free(stripe->table[i]);
+	}
+
+	free(stripe->table);
+	pthread_mutex_destroy(&stripe->lock);
+}
+
+void dnet_locks_destroy(struct dnet_node *n)
+{
+	int i;
+
+	if (n->locks) {
+		for (i = 0; i < n->locks->stripes_num; ++i)
+			dnet_locks_stripe_destroy(&n->locks->stripes[i]);
 
 		free(n->locks);
 		n->locks = NULL;
 	}
 }
 
-int dnet_locks_init(struct dnet_node *n, int num)
+static int dnet_locks_stripe_init(struct dnet_node *n, struct dnet_locks_stripe *stripe, int num)
 {
-	int err, i;
 	struct dnet_locks_entry *entry;
+	unsigned int size = 16;
+	int err, i;
 
-	n->locks = malloc(sizeof(struct dnet_locks) + num * sizeof(struct dnet_locks_entry));
-	if (!n->locks) {
+	INIT_LIST_HEAD(&stripe->free_list);
+
+	for (i = 0; i < DNET_LOCKS_WAIT_BUCKETS; ++i)
+		atomic_init(&stripe->wait_hist[i], 0);
+
+	/* table is kept at most half full */
+	while (size < (unsigned int)num * 2)
+		size <<= 1;
+
+	stripe->table = calloc(size, sizeof(struct dnet_locks_entry *));
+	if (!stripe->table) {
 		err = -ENOMEM;
 		goto err_out_exit;
 	}
+	stripe->mask = size - 1;
+	stripe->used = 0;
 
-	INIT_LIST_HEAD(&n->locks->lock_list);
-	n->locks->lock_tree = RB_ROOT;
-
-	err = pthread_mutex_init(&n->locks->lock, NULL);
+	err = pthread_mutex_init(&stripe->lock, NULL);
 	if (err) {
 		err = -err;
 		dnet_log(n, DNET_LOG_ERROR, "Could not create lock: %s [%d]", strerror(-err), err);
+		goto err_out_free_table;
+	}
+
+	for (i = 0; i < num; ++i) {
+		entry = dnet_locks_entry_alloc(n);
+		if (!entry) {
+			err = -ENOMEM;
+			goto err_out_destroy;
+		}
 
-		goto err_out_destroy;
+		list_add_tail(&entry->lock_list_entry, &stripe->free_list);
 	}
 
-	entry = (struct dnet_locks_entry *) (n->locks + 1);
+	return 0;
 
-	for (i = 0; i < num; ++i, ++entry) {
-		entry->locked = 0;
+err_out_destroy:
+	dnet_locks_stripe_destroy(stripe);
+	return err;
 
-		err = pthread_mutex_init(&entry->lock, NULL);
-		if (err) {
-			err = -err;
-			dnet_log(n, DNET_LOG_ERROR, "Could not create lock %d/%d: %s [%d]", i, num, strerror(-err), err);
+err_out_free_table:
+	free(stripe->table);
+err_out_exit:
+	return err;
+}
 
-			goto err_out_destroy;
-		}
-		err = pthread_cond_init(&entry->wait, NULL);
-		if (err) {
-			err = -err;
-			dnet_log(n, DNET_LOG_ERROR, "Could not create cond %d/%d: %s [%d]", i, num, strerror(-err), err);
+/*
+ * Preallocates @num lock entries spread over all stripes,
+ * stripe allocates new entries once its preallocated ones are exhausted.
+ */
+int dnet_locks_init(struct dnet_node *n, int num)
+{
+	int err, i;
 
-			pthread_mutex_destroy(&entry->lock);
+	n->locks = malloc(sizeof(struct dnet_locks));
+	if (!n->locks) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	n->locks->stripes_num = 0;
+
+	for (i = 0; i < DNET_LOCKS_STRIPES_NUM; ++i) {
+		err = dnet_locks_stripe_init(n, &n->locks->stripes[i], (num + DNET_LOCKS_STRIPES_NUM - 1) / DNET_LOCKS_STRIPES_NUM);
+		if (err) {
+			dnet_log(n, DNET_LOG_ERROR, "Could not create lock stripe %d/%d: %s [%d]",
+					i, DNET_LOCKS_STRIPES_NUM, strerror(-err), err);
 			goto err_out_destroy;
 		}
 
-		memset(&entry->lock_tree_entry, 0, sizeof(struct rb_node));
-		list_add_tail(&entry->lock_list_entry, &n->locks->lock_list);
+		n->locks->stripes_num++;
 	}
 
 	return 0;
@@ -103,129 +204,177 @@ err_out_exit:
 	return err;
 }
 
-static struct dnet_locks_entry *dnet_oplock_search_nolock(struct dnet_node *n, struct dnet_id *id)
+static unsigned int dnet_oplock_search_nolock(struct dnet_locks_stripe *stripe, struct dnet_id *id, uint64_t hash)
 {
-	struct rb_root *root = &n->locks->lock_tree;
-	struct rb_node *node = root->rb_node;
-	struct dnet_locks_entry *entry = NULL;
-	int cmp = 1;
-
-	while (node) {
-		entry = rb_entry(node, struct dnet_locks_entry, lock_tree_entry);
-
-		cmp = memcmp(entry->id.id, id->id, DNET_ID_SIZE);
-		if (cmp < 0)
-			node = node->rb_left;
-		else if (cmp > 0)
-			node = node->rb_right;
-		else
-			return entry;
+	unsigned int pos = hash & stripe->mask;
+	struct dnet_locks_entry *entry;
+
+	while ((entry = stripe->table[pos]) != NULL) {
+		if (entry->hash == hash && !memcmp(entry->id.id, id->id, DNET_ID_SIZE))
+			break;
+
+		pos = (pos + 1) & stripe->mask;
 	}
 
-	return NULL;
+	return pos;
 }
 
-static int dnet_oplock_insert_nolock(struct dnet_node *n, struct dnet_locks_entry *a)
+static int dnet_oplock_grow_nolock(struct dnet_locks_stripe *stripe)
 {
-	struct rb_root *root = &n->locks->lock_tree;
-	struct rb_node **node = &root->rb_node, *parent = NULL;
-	struct dnet_locks_entry *t;
-	int cmp;
-
-	while (*node) {
-		parent = *node;
-
-		t = rb_entry(parent, struct dnet_locks_entry, lock_tree_entry);
-
-		cmp = memcmp(t->id.id, a->id.id, DNET_ID_SIZE);
-		if (cmp < 0)
-			node = &parent->rb_left;
-		else if (cmp > 0)
-			node = &parent->rb_right;
-		else
-			return -EEXIST;
+	struct dnet_locks_entry **table, **old = stripe->table;
+	unsigned int old_size = stripe->mask + 1;
+	unsigned int i, pos;
+
+	table = calloc(old_size * 2, sizeof(struct dnet_locks_entry *));
+	if (!table)
+		return -ENOMEM;
+
+	stripe->table = table;
+	stripe->mask = old_size * 2 - 1;
+
+	for (i = 0; i < old_size; ++i) {
+		if (!old[i])
+			continue;
+
+		pos = old[i]->hash & stripe->mask;
+		while (table[pos])
+			pos = (pos + 1) & stripe->mask;
+
+		table[pos] = old[i];
 	}
 
-	rb_link_node(&a->lock_tree_entry, parent, node);
-	rb_insert_color(&a->lock_tree_entry, root);
+	free(old);
 	return 0;
 }
 
-static void dnet_oplock_remove_nolock(struct dnet_node *n, struct dnet_locks_entry *entry)
+/*
+ * Removes entry at @pos, following entries of the same probe sequence are shifted back,
+ * so that lookups never meet a hole before reaching their entry.
+ */
+static void dnet_oplock_remove_nolock(struct dnet_locks_stripe *stripe, unsigned int pos)
 {
-	struct rb_root *root = &n->locks->lock_tree;
+	unsigned int next = pos, home;
 
-	if (!entry->lock_tree_entry.rb_parent_color) {
-		dnet_log(n, DNET_LOG_ERROR, "%s: trying to remove non-existen oplock.",
-			dnet_dump_id_str(entry->id.id));
-		return;
-	}
+	stripe->table[pos] = NULL;
+	stripe->used--;
 
-	if (entry) {
-		rb_erase(&entry->lock_tree_entry, root);
-		entry->lock_tree_entry.rb_parent_color = 0;
+	while (1) {
+		next = (next + 1) & stripe->mask;
+		if (!stripe->table[next])
+			break;
+
+		home = stripe->table[next]->hash & stripe->mask;
+
+		/* entry at @next may be moved to @pos only if its home slot is not within (pos, next] */
+		if (((next - home) & stripe->mask) >= ((next - pos) & stripe->mask)) {
+			stripe->table[pos] = stripe->table[next];
+			stripe->table[next] = NULL;
+			pos = next;
+		}
 	}
 }
 
 static struct dnet_locks_entry *dnet_oplock_ensure(struct dnet_node *n, struct dnet_id *id)
 {
+	uint64_t hash = dnet_locks_hash(id);
+	struct dnet_locks_stripe *stripe = dnet_locks_stripe(n, hash);
 	struct dnet_locks_entry *entry = NULL;
+	unsigned int pos;
 
-	pthread_mutex_lock(&n->locks->lock);
+	pthread_mutex_lock(&stripe->lock);
 
-	entry = dnet_oplock_search_nolock(n, id);
+	pos = dnet_oplock_search_nolock(stripe, id, hash);
+	entry = stripe->table[pos];
 
 	if (entry) {
 		atomic_inc(&entry->refcnt);
-	} else if (!list_empty(&n->locks->lock_list)) {
-		entry = list_first_entry(&n->locks->lock_list, struct dnet_locks_entry, lock_list_entry);
-		list_del(&entry->lock_list_entry);
+		goto err_out_unlock;
+	}
 
-		entry->locked = 0;
-		atomic_init(&entry->refcnt, 1);
+	if ((stripe->used + 1) * 2 > stripe->mask + 1) {
+		if (dnet_oplock_grow_nolock(stripe)) {
+			dnet_log(n, DNET_LOG_ERROR, "%s: could not grow oplock table.", dnet_dump_id(id));
+			goto err_out_unlock;
+		}
 
-		memcpy(entry->id.id, id->id, sizeof(entry->id.id));
+		pos = dnet_oplock_search_nolock(stripe, id, hash);
+	}
 
-		dnet_oplock_insert_nolock(n, entry);
+	if (!list_empty(&stripe->free_list)) {
+		entry = list_first_entry(&stripe->free_list, struct dnet_locks_entry, lock_list_entry);
+		list_del(&entry->lock_list_entry);
 	} else {
-		dnet_log(n, DNET_LOG_ERROR, "%s: oplock list is empty.", dnet_dump_id(id));
+		entry = dnet_locks_entry_alloc(n);
+		if (!entry) {
+			dnet_log(n, DNET_LOG_ERROR, "%s: could not allocate oplock.", dnet_dump_id(id));
+			goto err_out_unlock;
+		}
 	}
 
-	pthread_mutex_unlock(&n->locks->lock);
+	entry->locked = 0;
+	entry->hash = hash;
+	atomic_init(&entry->refcnt, 1);
+
+	memcpy(entry->id.id, id->id, sizeof(entry->id.id));
+
+	stripe->table[pos] = entry;
+	stripe->used++;
+
+err_out_unlock:
+	pthread_mutex_unlock(&stripe->lock);
 
 	return entry;
 }
 
 static struct dnet_locks_entry *dnet_oplock_take(struct dnet_node *n, struct dnet_id *id)
 {
+	uint64_t hash = dnet_locks_hash(id);
+	struct dnet_locks_stripe *stripe = dnet_locks_stripe(n, hash);
 	struct dnet_locks_entry *entry = NULL;
+	unsigned int pos;
 
-	pthread_mutex_lock(&n->locks->lock);
+	pthread_mutex_lock(&stripe->lock);
 
-	entry = dnet_oplock_search_nolock(n, id);
+	pos = dnet_oplock_search_nolock(stripe, id, hash);
+	entry = stripe->table[pos];
 
 	if (!entry) {
 		dnet_log(n, DNET_LOG_ERROR, "%s: lock not found.", dnet_dump_id(id));
 		goto err_out_complete;
 	}
 
-	if (entry && atomic_dec_and_test(&entry->refcnt)) {
-		dnet_oplock_remove_nolock(n, entry);
-		list_add_tail(&entry->lock_list_entry, &n->locks->lock_list);
+	if (atomic_dec_and_test(&entry->refcnt)) {
+		dnet_oplock_remove_nolock(stripe, pos);
+		list_add_tail(&entry->lock_list_entry, &stripe->free_list);
 
 		entry = NULL;
 		goto err_out_complete;
 	}
 
 err_out_complete:
-	pthread_mutex_unlock(&n->locks->lock);
+	pthread_mutex_unlock(&stripe->lock);
 
 	return entry;
 }
 
+/*
+ * Wait time histogram bucket: under 10 usecs, under 100 usecs and so on up to 1 second and above
+ */
+static int dnet_oplock_wait_bucket(long usecs)
+{
+	int bucket = 0;
+
+	for (usecs /= 10; usecs && bucket < DNET_LOCKS_WAIT_BUCKETS - 1; usecs /= 10)
+		++bucket;
+
+	return bucket;
+}
+
 void dnet_oplock(struct dnet_node *n, struct dnet_id *key)
 {
 	struct dnet_locks_entry *entry = dnet_oplock_ensure(n, key);
+	struct timespec start, end;
+	long usecs = 0;
 
 	if (!entry) {
 		return;
@@ -233,13 +382,22 @@ void dnet_oplock(struct dnet_node *n, struct dnet_id *key)
 
 	pthread_mutex_lock(&entry->lock);
 
-	while (entry->locked) {
-		pthread_cond_wait(&entry->wait, &entry->lock);
+	if (entry->locked) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		while (entry->locked) {
+			pthread_cond_wait(&entry->wait, &entry->lock);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		usecs = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
 	}
 
 	entry->locked = 1;
 
 	pthread_mutex_unlock(&entry->lock);
+
+	atomic_inc(&dnet_locks_stripe(n, entry->hash)->wait_hist[dnet_oplock_wait_bucket(usecs)]);
 }
 
 void dnet_opunlock(struct dnet_node *n, struct dnet_id *key)
@@ -280,3 +438,21 @@ int dnet_optrylock(struct dnet_node *n, struct dnet_id *key)
 	return err;
 }
 
+void dnet_locks_stat(struct dnet_node *n, int stripe_idx, struct dnet_locks_stripe_stats *stats)
+{
+	struct dnet_locks_stripe *stripe = &n->locks->stripes[stripe_idx];
+	struct dnet_locks_entry *entry;
+	int i;
+
+	memset(stats, 0, sizeof(struct dnet_locks_stripe_stats));
+
+	pthread_mutex_lock(&stripe->lock);
+	stats->used = stripe->used;
+	stats->table_size = stripe->mask + 1;
+	list_for_each_entry(entry, &stripe->free_list, lock_list_entry)
+		stats->free++;
+	pthread_mutex_unlock(&stripe->lock);
+
+	for (i = 0; i < DNET_LOCKS_WAIT_BUCKETS; ++i)
+		stats->wait_hist[i] = atomic_read(&stripe->wait_hist[i]);
+}
@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -174,15 +175,17 @@ static struct dnet_io_req *dnet_io_req_copy(struct dnet_net_state *st, struct dn
 {
 	void *buf;
 	struct dnet_io_req *r;
+	size_t dsize = orig->release ? 0 : orig->dsize;
 	int offset = 0;
 	int err = 0;
 
-	buf = r = malloc(sizeof(struct dnet_io_req) + orig->dsize + orig->hsize);
+	buf = r = malloc(sizeof(struct dnet_io_req) + dsize + orig->hsize);
 	if (!r) {
 		dnet_log(st->n, DNET_LOG_ERROR, "Not enough memory for io req queue fd: %d : %s %d", orig->fd, strerror(-err), err);
 		return NULL;
 	}
 	memset(r, 0, sizeof(struct dnet_io_req));
+	atomic_init(&r->refcnt, 1);
 	r->fd = -1;
 
 	if (orig->header && orig->hsize) {
@@ -193,7 +196,12 @@ static struct dnet_io_req *dnet_io_req_copy(struct dnet_net_state *st, struct dn
 		memcpy(r->header, orig->header, r->hsize);
 	}
 
-	if (orig->data && orig->dsize) {
+	if (orig->release) {
+		r->data = orig->data;
+		r->dsize = orig->dsize;
+		r->release = orig->release;
+		r->release_priv = orig->release_priv;
+	} else if (orig->data && orig->dsize) {
 		r->data = buf + sizeof(struct dnet_io_req) + offset;
 		r->dsize = orig->dsize;
 
@@ -212,8 +220,10 @@ static struct dnet_io_req *dnet_io_req_copy(struct dnet_net_state *st, struct dn
 }
 
 /*
- * Eventually we may end up with proper reference counters here, but for now let's just copy the whole buf.
- * Large data blocks are being sent through sendfile anyway, so it should not be _that_ costly operation.
+ * Header is always copied, it is small and usually lives on the caller's stack.
+ * Data is copied too unless request carries @release callback: in this case queued request
+ * references caller's data and takes ownership of @release_priv, @release is called even if queueing fails.
+ * Large data blocks are being sent through sendfile anyway.
  */
 static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig)
 {
@@ -222,6 +232,8 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 
 	r = dnet_io_req_copy(st, orig);
 	if (!r) {
+		if (orig->release)
+			orig->release(orig->release_priv);
 		err = -ENOMEM;
 		goto err_out_exit;
 	}
@@ -239,13 +251,19 @@ err_out_exit:
 
 void dnet_io_req_free(struct dnet_io_req *r)
 {
+	if (!atomic_dec_and_test(&r->refcnt))
+		return;
+
+	if (r->release)
+		r->release(r->release_priv);
+
 	if (r->fd >= 0 && r->fsize) {
 		if (r->on_exit & DNET_IO_REQ_FLAGS_CACHE_FORGET)
 			posix_fadvise(r->fd, r->local_offset, r->fsize, POSIX_FADV_DONTNEED);
 		if (r->on_exit & DNET_IO_REQ_FLAGS_CLOSE)
 			close(r->fd);
 	}
-	free(r);
+	dnet_io_arena_free(r);
 }
 
 static int dnet_wait(struct dnet_net_state *st, unsigned int events, long timeout)
@@ -356,6 +374,97 @@ ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize,
 	return dnet_io_req_queue(st, &r);
 }
 
+/*
+ * Queues @data without copying it, @release(@priv) is called once data is not needed anymore,
+ * both when it has been sent and when sending has failed.
+ */
+ssize_t dnet_send_data_ref(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize,
+		void (*release)(void *priv), void *priv)
+{
+	struct dnet_io_req r;
+
+	memset(&r, 0, sizeof(r));
+	r.header = header;
+	r.hsize = hsize;
+	r.data = data;
+	r.dsize = dsize;
+	r.fd = -1;
+	r.release = release;
+	r.release_priv = priv;
+
+	return dnet_io_req_queue(st, &r);
+}
+
+/*
+ * Queues @num data blocks of single packet without copying them, @header is sent before the first block.
+ * Blocks are added to the send queue at once, so that packets of other threads do not get in between.
+ * @refs[i].release(@refs[i].priv) is called once i-th block is not needed anymore, even if queueing fails.
+ */
+ssize_t dnet_send_data_refs(struct dnet_net_state *st, void *header, uint64_t hsize, struct dnet_data_ref *refs, int num)
+{
+	struct dnet_io_req orig, *r, *tmp;
+	LIST_HEAD(reqs);
+	int i, err = 0;
+
+	if (!num)
+		return dnet_send_data(st, header, hsize, NULL, 0);
+
+	for (i = 0; i < num; ++i) {
+		memset(&orig, 0, sizeof(orig));
+		if (i == 0) {
+			orig.header = header;
+			orig.hsize = hsize;
+		}
+		orig.data = refs[i].data;
+		orig.dsize = refs[i].size;
+		orig.fd = -1;
+		orig.release = refs[i].release;
+		orig.release_priv = refs[i].priv;
+
+		r = dnet_io_req_copy(st, &orig);
+		if (!r) {
+			err = -ENOMEM;
+			goto err_out_free;
+		}
+
+		list_add_tail(&r->req_entry, &reqs);
+	}
+
+	pthread_mutex_lock(&st->send_lock);
+	list_splice(&reqs, st->send_list.prev);
+
+	if (!st->__need_exit) {
+		/*
+		 * dnet_schedule_send() accounts a single request in the output queue stats,
+		 * while every spliced block is accounted back separately once it is sent
+		 */
+		if (num > 1) {
+			pthread_mutex_lock(&st->n->io->full_lock);
+			list_stat_size_increase(&st->n->io->output_stats, num - 1);
+			pthread_mutex_unlock(&st->n->io->full_lock);
+			HANDY_COUNTER_INCREMENT("io.output.queue.size", num - 1);
+		}
+
+		dnet_schedule_send(st);
+	}
+	pthread_mutex_unlock(&st->send_lock);
+
+	return 0;
+
+err_out_free:
+	list_for_each_entry_safe(r, tmp, &reqs, req_entry) {
+		list_del(&r->req_entry);
+		dnet_io_req_free(r);
+	}
+
+	for (; i < num; ++i) {
+		if (refs[i].release)
+			refs[i].release(refs[i].priv);
+	}
+
+	return err;
+}
+
 static ssize_t dnet_send_fd_nolock(struct dnet_net_state *st, int fd, uint64_t offset, uint64_t dsize)
 {
 	ssize_t err;
@@ -421,7 +530,7 @@ int dnet_trans_send(struct dnet_trans *t, struct dnet_io_req *req)
 		dnet_trans_timestamp(st, t);
 	pthread_mutex_unlock(&st->trans_lock);
 	if (err)
-		goto err_out_put;
+		goto err_out_release;
 
 	err = dnet_io_req_queue(st, req);
 	if (err)
@@ -430,6 +539,10 @@ int dnet_trans_send(struct dnet_trans *t, struct dnet_io_req *req)
 	dnet_trans_put(t);
 	return 0;
 
+err_out_release:
+	if (req->release)
+		req->release(req->release_priv);
+	goto err_out_put;
 err_out_remove:
 	dnet_trans_remove(t);
 err_out_put:
@@ -541,10 +654,20 @@ static int dnet_trans_complete_forward(struct dnet_addr *addr __unused, struct d
 	return err;
 }
 
+static void dnet_trans_forward_release(void *priv)
+{
+	dnet_io_req_free(priv);
+}
+
+/*
+ * Received request is forwarded without copying its data:
+ * queued request holds a reference to @r until it has been sent.
+ */
 static int dnet_trans_forward(struct dnet_io_req *r,
 		struct dnet_net_state *orig, struct dnet_net_state *forward)
 {
 	struct dnet_cmd *cmd = r->header;
+	struct dnet_io_req req;
 	struct dnet_trans *t;
 
 	t = dnet_trans_alloc(orig->n, 0);
@@ -565,7 +688,15 @@ static int dnet_trans_forward(struct dnet_io_req *r,
 	t->orig = dnet_state_get(orig);
 	t->st = dnet_state_get(forward);
 
-	r->st = forward;
+	memset(&req, 0, sizeof(req));
+	req.st = forward;
+	req.header = r->header;
+	req.hsize = r->hsize;
+	req.data = r->data;
+	req.dsize = r->dsize;
+	req.fd = -1;
+	req.release = dnet_trans_forward_release;
+	req.release_priv = dnet_io_req_get(r);
 
 	{
 		char saddr[128];
@@ -578,7 +709,7 @@ static int dnet_trans_forward(struct dnet_io_req *r,
 				(unsigned long long)t->rcv_trans, (unsigned long long)t->trans);
 	}
 
-	return dnet_trans_send(t, r);
+	return dnet_trans_send(t, &req);
 }
 
 static int dnet_process_update_ids(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_id_container *container)
@@ -853,17 +984,24 @@ void dnet_set_sockopt(struct dnet_node *n, int s)
 	fcntl(s, F_SETFL, O_NONBLOCK);
 }
 
-int dnet_setup_control_nolock(struct dnet_net_state *st)
+int dnet_setup_control_nolock(struct dnet_net_state *st, int epoll_fd)
 {
 	struct dnet_node *n = st->n;
 	struct dnet_io *io = n->io;
 	int err, pos;
 
 	if (st->epoll_fd == -1) {
-		pos = io->net_thread_pos;
-		if (++io->net_thread_pos >= io->net_thread_num)
-			io->net_thread_pos = 0;
-		st->epoll_fd = io->net[pos].epoll_fd;
+		/*
+		 * State is attached to the given network thread if there is one,
+		 * otherwise network threads are selected in round-robin manner
+		 */
+		if (epoll_fd == -1) {
+			pos = io->net_thread_pos;
+			if (++io->net_thread_pos >= io->net_thread_num)
+				io->net_thread_pos = 0;
+			epoll_fd = io->net[pos].epoll_fd;
+		}
+		st->epoll_fd = epoll_fd;
 
 		pthread_mutex_lock(&st->send_lock);
 		err = dnet_schedule_recv(st);
@@ -949,6 +1087,7 @@ int dnet_state_micro_init(struct dnet_net_state *st,
 	INIT_LIST_HEAD(&st->node_entry);
 	INIT_LIST_HEAD(&st->storage_state_entry);
 	INIT_LIST_HEAD(&st->idc_list);
+	INIT_LIST_HEAD(&st->paused_entry);
 
 	st->trans_root = RB_ROOT;
 	st->timer_root = RB_ROOT;
@@ -1033,7 +1172,7 @@ int dnet_state_move_to_dht(struct dnet_net_state *st, struct dnet_addr *addrs, i
 struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 		struct dnet_backend_ids **backends, int backends_count,
 		struct dnet_addr *addr, int s, int *errp, int join, int server_node, int idx,
-		int accepting_state, struct dnet_addr *addrs, int addrs_count)
+		int accepting_state, struct dnet_addr *addrs, int addrs_count, int epoll_fd)
 {
 	int err = -ENOMEM, i;
 	struct dnet_net_state *st;
@@ -1093,6 +1232,15 @@ struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 
 	fcntl(st->write_s, F_SETFD, FD_CLOEXEC);
 
+	if (!accepting_state) {
+		/*
+		 * Replies are coalesced by the send path itself,
+		 * so there is no reason to let Nagle delay them.
+		 */
+		int nodelay = 1;
+		setsockopt(st->write_s, IPPROTO_TCP, TCP_NODELAY, &nodelay, 4);
+	}
+
 	dnet_log(n, DNET_LOG_DEBUG, "dnet_state_create: %s: sockets: %d/%d", dnet_addr_string(addr), st->read_s, st->write_s);
 
 	err = dnet_state_micro_init(st, n, addr, join);
@@ -1137,7 +1285,7 @@ struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 		}
 
 		pthread_mutex_lock(&n->state_lock);
-		err = dnet_setup_control_nolock(st);
+		err = dnet_setup_control_nolock(st, epoll_fd);
 		if (err)
 			goto err_out_unlock;
 		pthread_mutex_unlock(&n->state_lock);
@@ -1152,7 +1300,7 @@ struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 		list_add_tail(&st->node_entry, &n->empty_state_list);
 		list_add_tail(&st->storage_state_entry, &n->storage_state_list);
 
-		err = dnet_setup_control_nolock(st);
+		err = dnet_setup_control_nolock(st, epoll_fd);
 		if (err)
 			goto err_out_unlock;
 		pthread_mutex_unlock(&n->state_lock);
@@ -1246,6 +1394,8 @@ void dnet_state_destroy(struct dnet_net_state *st)
 
 	dnet_state_send_clean(st);
 
+	free(st->rcv_buf);
+
 	pthread_mutex_destroy(&st->send_lock);
 	pthread_mutex_destroy(&st->trans_lock);
 
@@ -1258,14 +1408,22 @@ void dnet_state_destroy(struct dnet_net_state *st)
 	free(st);
 }
 
+/*
+ * Sends single request, it is used for requests which carry file descriptor,
+ * memory-only requests are sent in batches by dnet_send_request_batch().
+ *
+ * TCP_NODELAY is set once at state creation, so the only socket option toggled here
+ * is TCP_CORK which glues header and sendfile() body together.
+ */
 int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
 {
 	int cork;
 	int err = 0;
 	size_t offset = st->send_offset;
 	size_t total_size = r->dsize + r->hsize + r->fsize;
+	int need_cork = (r->fd >= 0 && r->fsize && (r->hsize || r->dsize));
 
-	if (total_size > sizeof(struct dnet_cmd)) {
+	if (need_cork) {
 		/* Use TCP_CORK to send headers and packet body in one piece */
 		cork = 1;
 		setsockopt(st->write_s, IPPROTO_TCP, TCP_CORK, &cork, 4);
@@ -1279,7 +1437,7 @@ int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
 			dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), dnet_addr_string(&st->addr),
 			(unsigned long long)cmd->trans,
 			(unsigned long long)cmd->size, dnet_flags_dump_cflags(cmd->flags),
-			st->send_offset, r->dsize + r->hsize + r->fsize);
+			st->send_offset, total_size);
 	}
 
 	if (r->hsize && r->header && st->send_offset < r->hsize) {
@@ -1295,7 +1453,7 @@ int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
 			goto err_out_exit;
 	}
 
-	if (r->fd >= 0 && r->fsize && st->send_offset < (r->dsize + r->hsize + r->fsize)) {
+	if (r->fd >= 0 && r->fsize && st->send_offset < total_size) {
 		offset = st->send_offset - r->dsize - r->hsize;
 		err = dnet_send_fd_nolock(st, r->fd, r->local_offset + offset, r->fsize - offset);
 		if (err)
@@ -1323,30 +1481,110 @@ err_out_exit:
 			dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), dnet_addr_string(&st->addr),
 			(unsigned long long)cmd->trans,
 			(unsigned long long)cmd->size, dnet_flags_dump_cflags(cmd->flags),
-			st->send_offset, r->dsize + r->hsize + r->fsize);
-	}
-
-	if (total_size > sizeof(struct dnet_cmd)) {
-		cork = 0;
-		setsockopt(st->write_s, IPPROTO_TCP, TCP_CORK, &cork, 4);
+			st->send_offset, total_size);
 	}
 
 	/*
-	 * Flush TCP output pipeline if we've sent whole request.
+	 * Uncorking flushes TCP output pipeline, since TCP_NODELAY is set on the socket.
 	 *
 	 * We do not destroy request here, it is postponed to caller.
-	 * Function can be called without lock - default call path from network processing thread and dnet_process_send_single()
-	 * or under st->send_lock, if queue was empty and dnet_send*() caller directly invoked this function from dnet_io_req_queue()
-	 * instead of queueing.
 	 */
-	if (st->send_offset == r->dsize + r->hsize + r->fsize) {
-		int nodelay = 1;
-		setsockopt(st->write_s, IPPROTO_TCP, TCP_NODELAY, &nodelay, 4);
+	if (need_cork) {
+		cork = 0;
+		setsockopt(st->write_s, IPPROTO_TCP, TCP_CORK, &cork, 4);
 	}
 
 	return err;
 }
 
+/*
+ * Fills @iov with not yet sent parts of memory-backed requests @reqs.
+ * The first request may have been partially sent already, st->send_offset
+ * contains number of its bytes which reached the socket.
+ *
+ * @iov must have room for DNET_SEND_BATCH_MAX_REQUESTS * 2 entries, returns number of filled entries.
+ */
+int dnet_send_batch_iov(struct dnet_net_state *st, struct dnet_io_req **reqs, int num, struct iovec *iov, size_t *total_size)
+{
+	size_t offset = st->send_offset;
+	int i, iov_num = 0;
+
+	*total_size = 0;
+
+	if (num > DNET_SEND_BATCH_MAX_REQUESTS)
+		num = DNET_SEND_BATCH_MAX_REQUESTS;
+
+	for (i = 0; i < num; ++i) {
+		struct dnet_io_req *r = reqs[i];
+
+		if (r->hsize && r->header && offset < r->hsize) {
+			iov[iov_num].iov_base = r->header + offset;
+			iov[iov_num].iov_len = r->hsize - offset;
+			*total_size += iov[iov_num].iov_len;
+			iov_num++;
+		}
+
+		if (r->dsize && r->data && offset < r->hsize + r->dsize) {
+			size_t doff = (offset > r->hsize) ? offset - r->hsize : 0;
+
+			iov[iov_num].iov_base = r->data + doff;
+			iov[iov_num].iov_len = r->dsize - doff;
+			*total_size += iov[iov_num].iov_len;
+			iov_num++;
+		}
+
+		offset = 0;
+	}
+
+	return iov_num;
+}
+
+/*
+ * Sends memory-backed requests @reqs with single sendmsg() call.
+ *
+ * Number of bytes sent by this call is stored in @sent, caller is responsible
+ * for completing requests which were sent in full.
+ */
+int dnet_send_request_batch(struct dnet_net_state *st, struct dnet_io_req **reqs, int num, size_t *sent)
+{
+	struct iovec iov[DNET_SEND_BATCH_MAX_REQUESTS * 2];
+	struct msghdr msg;
+	size_t total_size;
+	ssize_t err;
+	int iov_num;
+
+	*sent = 0;
+
+	iov_num = dnet_send_batch_iov(st, reqs, num, iov, &total_size);
+	if (!iov_num)
+		return 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iov_num;
+
+	err = sendmsg(st->write_s, &msg, 0);
+	if (err < 0) {
+		err = -errno;
+		if (err != -EAGAIN)
+			dnet_log_err(st->n, "%s: failed to send batch: requests: %d, size: %zu, socket: %d",
+				dnet_state_dump_addr(st), num, total_size, st->write_s);
+		return err;
+	}
+
+	if (err == 0) {
+		dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has dropped the connection: socket: %d.",
+				dnet_state_dump_addr(st), st->write_s);
+		return -ECONNRESET;
+	}
+
+	dnet_log(st->n, DNET_LOG_DEBUG, "%s: sent batch: requests: %d, iovecs: %d, sent: %zd/%zu",
+			dnet_state_dump_addr(st), num, iov_num, err, total_size);
+
+	*sent = err;
+	return 0;
+}
+
 int dnet_parse_addr(char *addr, int *portp, int *familyp)
 {
 	char *fam, *port;
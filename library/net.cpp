@@ -319,6 +319,11 @@ static int dnet_socket_init(dnet_node *node, const dnet_addr *addr, dnet_addr_so
 	if (listening) {
 		err = 1;
 		setsockopt(result->s, SOL_SOCKET, SO_REUSEADDR, &err, 4);
+#ifdef SO_REUSEPORT
+		/* every network thread listens on its own socket bound to the same address */
+		if (node->flags & DNET_CFG_REUSEPORT)
+			setsockopt(result->s, SOL_SOCKET, SO_REUSEPORT, &err, 4);
+#endif
 
 		err = bind(result->s, sa, salen);
 		if (err) {
@@ -908,7 +913,7 @@ static void dnet_process_socket(dnet_connect_state &state, epoll_event &ev)
 
 		dnet_net_state *st = dnet_state_create(state.node, backends.get(),
 			id_container->backends_count, &socket->addr, socket->s,
-			&err, state.join, 1, idx, 0, cnt->addrs, cnt->addr_num);
+			&err, state.join, 1, idx, 0, cnt->addrs, cnt->addr_num, -1);
 
 		socket->s = -1;
 		if (!st) {
@@ -17,9 +17,16 @@
  * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
+#include <ctype.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -45,48 +52,158 @@ static char *dnet_work_io_mode_str(int mode)
 	return dnet_work_io_mode_string[mode];
 }
 
+/*
+ * Resumes reading from the sockets paused by dnet_work_pool_pause_recv().
+ * States are dropped from the epoll set while being paused, thus reading is resumed by adding them back.
+ * States which have been reset in the meantime are not added back, their sockets are already shut down.
+ * Must be called without pool locks held, since the last reference to the state may be dropped here.
+ */
+static void dnet_work_pool_resume_recv(struct list_head *paused)
+{
+	struct dnet_net_state *st, *tmp;
+	int err;
+
+	list_for_each_entry_safe(st, tmp, paused, paused_entry) {
+		list_del_init(&st->paused_entry);
+
+		if (!st->n->need_exit) {
+			err = 0;
+
+			/* @__need_exit is set by dnet_state_reset() under @send_lock */
+			pthread_mutex_lock(&st->send_lock);
+			if (!st->__need_exit)
+				err = dnet_schedule_recv(st);
+			pthread_mutex_unlock(&st->send_lock);
+
+			if (err)
+				dnet_log(st->n, DNET_LOG_NOTICE, "%s: failed to resume receiving: %s [%d]",
+						dnet_state_dump_addr(st), strerror(-err), err);
+		}
+
+		dnet_state_put(st);
+	}
+}
+
+/*
+ * Stops reading from the socket of state @st, whose request has been just queued to overloaded @pool.
+ * Reading is resumed by IO thread once the pool's queue shrinks to half of the limit.
+ * Must be called by the state's network thread. Returns 1 if reading is paused.
+ */
+static int dnet_work_pool_pause_recv(struct dnet_work_pool *pool, struct dnet_net_state *st)
+{
+	int paused = 1;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!list_empty(&st->paused_entry))
+		goto err_out_unlock;
+
+	epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->read_s, NULL);
+	list_add_tail(&st->paused_entry, &pool->paused_list);
+	atomic_inc(&pool->paused);
+
+	/*
+	 * IO threads could drain the queue before state was put into the list,
+	 * in this case nobody will resume it, so do not pause at all.
+	 * @paused is incremented above and @queued is decremented by IO threads before they check @paused,
+	 * thus either IO thread or this check sees the other side.
+	 */
+	if (atomic_read(&pool->queued) <= pool->queue_limit / 2) {
+		list_del_init(&st->paused_entry);
+		atomic_dec(&pool->paused);
+
+		pthread_mutex_lock(&st->send_lock);
+		if (!st->__need_exit)
+			dnet_schedule_recv(st);
+		pthread_mutex_unlock(&st->send_lock);
+		paused = 0;
+		goto err_out_unlock;
+	}
+
+	dnet_state_get(st);
+
+err_out_unlock:
+	pthread_mutex_unlock(&pool->lock);
+	return paused;
+}
+
+/*
+ * Accounts request taken from the pool's queue. When the queue has shrunk enough,
+ * all paused states are moved to @resume list, which must be passed to dnet_work_pool_resume_recv().
+ */
+static void dnet_work_pool_dequeued(struct dnet_work_pool *pool, struct list_head *resume)
+{
+	long queued = atomic_dec(&pool->queued);
+
+	if (queued > pool->queue_limit / 2 || !atomic_read(&pool->paused))
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	list_splice_init(&pool->paused_list, resume);
+	atomic_set(&pool->paused, 0);
+	pthread_mutex_unlock(&pool->lock);
+}
+
 void dnet_work_pool_cleanup(struct dnet_work_pool_place *place)
 {
 	int i;
 	struct dnet_io_req *r, *tmp;
+	struct dnet_work_pool *pool;
 	struct dnet_work_io *wio;
+	LIST_HEAD(paused);
 
+	/*
+	 * Pool is detached from the place before its threads are joined:
+	 * they may wait for other places' locks, e.g. in dnet_work_pool_stolen_done(),
+	 * while threads of other pools wait for this place's lock.
+	 * Requests to the detached pool go to the system pool, thieves skip it.
+	 */
 	pthread_mutex_lock(&place->lock);
+	pool = place->pool;
+	place->pool = NULL;
+	pthread_mutex_unlock(&place->lock);
+
+	if (!pool)
+		return;
 
-	for (i = 0; i < place->pool->num; ++i) {
-		wio = &place->pool->wio_list[i];
+	for (i = 0; i < pool->num; ++i) {
+		wio = &pool->wio_list[i];
 		pthread_join(wio->tid, NULL);
 	}
 
+	for (i = 0; i < pool->num; ++i) {
+		wio = &pool->wio_list[i];
 
-	list_for_each_entry_safe(r, tmp, &place->pool->list, req_entry) {
-		list_del(&r->req_entry);
-		dnet_io_req_free(r);
-	}
+		list_for_each_entry_safe(r, tmp, &wio->list, req_entry) {
+			list_del(&r->req_entry);
+			dnet_io_req_free(r);
+		}
 
-	for (i = 0; i < place->pool->num; ++i) {
-		wio = &place->pool->wio_list[i];
+		pthread_mutex_destroy(&wio->lock);
+		pthread_cond_destroy(&wio->wait);
+	}
 
-		list_for_each_entry_safe(r, tmp, &wio->list, req_entry) {
+	for (i = 0; i < DNET_WORK_REPLY_BUCKETS; ++i) {
+		list_for_each_entry_safe(r, tmp, &pool->reply_buckets[i].list, req_entry) {
 			list_del(&r->req_entry);
 			dnet_io_req_free(r);
 		}
 	}
 
-	pthread_mutex_destroy(&place->pool->lock);
-	pthread_cond_destroy(&place->pool->wait);
+	list_splice_init(&pool->paused_list, &paused);
 
-	free(place->pool->wio_list);
-	free(place->pool);
+	pthread_mutex_destroy(&pool->lock);
 
-	place->pool = NULL;
+	free(pool->wio_list);
+	free(pool);
 
-	pthread_mutex_unlock(&place->lock);
+	/* requests to this pool are not accepted anymore, clients have to be read again */
+	dnet_work_pool_resume_recv(&paused);
 }
 
 static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool, int num, void *(* process)(void *))
 {
 	int i = 0, j, err;
+	int old_num = pool->num;
 	struct dnet_work_io *wio;
 
 	pthread_mutex_lock(&pool->lock);
@@ -94,16 +211,48 @@ static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool,
 	pool->wio_list = malloc(num * sizeof(struct dnet_work_io));
 	if (!pool->wio_list) {
 		err = -ENOMEM;
-		goto err_out_io_threads;
+		goto err_out_unlock;
 	}
+	memset(pool->wio_list, 0, num * sizeof(struct dnet_work_io));
 
+	/*
+	 * All queues must be initialized before the first thread is started,
+	 * since any thread may steal requests from any other queue
+	 */
 	for (i = 0; i < num; ++i) {
 		wio = &pool->wio_list[i];
 
 		wio->thread_index = i;
+		wio->reply_bucket = NULL;
 		wio->pool = pool;
-		wio->trans = ~0ULL;
 		INIT_LIST_HEAD(&wio->list);
+		INIT_LIST_HEAD(&wio->reply_ready);
+		list_stat_init(&wio->list_stats);
+
+		err = pthread_mutex_init(&wio->lock, NULL);
+		if (err) {
+			err = -err;
+			goto err_out_destroy_queues;
+		}
+
+		err = pthread_cond_init(&wio->wait, NULL);
+		if (err) {
+			err = -err;
+			pthread_mutex_destroy(&wio->lock);
+			goto err_out_destroy_queues;
+		}
+	}
+
+	/*
+	 * Threads are not started yet, but dnet_work_pool_push() uses @num to select the queue,
+	 * thus it has to be set before any thread is able to process anything.
+	 */
+	pool->num = num;
+	if (n->io)
+		pool->queue_limit = num * n->io->io_queue_limit;
+
+	for (i = 0; i < num; ++i) {
+		wio = &pool->wio_list[i];
 
 		err = pthread_create(&wio->tid, NULL, process, wio);
 		if (err) {
@@ -114,9 +263,8 @@ static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool,
 	}
 
 	dnet_log(n, DNET_LOG_INFO, "Grew %s pool by: %d -> %d IO threads",
-			dnet_work_io_mode_str(pool->mode), pool->num, pool->num + num);
+			dnet_work_io_mode_str(pool->mode), old_num, num);
 
-	pool->num = num;
 	pthread_mutex_unlock(&pool->lock);
 
 	return 0;
@@ -126,15 +274,24 @@ err_out_io_threads:
 		wio = &pool->wio_list[j];
 		pthread_join(wio->tid, NULL);
 	}
+	i = num;
+err_out_destroy_queues:
+	for (j = 0; j < i; ++j) {
+		wio = &pool->wio_list[j];
+		pthread_mutex_destroy(&wio->lock);
+		pthread_cond_destroy(&wio->wait);
+	}
 
+	pool->num = 0;
 	free(pool->wio_list);
-
+	pool->wio_list = NULL;
+err_out_unlock:
 	pthread_mutex_unlock(&pool->lock);
 
 	return err;
 }
 
-static int dnet_work_pool_place_init(struct dnet_work_pool_place *pool)
+int dnet_work_pool_place_init(struct dnet_work_pool_place *pool)
 {
 	int err;
 	memset(pool, 0, sizeof(struct dnet_work_pool_place));
@@ -151,13 +308,15 @@ static int dnet_work_pool_place_init(struct dnet_work_pool_place *pool)
 		goto err_out_mutex_destroy;
 	}
 
+	return 0;
+
 err_out_mutex_destroy:
 	pthread_mutex_destroy(&pool->lock);
 err_out_exit:
 	return err;
 }
 
-static void dnet_work_pool_place_cleanup(struct dnet_work_pool_place *pool)
+void dnet_work_pool_place_cleanup(struct dnet_work_pool_place *pool)
 {
 	pthread_mutex_destroy(&pool->lock);
 	pthread_cond_destroy(&pool->wait);
@@ -166,7 +325,7 @@ static void dnet_work_pool_place_cleanup(struct dnet_work_pool_place *pool)
 int dnet_work_pool_alloc(struct dnet_work_pool_place *place, struct dnet_node *n,
 	struct dnet_backend_io *io, int num, int mode, void *(* process)(void *))
 {
-	int err;
+	int i, err;
 
 	pthread_mutex_lock(&place->lock);
 
@@ -184,29 +343,29 @@ int dnet_work_pool_alloc(struct dnet_work_pool_place *place, struct dnet_node *n
 		goto err_out_free;
 	}
 
-	err = pthread_cond_init(&place->pool->wait, NULL);
-	if (err) {
-		err = -err;
-		goto err_out_mutex_destroy;
-	}
-
 	place->pool->num = 0;
 	place->pool->mode = mode;
 	place->pool->n = n;
 	place->pool->io = io;
-	INIT_LIST_HEAD(&place->pool->list);
-	list_stat_init(&place->pool->list_stats);
+	atomic_init(&place->pool->next_thread, 0);
+	atomic_init(&place->pool->steals, 0);
+	atomic_init(&place->pool->stolen, 0);
+	atomic_init(&place->pool->queued, 0);
+	atomic_init(&place->pool->paused, 0);
+	INIT_LIST_HEAD(&place->pool->paused_list);
+	for (i = 0; i < DNET_WORK_REPLY_BUCKETS; ++i) {
+		INIT_LIST_HEAD(&place->pool->reply_buckets[i].list);
+		INIT_LIST_HEAD(&place->pool->reply_buckets[i].ready_entry);
+	}
 
 	err = dnet_work_pool_grow(n, place->pool, num, process);
 	if (err)
-		goto err_out_cond_destroy;
+		goto err_out_mutex_destroy;
 
 	pthread_mutex_unlock(&place->lock);
 
 	return err;
 
-err_out_cond_destroy:
-	pthread_cond_destroy(&place->pool->wait);
 err_out_mutex_destroy:
 	pthread_mutex_destroy(&place->pool->lock);
 err_out_free:
@@ -248,16 +407,111 @@ static inline void make_thread_stat_id(char *buffer, int size, struct dnet_work_
 	}
 }
 
-void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
+/*
+ * Wakes up one sleeping thread of the pool to look for requests in other threads' queues.
+ * Must be called without queue locks held. Returns 1 if thread has been woken up.
+ */
+static int dnet_work_pool_wake(struct dnet_work_pool *pool)
+{
+	struct dnet_work_io *wio;
+	int i, pos, woken;
+
+	pos = (unsigned long)atomic_read(&pool->next_thread) % pool->num;
+
+	for (i = 0; i < pool->num; ++i) {
+		wio = &pool->wio_list[(pos + i) % pool->num];
+
+		/* @sleeping is read without lock, it is only a hint */
+		if (!wio->sleeping)
+			continue;
+
+		pthread_mutex_lock(&wio->lock);
+		woken = wio->sleeping && !wio->woken;
+		if (woken)
+			wio->woken = 1;
+		pthread_mutex_unlock(&wio->lock);
+
+		if (woken) {
+			pthread_cond_signal(&wio->wait);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static inline struct dnet_work_reply_bucket *dnet_work_pool_reply_bucket(struct dnet_work_pool *pool, uint64_t trans)
+{
+	/* transaction numbers are sequential, mix them to spread neighbours over all buckets */
+	uint64_t hash = trans * 0x9e3779b97f4a7c15ULL;
+
+	return &pool->reply_buckets[(hash >> 32) % DNET_WORK_REPLY_BUCKETS];
+}
+
+static inline struct dnet_work_io *dnet_work_reply_bucket_owner(struct dnet_work_pool *pool,
+		struct dnet_work_reply_bucket *bucket)
+{
+	return &pool->wio_list[(bucket - pool->reply_buckets) % pool->num];
+}
+
+/*
+ * Queues request to the pool.
+ *
+ * Transaction replies are queued to the owner of the reply bucket selected by transaction number,
+ * they are taken by the owner or by idle threads which steal from its queue when it is too long.
+ * Other requests are queued to the first sleeping thread starting from round-robin position,
+ * if all threads are busy, request is queued to the thread at round-robin position
+ * and the thread which goes to sleep next will steal it.
+ */
+void dnet_work_pool_push(struct dnet_work_pool *pool, struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+	struct dnet_work_io *wio = NULL;
+	int i, pos, sleeping;
+
+	atomic_inc(&pool->queued);
+
+	/* bucket is selected here, so queue lock is not held while request's header is read */
+	r->reply_bucket = NULL;
+	if (cmd->flags & DNET_FLAGS_REPLY) {
+		r->reply_bucket = dnet_work_pool_reply_bucket(pool, cmd->trans);
+		wio = dnet_work_reply_bucket_owner(pool, r->reply_bucket);
+	} else {
+		pos = (unsigned long)atomic_inc(&pool->next_thread) % pool->num;
+
+		/* @sleeping is read without lock, it is only a hint */
+		for (i = 0; i < pool->num; ++i) {
+			if (pool->wio_list[(pos + i) % pool->num].sleeping) {
+				wio = &pool->wio_list[(pos + i) % pool->num];
+				break;
+			}
+		}
+
+		if (!wio)
+			wio = &pool->wio_list[pos];
+	}
+
+	pthread_mutex_lock(&wio->lock);
+	list_add_tail(&r->req_entry, &wio->list);
+	list_stat_size_increase(&wio->list_stats, 1);
+	sleeping = wio->sleeping;
+	pthread_mutex_unlock(&wio->lock);
+
+	if (sleeping)
+		pthread_cond_signal(&wio->wait);
+}
+
+/*
+ * Returns place of the pool request should be queued to: pool of the backend command belongs to
+ * or node's system pool. Place is not locked, backend pool may be stopped in the meantime.
+ */
+static struct dnet_work_pool_place *dnet_io_req_place(struct dnet_node *n, struct dnet_io_req *r)
 {
-	struct dnet_work_pool_place *place = NULL;
-	struct dnet_work_pool_place *backend_place = NULL;
-	struct dnet_work_pool *pool = NULL;
 	struct dnet_io_pool *io_pool = &n->io->pool;
 	struct dnet_cmd *cmd = r->header;
 	int nonblocking = !!(cmd->flags & DNET_FLAGS_NOLOCK);
+	int reply = !!(cmd->flags & DNET_FLAGS_REPLY);
 	ssize_t backend_id = -1;
-	char thread_stat_id[255];
 
 	if (cmd->size > 0) {
 		dnet_log(r->st->n, DNET_LOG_DEBUG, "%s: %s: RECV cmd: %s: cmd-size: %llu, nonblocking: %d",
@@ -268,7 +522,6 @@ void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 			dnet_state_dump_addr(r->st), dnet_dump_id(r->header), dnet_cmd_string(cmd->cmd), nonblocking);
 	} else {
 		unsigned long long tid = cmd->trans;
-		int reply = !!(cmd->flags & DNET_FLAGS_REPLY);
 
 		dnet_log(r->st->n, DNET_LOG_DEBUG, "%s: %s: RECV: %s: nonblocking: %d, cmd-size: %llu, cflags: %s, trans: %lld, reply: %d",
 			dnet_state_dump_addr(r->st), dnet_dump_id(r->header), dnet_cmd_string(cmd->cmd), nonblocking,
@@ -280,68 +533,144 @@ void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 	else if (dnet_cmd_needs_backend(cmd->cmd))
 		backend_id = dnet_state_search_backend(n, &cmd->id);
 
-	if (backend_id >= 0 && backend_id < (ssize_t)n->io->backends_count) {
+	if (backend_id >= 0 && backend_id < (ssize_t)n->io->backends_count)
 		io_pool = &n->io->backends[backend_id].pool;
-		if (nonblocking) {
-			place = &io_pool->recv_pool_nb;
-		} else {
-			place = &io_pool->recv_pool;
-		}
 
-		if (place) {
-			pthread_mutex_lock(&place->lock);
-			if (!place->pool) {
-				pthread_mutex_unlock(&place->lock);
-				io_pool = &n->io->pool;
-				place = NULL;
-			}
-		}
-	}
+	return nonblocking ? &io_pool->recv_pool_nb : &io_pool->recv_pool;
+}
 
-	backend_place = place;
+/*
+ * Wakes up one sleeping thread of another backend to steal requests from overloaded nonblocking @pool.
+ * Called with @pool's place locked, thus other places are only tried to be locked.
+ */
+static void dnet_work_pool_wake_thief(struct dnet_node *n, struct dnet_work_pool *pool)
+{
+	struct dnet_io *io = n->io;
+	struct dnet_work_pool_place *places[2];
+	struct dnet_backend_io *thief_io;
+	size_t i, pos;
+	int j, woken = 0;
 
-	if (place == NULL) {
-		if (nonblocking) {
-			place = &io_pool->recv_pool_nb;
-		} else {
-			place = &io_pool->recv_pool;
-		}
+	pos = pool->io->backend_id + atomic_read(&pool->next_thread);
 
-		pthread_mutex_lock(&place->lock);
+	for (i = 0; i < io->backends_count && !woken; ++i) {
+		thief_io = &io->backends[(pos + i) % io->backends_count];
+		if (thief_io == pool->io || thief_io->need_exit)
+			continue;
+
+		places[0] = &thief_io->pool.recv_pool_nb;
+		places[1] = &thief_io->pool.recv_pool;
+
+		for (j = 0; j < 2 && !woken; ++j) {
+			if (pthread_mutex_trylock(&places[j]->lock))
+				continue;
+
+			if (places[j]->pool)
+				woken = dnet_work_pool_wake(places[j]->pool);
+
+			pthread_mutex_unlock(&places[j]->lock);
+		}
 	}
+}
 
-	pool = place->pool;
+/*
+ * Queues request to the pool of locked @place.
+ * Returns 1 if reading from the request's state has been paused because the pool is overloaded.
+ */
+static int dnet_schedule_io_locked(struct dnet_node *n, struct dnet_work_pool_place *place, struct dnet_io_req *r)
+{
+	struct dnet_work_pool *pool = place->pool;
+	struct dnet_cmd *cmd = r->header;
+	struct dnet_net_state *st = r->st;
+	int reply = !!(cmd->flags & DNET_FLAGS_REPLY);
+	int paused = 0;
+	char thread_stat_id[255];
 
 	make_thread_stat_id(thread_stat_id, sizeof(thread_stat_id), pool);
 
 	// If we are processing the command we should update cmd->backend_id to actual one
-	if (!(cmd->flags & DNET_FLAGS_REPLY)) {
+	if (!reply) {
 		if (pool->io)
 			cmd->backend_id = pool->io->backend_id;
 		else
 			cmd->backend_id = -1;
 	}
 
-	dnet_log(n, DNET_LOG_DEBUG, "%s: %s: backend_id: %zd, place: %p, backend_place: %p, backend_place->pool->backend_id: %zd, cmd->backend_id: %d",
-		dnet_state_dump_addr(r->st), dnet_dump_id(r->header), backend_id, place, backend_place,
-		backend_place && backend_place->pool->io ? (ssize_t)backend_place->pool->io->backend_id : (ssize_t)-1,
-		cmd->backend_id);
+	dnet_log(n, DNET_LOG_DEBUG, "%s: %s: place: %p, place->pool->backend_id: %zd, cmd->backend_id: %d",
+		dnet_state_dump_addr(st), dnet_dump_id(r->header), place,
+		pool->io ? (ssize_t)pool->io->backend_id : (ssize_t)-1, cmd->backend_id);
 
-	pthread_mutex_lock(&pool->lock);
+	FORMATTED(HANDY_TIMER_START, ("pool.%s.queue.wait_time", thread_stat_id), (uint64_t)&r->req_entry);
+	FORMATTED(HANDY_COUNTER_INCREMENT, ("pool.%s.queue.size", thread_stat_id), 1);
+	HANDY_COUNTER_INCREMENT("io.input.queue.size", 1);
 
-	list_add_tail(&r->req_entry, &pool->list);
-	list_stat_size_increase(&pool->list_stats, 1);
+	dnet_work_pool_push(pool, r);
 
-	pthread_mutex_unlock(&pool->lock);
-	pthread_cond_signal(&pool->wait);
+	/* threads of other backends do not look for requests to steal until they are woken up */
+	if (!reply && pool->io && pool->mode == DNET_WORK_IO_MODE_NONBLOCKING && n->io->work_steal_threshold > 0 &&
+			atomic_read(&pool->queued) > n->io->work_steal_threshold)
+		dnet_work_pool_wake_thief(n, pool);
 
-	pthread_mutex_unlock(&place->lock);
+	/*
+	 * Only clients which send requests to overloaded pool are not read anymore,
+	 * replies are never paused since they complete transactions this node waits for.
+	 * Request can not be touched after it has been queued, it may be already processed.
+	 */
+	if (!reply && pool->queue_limit && atomic_read(&pool->queued) > pool->queue_limit)
+		paused = dnet_work_pool_pause_recv(pool, st);
 
-	FORMATTED(HANDY_TIMER_START, ("pool.%s.queue.wait_time", thread_stat_id), (uint64_t)&r->req_entry);
-	FORMATTED(HANDY_COUNTER_INCREMENT, ("pool.%s.queue.size", thread_stat_id), 1);
-	HANDY_COUNTER_INCREMENT("io.input.queue.size", 1);
+	return paused;
 }
 
+/*
+ * Queues up to DNET_RECV_BATCH_MAX_REQUESTS requests received from the same state to IO pools.
+ * Requests going to the same pool are queued under single acquisition of the pool place lock.
+ * Returns 1 if reading from the state has been paused because one of the pools is overloaded.
+ */
+int dnet_schedule_io_batch(struct dnet_node *n, struct dnet_io_req **reqs, int num)
+{
+	struct dnet_work_pool_place *places[DNET_RECV_BATCH_MAX_REQUESTS];
+	struct dnet_work_pool_place *place;
+	struct dnet_cmd *cmd;
+	int paused = 0;
+	int i, j;
+
+	for (i = 0; i < num; ++i)
+		places[i] = dnet_io_req_place(n, reqs[i]);
+
+	for (i = 0; i < num; ++i) {
+		if (!reqs[i])
+			continue;
+
+		place = places[i];
+
+		pthread_mutex_lock(&place->lock);
+		if (!place->pool) {
+			/* backend is being stopped, its requests go to the system pool */
+			pthread_mutex_unlock(&place->lock);
+
+			cmd = reqs[i]->header;
+			if (cmd->flags & DNET_FLAGS_NOLOCK)
+				place = &n->io->pool.recv_pool_nb;
+			else
+				place = &n->io->pool.recv_pool;
+
+			pthread_mutex_lock(&place->lock);
+		}
+
+		for (j = i; j < num; ++j) {
+			if (!reqs[j] || places[j] != places[i])
+				continue;
+
+			paused |= dnet_schedule_io_locked(n, place, reqs[j]);
+			reqs[j] = NULL;
+		}
+
+		pthread_mutex_unlock(&place->lock);
+	}
+
+	return paused;
+}
 
 void dnet_schedule_command(struct dnet_net_state *st)
 {
@@ -354,7 +683,7 @@ void dnet_schedule_command(struct dnet_net_state *st)
 		dnet_log(st->n, DNET_LOG_DEBUG, "freed: size: %llu, trans: %llu, reply: %d, ptr: %p.",
 						(unsigned long long)c->size, tid, tid != c->trans, st->rcv_data);
 #endif
-		free(st->rcv_data);
+		dnet_io_arena_free(st->rcv_data);
 		st->rcv_data = NULL;
 	}
 
@@ -362,110 +691,226 @@ void dnet_schedule_command(struct dnet_net_state *st)
 	st->rcv_offset = 0;
 }
 
-static int dnet_process_recv_single(struct dnet_net_state *st)
+/*
+ * Fills @iov with buffers the next portion of data has to be received into, returns number of entries.
+ *
+ * Commands are received into per-state buffer, so many small commands are read at once.
+ * When the rest of command's data is not in the buffer, it is received directly into the request
+ * and the buffer is appended to catch the following commands with the same call.
+ */
+static int dnet_recv_iov(struct dnet_net_state *st, struct iovec *iov, size_t *sizep)
+{
+	int iov_num = 0;
+
+	if (!st->rcv_buf) {
+		st->rcv_buf = malloc(DNET_RECV_BUFFER_SIZE);
+		if (!st->rcv_buf)
+			return -ENOMEM;
+	}
+
+	if (st->rcv_buf_start == st->rcv_buf_end) {
+		st->rcv_buf_start = st->rcv_buf_end = 0;
+	} else if (st->rcv_buf_start) {
+		memmove(st->rcv_buf, st->rcv_buf + st->rcv_buf_start, st->rcv_buf_end - st->rcv_buf_start);
+		st->rcv_buf_end -= st->rcv_buf_start;
+		st->rcv_buf_start = 0;
+	}
+
+	*sizep = 0;
+
+	if (!(st->rcv_flags & DNET_IO_CMD)) {
+		iov[iov_num].iov_base = st->rcv_data + st->rcv_offset;
+		iov[iov_num].iov_len = st->rcv_end - st->rcv_offset;
+		*sizep += iov[iov_num].iov_len;
+		iov_num++;
+	}
+
+	iov[iov_num].iov_base = st->rcv_buf + st->rcv_buf_end;
+	iov[iov_num].iov_len = DNET_RECV_BUFFER_SIZE - st->rcv_buf_end;
+	*sizep += iov[iov_num].iov_len;
+	iov_num++;
+
+	return iov_num;
+}
+
+/*
+ * Allocates request for the command header just received into st->rcv_cmd
+ */
+static int dnet_recv_cmd_alloc(struct dnet_net_io *nio, struct dnet_net_state *st)
 {
 	struct dnet_node *n = st->n;
+	struct dnet_cmd *c = &st->rcv_cmd;
+	struct dnet_io_req *r;
+	unsigned long long tid;
+
+	dnet_convert_cmd(c);
+
+	tid = c->trans;
+
+	dnet_log(n, DNET_LOG_DEBUG, "%s: received trans: %llu / 0x%llx, "
+			"reply: %d, size: %llu, flags: %s, status: %d.",
+			dnet_dump_id(&c->id), tid, (unsigned long long)c->trans,
+			!!(c->flags & DNET_FLAGS_REPLY),
+			(unsigned long long)c->size, dnet_flags_dump_cflags(c->flags), c->status);
+
+	r = dnet_io_arena_alloc(nio->arena, c->size + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
+	if (!r)
+		return -ENOMEM;
+
+	r->header = r + 1;
+	r->hsize = sizeof(struct dnet_cmd);
+	memcpy(r->header, &st->rcv_cmd, sizeof(struct dnet_cmd));
+
+	st->rcv_data = r;
+	st->rcv_offset = sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd);
+	st->rcv_end = st->rcv_offset + c->size;
+	st->rcv_flags &= ~DNET_IO_CMD;
+
+	if (c->size) {
+		r->data = r->header + sizeof(struct dnet_cmd);
+		r->dsize = c->size;
+	}
+
+	return 0;
+}
+
+/*
+ * Parses all complete commands from the receive buffer and queues them to IO pools in batches,
+ * beginning of incomplete command is left in the buffer or moved into its request.
+ * Returns 1 if reading from the state has been paused, 0 or negative error otherwise.
+ */
+static int dnet_recv_parse(struct dnet_net_io *nio, struct dnet_net_state *st)
+{
+	struct dnet_io_req *reqs[DNET_RECV_BATCH_MAX_REQUESTS];
 	struct dnet_io_req *r;
-	void *data;
 	uint64_t size;
-	int err;
+	int num = 0, paused = 0;
+	int err = 0;
 
-again:
-	/*
-	 * Reading command first.
-	 */
-	if (st->rcv_flags & DNET_IO_CMD)
-		data = &st->rcv_cmd;
-	else
-		data = st->rcv_data;
-	data += st->rcv_offset;
-	size = st->rcv_end - st->rcv_offset;
-
-	if (size) {
-		err = recv(st->read_s, data, size, 0);
-		if (err < 0) {
-			err = -EAGAIN;
-			if (errno != EAGAIN && errno != EINTR) {
-				err = -errno;
-				dnet_log_err(n, "%s: failed to receive data, socket: %d/%d",
-						dnet_state_dump_addr(st), st->read_s, st->write_s);
-				goto out;
-			}
+	while (1) {
+		size = st->rcv_buf_end - st->rcv_buf_start;
 
-			goto out;
-		}
+		if (st->rcv_flags & DNET_IO_CMD) {
+			if (size < sizeof(struct dnet_cmd))
+				break;
 
-		if (err == 0) {
-			dnet_log(n, DNET_LOG_ERROR, "%s: peer has disconnected, socket: %d/%d.",
-				dnet_state_dump_addr(st), st->read_s, st->write_s);
-			err = -ECONNRESET;
-			goto out;
+			memcpy(&st->rcv_cmd, st->rcv_buf + st->rcv_buf_start, sizeof(struct dnet_cmd));
+			st->rcv_buf_start += sizeof(struct dnet_cmd);
+			size -= sizeof(struct dnet_cmd);
+
+			err = dnet_recv_cmd_alloc(nio, st);
+			if (err)
+				break;
 		}
 
-		st->rcv_offset += err;
-	}
+		if (size > st->rcv_end - st->rcv_offset)
+			size = st->rcv_end - st->rcv_offset;
 
-	if (st->rcv_offset != st->rcv_end)
-		goto again;
+		memcpy(st->rcv_data + st->rcv_offset, st->rcv_buf + st->rcv_buf_start, size);
+		st->rcv_offset += size;
+		st->rcv_buf_start += size;
 
-	if (st->rcv_flags & DNET_IO_CMD) {
-		unsigned long long tid;
-		struct dnet_cmd *c = &st->rcv_cmd;
+		if (st->rcv_offset != st->rcv_end)
+			break;
 
-		dnet_convert_cmd(c);
+		r = st->rcv_data;
+		st->rcv_data = NULL;
 
-		tid = c->trans;
+		dnet_schedule_command(st);
 
-		dnet_log(n, DNET_LOG_DEBUG, "%s: received trans: %llu / 0x%llx, "
-				"reply: %d, size: %llu, flags: %s, status: %d.",
-				dnet_dump_id(&c->id), tid, (unsigned long long)c->trans,
-				!!(c->flags & DNET_FLAGS_REPLY),
-				(unsigned long long)c->size, dnet_flags_dump_cflags(c->flags), c->status);
+		r->st = dnet_state_get(st);
+		reqs[num++] = r;
 
-		r = malloc(c->size + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
-		if (!r) {
-			err = -ENOMEM;
-			goto out;
+		if (num == DNET_RECV_BATCH_MAX_REQUESTS) {
+			paused |= dnet_schedule_io_batch(st->n, reqs, num);
+			num = 0;
 		}
-		memset(r, 0, sizeof(struct dnet_io_req));
+	}
 
-		r->header = r + 1;
-		r->hsize = sizeof(struct dnet_cmd);
-		memcpy(r->header, &st->rcv_cmd, sizeof(struct dnet_cmd));
+	if (num)
+		paused |= dnet_schedule_io_batch(st->n, reqs, num);
 
-		st->rcv_data = r;
-		st->rcv_offset = sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd);
-		st->rcv_end = st->rcv_offset + c->size;
-		st->rcv_flags &= ~DNET_IO_CMD;
+	return err ? err : paused;
+}
 
-		if (c->size) {
-			r->data = r->header + sizeof(struct dnet_cmd);
-			r->dsize = c->size;
+/*
+ * Accounts result of receiving into buffers returned by dnet_recv_iov() of @size total size:
+ * number of bytes or negative error. Returns 1 if the socket may have more data to receive,
+ * 0 if there is no need to read more right now, negative error otherwise.
+ */
+static int dnet_recv_complete(struct dnet_net_io *nio, struct dnet_net_state *st, ssize_t res, size_t size)
+{
+	struct dnet_node *n = st->n;
+	uint64_t direct;
+	int err;
 
-			/*
-			 * We read the command header, now get the data.
-			 */
-			goto again;
+	if (res < 0) {
+		err = (res == -EINTR) ? -EAGAIN : res;
+		if (err != -EAGAIN) {
+			dnet_log(n, DNET_LOG_ERROR, "%s: failed to receive data, socket: %d/%d: %s [%d]",
+					dnet_state_dump_addr(st), st->read_s, st->write_s, strerror(-err), err);
 		}
+		goto out;
 	}
 
-	r = st->rcv_data;
-	st->rcv_data = NULL;
+	if (res == 0) {
+		dnet_log(n, DNET_LOG_ERROR, "%s: peer has disconnected, socket: %d/%d.",
+			dnet_state_dump_addr(st), st->read_s, st->write_s);
+		err = -ECONNRESET;
+		goto out;
+	}
+
+	/* data received directly into request, see dnet_recv_iov() */
+	direct = 0;
+	if (!(st->rcv_flags & DNET_IO_CMD)) {
+		direct = st->rcv_end - st->rcv_offset;
+		if (direct > (uint64_t)res)
+			direct = res;
 
-	dnet_schedule_command(st);
+		st->rcv_offset += direct;
+	}
 
-	r->st = dnet_state_get(st);
+	st->rcv_buf_end += res - direct;
 
-	dnet_schedule_io(n, r);
-	return 0;
+	err = dnet_recv_parse(nio, st);
+	if (err < 0)
+		goto out;
+
+	/* short read means socket has been drained, epoll reports when more data arrives */
+	if (err || (size_t)res != size)
+		return 0;
+
+	return 1;
 
 out:
-	if (err != -EAGAIN && err != -EINTR)
+	if (err != -EAGAIN)
 		dnet_schedule_command(st);
 
 	return err;
 }
 
+static int dnet_process_recv_single(struct dnet_net_io *nio, struct dnet_net_state *st)
+{
+	struct iovec iov[2];
+	size_t size;
+	ssize_t res;
+	int err;
+
+	do {
+		err = dnet_recv_iov(st, iov, &size);
+		if (err < 0)
+			return err;
+
+		res = readv(st->read_s, iov, err);
+		if (res < 0)
+			res = -errno;
+
+		err = dnet_recv_complete(nio, st, res, size);
+	} while (err == 1);
+
+	return err;
+}
+
 /*
  * Tries to unmap IPv4 from IPv6.
  * If it is succeeded addr will contain valid unmapped IPv4 address
@@ -572,7 +1017,12 @@ int dnet_state_accept_process(struct dnet_net_state *orig, struct epoll_event *e
 
 	idx = dnet_local_addr_index(n, &saddr);
 
-	st = dnet_state_create(n, NULL, 0, &addr, cs, &err, 0, 0, idx, 0, NULL, 0);
+	/*
+	 * With per-thread SO_REUSEPORT listeners client is served by the network thread
+	 * which has accepted it, otherwise clients are spread over all network threads
+	 */
+	st = dnet_state_create(n, NULL, 0, &addr, cs, &err, 0, 0, idx, 0, NULL, 0,
+			(n->flags & DNET_CFG_REUSEPORT) ? orig->epoll_fd : -1);
 	if (!st) {
 		dnet_log(n, DNET_LOG_ERROR, "%s: Failed to create state for accepted client: %s [%d]",
 				dnet_addr_string_raw(&addr, client_addr, sizeof(client_addr)), strerror(-err), -err);
@@ -611,53 +1061,127 @@ void dnet_unschedule_all(struct dnet_net_state *st)
 		epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->accept_s, NULL);
 }
 
-static int dnet_process_send_single(struct dnet_net_state *st)
+static void dnet_send_complete_request(struct dnet_net_state *st, struct dnet_io_req *r)
 {
-	struct dnet_io_req *r = NULL;
-	int err;
+	pthread_mutex_lock(&st->send_lock);
+	list_del(&r->req_entry);
+	pthread_mutex_unlock(&st->send_lock);
+
+	pthread_mutex_lock(&st->n->io->full_lock);
+	list_stat_size_decrease(&st->n->io->output_stats, 1);
+	pthread_mutex_unlock(&st->n->io->full_lock);
+	HANDY_COUNTER_DECREMENT("io.output.queue.size", 1);
+
+	if (atomic_read(&st->send_queue_size) > 0)
+		if (atomic_dec(&st->send_queue_size) == DNET_SEND_WATERMARK_LOW) {
+			dnet_log(st->n, DNET_LOG_DEBUG,
+					"State low_watermark reached: %s: %d, waking up",
+					dnet_addr_string(&st->addr),
+					atomic_read(&st->send_queue_size));
+			pthread_cond_broadcast(&st->send_wait);
+		}
 
-	while (1) {
-		r = NULL;
+	dnet_io_req_free(r);
+	st->send_offset = 0;
+}
 
-		pthread_mutex_lock(&st->send_lock);
-		if (!list_empty(&st->send_list)) {
-			r = list_first_entry(&st->send_list, struct dnet_io_req, req_entry);
-		} else {
-			dnet_unschedule_send(st);
+/*
+ * Collects requests from the head of the send queue which can be sent with single sendmsg() call:
+ * only memory-backed requests are coalesced, request which carries file descriptor is sent
+ * alone via sendfile(). Returns number of collected requests, @first is set to the head of the queue.
+ *
+ * Only network thread removes requests from the queue, so collected pointers stay valid
+ * after the lock is dropped.
+ */
+static int dnet_send_collect_batch(struct dnet_net_state *st, struct dnet_io_req **reqs, struct dnet_io_req **first)
+{
+	struct dnet_io_req *r;
+	size_t max_size = st->n->io->send_batch_size;
+	size_t size = 0;
+	int num = 0;
+
+	*first = NULL;
+
+	pthread_mutex_lock(&st->send_lock);
+	if (list_empty(&st->send_list)) {
+		dnet_unschedule_send(st);
+		goto out_unlock;
+	}
+
+	*first = list_first_entry(&st->send_list, struct dnet_io_req, req_entry);
+
+	list_for_each_entry(r, &st->send_list, req_entry) {
+		if (r->fd >= 0 && r->fsize)
+			break;
+		if (num == DNET_SEND_BATCH_MAX_REQUESTS)
+			break;
+		if (num && size + r->hsize + r->dsize > max_size)
+			break;
+
+		size += r->hsize + r->dsize;
+		reqs[num++] = r;
+	}
+
+out_unlock:
+	pthread_mutex_unlock(&st->send_lock);
+	return num;
+}
+
+/*
+ * Completes requests of the batch which were sent in full by sending @sent bytes,
+ * returns number of completed requests
+ */
+static int dnet_send_batch_complete(struct dnet_net_state *st, struct dnet_io_req **reqs, int num, size_t sent)
+{
+	struct dnet_io_req *r;
+	size_t rest;
+	int i;
+
+	for (i = 0; i < num; ++i) {
+		r = reqs[i];
+		rest = r->hsize + r->dsize - st->send_offset;
+
+		if (sent < rest) {
+			st->send_offset += sent;
+			break;
 		}
-		pthread_mutex_unlock(&st->send_lock);
 
+		sent -= rest;
+		dnet_send_complete_request(st, r);
+	}
+
+	return i;
+}
+
+static int dnet_process_send_single(struct dnet_net_state *st)
+{
+	struct dnet_io_req *reqs[DNET_SEND_BATCH_MAX_REQUESTS];
+	struct dnet_io_req *r;
+	size_t sent;
+	int err, num;
+
+	while (1) {
+		num = dnet_send_collect_batch(st, reqs, &r);
 		if (!r) {
 			err = -EAGAIN;
 			goto err_out_exit;
 		}
 
-		err = dnet_send_request(st, r);
-		if (st->send_offset == (r->dsize + r->hsize + r->fsize)) {
-			pthread_mutex_lock(&st->send_lock);
-			list_del(&r->req_entry);
-			pthread_mutex_unlock(&st->send_lock);
-
-			pthread_mutex_lock(&st->n->io->full_lock);
-			list_stat_size_decrease(&st->n->io->output_stats, 1);
-			pthread_mutex_unlock(&st->n->io->full_lock);
-			HANDY_COUNTER_DECREMENT("io.output.queue.size", 1);
+		if (!num) {
+			err = dnet_send_request(st, r);
+			if (st->send_offset == (r->dsize + r->hsize + r->fsize))
+				dnet_send_complete_request(st, r);
 
-			if (atomic_read(&st->send_queue_size) > 0)
-				if (atomic_dec(&st->send_queue_size) == DNET_SEND_WATERMARK_LOW) {
-					dnet_log(st->n, DNET_LOG_DEBUG,
-							"State low_watermark reached: %s: %d, waking up",
-							dnet_addr_string(&st->addr),
-							atomic_read(&st->send_queue_size));
-					pthread_cond_broadcast(&st->send_wait);
-				}
-
-			dnet_io_req_free(r);
-			st->send_offset = 0;
+			if (err)
+				goto err_out_exit;
+			continue;
 		}
 
+		err = dnet_send_request_batch(st, reqs, num, &sent);
 		if (err)
 			goto err_out_exit;
+
+		dnet_send_batch_complete(st, reqs, num, sent);
 	}
 
 err_out_exit:
@@ -703,100 +1227,366 @@ static int dnet_schedule_network_io(struct dnet_net_state *st, int send)
 	if (err < 0) {
 		err = -errno;
 
-		if (err == -EEXIST) {
-			err = 0;
-		} else {
-			dnet_log_err(st->n, "%s: failed to add %s event, fd: %d", dnet_state_dump_addr(st), send ? "SEND" : "RECV", fd);
+		if (err == -EEXIST) {
+			err = 0;
+		} else {
+			dnet_log_err(st->n, "%s: failed to add %s event, fd: %d", dnet_state_dump_addr(st), send ? "SEND" : "RECV", fd);
+		}
+	} else if (!send && st->accept_s >= 0) {
+		ev.data.ptr = &st->accept_data;
+		err = epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, st->accept_s, &ev);
+
+		if (err < 0) {
+			err = -errno;
+
+			dnet_log_err(st->n, "%s: failed to add %s event, fd: %d", dnet_state_dump_addr(st), "ACCEPT", st->accept_s);
+		}
+	}
+
+	return err;
+}
+
+int dnet_schedule_send(struct dnet_net_state *st)
+{
+	return dnet_schedule_network_io(st, 1);
+}
+
+int dnet_schedule_recv(struct dnet_net_state *st)
+{
+	return dnet_schedule_network_io(st, 0);
+}
+
+static int dnet_state_net_process(struct dnet_net_io *nio, struct dnet_net_state *st, struct epoll_event *ev)
+{
+	int err = -ECONNRESET;
+
+	if (ev->events & EPOLLIN) {
+		err = dnet_process_recv_single(nio, st);
+		if (err && (err != -EAGAIN))
+			goto err_out_exit;
+	}
+	if (ev->events & EPOLLOUT) {
+		err = dnet_process_send_single(st);
+		if (err && (err != -EAGAIN))
+			goto err_out_exit;
+	}
+
+	if (ev->events & (EPOLLHUP | EPOLLERR)) {
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: received error event mask 0x%x", dnet_state_dump_addr(st), ev->events);
+		err = -ECONNRESET;
+	}
+err_out_exit:
+	return err;
+}
+
+/*
+ * Resets state if processing of its network event has failed or state has stalled
+ */
+static void dnet_net_state_check_error(struct dnet_node *n, struct dnet_net_state *st, int err)
+{
+	if (err == 0)
+		return;
+
+	if (err == -EAGAIN && st->stall < DNET_DEFAULT_STALL_TRANSACTIONS)
+		return;
+
+	if (err < 0 || st->stall >= DNET_DEFAULT_STALL_TRANSACTIONS) {
+		if (!err)
+			err = -ETIMEDOUT;
+
+		char addr_str[128] = "no address";
+		if (n->addr_num) {
+			dnet_addr_string_raw(&n->addrs[0], addr_str, sizeof(addr_str));
+		}
+		dnet_log(n, DNET_LOG_ERROR, "self: addr: %s, resetting state: %p", addr_str, st);
+		dnet_log(n, DNET_LOG_ERROR, "self: addr: %s, resetting state: %s", addr_str, dnet_state_dump_addr(st));
+
+		dnet_state_reset(st, err);
+
+		pthread_mutex_lock(&st->send_lock);
+		dnet_unschedule_all(st);
+		pthread_mutex_unlock(&st->send_lock);
+
+		dnet_add_reconnect_state(st->n, &st->addr, st->__join_state);
+
+		// state still contains a fair number of transactions in its queue
+		// they will not be cleaned up here - dnet_state_put() will only drop refctn by 1,
+		// while every transaction holds a reference
+		//
+		// IO thread could remove transaction, it is the only place allowed to do it.
+		// transactions may live in the tree and be accessed without locks in IO thread,
+		// IO thread is kind of 'owner' of the transaction processing
+		dnet_state_put(st);
+	}
+}
+
+/*
+ * Receive or send operation queued into network thread's io_uring.
+ * Operation holds state reference until the end of the flush.
+ */
+struct dnet_uring_op {
+	struct dnet_net_state	*st;
+	int			send;
+
+	/* total size of receive buffers */
+	size_t			size;
+
+	int			num;
+	struct dnet_io_req	*reqs[DNET_SEND_BATCH_MAX_REQUESTS];
+	struct iovec		iov[DNET_SEND_BATCH_MAX_REQUESTS * 2];
+	struct msghdr		msg;
+};
+
+static int dnet_uring_net_init(struct dnet_net_io *nio)
+{
+	int err;
+
+	nio->uring_ops = malloc(DNET_URING_ENTRIES * sizeof(struct dnet_uring_op));
+	if (!nio->uring_ops)
+		return -ENOMEM;
+
+	nio->uring = dnet_uring_create(DNET_URING_ENTRIES, &err);
+	if (!nio->uring) {
+		free(nio->uring_ops);
+		nio->uring_ops = NULL;
+		return err;
+	}
+
+	nio->uring_ops_num = 0;
+	return 0;
+}
+
+static void dnet_uring_net_destroy(struct dnet_net_io *nio)
+{
+	dnet_uring_destroy(nio->uring);
+	free(nio->uring_ops);
+
+	nio->uring = NULL;
+	nio->uring_ops = NULL;
+}
+
+/*
+ * Queues the next receive or send of the operation's state into the ring.
+ * Returns 1 if operation has been queued, 0 or negative error if there is nothing to queue.
+ *
+ * Requests which carry file descriptor are sent synchronously via sendfile().
+ */
+static int dnet_uring_op_prep(struct dnet_net_io *nio, struct dnet_uring_op *op)
+{
+	struct dnet_net_state *st = op->st;
+	struct dnet_io_req *r;
+	size_t total_size;
+	int err, iov_num;
+
+	if (!op->send) {
+		iov_num = dnet_recv_iov(st, op->iov, &op->size);
+		if (iov_num < 0)
+			return iov_num;
+
+		memset(&op->msg, 0, sizeof(struct msghdr));
+		op->msg.msg_iov = op->iov;
+		op->msg.msg_iovlen = iov_num;
+
+		err = dnet_uring_prep_recvmsg(nio->uring, st->read_s, &op->msg, op);
+		return err ? err : 1;
+	}
+
+	while (1) {
+		op->num = dnet_send_collect_batch(st, op->reqs, &r);
+		if (!r)
+			return 0;
+
+		if (!op->num)
+			return dnet_process_send_single(st);
+
+		iov_num = dnet_send_batch_iov(st, op->reqs, op->num, op->iov, &total_size);
+		if (iov_num)
+			break;
+
+		/* nothing left to send in collected requests */
+		dnet_send_batch_complete(st, op->reqs, op->num, 0);
+	}
+
+	memset(&op->msg, 0, sizeof(struct msghdr));
+	op->msg.msg_iov = op->iov;
+	op->msg.msg_iovlen = iov_num;
+
+	err = dnet_uring_prep_sendmsg(nio->uring, st->write_s, &op->msg, op);
+	return err ? err : 1;
+}
+
+/*
+ * Accounts result of the completed operation and queues its continuation if socket may have
+ * more data to receive or send. Return value is the same as of dnet_uring_op_prep().
+ */
+static int dnet_uring_op_complete(struct dnet_net_io *nio, struct dnet_uring_op *op, int res)
+{
+	struct dnet_net_state *st = op->st;
+	int err;
+
+	if (!op->send) {
+		err = dnet_recv_complete(nio, st, res, op->size);
+		if (err != 1)
+			return err;
+
+		return dnet_uring_op_prep(nio, op);
+	}
+
+	if (res < 0) {
+		err = (res == -EINTR) ? -EAGAIN : res;
+		if (err != -EAGAIN)
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to send batch: requests: %d, socket: %d: %s [%d]",
+				dnet_state_dump_addr(st), op->num, st->write_s, strerror(-err), err);
+		goto err_out_wakeup;
+	}
+
+	if (res == 0) {
+		dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has dropped the connection: socket: %d.",
+				dnet_state_dump_addr(st), st->write_s);
+		err = -ECONNRESET;
+		goto err_out_wakeup;
+	}
+
+	if (dnet_send_batch_complete(st, op->reqs, op->num, res) == op->num)
+		return dnet_uring_op_prep(nio, op);
+
+	/* socket buffer is full, wait for the next EPOLLOUT */
+	err = -EAGAIN;
+
+err_out_wakeup:
+	if (atomic_read(&st->send_queue_size) > 0)
+		pthread_cond_broadcast(&st->send_wait);
+	return err;
+}
+
+/*
+ * Submits all queued operations, processes their completions and resubmits continuations
+ * until every socket is either drained or would block.
+ */
+static void dnet_uring_net_flush(struct dnet_net_io *nio)
+{
+	struct dnet_node *n = nio->n;
+	struct dnet_uring_op *op;
+	void *priv;
+	int queued = nio->uring_ops_num;
+	int res, err, i;
+
+	while (queued) {
+		err = dnet_uring_submit_and_wait(nio->uring);
+		if (err) {
+			/* queued operations reference states and their buffers, they can not be dropped */
+			dnet_log(n, DNET_LOG_ERROR, "Failed to submit io_uring operations: %s [%d]", strerror(-err), err);
+			n->need_exit = err;
+			return;
 		}
-	} else if (!send && st->accept_s >= 0) {
-		ev.data.ptr = &st->accept_data;
-		err = epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, st->accept_s, &ev);
 
-		if (err < 0) {
-			err = -errno;
+		queued = 0;
+		while (dnet_uring_reap(nio->uring, &priv, &res)) {
+			op = priv;
 
-			dnet_log_err(st->n, "%s: failed to add %s event, fd: %d", dnet_state_dump_addr(st), "ACCEPT", st->accept_s);
+			err = dnet_uring_op_complete(nio, op, res);
+			if (err == 1) {
+				queued++;
+				continue;
+			}
+
+			/*
+			 * State could be reset by previous completion for its another socket,
+			 * or by other thread, in the latter case epoll reports error event for its sockets later
+			 */
+			if (!op->st->__need_exit)
+				dnet_net_state_check_error(n, op->st, err);
 		}
 	}
 
-	if (send)
-		pthread_cond_broadcast(&st->n->io->full_wait);
+	for (i = 0; i < nio->uring_ops_num; ++i)
+		dnet_state_put(nio->uring_ops[i].st);
 
-	return err;
+	nio->uring_ops_num = 0;
 }
 
-int dnet_schedule_send(struct dnet_net_state *st)
+static int dnet_uring_net_queue_op(struct dnet_net_io *nio, struct dnet_net_state *st, int send)
 {
-	return dnet_schedule_network_io(st, 1);
-}
+	struct dnet_uring_op *op;
+	int err;
 
-int dnet_schedule_recv(struct dnet_net_state *st)
-{
-	return dnet_schedule_network_io(st, 0);
+	if (nio->uring_ops_num == DNET_URING_ENTRIES)
+		dnet_uring_net_flush(nio);
+
+	op = &nio->uring_ops[nio->uring_ops_num];
+	op->st = st;
+	op->send = send;
+
+	err = dnet_uring_op_prep(nio, op);
+	if (err != 1)
+		return err;
+
+	dnet_state_get(st);
+	nio->uring_ops_num++;
+	return 0;
 }
 
-static int dnet_state_net_process(struct dnet_net_state *st, struct epoll_event *ev)
+/*
+ * io_uring counterpart of dnet_state_net_process(): receive and send are queued into the ring
+ * and performed by dnet_uring_net_flush() for all ready sockets at once.
+ */
+static int dnet_uring_net_process(struct dnet_net_io *nio, struct dnet_net_state *st, struct epoll_event *ev)
 {
-	int err = -ECONNRESET;
+	int err = 0;
+
+	if (ev->events & (EPOLLHUP | EPOLLERR)) {
+		/* complete operations which may touch this state before resetting it */
+		dnet_uring_net_flush(nio);
+		return dnet_state_net_process(nio, st, ev);
+	}
 
 	if (ev->events & EPOLLIN) {
-		err = dnet_process_recv_single(st);
+		err = dnet_uring_net_queue_op(nio, st, 0);
 		if (err && (err != -EAGAIN))
-			goto err_out_exit;
+			return err;
 	}
 	if (ev->events & EPOLLOUT) {
-		err = dnet_process_send_single(st);
-		if (err && (err != -EAGAIN))
-			goto err_out_exit;
+		err = dnet_uring_net_queue_op(nio, st, 1);
 	}
 
-	if (ev->events & (EPOLLHUP | EPOLLERR)) {
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: received error event mask 0x%x", dnet_state_dump_addr(st), ev->events);
-		err = -ECONNRESET;
-	}
-err_out_exit:
 	return err;
 }
 
-static void dnet_check_work_pool_place(struct dnet_work_pool_place *place, uint64_t *list_size, uint64_t *threads_count)
+static void dnet_check_work_pool_place(struct dnet_work_pool_place *place, uint64_t *paused)
 {
 	struct dnet_work_pool *pool;
 
 	pthread_mutex_lock(&place->lock);
 	pool = place->pool;
-	if (pool) {
-		pthread_mutex_lock(&pool->lock);
-		*list_size += pool->list_stats.list_size;
-		*threads_count += pool->num;
-		pthread_mutex_unlock(&pool->lock);
-	}
+	if (pool)
+		*paused += atomic_read(&pool->paused);
 	pthread_mutex_unlock(&place->lock);
 }
 
-static void dnet_check_io_pool(struct dnet_io_pool *io, uint64_t *list_size, uint64_t *threads_count)
+static void dnet_check_io_pool(struct dnet_io_pool *io, uint64_t *paused)
 {
-	dnet_check_work_pool_place(&io->recv_pool, list_size, threads_count);
-	dnet_check_work_pool_place(&io->recv_pool_nb, list_size, threads_count);
+	dnet_check_work_pool_place(&io->recv_pool, paused);
+	dnet_check_work_pool_place(&io->recv_pool_nb, paused);
 }
 
-static int dnet_check_io(struct dnet_io *io)
+/*
+ * Returns number of states which are not read because their requests go to overloaded pools
+ */
+uint64_t dnet_io_paused_states(struct dnet_node *n)
 {
-	uint64_t list_size = 0;
-	uint64_t threads_count = 0;
+	struct dnet_io *io = n->io;
+	uint64_t paused = 0;
 
-	dnet_check_io_pool(&io->pool, &list_size, &threads_count);
+	dnet_check_io_pool(&io->pool, &paused);
 
 	if (io->backends) {
 		size_t i;
 		for (i = 0; i < io->backends_count; ++i) {
-			dnet_check_io_pool(&io->backends[i].pool, &list_size, &threads_count);
+			dnet_check_io_pool(&io->backends[i].pool, &paused);
 		}
 	}
 
-	if (list_size <= threads_count * 1000)
-		return 1;
-
-	return 0;
+	return paused;
 }
 
 static void dnet_shuffle_epoll_events(struct epoll_event *evs, int size) {
@@ -827,20 +1617,33 @@ static void *dnet_io_process_network(void *data_)
 	int evs_size = 1;
 	int tmp = 0;
 	int err = 0;
-	int i = 0;
-	struct timeval prev_tv, curr_tv;
+	int num, i = 0;
 
 	dnet_set_name("dnet_net");
 
-	dnet_log(n, DNET_LOG_NOTICE, "started net pool");
+	if (n->io->net_cpus) {
+		int cpu = n->io->net_cpus[(nio - n->io->net) % n->io->net_cpus_num];
+
+		err = dnet_set_affinity(&cpu, 1);
+		if (err)
+			dnet_log(n, DNET_LOG_ERROR, "failed to bind net thread to CPU %d: %s [%d]", cpu, strerror(-err), err);
+	}
 
 	if (evs == NULL) {
 		dnet_log(n, DNET_LOG_ERROR, "Not enough memory to allocate epoll_events");
 		goto err_out_exit;
 	}
 
+	if (n->flags & DNET_CFG_IO_URING) {
+		err = dnet_uring_net_init(nio);
+		if (err)
+			dnet_log(n, DNET_LOG_ERROR, "failed to initialize io_uring, falling back to epoll: %s [%d]",
+					strerror(-err), err);
+	}
+
+	dnet_log(n, DNET_LOG_NOTICE, "started net pool, engine: %s", nio->uring ? "io_uring" : "epoll");
+
 	// get current timestamp for future outputting "Net pool is suspended..." logging
-	gettimeofday(&prev_tv, NULL);
 
 	while (!n->need_exit) {
 		// get current number of states
@@ -869,81 +1672,35 @@ static void *dnet_io_process_network(void *data_)
 			break;
 		}
 
-		// tmp will counts number of send events
-		tmp = 0;
+		num = err;
+
 		// suffles available epoll_events
-		dnet_shuffle_epoll_events(evs, err);
-		for (i = 0; i < err; ++i) {
+		dnet_shuffle_epoll_events(evs, num);
+		for (i = 0; i < num; ++i) {
 			data = evs[i].data.ptr;
 			st = data->st;
 			st->epoll_fd = nio->epoll_fd;
 
 			if (data->fd == st->accept_s) {
 				// We have to accept new connection
-				++tmp;
 				err = dnet_state_accept_process(st, &evs[i]);
-			} else if ((evs[i].events & EPOLLOUT) || dnet_check_io(n->io)) {
-				// if event is send or io pool queues are not full then process it
-				++tmp;
-				err = dnet_state_net_process(st, &evs[i]);
+			} else if (nio->uring) {
+				err = dnet_uring_net_process(nio, st, &evs[i]);
+			} else {
+				// sockets whose requests go to overloaded pools are removed from epoll set by dnet_schedule_io_batch()
+				err = dnet_state_net_process(nio, st, &evs[i]);
 			}
-			else
-				continue;
-
-			if (err == 0)
-				continue;
-
-			if (err == -EAGAIN && st->stall < DNET_DEFAULT_STALL_TRANSACTIONS)
-				continue;
 
-			if (err < 0 || st->stall >= DNET_DEFAULT_STALL_TRANSACTIONS) {
-				if (!err)
-					err = -ETIMEDOUT;
-
-				char addr_str[128] = "no address";
-				if (n->addr_num) {
-					dnet_addr_string_raw(&n->addrs[0], addr_str, sizeof(addr_str));
-				}
-				dnet_log(n, DNET_LOG_ERROR, "self: addr: %s, resetting state: %p", addr_str, st);
-				dnet_log(n, DNET_LOG_ERROR, "self: addr: %s, resetting state: %s", addr_str, dnet_state_dump_addr(st));
-
-				dnet_state_reset(st, err);
-
-				pthread_mutex_lock(&st->send_lock);
-				dnet_unschedule_all(st);
-				pthread_mutex_unlock(&st->send_lock);
-
-				dnet_add_reconnect_state(st->n, &st->addr, st->__join_state);
-
-				// state still contains a fair number of transactions in its queue
-				// they will not be cleaned up here - dnet_state_put() will only drop refctn by 1,
-				// while every transaction holds a reference
-				//
-				// IO thread could remove transaction, it is the only place allowed to do it.
-				// transactions may live in the tree and be accessed without locks in IO thread,
-				// IO thread is kind of 'owner' of the transaction processing
-				dnet_state_put(st);
-				continue;
-			}
+			dnet_net_state_check_error(n, st, err);
 		}
 
-		// wait condition variable if no data was sended and io pool queues are still full
-		if (tmp == 0 && dnet_check_io(n->io) == 0) {
-			gettimeofday(&curr_tv, NULL);
-			// print log only if previous log was writed more then 1 seconds
-			if ((curr_tv.tv_sec - prev_tv.tv_sec) > 1) {
-				dnet_log(n, DNET_LOG_INFO, "Net pool is suspended bacause io pool queues is full");
-				prev_tv = curr_tv;
-			}
-			// wait condition variable - io queues has a free slot or some socket has something to send
-			pthread_mutex_lock(&n->io->full_lock);
-			n->io->blocked = 1;
-			pthread_cond_wait(&n->io->full_wait, &n->io->full_lock);
-			n->io->blocked = 0;
-			pthread_mutex_unlock(&n->io->full_lock);
-		}
+		if (nio->uring)
+			dnet_uring_net_flush(nio);
 	}
 
+	if (nio->uring)
+		dnet_uring_net_destroy(nio);
+
 	free(evs);
 
 err_out_exit:
@@ -967,48 +1724,292 @@ static void dnet_io_cleanup_states(struct dnet_node *n)
 	n->st = NULL;
 }
 
-static struct dnet_io_req *take_request(struct dnet_work_io *wio)
+void dnet_work_pool_stat(struct dnet_work_pool *pool, struct list_stat *stats)
+{
+	struct dnet_work_io *wio;
+	int i;
+
+	list_stat_init(stats);
+
+	for (i = 0; i < pool->num; ++i) {
+		wio = &pool->wio_list[i];
+
+		pthread_mutex_lock(&wio->lock);
+		list_stat_size_increase(stats, wio->list_stats.list_size);
+		pthread_mutex_unlock(&wio->lock);
+	}
+}
+
+/*
+ * Takes the first parked reply of the first ready bucket of @wio or the first request of @wio's queue.
+ * Transaction reply claims its bucket for @taker, reply whose bucket is already claimed by another thread
+ * is parked in the bucket and the next request is taken, so every reply is moved at most once.
+ * If @taker is NULL, only a request which is not a transaction reply is taken from the head of the queue.
+ */
+static struct dnet_io_req *dnet_work_io_pop_nolock(struct dnet_work_io *wio, struct dnet_work_io *taker)
+{
+	struct dnet_work_reply_bucket *bucket;
+	struct dnet_io_req *r;
+
+	if (taker && !list_empty(&wio->reply_ready)) {
+		bucket = list_first_entry(&wio->reply_ready, struct dnet_work_reply_bucket, ready_entry);
+		list_del_init(&bucket->ready_entry);
+
+		r = list_first_entry(&bucket->list, struct dnet_io_req, req_entry);
+		goto out_claim;
+	}
+
+	while (!list_empty(&wio->list)) {
+		r = list_first_entry(&wio->list, struct dnet_io_req, req_entry);
+		bucket = r->reply_bucket;
+		if (!bucket)
+			goto out;
+
+		if (!taker)
+			return NULL;
+
+		if (!bucket->claimed)
+			goto out_claim;
+
+		list_move_tail(&r->req_entry, &bucket->list);
+	}
+
+	return NULL;
+
+out_claim:
+	bucket->claimed = 1;
+	taker->reply_bucket = bucket;
+out:
+	list_del_init(&r->req_entry);
+	list_stat_size_decrease(&wio->list_stats, 1);
+
+	return r;
+}
+
+/*
+ * Returns true if queue of @wio is long enough for other threads to take its transaction replies:
+ * it holds more than twice its share of the pool's queued requests. When all queues are equally long,
+ * claiming reply buckets by other threads only costs more than waiting for the owner.
+ * Must be called with @wio's lock held.
+ */
+static int dnet_work_io_overloaded(struct dnet_work_io *wio)
 {
 	struct dnet_work_pool *pool = wio->pool;
-	struct dnet_io_req *it = NULL, *tmp;
-	struct dnet_cmd *cmd;
-	uint64_t trans;
+	uint64_t size = wio->list_stats.list_size;
+
+	return size > DNET_WORK_REPLY_STEAL_BACKLOG && size > 2 * (uint64_t)atomic_read(&pool->queued) / pool->num;
+}
+
+/*
+ * Takes the first request from one of @count pool's queues starting from @start, busy queues are skipped.
+ * Transaction replies are taken only if @taker is set and the queue is overloaded, see dnet_work_io_pop_nolock().
+ */
+static struct dnet_io_req *dnet_work_pool_steal(struct dnet_work_pool *pool, int start, int count,
+		struct dnet_work_io *taker)
+{
+	struct dnet_work_io *victim;
+	struct dnet_io_req *r;
 	int i;
-	int ok;
 
-	if (!list_empty(&wio->list)) {
-		it = list_first_entry(&wio->list, struct dnet_io_req, req_entry);
-		cmd = it->header;
-		trans = cmd->trans;
-		wio->trans = trans;
-		return it;
+	for (i = 0; i < count; ++i) {
+		victim = &pool->wio_list[(start + i) % pool->num];
+
+		if (pthread_mutex_trylock(&victim->lock))
+			continue;
+
+		r = dnet_work_io_pop_nolock(victim, dnet_work_io_overloaded(victim) ? taker : NULL);
+		pthread_mutex_unlock(&victim->lock);
+
+		if (r)
+			return r;
 	}
 
-	list_for_each_entry_safe(it, tmp, &pool->list, req_entry) {
-		cmd = it->header;
-		trans = cmd->trans;
-		ok = 1;
+	return NULL;
+}
+
+static struct dnet_io_req *dnet_work_io_steal(struct dnet_work_io *wio)
+{
+	return dnet_work_pool_steal(wio->pool, wio->thread_index + 1, wio->pool->num - 1, wio);
+}
 
-		/* This is not a transaction reply, process it right now */
-		if (!(cmd->flags & DNET_FLAGS_REPLY))
-			return it;
+/*
+ * Releases reply bucket claimed by @wio, its next reply may be taken by any thread now.
+ * Bucket with parked replies is queued to its owner's ready list, they go before the owner's queue.
+ * Must be called with bucket owner's @lock held, returns true if the owner has to be woken up,
+ * since nobody else is going to wake it up for the parked replies.
+ */
+static int dnet_work_io_release_reply_nolock(struct dnet_work_io *owner, struct dnet_work_io *wio)
+{
+	struct dnet_work_reply_bucket *bucket = wio->reply_bucket;
+	int wake = 0;
 
-		for (i = 0; i < pool->num; ++i) {
-			 /* Someone claimed transaction @tid */
-			if (pool->wio_list[i].trans == trans) {
-				list_move_tail(&it->req_entry, &pool->wio_list[i].list);
-				ok = 0;
-				break;
+	bucket->claimed = 0;
+	wio->reply_bucket = NULL;
+
+	if (!list_empty(&bucket->list)) {
+		list_add_tail(&bucket->ready_entry, &owner->reply_ready);
+
+		wake = owner != wio && owner->sleeping && !owner->woken;
+		if (wake)
+			owner->woken = 1;
+	}
+
+	return wake;
+}
+
+/*
+ * Takes nonblocking request from another backend whose queue is longer than node's work_steal_threshold.
+ * Returned request has to be processed with @backend and completed with dnet_work_pool_stolen_done().
+ *
+ * Only nonblocking requests are stolen, since they do not take key oplock: processing them
+ * by another backend's thread does not break serialization of requests to the same key.
+ * They still may read the victim backend's disk, so stealing adds concurrency to the overloaded
+ * backend rather than moves its work elsewhere.
+ */
+static struct dnet_io_req *dnet_io_steal_backend_request(struct dnet_work_io *wio, struct dnet_backend_io **backend,
+		char *thread_stat_id, int thread_stat_id_size)
+{
+	struct dnet_work_pool *pool = wio->pool;
+	struct dnet_io *io = pool->n->io;
+	struct dnet_work_pool_place *place;
+	struct dnet_backend_io *victim_io;
+	struct dnet_work_pool *victim;
+	struct dnet_io_req *r = NULL;
+	size_t i, pos;
+	LIST_HEAD(resume);
+
+	if (!io->backends_count)
+		return NULL;
+
+	pos = pool->io->backend_id + wio->thread_index;
+
+	for (i = 0; i < io->backends_count && !r; ++i) {
+		victim_io = &io->backends[(pos + i) % io->backends_count];
+		if (victim_io == pool->io)
+			continue;
+
+		place = &victim_io->pool.recv_pool_nb;
+
+		if (pthread_mutex_trylock(&place->lock))
+			continue;
+
+		victim = place->pool;
+		if (victim && !victim_io->need_exit && atomic_read(&victim->queued) > io->work_steal_threshold) {
+			/* replies are not stolen, their buckets are claimed by threads of their pool */
+			r = dnet_work_pool_steal(victim, wio->thread_index, victim->num, NULL);
+			if (r) {
+				dnet_work_pool_dequeued(victim, &resume);
+
+				/* backend cleanup waits for this counter to drop to zero */
+				atomic_inc(&victim_io->stolen_inflight);
+				atomic_inc(&victim->stolen);
+				atomic_inc(&pool->steals);
+
+				make_thread_stat_id(thread_stat_id, thread_stat_id_size, victim);
+				*backend = victim_io;
 			}
 		}
 
-		if (ok) {
-			wio->trans = trans;
-			return it;
-		}
+		pthread_mutex_unlock(&place->lock);
 	}
 
-	return NULL;
+	/* victim pool may be already destroyed, but its paused states are referenced by @resume list */
+	dnet_work_pool_resume_recv(&resume);
+
+	return r;
+}
+
+/*
+ * Completes request stolen from backend @io, wakes up backend cleanup waiting for it
+ */
+static void dnet_work_pool_stolen_done(struct dnet_backend_io *io)
+{
+	struct dnet_work_pool_place *place = &io->pool.recv_pool_nb;
+
+	pthread_mutex_lock(&place->lock);
+	if (atomic_dec(&io->stolen_inflight) == 0)
+		pthread_cond_broadcast(&place->wait);
+	pthread_mutex_unlock(&place->lock);
+}
+
+void dnet_work_pool_wait_stolen(struct dnet_backend_io *io)
+{
+	struct dnet_work_pool_place *place = &io->pool.recv_pool_nb;
+
+	pthread_mutex_lock(&place->lock);
+	while (atomic_read(&io->stolen_inflight) > 0)
+		pthread_cond_wait(&place->wait, &place->lock);
+	pthread_mutex_unlock(&place->lock);
+}
+
+/*
+ * Returns the next request for IO thread @wio: transaction reply or request from its own queues first,
+ * then steals reply or request from other threads' queues.
+ * Waits up to @timeout_ms milliseconds for the new request if there is nothing to process.
+ */
+struct dnet_io_req *dnet_work_pool_take(struct dnet_work_io *wio, long timeout_ms)
+{
+	struct dnet_work_pool *pool = wio->pool;
+	struct dnet_work_io *owner;
+	struct dnet_io_req *r = NULL;
+	struct timespec ts;
+	struct timeval tv;
+	LIST_HEAD(resume);
+	int wake;
+
+	/* previous request has been a reply to a bucket of another thread, release it */
+	owner = wio->reply_bucket ? dnet_work_reply_bucket_owner(pool, wio->reply_bucket) : wio;
+	if (owner != wio) {
+		pthread_mutex_lock(&owner->lock);
+		wake = dnet_work_io_release_reply_nolock(owner, wio);
+		pthread_mutex_unlock(&owner->lock);
+
+		if (wake)
+			pthread_cond_signal(&owner->wait);
+	}
+
+	pthread_mutex_lock(&wio->lock);
+	if (wio->reply_bucket)
+		dnet_work_io_release_reply_nolock(wio, wio);
+	r = dnet_work_io_pop_nolock(wio, wio);
+	pthread_mutex_unlock(&wio->lock);
+	if (r)
+		goto out;
+
+	r = dnet_work_io_steal(wio);
+	if (r || !timeout_ms)
+		goto out;
+
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = tv.tv_sec + timeout_ms / 1000;
+	ts.tv_nsec = tv.tv_usec * 1000 + (timeout_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	/* requests queued to busy threads meanwhile are not lost, every queue is drained by its own thread at least */
+	pthread_mutex_lock(&wio->lock);
+	r = dnet_work_io_pop_nolock(wio, wio);
+	if (!r && !wio->woken) {
+		wio->sleeping = 1;
+		pthread_cond_timedwait(&wio->wait, &wio->lock, &ts);
+		r = dnet_work_io_pop_nolock(wio, wio);
+	}
+	wio->sleeping = 0;
+	wio->woken = 0;
+	pthread_mutex_unlock(&wio->lock);
+
+	if (!r)
+		r = dnet_work_io_steal(wio);
+
+out:
+	if (r) {
+		dnet_work_pool_dequeued(pool, &resume);
+		dnet_work_pool_resume_recv(&resume);
+	}
+
+	return r;
 }
 
 void *dnet_io_process(void *data_)
@@ -1017,13 +2018,14 @@ void *dnet_io_process(void *data_)
 	struct dnet_work_pool *pool = wio->pool;
 	struct dnet_node *n = pool->n;
 	struct dnet_net_state *st;
-	struct timespec ts;
-	struct timeval tv;
 	struct dnet_io_req *r;
-	int err;
 	struct dnet_cmd *cmd;
+	struct dnet_backend_io *backend;
 	int nonblocking = (pool->mode == DNET_WORK_IO_MODE_NONBLOCKING);
+	int steal = pool->io && (n->io->work_steal_threshold > 0);
 	char thread_stat_id[255];
+	char stolen_stat_id[255];
+	char *stat_id;
 
 	if (pool->io) {
 		dnet_set_name("dnet_%sio_%zu", nonblocking ? "nb_" : "", pool->io->backend_id);
@@ -1031,6 +2033,12 @@ void *dnet_io_process(void *data_)
 		dnet_set_name("dnet_%sio", nonblocking ? "nb_" : "");
 	}
 
+	if (n->io->io_cpus) {
+		int err = dnet_set_affinity(n->io->io_cpus, n->io->io_cpus_num);
+		if (err)
+			dnet_log(n, DNET_LOG_ERROR, "failed to bind io thread to CPUs: %s [%d]", strerror(-err), err);
+	}
+
 	make_thread_stat_id(thread_stat_id, sizeof(thread_stat_id), pool);
 
 	dnet_log(n, DNET_LOG_NOTICE, "started io thread: #%d, nonblocking: %d, backend: %zd",
@@ -1038,68 +2046,49 @@ void *dnet_io_process(void *data_)
 
 
 	while (!n->need_exit && (!pool->io || !pool->io->need_exit)) {
-		r = NULL;
-		err = 0;
-
-		gettimeofday(&tv, NULL);
-		ts.tv_sec = tv.tv_sec + 1;
-		ts.tv_nsec = tv.tv_usec * 1000;
-
-		pthread_mutex_lock(&pool->lock);
-
 		/*
-		 * Comment below is only related to client IO threads processing replies from the server.
-		 *
 		 * At any given moment of time it is forbidden for 2 IO threads to process replies for the same transaction.
 		 * This may lead to the situation, when thread 1 processes final ack, while thread 2 is being handling received data.
 		 * Thread 1 will free resources, which leads thread 2 to crash the whole process.
 		 *
-		 * Thus any transaction may only be processed on single thread at any given time.
-		 * But it is possible to ping-pong transaction between multiple IO threads as long as each IO thread
-		 * processes different transaction reply simultaneously.
-		 *
-		 * We must set current thread index to -1 to highlight that current thread currently does not perform any task,
-		 * so it can be assigned any transaction reply, if it is not already claimed by another thread.
-		 *
-		 * If we leave here previously processed transaction id, we might stuck, since all threads will wait for those
-		 * transactions they are assigned to, thus not allowing any further process, since no thread will be able to
-		 * process current request and move to the next one.
+		 * dnet_work_pool_take() does not hand out reply to the transaction whose reply is being processed
+		 * by another thread until that thread asks for the next request, so this can not happen.
 		 */
-		wio->trans = ~0ULL;
+		backend = pool->io;
+		stat_id = thread_stat_id;
 
-		if (!(r = take_request(wio))) {
-			err = pthread_cond_timedwait(&pool->wait, &pool->lock, &ts);
-			if ((r = take_request(wio)))
-				err = 0;
-		}
-
-		if (r) {
-			list_del_init(&r->req_entry);
-			list_stat_size_decrease(&pool->list_stats, 1);
-			pthread_cond_broadcast(&n->io->full_wait);
+		/*
+		 * When stealing is enabled thread looks for requests of other backends before going to sleep,
+		 * sleeping thread is woken up by dnet_work_pool_wake_thief() when other backend gets overloaded
+		 */
+		r = dnet_work_pool_take(wio, steal ? 0 : 1000);
+		if (!r && steal) {
+			r = dnet_io_steal_backend_request(wio, &backend, stolen_stat_id, sizeof(stolen_stat_id));
+			if (r)
+				stat_id = stolen_stat_id;
+			else
+				r = dnet_work_pool_take(wio, 1000);
 		}
-		pthread_mutex_unlock(&pool->lock);
-
-		if (!r || err)
+		if (!r)
 			continue;
 
 		HANDY_COUNTER_DECREMENT("io.input.queue.size", 1);
 
-		FORMATTED(HANDY_COUNTER_DECREMENT, ("pool.%s.queue.size", thread_stat_id), 1);
-		FORMATTED(HANDY_TIMER_STOP, ("pool.%s.queue.wait_time", thread_stat_id), (uint64_t)r);
+		FORMATTED(HANDY_COUNTER_DECREMENT, ("pool.%s.queue.size", stat_id), 1);
+		FORMATTED(HANDY_TIMER_STOP, ("pool.%s.queue.wait_time", stat_id), (uint64_t)r);
 
 		FORMATTED(HANDY_COUNTER_INCREMENT, ("pool.%s.active_threads", thread_stat_id), 1);
 
 		st = r->st;
 		cmd = r->header;
 
-		dnet_node_set_trace_id(n->log, cmd->trace_id, cmd->flags & DNET_FLAGS_TRACE_BIT, pool->io ? (ssize_t)pool->io->backend_id : (ssize_t)-1);
+		dnet_node_set_trace_id(n->log, cmd->trace_id, cmd->flags & DNET_FLAGS_TRACE_BIT, backend ? (ssize_t)backend->backend_id : (ssize_t)-1);
 
-		dnet_log(n, DNET_LOG_DEBUG, "%s: %s: got IO event: %p: cmd: %s, hsize: %zu, dsize: %zu, mode: %s, backend_id: %zd",
+		dnet_log(n, DNET_LOG_DEBUG, "%s: %s: got IO event: %p: cmd: %s, hsize: %zu, dsize: %zu, mode: %s, backend_id: %zd, stolen: %d",
 			dnet_state_dump_addr(st), dnet_dump_id(r->header), r, dnet_cmd_string(cmd->cmd), r->hsize, r->dsize, dnet_work_io_mode_str(pool->mode),
-			pool->io ? (ssize_t)pool->io->backend_id : (ssize_t)-1);
+			backend ? (ssize_t)backend->backend_id : (ssize_t)-1, backend != pool->io);
 
-		err = dnet_process_recv(pool->io, st, r);
+		dnet_process_recv(backend, st, r);
 
 		dnet_log(n, DNET_LOG_DEBUG, "%s: %s: processed IO event: %p, cmd: %s",
 			dnet_state_dump_addr(st), dnet_dump_id(r->header), r, dnet_cmd_string(cmd->cmd));
@@ -1109,6 +2098,9 @@ void *dnet_io_process(void *data_)
 		dnet_io_req_free(r);
 		dnet_state_put(st);
 
+		if (backend != pool->io)
+			dnet_work_pool_stolen_done(backend);
+
 		FORMATTED(HANDY_COUNTER_DECREMENT, ("pool.%s.active_threads", thread_stat_id), 1);
 	}
 
@@ -1118,9 +2110,83 @@ void *dnet_io_process(void *data_)
 	return NULL;
 }
 
+/*
+ * Parses CPU list like "0-3,8,10-11" into array of CPU numbers.
+ * CPU numbers must be less than CPU_SETSIZE, repeated CPUs are taken once.
+ */
+static int dnet_io_parse_cpus(struct dnet_node *n, const char *str, int **cpus_ret, int *num_ret)
+{
+	const char *p = str;
+	char *end;
+	char seen[CPU_SETSIZE];
+	int *cpus;
+	int num = 0;
+	long first, last;
+	int err;
+
+	*cpus_ret = NULL;
+	*num_ret = 0;
+
+	if (!str || !*str)
+		return 0;
+
+	cpus = malloc(CPU_SETSIZE * sizeof(int));
+	if (!cpus)
+		return -ENOMEM;
+
+	memset(seen, 0, sizeof(seen));
+
+	while (1) {
+		/* signs, spaces and empty entries are not allowed */
+		if (!isdigit(*p))
+			goto err_out_invalid;
+
+		errno = 0;
+		first = last = strtol(p, &end, 10);
+		if (errno || first >= CPU_SETSIZE)
+			goto err_out_invalid;
+		p = end;
+
+		if (*p == '-') {
+			++p;
+			if (!isdigit(*p))
+				goto err_out_invalid;
+
+			last = strtol(p, &end, 10);
+			if (errno || last < first || last >= CPU_SETSIZE)
+				goto err_out_invalid;
+			p = end;
+		}
+
+		for (; first <= last; ++first) {
+			if (!seen[first]) {
+				seen[first] = 1;
+				cpus[num++] = first;
+			}
+		}
+
+		if (!*p)
+			break;
+		if (*p != ',')
+			goto err_out_invalid;
+		++p;
+	}
+
+	*cpus_ret = cpus;
+	*num_ret = num;
+	return 0;
+
+err_out_invalid:
+	err = -EINVAL;
+	dnet_log(n, DNET_LOG_ERROR, "Invalid CPU list '%s' at '%s', CPU numbers must be in [0, %d) range",
+			str, p, CPU_SETSIZE);
+	free(cpus);
+	return err;
+}
+
 int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 {
-	int err, i;
+	int err, i, net_num = 0;
 	int io_size = sizeof(struct dnet_io) + sizeof(struct dnet_net_io) * cfg->net_thread_num;
 
 	n->io = malloc(io_size);
@@ -1136,29 +2202,43 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 		goto err_out_free;
 	}
 
-	err = pthread_cond_init(&n->io->full_wait, NULL);
-	if (err) {
-		err = -err;
-		goto err_out_free_mutex;
-	}
-
 	err = pthread_mutex_init(&n->io->backends_lock, NULL);
 	if (err) {
 		err = -err;
-		goto err_out_free_cond;
+		goto err_out_free_mutex;
 	}
 
 	list_stat_init(&n->io->output_stats);
 
 	n->io->net_thread_num = cfg->net_thread_num;
 	n->io->net_thread_pos = 0;
+
+	n->io->send_batch_size = cfg->send_batch_size;
+	if (!n->io->send_batch_size)
+		n->io->send_batch_size = DNET_DEFAULT_SEND_BATCH_SIZE;
+
+	n->io->work_steal_threshold = cfg->work_steal_threshold;
+
+	n->io->io_queue_limit = cfg->io_queue_limit;
+	if (!n->io->io_queue_limit)
+		n->io->io_queue_limit = DNET_DEFAULT_IO_QUEUE_LIMIT;
 	n->io->net = (struct dnet_net_io *)(n->io + 1);
 
-	err = dnet_work_pool_place_init(&n->io->pool.recv_pool);
+	err = dnet_io_parse_cpus(n, cfg->net_thread_cpus, &n->io->net_cpus, &n->io->net_cpus_num);
 	if (err) {
 		goto err_out_free_backends_lock;
 	}
 
+	err = dnet_io_parse_cpus(n, cfg->io_thread_cpus, &n->io->io_cpus, &n->io->io_cpus_num);
+	if (err) {
+		goto err_out_free_cpus;
+	}
+
+	err = dnet_work_pool_place_init(&n->io->pool.recv_pool);
+	if (err) {
+		goto err_out_free_cpus;
+	}
+
 	err = dnet_work_pool_alloc(&n->io->pool.recv_pool, n, NULL, cfg->io_thread_num, DNET_WORK_IO_MODE_BLOCKING, dnet_io_process);
 	if (err) {
 		goto err_out_cleanup_recv_place;
@@ -1179,10 +2259,19 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 
 		nio->n = n;
 
+		nio->arena = dnet_io_arena_create();
+		if (!nio->arena) {
+			err = -ENOMEM;
+			dnet_log(n, DNET_LOG_ERROR, "Failed to initialize receive arena: %d", err);
+			goto err_out_net_destroy;
+		}
+
 		nio->epoll_fd = epoll_create(10000);
 		if (nio->epoll_fd < 0) {
 			err = -errno;
 			dnet_log_err(n, "Failed to create epoll fd");
+			dnet_io_arena_put(nio->arena);
+			nio->arena = NULL;
 			goto err_out_net_destroy;
 		}
 
@@ -1192,6 +2281,8 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 		err = pthread_create(&nio->tid, NULL, dnet_io_process_network, nio);
 		if (err) {
 			close(nio->epoll_fd);
+			dnet_io_arena_put(nio->arena);
+			nio->arena = NULL;
 			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Failed to create network processing thread: %d", err);
 			goto err_out_net_destroy;
@@ -1202,6 +2293,7 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 
 err_out_net_destroy:
 	n->need_exit = 1;
+	net_num = i;
 	while (--i >= 0) {
 		pthread_join(n->io->net[i].tid, NULL);
 		close(n->io->net[i].epoll_fd);
@@ -1213,12 +2305,17 @@ err_out_cleanup_recv_place_nb:
 err_out_free_recv_pool:
 	n->need_exit = 1;
 	dnet_work_pool_cleanup(&n->io->pool.recv_pool);
+
+	/* arenas are released once requests which are still referenced are freed */
+	for (i = 0; i < net_num; ++i)
+		dnet_io_arena_put(n->io->net[i].arena);
 err_out_cleanup_recv_place:
 	dnet_work_pool_place_cleanup(&n->io->pool.recv_pool);
+err_out_free_cpus:
+	free(n->io->net_cpus);
+	free(n->io->io_cpus);
 err_out_free_backends_lock:
 	pthread_mutex_destroy(&n->io->backends_lock);
-err_out_free_cond:
-	pthread_cond_destroy(&n->io->full_wait);
 err_out_free_mutex:
 	pthread_mutex_destroy(&n->io->full_lock);
 err_out_free:
@@ -1243,6 +2340,7 @@ int dnet_server_io_init(struct dnet_node *n)
 	for (j = 0; j < n->io->backends_count; ++j) {
 		struct dnet_backend_io *io = &n->io->backends[j];
 		io->backend_id = j;
+		atomic_init(&io->stolen_inflight, 0);
 
 		err = dnet_work_pool_place_init(&io->pool.recv_pool);
 		if (err) {
@@ -1308,6 +2406,15 @@ void dnet_io_exit(struct dnet_node *n)
 
 	dnet_io_cleanup_states(n);
 
+	/*
+	 * States which are still referenced may keep requests whose data lives in the arenas
+	 * in their send lists, arenas are released when the last such request is freed
+	 */
+	for (i = 0; i < io->net_thread_num; ++i)
+		dnet_io_arena_put(io->net[i].arena);
+
+	free(io->net_cpus);
+	free(io->io_cpus);
 	free(io);
 	n->io = NULL;
 }
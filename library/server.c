@@ -55,6 +55,40 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * Creates listening sockets for network threads starting from the second one,
+ * the first thread serves primary node state @n->st.
+ * All sockets are bound to the same address with SO_REUSEPORT, so kernel spreads
+ * incoming connections among threads and accepted client stays in the thread which has accepted it.
+ * Listening states are put into storage state list and are destroyed together with other states.
+ */
+static int dnet_server_create_reuseport_listeners(struct dnet_node *n, struct dnet_addr *la)
+{
+	struct dnet_net_state *st;
+	int err, s, i;
+
+	for (i = 1; i < n->io->net_thread_num; ++i) {
+		s = dnet_socket_create_listening(n, la);
+		if (s < 0) {
+			err = s;
+			dnet_log(n, DNET_LOG_ERROR, "failed to create listening socket for net thread %d: %s %d",
+					i, strerror(-err), err);
+			return err;
+		}
+
+		st = dnet_state_create(n, NULL, 0, n->addrs, s, &err, 0, 0, 0, 1, NULL, 0, n->io->net[i].epoll_fd);
+		if (!st) {
+			dnet_log(n, DNET_LOG_ERROR, "failed to create listening state for net thread %d: %s %d",
+					i, strerror(-err), err);
+			return err;
+		}
+
+		dnet_state_put(st);
+	}
+
+	return 0;
+}
+
 static void dnet_local_addr_cleanup(struct dnet_node *n)
 {
 	free(n->addrs);
@@ -139,10 +173,16 @@ struct dnet_node *dnet_server_node_create(struct dnet_config_data *cfg_data)
 			goto err_out_addr_cleanup;
 		}
 
+		err = dnet_indexes_init(n, cfg);
+		if (err) {
+			dnet_log(n, DNET_LOG_ERROR, "failed to init indexes: %s %d", strerror(-err), err);
+			goto err_out_locks_destroy;
+		}
+
 		n->route = dnet_route_list_create(n);
 		if (!n->route) {
 			dnet_log(n, DNET_LOG_ERROR, "failed to create route list: %s %d", strerror(-err), err);
-			goto err_out_locks_destroy;
+			goto err_out_indexes_cleanup;
 		}
 
 		err = dnet_create_addr(&la, NULL, cfg->port, cfg->family);
@@ -164,7 +204,8 @@ struct dnet_node *dnet_server_node_create(struct dnet_config_data *cfg_data)
 			goto err_out_route_list_destroy;
 		}
 
-		n->st = dnet_state_create(n, NULL, 0, n->addrs, s, &err, DNET_JOIN, 1, 0, 1, n->addrs, n->addr_num);
+		n->st = dnet_state_create(n, NULL, 0, n->addrs, s, &err, DNET_JOIN, 1, 0, 1, n->addrs, n->addr_num,
+				(cfg->flags & DNET_CFG_REUSEPORT) ? n->io->net[0].epoll_fd : -1);
 
 		if (!n->st) {
 			dnet_log(n, DNET_LOG_ERROR, "failed to create state: %s %d", strerror(-err), err);
@@ -176,6 +217,12 @@ struct dnet_node *dnet_server_node_create(struct dnet_config_data *cfg_data)
 		// by network thread given state was attached to, and it can already release it.
 		dnet_state_put(n->st);
 
+		if (cfg->flags & DNET_CFG_REUSEPORT) {
+			err = dnet_server_create_reuseport_listeners(n, &la);
+			if (err)
+				goto err_out_state_destroy;
+		}
+
 		err = dnet_backend_init_all(n);
 		if (err) {
 			dnet_log(n, DNET_LOG_ERROR, "failed to init backends: %s %d", strerror(-err), err);
@@ -207,6 +254,8 @@ err_out_state_destroy:
 	dnet_state_put(n->st);
 err_out_route_list_destroy:
 	dnet_route_list_destroy(n->route);
+err_out_indexes_cleanup:
+	dnet_indexes_cleanup(n);
 err_out_locks_destroy:
 	dnet_locks_destroy(n);
 err_out_addr_cleanup:
@@ -244,6 +293,11 @@ void dnet_server_node_destroy(struct dnet_node *n)
 	dnet_route_list_destroy(n->route);
 	n->route = NULL;
 
+	/*
+	 * Index readers use backends, they are idle since io threads are stopped.
+	 */
+	dnet_indexes_cleanup(n);
+
 	dnet_backend_cleanup_all(n);
 
 	dnet_srw_cleanup(n);
@@ -0,0 +1,344 @@
+/*
+ * Copyright 2015+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+
+/*
+ * Minimal io_uring ring used by network threads to submit many socket operations with single syscall.
+ * Kernel interface is used directly via syscalls, since only a handful of operations is needed.
+ *
+ * All operations are nonblocking: socket without data or buffer space completes with -EAGAIN
+ * instead of waiting in the kernel, epoll tells when it is worth trying again.
+ */
+#ifdef HAVE_IO_URING_SUPPORT
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct dnet_uring {
+	int			fd;
+
+	unsigned int		*sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe	*sqes;
+	unsigned int		sq_entries;
+
+	unsigned int		*cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void			*sq_ring, *cq_ring;
+	size_t			sq_ring_size, cq_ring_size, sqes_size;
+
+	/* operations queued since the last submit */
+	unsigned int		queued;
+};
+
+static int dnet_uring_probe(struct dnet_uring *ring)
+{
+	static const int ops[] = { IORING_OP_RECV, IORING_OP_RECVMSG, IORING_OP_SENDMSG };
+	struct io_uring_probe *probe;
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	int err = 0;
+	unsigned int i;
+
+	probe = malloc(size);
+	if (!probe)
+		return -ENOMEM;
+	memset(probe, 0, size);
+
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(ops); ++i) {
+		if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+			err = -ENOTSUP;
+			break;
+		}
+	}
+
+err_out_free:
+	free(probe);
+	return err;
+}
+
+struct dnet_uring *dnet_uring_create(unsigned int entries, int *errp)
+{
+	struct io_uring_params p;
+	struct dnet_uring *ring;
+	int err;
+
+	ring = malloc(sizeof(struct dnet_uring));
+	if (!ring) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+	memset(ring, 0, sizeof(struct dnet_uring));
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	err = dnet_uring_probe(ring);
+	if (err)
+		goto err_out_close;
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		err = -errno;
+		goto err_out_close;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			err = -errno;
+			goto err_out_unmap_sq;
+		}
+	}
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		err = -errno;
+		goto err_out_unmap_cq;
+	}
+
+	ring->sq_head = ring->sq_ring + p.sq_off.head;
+	ring->sq_tail = ring->sq_ring + p.sq_off.tail;
+	ring->sq_mask = ring->sq_ring + p.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ring + p.sq_off.array;
+	ring->sq_entries = p.sq_entries;
+
+	ring->cq_head = ring->cq_ring + p.cq_off.head;
+	ring->cq_tail = ring->cq_ring + p.cq_off.tail;
+	ring->cq_mask = ring->cq_ring + p.cq_off.ring_mask;
+	ring->cqes = ring->cq_ring + p.cq_off.cqes;
+
+	return ring;
+
+err_out_unmap_cq:
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+err_out_unmap_sq:
+	munmap(ring->sq_ring, ring->sq_ring_size);
+err_out_close:
+	close(ring->fd);
+err_out_free:
+	free(ring);
+err_out_exit:
+	*errp = err;
+	return NULL;
+}
+
+void dnet_uring_destroy(struct dnet_uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	free(ring);
+}
+
+static struct io_uring_sqe *dnet_uring_get_sqe(struct dnet_uring *ring)
+{
+	unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned int tail = *ring->sq_tail + ring->queued;
+	struct io_uring_sqe *sqe;
+
+	if (tail - head >= ring->sq_entries)
+		return NULL;
+
+	sqe = &ring->sqes[tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+	ring->queued++;
+
+	return sqe;
+}
+
+int dnet_uring_prep_recv(struct dnet_uring *ring, int fd, void *buf, size_t size, void *priv)
+{
+	struct io_uring_sqe *sqe = dnet_uring_get_sqe(ring);
+
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = size;
+	sqe->msg_flags = MSG_DONTWAIT;
+	sqe->user_data = (unsigned long)priv;
+	return 0;
+}
+
+int dnet_uring_prep_recvmsg(struct dnet_uring *ring, int fd, struct msghdr *msg, void *priv)
+{
+	struct io_uring_sqe *sqe = dnet_uring_get_sqe(ring);
+
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_DONTWAIT;
+	sqe->user_data = (unsigned long)priv;
+	return 0;
+}
+
+int dnet_uring_prep_sendmsg(struct dnet_uring *ring, int fd, struct msghdr *msg, void *priv)
+{
+	struct io_uring_sqe *sqe = dnet_uring_get_sqe(ring);
+
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+	sqe->user_data = (unsigned long)priv;
+	return 0;
+}
+
+/*
+ * Submits all queued operations and waits until all of them are completed
+ */
+int dnet_uring_submit_and_wait(struct dnet_uring *ring)
+{
+	unsigned int total = ring->queued, submitted = 0;
+	int err;
+
+	if (!total)
+		return 0;
+
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + total, __ATOMIC_RELEASE);
+	ring->queued = 0;
+
+	/*
+	 * Kernel may consume submission queue partially, in this case it does not wait for completions,
+	 * completion queue is reaped by the caller after every call, so it only contains this batch
+	 */
+	while (submitted < total) {
+		err = syscall(__NR_io_uring_enter, ring->fd, total - submitted, total, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		submitted += err;
+	}
+
+	while (__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) - *ring->cq_head < total) {
+		err = syscall(__NR_io_uring_enter, ring->fd, 0, total, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (err < 0 && errno != EINTR)
+			return -errno;
+	}
+
+	return 0;
+}
+
+/*
+ * Takes the next completed operation, returns 0 if there are no completions
+ */
+int dnet_uring_reap(struct dnet_uring *ring, void **priv, int *res)
+{
+	unsigned int head = *ring->cq_head;
+	struct io_uring_cqe *cqe;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+
+	cqe = &ring->cqes[head & *ring->cq_mask];
+	*priv = (void *)(unsigned long)cqe->user_data;
+	*res = cqe->res;
+
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+#else
+struct dnet_uring *dnet_uring_create(unsigned int entries __unused, int *errp)
+{
+	*errp = -ENOTSUP;
+	return NULL;
+}
+
+void dnet_uring_destroy(struct dnet_uring *ring __unused)
+{
+}
+
+int dnet_uring_prep_recv(struct dnet_uring *ring __unused, int fd __unused, void *buf __unused,
+		size_t size __unused, void *priv __unused)
+{
+	return -ENOTSUP;
+}
+
+int dnet_uring_prep_recvmsg(struct dnet_uring *ring __unused, int fd __unused, struct msghdr *msg __unused,
+		void *priv __unused)
+{
+	return -ENOTSUP;
+}
+
+int dnet_uring_prep_sendmsg(struct dnet_uring *ring __unused, int fd __unused, struct msghdr *msg __unused,
+		void *priv __unused)
+{
+	return -ENOTSUP;
+}
+
+int dnet_uring_submit_and_wait(struct dnet_uring *ring __unused)
+{
+	return -ENOTSUP;
+}
+
+int dnet_uring_reap(struct dnet_uring *ring __unused, void **priv __unused, int *res __unused)
+{
+	return 0;
+}
+#endif
@@ -60,6 +60,15 @@ static void dump_list_stats(rapidjson::Value &stat, list_stat &list_stats, rapid
 	stat.AddMember("current_size", list_stats.list_size, allocator);
 }
 
+static void dump_pool_stats(rapidjson::Value &stat, struct dnet_work_pool *pool, rapidjson::Document::AllocatorType &allocator) {
+	list_stat list_stats;
+	dnet_work_pool_stat(pool, &list_stats);
+	dump_list_stats(stat, list_stats, allocator);
+	stat.AddMember("steals", atomic_read(&pool->steals), allocator)
+	    .AddMember("stolen", atomic_read(&pool->stolen), allocator)
+	    .AddMember("paused_states", atomic_read(&pool->paused), allocator);
+}
+
 /*
  * Fills io section of one backend
  */
@@ -69,11 +78,11 @@ static void fill_backend_io(rapidjson::Value &stat_value,
 	rapidjson::Value io_value(rapidjson::kObjectType);
 
 	rapidjson::Value blocking_stat(rapidjson::kObjectType);
-	dump_list_stats(blocking_stat, backend.pool.recv_pool.pool->list_stats, allocator);
+	dump_pool_stats(blocking_stat, backend.pool.recv_pool.pool, allocator);
 	io_value.AddMember("blocking", blocking_stat, allocator);
 
 	rapidjson::Value nonblocking_stat(rapidjson::kObjectType);
-	dump_list_stats(nonblocking_stat, backend.pool.recv_pool_nb.pool->list_stats, allocator);
+	dump_pool_stats(nonblocking_stat, backend.pool.recv_pool_nb.pool, allocator);
 	io_value.AddMember("nonblocking", nonblocking_stat, allocator);
 
 	stat_value.AddMember("io", io_value, allocator);
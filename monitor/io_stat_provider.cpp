@@ -29,6 +29,48 @@ void dump_list_stats(rapidjson::Value &stat, list_stat &list_stats, rapidjson::D
 	stat.AddMember("current_size", list_stats.list_size, allocator);
 }
 
+void dump_pool_stats(rapidjson::Value &stat, struct dnet_work_pool *pool, rapidjson::Document::AllocatorType &allocator) {
+	list_stat list_stats;
+	dnet_work_pool_stat(pool, &list_stats);
+	dump_list_stats(stat, list_stats, allocator);
+	stat.AddMember("paused_states", atomic_read(&pool->paused), allocator);
+}
+
+void dump_arena_stats(rapidjson::Value &stat, struct dnet_node *n, rapidjson::Document::AllocatorType &allocator) {
+	struct dnet_io_arena_stats arena_stats;
+
+	dnet_io_arena_stat_all(n, &arena_stats);
+
+	stat.AddMember("hits", arena_stats.hits, allocator)
+	    .AddMember("misses", arena_stats.misses, allocator)
+	    .AddMember("large", arena_stats.large, allocator)
+	    .AddMember("slab_memory", arena_stats.slab_memory, allocator);
+}
+
+void dump_oplocks_stats(rapidjson::Value &stat, struct dnet_node *n, rapidjson::Document::AllocatorType &allocator) {
+	static const char *wait_buckets[DNET_LOCKS_WAIT_BUCKETS] = {"10us", "100us", "1ms", "10ms", "100ms", "1s", "inf"};
+	struct dnet_locks_stripe_stats stripe_stats;
+
+	if (!n->locks)
+		return;
+
+	for (int i = 0; i < n->locks->stripes_num; ++i) {
+		dnet_locks_stat(n, i, &stripe_stats);
+
+		rapidjson::Value wait_time(rapidjson::kObjectType);
+		for (int j = 0; j < DNET_LOCKS_WAIT_BUCKETS; ++j)
+			wait_time.AddMember(wait_buckets[j], stripe_stats.wait_hist[j], allocator);
+
+		rapidjson::Value stripe_value(rapidjson::kObjectType);
+		stripe_value.AddMember("used", stripe_stats.used, allocator)
+		            .AddMember("free", stripe_stats.free, allocator)
+		            .AddMember("table_size", stripe_stats.table_size, allocator)
+		            .AddMember("wait_time", wait_time, allocator);
+
+		stat.PushBack(stripe_value, allocator);
+	}
+}
+
 void dump_states_stats(rapidjson::Value &stat, struct dnet_node *n, rapidjson::Document::AllocatorType &allocator) {
 	struct dnet_net_state *st;
 
@@ -57,22 +99,30 @@ std::string io_stat_provider::json(uint64_t categories) const {
 	auto &allocator = doc.GetAllocator();
 
 	rapidjson::Value blocking_stat(rapidjson::kObjectType);
-	dump_list_stats(blocking_stat, m_node->io->pool.recv_pool.pool->list_stats, allocator);
+	dump_pool_stats(blocking_stat, m_node->io->pool.recv_pool.pool, allocator);
 	doc.AddMember("blocking", blocking_stat, allocator);
 
 	rapidjson::Value nonblocking_stat(rapidjson::kObjectType);
-	dump_list_stats(nonblocking_stat, m_node->io->pool.recv_pool_nb.pool->list_stats, allocator);
+	dump_pool_stats(nonblocking_stat, m_node->io->pool.recv_pool_nb.pool, allocator);
 	doc.AddMember("nonblocking", nonblocking_stat, allocator);
 
 	rapidjson::Value output_stat(rapidjson::kObjectType);
 	dump_list_stats(output_stat, m_node->io->output_stats, allocator);
 	doc.AddMember("output", output_stat, allocator);
 
+	rapidjson::Value arena_stat(rapidjson::kObjectType);
+	dump_arena_stats(arena_stat, m_node, allocator);
+	doc.AddMember("recv_arena", arena_stat, allocator);
+
 	rapidjson::Value states_stat(rapidjson::kObjectType);
 	dump_states_stats(states_stat, m_node, allocator);
 	doc.AddMember("states", states_stat, allocator);
 
-	doc.AddMember("blocked", m_node->io->blocked == 1, allocator);
+	rapidjson::Value oplocks_stat(rapidjson::kArrayType);
+	dump_oplocks_stats(oplocks_stat, m_node, allocator);
+	doc.AddMember("oplocks", oplocks_stat, allocator);
+
+	doc.AddMember("blocked", dnet_io_paused_states(m_node) != 0, allocator);
 
 	rapidjson::StringBuffer buffer;
 	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
@@ -138,6 +138,7 @@ static void fill_vm(dnet_node *node,
 		vm_value.AddMember("free", st.vm_free, allocator);
 		vm_value.AddMember("cached", st.vm_cached, allocator);
 		vm_value.AddMember("buffers", st.vm_buffers, allocator);
+		vm_value.AddMember("available", st.vm_available, allocator);
 	} else
 		vm_value.AddMember("string_error", strerror(-err), allocator);
 
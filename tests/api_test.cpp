@@ -14,6 +14,10 @@
  */
 
 #include "test_base.hpp"
+#include "../bindings/cpp/session_indexes.hpp"
+#include "../indexes/capped.hpp"
+#include "../indexes/intersection.hpp"
+#include "../library/elliptics.h"
 #include <algorithm>
 
 #define BOOST_TEST_NO_MAIN
@@ -110,11 +114,779 @@ static void test_data_buffer()
 	BOOST_REQUIRE_EQUAL(data2.to_string(), str + str);
 }
 
+static dnet_raw_id index_test_id(unsigned char value)
+{
+	dnet_raw_id id;
+	memset(id.id, value, sizeof(id.id));
+	return id;
+}
+
+static dnet_indexes index_test_table()
+{
+	dnet_indexes indexes;
+	indexes.shard_id = 3;
+	indexes.shard_count = 16;
+
+	for (unsigned char i = 1; i <= 3; ++i) {
+		dnet_time time;
+		time.tsec = 100 - i;
+		time.tnsec = i;
+
+		// the second entry has no data
+		const std::string data = i == 2 ? std::string() : std::string("data-") + char('0' + i);
+		indexes.indexes.push_back(dnet_index_entry(index_test_id(i), data_pointer::copy(data), time));
+	}
+
+	return indexes;
+}
+
+static void index_test_append_delta(data_buffer &buffer, uint32_t action, unsigned char id, const std::string &data)
+{
+	dnet_time time;
+	dnet_current_time(&time);
+
+	msgpack::sbuffer delta;
+	msgpack::pack(&delta, dnet_index_delta(action, dnet_index_entry(index_test_id(id), data_pointer::copy(data), time)));
+	buffer.write(delta.data(), delta.size());
+}
+
+static void test_index_table_round_trip()
+{
+	const dnet_indexes indexes = index_test_table();
+	const std::vector<uint64_t> time_order = { 2, 1, 0 };
+	const data_pointer file = indexes_pack(indexes, &time_order);
+
+	index_table_view view;
+	BOOST_REQUIRE(view.map(file));
+	BOOST_REQUIRE_EQUAL(view.size(), indexes.indexes.size());
+	BOOST_REQUIRE_EQUAL(view.shard_id(), indexes.shard_id);
+	BOOST_REQUIRE_EQUAL(view.shard_count(), indexes.shard_count);
+	BOOST_REQUIRE_EQUAL(view.table_size(), file.size());
+	BOOST_REQUIRE(!view.has_deltas());
+	BOOST_REQUIRE(view.has_time_order());
+
+	for (size_t i = 0; i < indexes.indexes.size(); ++i) {
+		const dnet_index_entry &entry = indexes.indexes[i];
+
+		BOOST_REQUIRE(view.id(i) == entry.index);
+		BOOST_REQUIRE_EQUAL(view.data(i).to_string(), entry.data.to_string());
+		BOOST_REQUIRE_EQUAL(view.time(i).tsec, entry.time.tsec);
+		BOOST_REQUIRE_EQUAL(view.time(i).tnsec, entry.time.tnsec);
+		BOOST_REQUIRE_EQUAL(view.time_order(i), time_order[i]);
+		BOOST_REQUIRE_EQUAL(view.lower_bound(entry.index), i);
+	}
+
+	BOOST_REQUIRE_EQUAL(view.lower_bound(index_test_id(0)), 0);
+	BOOST_REQUIRE_EQUAL(view.lower_bound(index_test_id(0xff)), indexes.indexes.size());
+
+	dnet_indexes unpacked;
+	indexes_unpack_raw(file, &unpacked);
+	BOOST_REQUIRE_EQUAL(unpacked.shard_id, indexes.shard_id);
+	BOOST_REQUIRE_EQUAL(unpacked.shard_count, indexes.shard_count);
+	BOOST_REQUIRE_EQUAL(unpacked.indexes.size(), indexes.indexes.size());
+	for (size_t i = 0; i < indexes.indexes.size(); ++i) {
+		BOOST_REQUIRE(unpacked.indexes[i] == indexes.indexes[i]);
+		BOOST_REQUIRE_EQUAL(unpacked.indexes[i].time.tsec, indexes.indexes[i].time.tsec);
+	}
+	BOOST_REQUIRE_EQUAL(indexes_count(file), indexes.indexes.size());
+
+	// metadata is counted from the header alone
+	size_t count = 0;
+	const data_pointer header = file.slice(0, sizeof(dnet_index_table_header));
+	BOOST_REQUIRE(index_table_view::header_count(header, file.size(), count));
+	BOOST_REQUIRE_EQUAL(count, indexes.indexes.size());
+	BOOST_REQUIRE(!index_table_view::header_count(header.slice(0, sizeof(dnet_index_table_header) - 1), file.size(), count));
+	BOOST_REQUIRE(!index_table_view::header_count(header, file.size() - 1, count));
+
+	// table without time order
+	index_table_view unordered;
+	BOOST_REQUIRE(unordered.map(indexes_pack(indexes)));
+	BOOST_REQUIRE(!unordered.has_time_order());
+	BOOST_REQUIRE_EQUAL(unordered.data(2).to_string(), indexes.indexes[2].data.to_string());
+}
+
+static void test_index_table_deltas()
+{
+	const dnet_indexes indexes = index_test_table();
+	const data_pointer table = indexes_pack(indexes);
+
+	data_buffer buffer;
+	buffer.write(table.data<char>(), table.size());
+	index_test_append_delta(buffer, DNET_INDEXES_FLAGS_INTERNAL_INSERT, 4, "data-4");
+	index_test_append_delta(buffer, DNET_INDEXES_FLAGS_INTERNAL_REMOVE, 1, std::string());
+	index_test_append_delta(buffer, DNET_INDEXES_FLAGS_INTERNAL_INSERT, 2, "new-data-2");
+	// removal of absent entry and its later insert
+	index_test_append_delta(buffer, DNET_INDEXES_FLAGS_INTERNAL_REMOVE, 5, std::string());
+	index_test_append_delta(buffer, DNET_INDEXES_FLAGS_INTERNAL_INSERT, 5, "data-5");
+	index_test_append_delta(buffer, DNET_INDEXES_FLAGS_INTERNAL_REMOVE, 4, std::string());
+	data_pointer file = std::move(buffer);
+
+	index_table_view view;
+	BOOST_REQUIRE(view.map(file));
+	BOOST_REQUIRE(view.has_deltas());
+	BOOST_REQUIRE_EQUAL(view.size(), indexes.indexes.size());
+	BOOST_REQUIRE_EQUAL(view.table_size(), table.size());
+
+	dnet_indexes unpacked;
+	indexes_unpack_raw(file, &unpacked);
+	BOOST_REQUIRE_EQUAL(unpacked.indexes.size(), 3);
+	BOOST_REQUIRE(unpacked.indexes[0].index == index_test_id(2));
+	BOOST_REQUIRE_EQUAL(unpacked.indexes[0].data.to_string(), "new-data-2");
+	BOOST_REQUIRE(unpacked.indexes[1].index == index_test_id(3));
+	BOOST_REQUIRE_EQUAL(unpacked.indexes[1].data.to_string(), "data-3");
+	BOOST_REQUIRE(unpacked.indexes[2].index == index_test_id(5));
+	BOOST_REQUIRE_EQUAL(unpacked.indexes[2].data.to_string(), "data-5");
+	BOOST_REQUIRE_EQUAL(indexes_count(file), unpacked.indexes.size());
+
+	// the log of updates can not be counted from the header
+	size_t count = 0;
+	BOOST_REQUIRE(!index_table_view::header_count(file.slice(0, sizeof(dnet_index_table_header)), file.size(), count));
+
+	// torn last update is skipped
+	const data_pointer torn = file.slice(0, file.size() - 1);
+	indexes_unpack_raw(torn, &unpacked);
+	BOOST_REQUIRE_EQUAL(unpacked.indexes.size(), 4);
+	BOOST_REQUIRE_EQUAL(indexes_count(torn), unpacked.indexes.size());
+}
+
+static void test_index_table_truncated()
+{
+	const dnet_indexes indexes = index_test_table();
+	const std::vector<uint64_t> time_order = { 0, 1, 2 };
+	const data_pointer file = indexes_pack(indexes, &time_order);
+
+	const size_t sizes[] = {
+		// header, ids, entries, time order and data are cut in turn
+		sizeof(dnet_index_table_header) - 1,
+		sizeof(dnet_index_table_header) + DNET_ID_SIZE,
+		sizeof(dnet_index_table_header) + indexes.indexes.size() * (DNET_ID_SIZE + sizeof(dnet_index_table_entry)),
+		file.size() - 10,
+		file.size() - 1
+	};
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		const data_pointer truncated = file.slice(0, sizes[i]);
+
+		index_table_view view;
+		BOOST_REQUIRE_THROW(view.map(truncated), std::runtime_error);
+
+		dnet_indexes unpacked;
+		BOOST_REQUIRE_THROW(indexes_unpack_raw(truncated, &unpacked), std::runtime_error);
+	}
+
+	// too short to have a magic
+	index_table_view view;
+	BOOST_REQUIRE(!view.map(file.slice(0, DNET_INDEX_TABLE_MAGIC_SIZE - 1)));
+}
+
+static void test_index_table_legacy()
+{
+	const dnet_indexes indexes = index_test_table();
+
+	msgpack::sbuffer packed;
+	msgpack::pack(&packed, indexes);
+
+	data_buffer buffer;
+	buffer.write(dnet_bswap64(DNET_INDEX_TABLE_MAGIC));
+	buffer.write(packed.data(), packed.size());
+	index_test_append_delta(buffer, DNET_INDEXES_FLAGS_INTERNAL_REMOVE, 3, std::string());
+	data_pointer file = std::move(buffer);
+
+	index_table_view view;
+	BOOST_REQUIRE(!view.map(file));
+
+	dnet_indexes unpacked;
+	indexes_unpack_raw(file, &unpacked);
+	BOOST_REQUIRE_EQUAL(unpacked.shard_id, indexes.shard_id);
+	BOOST_REQUIRE_EQUAL(unpacked.shard_count, indexes.shard_count);
+	BOOST_REQUIRE_EQUAL(unpacked.indexes.size(), 2);
+	BOOST_REQUIRE(unpacked.indexes[0] == indexes.indexes[0]);
+	BOOST_REQUIRE(unpacked.indexes[1] == indexes.indexes[1]);
+	BOOST_REQUIRE_EQUAL(indexes_count(file), 2);
+
+	size_t count = 0;
+	BOOST_REQUIRE(!index_table_view::header_count(file.slice(0, sizeof(dnet_index_table_header)), file.size(), count));
+
+	// neither sorted nor msgpack table
+	const data_pointer invalid = data_pointer::copy(std::string(64, 'x'));
+	BOOST_REQUIRE(!view.map(invalid));
+	BOOST_REQUIRE_THROW(indexes_count(invalid), std::runtime_error);
+}
+
+// shard of ids which encode values, ids of neighbour values differ only in the last byte
+struct index_test_shard
+{
+	std::vector<dnet_raw_id> ids;
+
+	size_t size() const
+	{
+		return ids.size();
+	}
+
+	const dnet_raw_id &id(size_t index) const
+	{
+		return ids[index];
+	}
+};
+
+static dnet_raw_id index_test_value_id(uint32_t value)
+{
+	dnet_raw_id id;
+	memset(id.id, 0, sizeof(id.id));
+
+	const uint32_t prefix = htobe32(value >> 4);
+	memcpy(id.id, &prefix, sizeof(prefix));
+	id.id[DNET_ID_SIZE - 1] = value & 0xf;
+	return id;
+}
+
+static uint32_t index_test_id_value(const dnet_raw_id &id)
+{
+	uint32_t prefix;
+	memcpy(&prefix, id.id, sizeof(prefix));
+	return (be32toh(prefix) << 4) | id.id[DNET_ID_SIZE - 1];
+}
+
+static index_test_shard index_test_make_shard(const std::vector<uint32_t> &values)
+{
+	index_test_shard shard;
+	for (auto it = values.begin(); it != values.end(); ++it)
+		shard.ids.push_back(index_test_value_id(*it));
+	return shard;
+}
+
+// ascending values from [0, @range) picked by a fixed pseudo-random sequence with @percent probability
+static std::vector<uint32_t> index_test_random_values(uint32_t range, uint32_t percent, uint32_t seed)
+{
+	std::vector<uint32_t> values;
+	for (uint32_t value = 0; value < range; ++value) {
+		seed = seed * 1103515245 + 12345;
+		if ((seed >> 16) % 100 < percent)
+			values.push_back(value);
+	}
+	return values;
+}
+
+static std::vector<uint32_t> index_test_intersect(const std::vector<const index_test_shard *> &shards)
+{
+	std::vector<uint32_t> result;
+	indexes_intersect(shards, [&] (const dnet_raw_id &id, const std::vector<size_t> &positions) {
+		BOOST_REQUIRE_EQUAL(positions.size(), shards.size());
+		for (size_t i = 0; i < shards.size(); ++i)
+			BOOST_REQUIRE(indexes_compare_id(shards[i]->id(positions[i]), id) == 0);
+		result.push_back(index_test_id_value(id));
+	});
+
+	// incremental intersection must find the same objects
+	indexes_intersection<index_test_shard> matches;
+	for (auto it = shards.begin(); it != shards.end(); ++it)
+		matches.add(**it);
+
+	BOOST_REQUIRE_EQUAL(matches.shards(), shards.size());
+	BOOST_REQUIRE_EQUAL(matches.size(), result.size());
+	for (size_t i = 0; i < matches.size(); ++i) {
+		BOOST_REQUIRE_EQUAL(index_test_id_value(matches.id(i)), result[i]);
+		for (size_t j = 0; j < shards.size(); ++j)
+			BOOST_REQUIRE(indexes_compare_id(shards[j]->id(matches.position(i, j)), matches.id(i)) == 0);
+	}
+
+	return result;
+}
+
+static std::vector<uint32_t> index_test_unite(const std::vector<const index_test_shard *> &shards)
+{
+	std::vector<uint32_t> result;
+	indexes_unite(shards, [&] (const dnet_raw_id &id, const std::vector<size_t> &positions) {
+		BOOST_REQUIRE_EQUAL(positions.size(), shards.size());
+
+		size_t found = 0;
+		for (size_t i = 0; i < shards.size(); ++i) {
+			if (positions[i] == indexes_npos) {
+				const size_t position = indexes_gallop(*shards[i], id, 0);
+				BOOST_REQUIRE(position == shards[i]->size() || indexes_compare_id(shards[i]->id(position), id) != 0);
+			} else {
+				BOOST_REQUIRE(indexes_compare_id(shards[i]->id(positions[i]), id) == 0);
+				++found;
+			}
+		}
+		BOOST_REQUIRE(found > 0);
+
+		result.push_back(index_test_id_value(id));
+	});
+	return result;
+}
+
+static void test_indexes_gallop()
+{
+	const index_test_shard empty;
+	BOOST_REQUIRE_EQUAL(indexes_gallop(empty, index_test_value_id(1), 0), 0);
+
+	std::vector<uint32_t> values;
+	for (uint32_t value = 10; value <= 10000; value += 10)
+		values.push_back(value);
+	const index_test_shard shard = index_test_make_shard(values);
+
+	BOOST_REQUIRE_EQUAL(indexes_gallop(shard, index_test_value_id(0), 0), 0);
+	BOOST_REQUIRE_EQUAL(indexes_gallop(shard, index_test_value_id(10), 0), 0);
+	BOOST_REQUIRE_EQUAL(indexes_gallop(shard, index_test_value_id(11), 0), 1);
+	BOOST_REQUIRE_EQUAL(indexes_gallop(shard, index_test_value_id(5000), 0), 499);
+	BOOST_REQUIRE_EQUAL(indexes_gallop(shard, index_test_value_id(5001), 0), 500);
+	BOOST_REQUIRE_EQUAL(indexes_gallop(shard, index_test_value_id(10000), 0), 999);
+	BOOST_REQUIRE_EQUAL(indexes_gallop(shard, index_test_value_id(10001), 0), values.size());
+
+	// search starts at @first even if less ids are before it
+	BOOST_REQUIRE_EQUAL(indexes_gallop(shard, index_test_value_id(0), 100), 100);
+	BOOST_REQUIRE_EQUAL(indexes_gallop(shard, index_test_value_id(5001), 100), 500);
+	BOOST_REQUIRE_EQUAL(indexes_gallop(shard, index_test_value_id(1), values.size()), values.size());
+
+	// every distance from every start matches std::lower_bound
+	for (size_t first = 0; first < 40; ++first) {
+		for (uint32_t value = 0; value < 500; ++value) {
+			const auto it = std::lower_bound(values.begin() + first, values.end(), value);
+			BOOST_REQUIRE_EQUAL(indexes_gallop(shard, index_test_value_id(value), first), it - values.begin());
+		}
+	}
+}
+
+static void test_indexes_intersect()
+{
+	const index_test_shard empty;
+	const index_test_shard small = index_test_make_shard({5, 17, 500, 999, 1001});
+	const index_test_shard other = index_test_make_shard({3, 5, 16, 17, 999});
+
+	std::vector<uint32_t> all;
+	for (uint32_t value = 0; value < 100000; ++value)
+		all.push_back(value);
+	const index_test_shard huge = index_test_make_shard(all);
+
+	// no shards and empty shards give nothing
+	BOOST_REQUIRE(index_test_intersect({}).empty());
+	BOOST_REQUIRE(index_test_intersect({&empty}).empty());
+	BOOST_REQUIRE(index_test_intersect({&small, &empty}).empty());
+	BOOST_REQUIRE(index_test_intersect({&empty, &huge, &small}).empty());
+
+	// one shard is the result
+	BOOST_REQUIRE(index_test_intersect({&small}) == std::vector<uint32_t>({5, 17, 500, 999, 1001}));
+
+	// the same shard passed several times
+	BOOST_REQUIRE(index_test_intersect({&small, &small, &small}) == std::vector<uint32_t>({5, 17, 500, 999, 1001}));
+
+	// skewed sizes in both orders
+	BOOST_REQUIRE(index_test_intersect({&small, &huge}) == std::vector<uint32_t>({5, 17, 500, 999, 1001}));
+	BOOST_REQUIRE(index_test_intersect({&huge, &small}) == std::vector<uint32_t>({5, 17, 500, 999, 1001}));
+	BOOST_REQUIRE(index_test_intersect({&huge, &other, &small}) == std::vector<uint32_t>({5, 17, 999}));
+
+	// disjoint shards
+	const index_test_shard odd = index_test_make_shard({1, 3, 5, 7});
+	const index_test_shard even = index_test_make_shard({0, 2, 4, 6, 8});
+	BOOST_REQUIRE(index_test_intersect({&odd, &even}).empty());
+
+	// random shards match std::set_intersection
+	const std::vector<uint32_t> first = index_test_random_values(20000, 50, 1);
+	const std::vector<uint32_t> second = index_test_random_values(20000, 5, 2);
+	const std::vector<uint32_t> third = index_test_random_values(20000, 90, 3);
+
+	std::vector<uint32_t> expected, tmp;
+	std::set_intersection(first.begin(), first.end(), second.begin(), second.end(), std::back_inserter(tmp));
+	std::set_intersection(tmp.begin(), tmp.end(), third.begin(), third.end(), std::back_inserter(expected));
+	BOOST_REQUIRE(!expected.empty());
+
+	const index_test_shard first_shard = index_test_make_shard(first);
+	const index_test_shard second_shard = index_test_make_shard(second);
+	const index_test_shard third_shard = index_test_make_shard(third);
+	BOOST_REQUIRE(index_test_intersect({&first_shard, &second_shard, &third_shard}) == expected);
+	BOOST_REQUIRE(index_test_intersect({&third_shard, &first_shard, &second_shard}) == expected);
+
+	// incremental intersection stays empty after a disjoint shard
+	indexes_intersection<index_test_shard> matches;
+	BOOST_REQUIRE_EQUAL(matches.size(), 0);
+	matches.add(odd);
+	BOOST_REQUIRE_EQUAL(matches.size(), 4);
+	matches.add(even);
+	BOOST_REQUIRE_EQUAL(matches.size(), 0);
+	matches.add(huge);
+	BOOST_REQUIRE_EQUAL(matches.size(), 0);
+}
+
+static void test_indexes_unite()
+{
+	const index_test_shard empty;
+	const index_test_shard small = index_test_make_shard({5, 17, 500, 999, 1001});
+	const index_test_shard other = index_test_make_shard({3, 5, 16, 17, 999});
+
+	// no shards and empty shards give nothing
+	BOOST_REQUIRE(index_test_unite({}).empty());
+	BOOST_REQUIRE(index_test_unite({&empty, &empty}).empty());
+
+	// one shard is the result, empty shards do not matter
+	BOOST_REQUIRE(index_test_unite({&small}) == std::vector<uint32_t>({5, 17, 500, 999, 1001}));
+	BOOST_REQUIRE(index_test_unite({&empty, &small, &empty}) == std::vector<uint32_t>({5, 17, 500, 999, 1001}));
+
+	// objects presented in several shards are reported once
+	BOOST_REQUIRE(index_test_unite({&small, &small}) == std::vector<uint32_t>({5, 17, 500, 999, 1001}));
+	BOOST_REQUIRE(index_test_unite({&small, &other}) == std::vector<uint32_t>({3, 5, 16, 17, 500, 999, 1001}));
+
+	// skewed sizes
+	std::vector<uint32_t> even;
+	for (uint32_t value = 0; value < 100000; value += 2)
+		even.push_back(value);
+	const index_test_shard huge = index_test_make_shard(even);
+
+	const std::vector<uint32_t> small_values = {5, 17, 500, 999, 1001};
+	std::vector<uint32_t> expected;
+	std::set_union(even.begin(), even.end(), small_values.begin(), small_values.end(), std::back_inserter(expected));
+	BOOST_REQUIRE(index_test_unite({&small, &huge}) == expected);
+	BOOST_REQUIRE(index_test_unite({&huge, &small}) == expected);
+
+	// random shards match std::set_union, which is sorted and unique
+	const std::vector<uint32_t> first = index_test_random_values(20000, 50, 1);
+	const std::vector<uint32_t> second = index_test_random_values(20000, 5, 2);
+	const std::vector<uint32_t> third = index_test_random_values(20000, 20, 3);
+
+	std::vector<uint32_t> tmp;
+	expected.clear();
+	std::set_union(first.begin(), first.end(), second.begin(), second.end(), std::back_inserter(tmp));
+	std::set_union(tmp.begin(), tmp.end(), third.begin(), third.end(), std::back_inserter(expected));
+
+	const index_test_shard first_shard = index_test_make_shard(first);
+	const index_test_shard second_shard = index_test_make_shard(second);
+	const index_test_shard third_shard = index_test_make_shard(third);
+	const std::vector<uint32_t> result = index_test_unite({&third_shard, &first_shard, &second_shard});
+	BOOST_REQUIRE(std::adjacent_find(result.begin(), result.end(), std::greater_equal<uint32_t>()) == result.end());
+	BOOST_REQUIRE(result == expected);
+}
+
+static capped_update_t capped_test_update(uint32_t action, unsigned char object, const std::string &data)
+{
+	capped_update_t update;
+	update.action = action;
+	update.object = index_test_id(object);
+	update.data = data_pointer::copy(data);
+	return update;
+}
+
+/*
+ * Applies @updates to capped table @file like INDEXES_INTERNAL does, objects evicted
+ * from the oldest one are appended to @evicted. Returns @file if it is not changed.
+ */
+static data_pointer capped_test_apply(const data_pointer &file, const std::vector<capped_update_t> &updates,
+	uint32_t limit, uint64_t tsec, std::vector<unsigned char> &evicted)
+{
+	dnet_indexes indexes;
+	std::vector<uint64_t> order;
+	if (!file.empty()) {
+		indexes_unpack_raw(file, &indexes);
+		indexes_capped_time_order(file, indexes.indexes, order);
+	}
+
+	dnet_time now;
+	now.tsec = tsec;
+	now.tnsec = 0;
+
+	std::vector<dnet_indexes_reply_entry> removed;
+	if (!indexes_capped_apply(indexes, order, updates, limit, now, removed)) {
+		BOOST_REQUIRE(removed.empty());
+		return file;
+	}
+
+	for (auto it = removed.begin(); it != removed.end(); ++it) {
+		BOOST_REQUIRE_EQUAL(it->status, DNET_INDEXES_CAPPED_REMOVED);
+		evicted.push_back(it->id.id[0]);
+	}
+
+	BOOST_REQUIRE_EQUAL(order.size(), indexes.indexes.size());
+	for (size_t i = 1; i < indexes.indexes.size(); ++i)
+		BOOST_REQUIRE(dnet_raw_id_less_than<>()(indexes.indexes[i - 1].index, indexes.indexes[i].index));
+
+	const data_pointer result = indexes_pack(indexes, &order);
+
+	index_table_view view;
+	BOOST_REQUIRE(view.map(result));
+	BOOST_REQUIRE(view.has_time_order());
+
+	return result;
+}
+
+// objects of capped table @file from the oldest to the newest one
+static std::vector<unsigned char> capped_test_objects(const data_pointer &file)
+{
+	dnet_indexes indexes;
+	indexes_unpack_raw(file, &indexes);
+
+	std::vector<uint64_t> order;
+	indexes_capped_time_order(file, indexes.indexes, order);
+
+	std::vector<unsigned char> objects;
+	for (auto it = order.begin(); it != order.end(); ++it)
+		objects.push_back(indexes.indexes[*it].index.id[0]);
+	return objects;
+}
+
+static std::vector<capped_update_t> capped_test_inserts(unsigned char first, unsigned char last)
+{
+	std::vector<capped_update_t> updates;
+	for (unsigned char object = first; object <= last; ++object)
+		updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_INSERT, object, "data"));
+	return updates;
+}
+
+static void test_capped_eviction_order()
+{
+	typedef std::vector<unsigned char> objects_t;
+	objects_t evicted;
+
+	// batch which overflows the limit keeps its newest objects
+	data_pointer file = capped_test_apply(data_pointer(), capped_test_inserts(1, 8), 5, 100, evicted);
+	BOOST_REQUIRE(evicted == objects_t({1, 2, 3}));
+	BOOST_REQUIRE(capped_test_objects(file) == objects_t({4, 5, 6, 7, 8}));
+
+	// objects of the next batch are newer than stored ones, all of them got the same time
+	evicted.clear();
+	file = capped_test_apply(file, capped_test_inserts(9, 10), 5, 100, evicted);
+	BOOST_REQUIRE(evicted == objects_t({4, 5}));
+	BOOST_REQUIRE(capped_test_objects(file) == objects_t({6, 7, 8, 9, 10}));
+
+	// reinserted object becomes the newest one and is not evicted
+	evicted.clear();
+	file = capped_test_apply(file, capped_test_inserts(6, 6), 5, 100, evicted);
+	BOOST_REQUIRE(evicted.empty());
+	BOOST_REQUIRE(capped_test_objects(file) == objects_t({7, 8, 9, 10, 6}));
+
+	// stored objects are evicted before the batch ones
+	evicted.clear();
+	file = capped_test_apply(file, capped_test_inserts(11, 17), 5, 100, evicted);
+	BOOST_REQUIRE(evicted == objects_t({7, 8, 9, 10, 6, 11, 12}));
+	BOOST_REQUIRE(capped_test_objects(file) == objects_t({13, 14, 15, 16, 17}));
+
+	// no limit
+	evicted.clear();
+	file = capped_test_apply(file, capped_test_inserts(1, 3), 0, 100, evicted);
+	BOOST_REQUIRE(evicted.empty());
+	BOOST_REQUIRE(capped_test_objects(file) == objects_t({13, 14, 15, 16, 17, 1, 2, 3}));
+}
+
+static void test_capped_duplicates()
+{
+	typedef std::vector<unsigned char> objects_t;
+	objects_t evicted;
+
+	// the last update of the object wins and defines its age
+	std::vector<capped_update_t> updates;
+	updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_INSERT, 1, "first"));
+	updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_INSERT, 2, "data"));
+	updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_INSERT, 3, "data"));
+	updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_REMOVE, 3, std::string()));
+	updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_INSERT, 1, "second"));
+
+	data_pointer file = capped_test_apply(data_pointer(), updates, 10, 100, evicted);
+	BOOST_REQUIRE(evicted.empty());
+	BOOST_REQUIRE(capped_test_objects(file) == objects_t({2, 1}));
+
+	dnet_indexes indexes;
+	indexes_unpack_raw(file, &indexes);
+	BOOST_REQUIRE_EQUAL(indexes.indexes.size(), 2);
+	BOOST_REQUIRE(indexes.indexes[0].index == index_test_id(1));
+	BOOST_REQUIRE_EQUAL(indexes.indexes[0].data.to_string(), "second");
+
+	// removed and inserted again in one batch
+	updates.clear();
+	updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_REMOVE, 2, std::string()));
+	updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_INSERT, 2, "again"));
+	file = capped_test_apply(file, updates, 10, 200, evicted);
+	BOOST_REQUIRE(evicted.empty());
+	BOOST_REQUIRE(capped_test_objects(file) == objects_t({1, 2}));
+
+	// duplicates occupy one place within the limit
+	updates = capped_test_inserts(3, 3);
+	updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_INSERT, 3, "data"));
+	file = capped_test_apply(file, updates, 2, 300, evicted);
+	BOOST_REQUIRE(evicted == objects_t({1}));
+	BOOST_REQUIRE(capped_test_objects(file) == objects_t({2, 3}));
+}
+
+static void test_capped_absent_removal()
+{
+	typedef std::vector<unsigned char> objects_t;
+	objects_t evicted;
+
+	data_pointer file = capped_test_apply(data_pointer(), capped_test_inserts(1, 3), 5, 100, evicted);
+
+	// nothing to change
+	std::vector<capped_update_t> updates;
+	updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_REMOVE, 7, std::string()));
+	BOOST_REQUIRE(capped_test_apply(file, updates, 5, 200, evicted) == file);
+	BOOST_REQUIRE(capped_test_apply(data_pointer(), updates, 5, 200, evicted).empty());
+
+	// absent objects do not affect removal of present ones
+	updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_REMOVE, 2, std::string()));
+	updates.push_back(capped_test_update(DNET_INDEXES_FLAGS_INTERNAL_REMOVE, 9, std::string()));
+	file = capped_test_apply(file, updates, 5, 200, evicted);
+	BOOST_REQUIRE(evicted.empty());
+	BOOST_REQUIRE(capped_test_objects(file) == objects_t({1, 3}));
+}
+
+static void test_capped_legacy_table()
+{
+	typedef std::vector<unsigned char> objects_t;
+
+	// entries are sorted by id, but were inserted in other order
+	dnet_indexes indexes;
+	indexes.shard_id = 0;
+	indexes.shard_count = 1;
+
+	const uint64_t times[] = { 40, 10, 30, 20 };
+	for (unsigned char i = 0; i < 4; ++i) {
+		dnet_time time;
+		time.tsec = times[i];
+		time.tnsec = 0;
+		indexes.indexes.push_back(dnet_index_entry(index_test_id(i + 1), data_pointer::copy("data"), time));
+	}
+
+	msgpack::sbuffer packed;
+	msgpack::pack(&packed, indexes);
+
+	data_buffer buffer;
+	buffer.write(dnet_bswap64(DNET_INDEX_TABLE_MAGIC));
+	buffer.write(packed.data(), packed.size());
+	const data_pointer legacy = std::move(buffer);
+
+	// sorted table written without time order
+	const data_pointer unordered = indexes_pack(indexes);
+	index_table_view view;
+	BOOST_REQUIRE(view.map(unordered));
+	BOOST_REQUIRE(!view.has_time_order());
+
+	const data_pointer tables[] = { legacy, unordered };
+	for (size_t i = 0; i < 2; ++i) {
+		BOOST_REQUIRE(capped_test_objects(tables[i]) == objects_t({2, 4, 3, 1}));
+
+		objects_t evicted;
+		const data_pointer file = capped_test_apply(tables[i], capped_test_inserts(5, 5), 3, 50, evicted);
+		BOOST_REQUIRE(evicted == objects_t({2, 4}));
+		BOOST_REQUIRE(capped_test_objects(file) == objects_t({3, 1, 5}));
+	}
+}
+
+static void test_arena_reuse()
+{
+	dnet_io_arena *arena = dnet_io_arena_create();
+	BOOST_REQUIRE(arena);
+
+	dnet_io_req *first = dnet_io_arena_alloc(arena, 1000);
+	BOOST_REQUIRE(first);
+	BOOST_REQUIRE(first->arena_class);
+	dnet_io_arena_free(first);
+
+	// freed request is the head of its class free list and is handed out again
+	dnet_io_req *second = dnet_io_arena_alloc(arena, 700);
+	BOOST_REQUIRE_EQUAL(second, first);
+	BOOST_REQUIRE_EQUAL(atomic_read(&second->refcnt), 1);
+
+	dnet_io_req *large = dnet_io_arena_alloc(arena, 1 << 20);
+	BOOST_REQUIRE(large);
+	BOOST_REQUIRE(!large->arena_class);
+
+	dnet_io_arena_stats stats;
+	memset(&stats, 0, sizeof(stats));
+	dnet_io_arena_stat(arena, &stats);
+	BOOST_REQUIRE_EQUAL(stats.hits, 2U);
+	BOOST_REQUIRE_EQUAL(stats.misses, 0U);
+	BOOST_REQUIRE_EQUAL(stats.large, 1U);
+	BOOST_REQUIRE_EQUAL(stats.slab_memory, DNET_IO_ARENA_SLAB_SIZE);
+
+	dnet_io_arena_free(large);
+	dnet_io_arena_free(second);
+	dnet_io_arena_put(arena);
+}
+
+struct arena_test_release {
+	std::vector<int>	*order;
+	int			index;
+	dnet_io_req		*received;
+};
+
+static void arena_test_release_callback(void *priv)
+{
+	arena_test_release *release = static_cast<arena_test_release *>(priv);
+
+	release->order->push_back(release->index);
+	dnet_io_req_free(release->received);
+}
+
+/*
+ * Queued requests reference data of the received one, like forwarded requests do.
+ * Received request and its arena have to outlive them, even if the arena's owner
+ * has already dropped its reference, as it happens at node shutdown.
+ */
+static void test_arena_release_order()
+{
+	std::vector<int> order;
+
+	dnet_io_arena *arena = dnet_io_arena_create();
+	BOOST_REQUIRE(arena);
+
+	dnet_io_req *received = dnet_io_arena_alloc(arena, 512);
+	BOOST_REQUIRE(received);
+	BOOST_REQUIRE(received->arena_class);
+	received->fd = -1;
+
+	arena_test_release releases[2];
+	dnet_io_req *queued[2];
+
+	for (int i = 0; i < 2; ++i) {
+		releases[i].order = &order;
+		releases[i].index = i;
+		releases[i].received = dnet_io_req_get(received);
+
+		// heap requests are freed by dnet_io_req_free() too
+		queued[i] = static_cast<dnet_io_req *>(malloc(sizeof(dnet_io_req)));
+		BOOST_REQUIRE(queued[i]);
+
+		memset(queued[i], 0, sizeof(dnet_io_req));
+		atomic_init(&queued[i]->refcnt, 1);
+		queued[i]->fd = -1;
+		queued[i]->release = arena_test_release_callback;
+		queued[i]->release_priv = &releases[i];
+	}
+
+	// the first block is still being sent, so it is not released when the send list drops it
+	dnet_io_req_get(queued[0]);
+
+	dnet_io_req_free(received);
+	dnet_io_arena_put(arena);
+	BOOST_REQUIRE(order.empty());
+	BOOST_REQUIRE_EQUAL(atomic_read(&received->refcnt), 2);
+
+	dnet_io_req_free(queued[0]);
+	BOOST_REQUIRE(order.empty());
+
+	dnet_io_req_free(queued[1]);
+	BOOST_REQUIRE(order == std::vector<int>({1}));
+	BOOST_REQUIRE_EQUAL(atomic_read(&received->refcnt), 1);
+
+	// the last release returns received request to the arena, which frees its slabs
+	dnet_io_req_free(queued[0]);
+	BOOST_REQUIRE(order == std::vector<int>({1, 0}));
+}
+
 bool register_tests(test_suite *suite, node n)
 {
 	ELLIPTICS_TEST_CASE(test_error_message, create_session(n, {2}, 0, 0), "non-existen-key", -ENOENT);
 	ELLIPTICS_TEST_CASE_NOARGS(test_error_null_message);
 	ELLIPTICS_TEST_CASE_NOARGS(test_data_buffer);
+	ELLIPTICS_TEST_CASE_NOARGS(test_index_table_round_trip);
+	ELLIPTICS_TEST_CASE_NOARGS(test_index_table_deltas);
+	ELLIPTICS_TEST_CASE_NOARGS(test_index_table_truncated);
+	ELLIPTICS_TEST_CASE_NOARGS(test_index_table_legacy);
+	ELLIPTICS_TEST_CASE_NOARGS(test_indexes_gallop);
+	ELLIPTICS_TEST_CASE_NOARGS(test_indexes_intersect);
+	ELLIPTICS_TEST_CASE_NOARGS(test_indexes_unite);
+	ELLIPTICS_TEST_CASE_NOARGS(test_capped_eviction_order);
+	ELLIPTICS_TEST_CASE_NOARGS(test_capped_duplicates);
+	ELLIPTICS_TEST_CASE_NOARGS(test_capped_absent_removal);
+	ELLIPTICS_TEST_CASE_NOARGS(test_capped_legacy_table);
+	ELLIPTICS_TEST_CASE_NOARGS(test_arena_reuse);
+	ELLIPTICS_TEST_CASE_NOARGS(test_arena_release_order);
 
 	return true;
 }
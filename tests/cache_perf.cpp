@@ -0,0 +1,170 @@
+/*
+ * 2015+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/*
+ * Cache hit path benchmark: server node with single cache shard is filled with small records,
+ * then reader threads call cache read directly for random keys of this working set,
+ * so scaling with the number of threads shows how much readers of the same shard serialize.
+ */
+
+#include "test_base.hpp"
+#include "../cache/cache.hpp"
+
+#include <iostream>
+#include <thread>
+
+#include <boost/program_options.hpp>
+
+#include <elliptics/timer.hpp>
+
+using namespace ioremap::elliptics;
+
+namespace tests {
+
+static void cache_perf_reader(ioremap::cache::cache_manager *cache, const std::vector<dnet_id> *ids, long num,
+		std::atomic<long> *misses)
+{
+	unsigned int seed = rand();
+	long local_misses = 0;
+
+	for (long i = 0; i < num; ++i) {
+		const dnet_id &id = (*ids)[rand_r(&seed) % ids->size()];
+		dnet_cmd cmd;
+		dnet_io_attr io;
+
+		memset(&cmd, 0, sizeof(cmd));
+		memset(&io, 0, sizeof(io));
+		cmd.id = id;
+		io.flags = DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY;
+
+		if (!cache->read(id.id, &cmd, &io))
+			++local_misses;
+	}
+
+	*misses += local_misses;
+}
+
+static int cache_perf(const std::string &path, int keys, size_t size, long num, const std::vector<int> &threads)
+{
+	start_nodes_config start_config(std::cerr, std::vector<server_config>({
+		server_config::default_value().apply_options(config_data()
+			("group", 5)
+			("cache_shards", 1)
+		)
+	}), path);
+	start_config.monitor = false;
+
+	nodes_data::ptr data = start_nodes(start_config);
+
+	dnet_node *node = data->nodes[0].get_native();
+	ioremap::cache::cache_manager *cache = (ioremap::cache::cache_manager *) node->io->backends[0].cache;
+	session sess = create_session(*data->node, { 5 }, 0, DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY);
+
+	std::vector<dnet_id> ids;
+	std::string value(size, 'x');
+
+	for (int i = 0; i < keys; ++i) {
+		key k(boost::lexical_cast<std::string>(i));
+		k.transform(sess);
+
+		auto result = sess.write_cache(k, value, 0);
+		result.wait();
+		if (result.error()) {
+			std::cerr << "Could not write key " << i << ": " << result.error().message() << std::endl;
+			return -1;
+		}
+
+		ids.push_back(k.id());
+	}
+
+	for (auto thread_num : threads) {
+		std::vector<std::thread> readers;
+		std::atomic<long> misses(0);
+
+		ioremap::elliptics::timer tm;
+
+		for (int i = 0; i < thread_num; ++i)
+			readers.emplace_back(cache_perf_reader, cache, &ids, num, &misses);
+
+		for (auto &reader : readers)
+			reader.join();
+
+		long total_time = tm.elapsed();
+		const double total = (double)num * thread_num;
+		const double secs = (double)(total_time ? total_time : 1) / 1000;
+
+		printf("threads: %3d, keys: %d, size: %zu, reads: %.0f, misses: %ld, time: %ld msecs, "
+				"speed: %.3f reads/sec, %.3f reads/sec per thread\n",
+				thread_num, keys, size, total, misses.load(), total_time,
+				total / secs, total / secs / thread_num);
+	}
+
+	return 0;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::options_description generic("Cache hit path performance tool options");
+
+	std::string path;
+	int keys;
+	size_t size;
+	long num;
+	std::vector<int> threads;
+
+	generic.add_options()
+		("help", "This help message")
+		("path", bpo::value<std::string>(&path)->default_value("cache_perf"), "Path where to store everything")
+		("keys", bpo::value<int>(&keys)->default_value(1000), "Number of cached keys, all of them are read uniformly")
+		("size", bpo::value<size_t>(&size)->default_value(200), "Size of every cached record")
+		("num", bpo::value<long>(&num)->default_value(1000000), "Number of reads made by every thread")
+		("threads", bpo::value<std::vector<int>>(&threads)->multitoken()->default_value(std::vector<int>({1, 2, 4, 8, 16}), "1 2 4 8 16"),
+			"Numbers of reader threads to test")
+		;
+
+	bpo::variables_map vm;
+
+	try {
+		bpo::store(bpo::command_line_parser(argc, argv).options(generic).run(), vm);
+
+		if (vm.count("help")) {
+			std::cout << generic << std::endl;
+			return 0;
+		}
+
+		bpo::notify(vm);
+	} catch (const std::exception &e) {
+		std::cerr << "Invalid options: " << e.what() << "\n" << generic << std::endl;
+		return -1;
+	}
+
+	if (keys <= 0 || num <= 0) {
+		std::cerr << "Invalid options: keys and num must be positive\n" << generic << std::endl;
+		return -1;
+	}
+
+	srand(time(0));
+
+	try {
+		return tests::cache_perf(path, keys, size, num, threads);
+	} catch (const std::exception &e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		return -1;
+	}
+}
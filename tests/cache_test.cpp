@@ -19,6 +19,9 @@
 
 #include <list>
 #include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 
 #define BOOST_TEST_NO_MAIN
 #include <boost/test/included/unit_test.hpp>
@@ -251,6 +254,78 @@ static void test_cache_lru_eviction(session &sess)
 
 /*! \} */ //test_cache_lru_eviction group
 
+/*!
+ * Cache hits are served without the shard lock while the object may be rewritten concurrently,
+ * readers must always see some complete version of the data. Every version is filled with
+ * a single byte and its size is derived from this byte, so mixed versions are detected.
+ */
+static size_t cache_version_size(char fill)
+{
+	return 100 + (fill - 'a') * 37;
+}
+
+static void cache_concurrent_reader(ioremap::cache::cache_manager *cache, const dnet_id *id,
+		std::atomic_bool *stop, std::atomic<long> *hits, std::atomic<long> *torn)
+{
+	std::vector<char> buffer;
+
+	while (!stop->load()) {
+		dnet_cmd cmd;
+		dnet_io_attr io;
+
+		memset(&cmd, 0, sizeof(cmd));
+		memset(&io, 0, sizeof(io));
+		cmd.id = *id;
+		io.flags = DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY;
+
+		auto raw = cache->read(id->id, &cmd, &io);
+		if (!raw)
+			continue;
+
+		++*hits;
+
+		const char *data = raw->contiguous_data(buffer);
+		const size_t size = raw->size();
+		if (!size || size != cache_version_size(data[0])
+				|| std::count(data, data + size, data[0]) != (ssize_t)size) {
+			++*torn;
+		}
+	}
+}
+
+static void test_cache_concurrent_read_write(session &sess)
+{
+	dnet_node *node = global_data->nodes[0].get_native();
+	ioremap::cache::cache_manager *cache = (ioremap::cache::cache_manager*) node->io->backends[0].cache;
+
+	cache->clear();
+
+	key id(std::string("concurrent read write"));
+	id.transform(sess);
+
+	ELLIPTICS_REQUIRE(first_write, sess.write_cache(id, std::string(cache_version_size('a'), 'a'), 3000));
+
+	std::atomic_bool stop(false);
+	std::atomic<long> hits(0);
+	std::atomic<long> torn(0);
+	std::vector<std::thread> readers;
+
+	for (int i = 0; i < 4; ++i)
+		readers.emplace_back(cache_concurrent_reader, cache, &id.id(), &stop, &hits, &torn);
+
+	for (int i = 1; i < 2000; ++i) {
+		const char fill = 'a' + i % 26;
+		ELLIPTICS_REQUIRE(write_result, sess.write_cache(id, std::string(cache_version_size(fill), fill), 3000));
+	}
+
+	stop = true;
+	for (auto &reader : readers)
+		reader.join();
+
+	BOOST_REQUIRE_GT(hits.load(), 0);
+	BOOST_REQUIRE_EQUAL(torn.load(), 0);
+}
+
 std::string generate_data(size_t length)
 {
 	std::string data;
@@ -267,6 +342,7 @@ bool register_tests(test_suite *suite, node n)
 	ELLIPTICS_TEST_CASE(test_cache_overflow, create_session(n, { 5 }, 0, DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY));
 	ELLIPTICS_TEST_CASE(test_cache_overflow, create_session(n, { 5 }, 0, DNET_IO_FLAGS_CACHE));
 	ELLIPTICS_TEST_CASE(test_cache_lru_eviction, create_session(n, { 5 }, 0, DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY));
+	ELLIPTICS_TEST_CASE(test_cache_concurrent_read_write, create_session(n, { 5 }, 0, DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY));
 
 	return true;
 }
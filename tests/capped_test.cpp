@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include <deque>
+#include <map>
 
 #define BOOST_TEST_NO_MAIN
 #include <boost/test/included/unit_test.hpp>
@@ -95,9 +96,67 @@ static void test_capped_collection(session &sess, const std::string &collection_
 	}
 }
 
+/*
+ * Adds objects to capped collection by batch, including an object passed twice,
+ * and checks that the oldest ones are displaced and their data is removed
+ */
+static void test_capped_collection_batch(session &sess, const std::string &collection_name)
+{
+	key collection = collection_name;
+	sess.transform(collection);
+
+	std::vector<key> objects;
+	std::vector<data_pointer> datas;
+
+	for (int i = 0; i < 8; ++i) {
+		std::string object = "capped_batch_obj_" + boost::lexical_cast<std::string>(i);
+
+		ELLIPTICS_REQUIRE(write_result, sess.write_data(object, "capped_batch_data", 0));
+
+		objects.push_back(object);
+		datas.push_back(data_pointer::copy("index_data_" + boost::lexical_cast<std::string>(i)));
+	}
+
+	// the first object is the newest one now
+	objects.push_back(objects.front());
+	datas.push_back(data_pointer::copy(std::string("index_data_last")));
+
+	ELLIPTICS_REQUIRE(add_result, sess.add_to_capped_collection(objects, collection.raw_id(), datas, 5, true));
+	ELLIPTICS_REQUIRE(find_result, sess.find_any_indexes(std::vector<std::string>(1, collection_name)));
+
+	// objects 1, 2 and 3 are displaced
+	std::map<key, std::string> expected;
+	for (int i = 0; i < 8; ++i) {
+		if (i >= 1 && i <= 3)
+			continue;
+
+		key id = objects[i];
+		sess.transform(id);
+		expected[id.id()] = i == 0 ? "index_data_last" : datas[i].to_string();
+	}
+
+	sync_find_indexes_result results = find_result;
+	BOOST_REQUIRE_EQUAL(results.size(), expected.size());
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		key id = results[i].id;
+		auto it = expected.find(id);
+		BOOST_REQUIRE(it != expected.end());
+		BOOST_REQUIRE_EQUAL(results[i].indexes.size(), 1);
+		BOOST_REQUIRE_EQUAL(results[i].indexes[0].data.to_string(), it->second);
+		expected.erase(it);
+	}
+
+	for (int i = 1; i < 4; ++i) {
+		ELLIPTICS_REQUIRE_ERROR(read_result, sess.read_data(objects[i], 0, 0), -ENOENT);
+	}
+	ELLIPTICS_REQUIRE(read_result, sess.read_data(objects[0], 0, 0));
+}
+
 bool register_tests(test_suite *suite, node n)
 {
 	ELLIPTICS_TEST_CASE(test_capped_collection, create_session(n, {5}, 0, 0), "capped-collection");
+	ELLIPTICS_TEST_CASE(test_capped_collection_batch, create_session(n, {5}, 0, 0), "capped-collection-batch");
 
 	return true;
 }
@@ -903,6 +903,75 @@ static void test_indexes_update(session &sess)
 	}
 }
 
+/*!
+ * \brief Tests updates of index shards which are appended to their log of updates
+ * Test workflow:
+ * - Insert 400 keys with 4 KiB of data into index, so shards are compacted several times
+ * - Insert half of them again with the same data, which does not change the shards
+ * - Update data of even keys and remove odd keys from the index
+ * - Check that only even keys with their new data are found and counted by metadata
+ */
+static void test_indexes_delta_log(session &sess)
+{
+	const std::string index = "delta-log-index";
+	const std::vector<std::string> indexes(1, index);
+
+	std::vector<std::string> keys;
+	std::map<std::string, size_t> key_numbers;
+	for (size_t i = 0; i < 400; ++i) {
+		keys.push_back("delta-log-key-" + boost::lexical_cast<std::string>(i));
+
+		key id(keys.back());
+		id.transform(sess);
+		key_numbers[std::string(reinterpret_cast<const char *>(id.raw_id().id), DNET_ID_SIZE)] = i;
+	}
+
+	auto key_data = [] (size_t number, char version) {
+		return data_pointer::copy(std::string(4096, version) + boost::lexical_cast<std::string>(number));
+	};
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		ELLIPTICS_REQUIRE(update_result, sess.update_indexes(keys[i], indexes,
+			std::vector<data_pointer>(1, key_data(i, 'a'))));
+	}
+
+	for (size_t i = 0; i < keys.size(); i += 2) {
+		ELLIPTICS_REQUIRE(same_update_result, sess.update_indexes(keys[i], indexes,
+			std::vector<data_pointer>(1, key_data(i, 'a'))));
+	}
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		if (i % 2) {
+			ELLIPTICS_REQUIRE(remove_result, sess.remove_indexes(keys[i], indexes));
+		} else {
+			ELLIPTICS_REQUIRE(update_result, sess.update_indexes(keys[i], indexes,
+				std::vector<data_pointer>(1, key_data(i, 'b'))));
+		}
+	}
+
+	ELLIPTICS_REQUIRE(find_result, sess.find_all_indexes(indexes));
+	sync_find_indexes_result sync_find_result = find_result.get();
+
+	BOOST_REQUIRE_EQUAL(sync_find_result.size(), keys.size() / 2);
+	for (auto it = sync_find_result.begin(); it != sync_find_result.end(); ++it) {
+		auto number = key_numbers.find(std::string(reinterpret_cast<const char *>(it->id.id), DNET_ID_SIZE));
+		BOOST_REQUIRE(number != key_numbers.end());
+		BOOST_REQUIRE_EQUAL(number->second % 2, 0);
+		BOOST_REQUIRE_EQUAL(it->indexes.size(), 1);
+		BOOST_REQUIRE_EQUAL(it->indexes[0].data.to_string(), key_data(number->second, 'b').to_string());
+	}
+
+	ELLIPTICS_REQUIRE(metadata_result, sess.get_index_metadata(index));
+	sync_get_index_metadata_result metadata = metadata_result.get();
+
+	size_t total_index_size = 0;
+	for (auto it = metadata.begin(); it != metadata.end(); ++it) {
+		BOOST_REQUIRE(it->is_valid);
+		total_index_size += it->index_size;
+	}
+	BOOST_REQUIRE_EQUAL(total_index_size, keys.size() / 2);
+}
+
 static void test_lookup(session &sess, const std::string &id, const std::string &data)
 {
 	dnet_io_attr io;
@@ -1416,6 +1485,7 @@ bool register_tests(test_suite *suite, node n)
 	ELLIPTICS_TEST_CASE(test_metadata, create_session(n, {1, 2}, 0, 0), "metadata-key", "meta-data");
 	ELLIPTICS_TEST_CASE(test_partial_bulk_read, create_session(n, {1, 2, 3}, 0, 0));
 	ELLIPTICS_TEST_CASE(test_indexes_update, create_session(n, {2}, 0, 0));
+	ELLIPTICS_TEST_CASE(test_indexes_delta_log, create_session(n, {2}, 0, 0));
 	ELLIPTICS_TEST_CASE(test_prepare_latest, create_session(n, {1, 2}, 0, 0), "prepare-latest-key");
 	ELLIPTICS_TEST_CASE(test_partial_lookup, create_session(n, {1, 2}, 0, 0), "partial-lookup-key");
 	ELLIPTICS_TEST_CASE(test_parallel_lookup, create_session(n, {1, 2, 3}, 0, 0), "parallel-lookup-key");